@@ -19,6 +19,7 @@ func Process(model whisper.Model, path string, flags *Flags) error {
 	if err != nil {
 		return err
 	}
+	defer context.Close()
 
 	// Set the parameters
 	if err := flags.SetParams(context); err != nil {
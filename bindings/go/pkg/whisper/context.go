@@ -17,6 +17,7 @@ import (
 type context struct {
 	n      int
 	model  *model
+	state  *whisper.State
 	params whisper.Params
 }
 
@@ -31,10 +32,36 @@ func newContext(model *model, params whisper.Params) (Context, error) {
 	context.model = model
 	context.params = params
 
+	// Each context has its own state, so that contexts of the same model can process concurrently
+	if state := model.acquireState(); state == nil {
+		return nil, ErrInternalAppError
+	} else {
+		context.state = state
+	}
+
+	// Return the state to the model if the context is not closed
+	runtime.SetFinalizer(context, finalizeContext)
+
 	// Return success
 	return context, nil
 }
 
+func finalizeContext(c *context) {
+	c.Close()
+}
+
+// Return the state of the context to the model, the context cannot be used afterwards
+func (context *context) Close() error {
+	if context.state != nil {
+		context.model.releaseState(context.state)
+		context.state = nil
+	}
+	runtime.SetFinalizer(context, nil)
+
+	// Return success
+	return nil
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // PUBLIC METHODS
 
@@ -72,7 +99,7 @@ func (context *context) Language() string {
 }
 
 func (context *context) DetectedLanguage() string {
-	return whisper.Whisper_lang_str(context.model.ctx.Whisper_full_lang_id())
+	return whisper.Whisper_lang_str(context.state.Whisper_full_lang_id_from_state())
 }
 
 // Set translate flag
@@ -163,11 +190,20 @@ func (context *context) SetInitialPrompt(prompt string) {
 // ResetTimings resets the mode timings. Should be called before processing
 func (context *context) ResetTimings() {
 	context.model.ctx.Whisper_reset_timings()
+	context.state.Whisper_reset_timings_from_state()
 }
 
 // PrintTimings prints the model timings to stdout.
 func (context *context) PrintTimings() {
 	context.model.ctx.Whisper_print_timings()
+
+	stats := context.state.Whisper_get_state_stats()
+	fmt.Printf("whisper_print_timings:      mel time = %8.2f ms\n", stats.MelMs())
+	printTiming("sample", stats.SampleMs(), stats.NumSample())
+	printTiming("encode", stats.EncodeMs(), stats.NumEncode())
+	printTiming("decode", stats.DecodeMs(), stats.NumDecode())
+	printTiming("batchd", stats.BatchdMs(), stats.NumBatchd())
+	printTiming("prompt", stats.PromptMs(), stats.NumPrompt())
 }
 
 // SystemInfo returns the system information
@@ -183,7 +219,7 @@ func (context *context) SystemInfo() string {
 // Make sure to call whisper_pcm_to_mel() or whisper_set_mel() first.
 // Returns the probabilities of all languages.
 func (context *context) WhisperLangAutoDetect(offset_ms int, n_threads int) ([]float32, error) {
-	langProbs, err := context.model.ctx.Whisper_lang_auto_detect(offset_ms, n_threads)
+	langProbs, err := context.model.ctx.Whisper_lang_auto_detect_with_state(context.state, offset_ms, n_threads)
 	if err != nil {
 		return nil, err
 	}
@@ -197,7 +233,7 @@ func (context *context) Process(
 	callNewSegment SegmentCallback,
 	callProgress ProgressCallback,
 ) error {
-	if context.model.ctx == nil {
+	if context.model.ctx == nil || context.state == nil {
 		return ErrInternalAppError
 	}
 	// If the callback is defined then we force on single_segment mode
@@ -208,25 +244,25 @@ func (context *context) Process(
 	// We don't do parallel processing at the moment
 	processors := 0
 	if processors > 1 {
-		if err := context.model.ctx.Whisper_full_parallel(context.params, data, processors, callEncoderBegin,
+		if err := context.model.ctx.Whisper_full_parallel_with_state(context.state, context.params, data, processors, callEncoderBegin,
 			func(new int) {
 				if callNewSegment != nil {
-					num_segments := context.model.ctx.Whisper_full_n_segments()
+					num_segments := context.state.Whisper_full_n_segments_from_state()
 					s0 := num_segments - new
 					for i := s0; i < num_segments; i++ {
-						callNewSegment(toSegment(context.model.ctx, i))
+						callNewSegment(toSegment(context.model.ctx, context.state, i))
 					}
 				}
 			}); err != nil {
 			return err
 		}
-	} else if err := context.model.ctx.Whisper_full(context.params, data, callEncoderBegin,
+	} else if err := context.model.ctx.Whisper_full_with_state(context.state, context.params, data, callEncoderBegin,
 		func(new int) {
 			if callNewSegment != nil {
-				num_segments := context.model.ctx.Whisper_full_n_segments()
+				num_segments := context.state.Whisper_full_n_segments_from_state()
 				s0 := num_segments - new
 				for i := s0; i < num_segments; i++ {
-					callNewSegment(toSegment(context.model.ctx, i))
+					callNewSegment(toSegment(context.model.ctx, context.state, i))
 				}
 			}
 		}, func(progress int) {
@@ -243,15 +279,15 @@ func (context *context) Process(
 
 // Return the next segment of tokens
 func (context *context) NextSegment() (Segment, error) {
-	if context.model.ctx == nil {
+	if context.model.ctx == nil || context.state == nil {
 		return Segment{}, ErrInternalAppError
 	}
-	if context.n >= context.model.ctx.Whisper_full_n_segments() {
+	if context.n >= context.state.Whisper_full_n_segments_from_state() {
 		return Segment{}, io.EOF
 	}
 
 	// Populate result
-	result := toSegment(context.model.ctx, context.n)
+	result := toSegment(context.model.ctx, context.state, context.n)
 
 	// Increment the cursor
 	context.n++
@@ -322,28 +358,36 @@ func (context *context) IsLANG(t Token, lang string) bool {
 ///////////////////////////////////////////////////////////////////////////////
 // PRIVATE METHODS
 
-func toSegment(ctx *whisper.Context, n int) Segment {
+func toSegment(ctx *whisper.Context, state *whisper.State, n int) Segment {
 	return Segment{
 		Num:    n,
-		Text:   strings.TrimSpace(ctx.Whisper_full_get_segment_text(n)),
-		Start:  time.Duration(ctx.Whisper_full_get_segment_t0(n)) * time.Millisecond * 10,
-		End:    time.Duration(ctx.Whisper_full_get_segment_t1(n)) * time.Millisecond * 10,
-		Tokens: toTokens(ctx, n),
+		Text:   strings.TrimSpace(state.Whisper_full_get_segment_text_from_state(n)),
+		Start:  time.Duration(state.Whisper_full_get_segment_t0_from_state(n)) * time.Millisecond * 10,
+		End:    time.Duration(state.Whisper_full_get_segment_t1_from_state(n)) * time.Millisecond * 10,
+		Tokens: toTokens(ctx, state, n),
 	}
 }
 
-func toTokens(ctx *whisper.Context, n int) []Token {
-	result := make([]Token, ctx.Whisper_full_n_tokens(n))
-	for i := 0; i < len(result); i++ {
-		data := ctx.Whisper_full_get_token_data(n, i)
-
+// The tokens of a segment are read with a single cgo call
+func toTokens(ctx *whisper.Context, state *whisper.State, n int) []Token {
+	data, text := ctx.Whisper_full_get_tokens_from_state(state, n)
+	result := make([]Token, len(data))
+	for i := range data {
 		result[i] = Token{
-			Id:    int(ctx.Whisper_full_get_token_id(n, i)),
-			Text:  ctx.Whisper_full_get_token_text(n, i),
-			P:     ctx.Whisper_full_get_token_p(n, i),
-			Start: time.Duration(data.T0()) * time.Millisecond * 10,
-			End:   time.Duration(data.T1()) * time.Millisecond * 10,
+			Id:    int(data[i].Id()),
+			Text:  text[i],
+			P:     data[i].P(),
+			Start: time.Duration(data[i].T0()) * time.Millisecond * 10,
+			End:   time.Duration(data[i].T1()) * time.Millisecond * 10,
 		}
 	}
 	return result
 }
+
+func printTiming(name string, ms float32, n int) {
+	per_run := float32(0)
+	if n > 0 {
+		per_run = ms / float32(n)
+	}
+	fmt.Printf("whisper_print_timings:   %s time = %8.2f ms / %5d runs (%8.2f ms per run)\n", name, ms, n, per_run)
+}
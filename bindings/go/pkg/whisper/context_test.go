@@ -2,6 +2,7 @@ package whisper_test
 
 import (
 	"os"
+	"sync"
 	"testing"
 
 	"github.com/ggerganov/whisper.cpp/bindings/go/pkg/whisper"
@@ -122,3 +123,52 @@ func TestDetectedLanguage(t *testing.T) {
 	actualLanguage := context.DetectedLanguage()
 	assert.Equal(expectedLanguage, actualLanguage)
 }
+
+func TestProcessConcurrent(t *testing.T) {
+	assert := assert.New(t)
+
+	fh, err := os.Open(SamplePath)
+	assert.NoError(err)
+	defer fh.Close()
+
+	// Decode the WAV file - load the full buffer
+	dec := wav.NewDecoder(fh)
+	buf, err := dec.FullPCMBuffer()
+	assert.NoError(err)
+	assert.Equal(uint16(1), dec.NumChans)
+
+	data := buf.AsFloat32Buffer().Data
+
+	model, err := whisper.New(ModelPath)
+	assert.NoError(err)
+	assert.NotNil(model)
+	defer model.Close()
+
+	// Each context has its own state, so they can process from separate goroutines
+	const n = 2
+	texts := make([]string, n)
+	var wg sync.WaitGroup
+	for i := 0; i < n; i++ {
+		context, err := model.NewContext()
+		assert.NoError(err)
+		defer context.Close()
+		context.SetThreads(2)
+
+		wg.Add(1)
+		go func(i int, context whisper.Context) {
+			defer wg.Done()
+			assert.NoError(context.Process(data, nil, nil, nil))
+			for {
+				segment, err := context.NextSegment()
+				if err != nil {
+					break
+				}
+				texts[i] += segment.Text
+			}
+		}(i, context)
+	}
+	wg.Wait()
+
+	assert.NotEmpty(texts[0])
+	assert.Equal(texts[0], texts[1])
+}
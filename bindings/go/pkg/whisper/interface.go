@@ -35,8 +35,12 @@ type Model interface {
 	Languages() []string
 }
 
-// Context is the speech recognition context.
+// Context is the speech recognition context. Each context has its own state,
+// so several contexts of the same model can process concurrently, one
+// goroutine per context. Close returns the state to the model for reuse.
 type Context interface {
+	io.Closer
+
 	SetLanguage(string) error // Set the language to use for speech recognition, use "auto" for auto detect language.
 	SetTranslate(bool)        // Set translate flag
 	IsMultilingual() bool     // Return true if the model is multilingual.
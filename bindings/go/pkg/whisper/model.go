@@ -4,6 +4,7 @@ import (
 	"fmt"
 	"os"
 	"runtime"
+	"sync"
 
 	// Bindings
 	whisper "github.com/ggerganov/whisper.cpp/bindings/go"
@@ -15,6 +16,9 @@ import (
 type model struct {
 	path string
 	ctx  *whisper.Context
+
+	// Guards ctx against the contexts returning their states concurrently
+	mu sync.Mutex
 }
 
 // Make sure model adheres to the interface
@@ -27,7 +31,7 @@ func New(path string) (Model, error) {
 	model := new(model)
 	if _, err := os.Stat(path); err != nil {
 		return nil, err
-	} else if ctx := whisper.Whisper_init(path); ctx == nil {
+	} else if ctx := whisper.Whisper_init_no_state(path); ctx == nil {
 		return nil, ErrUnableToLoadModel
 	} else {
 		model.ctx = ctx
@@ -39,6 +43,10 @@ func New(path string) (Model, error) {
 }
 
 func (model *model) Close() error {
+	model.mu.Lock()
+	defer model.mu.Unlock()
+
+	// Also frees the states returned by the contexts
 	if model.ctx != nil {
 		model.ctx.Whisper_free()
 	}
@@ -99,3 +107,27 @@ func (model *model) NewContext() (Context, error) {
 	// Return new context
 	return newContext(model, params)
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// PRIVATE METHODS
+
+// Return a state for a new context, reusing the state of a closed context if there is one
+func (model *model) acquireState() *whisper.State {
+	model.mu.Lock()
+	defer model.mu.Unlock()
+	if model.ctx == nil {
+		return nil
+	}
+	return model.ctx.Whisper_init_state()
+}
+
+// Keep the state of a closed context in the model for the next context, or free it if the model is closed
+func (model *model) releaseState(state *whisper.State) {
+	model.mu.Lock()
+	defer model.mu.Unlock()
+	if model.ctx != nil {
+		model.ctx.Whisper_recycle_state(state)
+	} else {
+		state.Whisper_free_state()
+	}
+}
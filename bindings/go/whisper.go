@@ -2,6 +2,7 @@ package whisper
 
 import (
 	"errors"
+	"sync"
 	"unsafe"
 )
 
@@ -57,6 +58,23 @@ static struct whisper_full_params whisper_full_default_params_cb(struct whisper_
 	params.progress_callback_user_data = (void*)(ctx);
 	return params;
 }
+
+// Report the callbacks of a call with a state to that state, so that calls with different states on the same
+// context do not mix up their callbacks
+static struct whisper_full_params whisper_full_params_with_state_cb(struct whisper_full_params params, struct whisper_state* state) {
+	params.new_segment_callback_user_data = (void*)(state);
+	params.encoder_begin_callback_user_data = (void*)(state);
+	params.progress_callback_user_data = (void*)(state);
+	return params;
+}
+
+// Token data and token texts of a segment, in one call instead of one call per token
+static void whisper_full_get_tokens_from_state(struct whisper_context* ctx, struct whisper_state* state, int i_segment, struct whisper_token_data* data, const char** text, int n_tokens) {
+	for (int i = 0; i < n_tokens; i++) {
+		data[i] = whisper_full_get_token_data_from_state(state, i_segment, i);
+		text[i] = whisper_full_get_token_text_from_state(ctx, state, i_segment, i);
+	}
+}
 */
 import "C"
 
@@ -65,6 +83,8 @@ import "C"
 
 type (
 	Context          C.struct_whisper_context
+	State            C.struct_whisper_state
+	StateStats       C.struct_whisper_state_stats
 	Token            C.whisper_token
 	TokenData        C.struct_whisper_token_data
 	SamplingStrategy C.enum_whisper_sampling_strategy
@@ -109,6 +129,39 @@ func Whisper_init(path string) *Context {
 	}
 }
 
+// Allocates the memory of the model and loads it from the given file, without the default state.
+// Use Whisper_init_state to create the states the computations run with. Returns nil on failure.
+func Whisper_init_no_state(path string) *Context {
+	cPath := C.CString(path)
+	defer C.free(unsafe.Pointer(cPath))
+	if ctx := C.whisper_init_from_file_with_params_no_state(cPath, C.whisper_context_default_params()); ctx != nil {
+		return (*Context)(ctx)
+	} else {
+		return nil
+	}
+}
+
+// Allocates a state: the KV caches, the compute buffers and the results of a computation.
+// Computations with different states can run on the same context from several goroutines. Returns nil on failure.
+func (ctx *Context) Whisper_init_state() *State {
+	if state := C.whisper_init_state((*C.struct_whisper_context)(ctx)); state != nil {
+		return (*State)(state)
+	} else {
+		return nil
+	}
+}
+
+// Frees a state allocated by Whisper_init_state.
+func (state *State) Whisper_free_state() {
+	C.whisper_free_state((*C.struct_whisper_state)(state))
+}
+
+// Resets a state and keeps it in the context, so that the next Whisper_init_state returns it without allocating
+// its buffers again. The state must not be used afterwards.
+func (ctx *Context) Whisper_recycle_state(state *State) {
+	C.whisper_recycle_state((*C.struct_whisper_context)(ctx), (*C.struct_whisper_state)(state))
+}
+
 // Frees all memory allocated by the model.
 func (ctx *Context) Whisper_free() {
 	C.whisper_free((*C.struct_whisper_context)(ctx))
@@ -308,12 +361,12 @@ func (ctx *Context) Whisper_full(
 	newSegmentCallback func(int),
 	progressCallback func(int),
 ) error {
-	registerEncoderBeginCallback(ctx, encoderBeginCallback)
-	registerNewSegmentCallback(ctx, newSegmentCallback)
-	registerProgressCallback(ctx, progressCallback)
-	defer registerEncoderBeginCallback(ctx, nil)
-	defer registerNewSegmentCallback(ctx, nil)
-	defer registerProgressCallback(ctx, nil)
+	registerEncoderBeginCallback(unsafe.Pointer(ctx), encoderBeginCallback)
+	registerNewSegmentCallback(unsafe.Pointer(ctx), newSegmentCallback)
+	registerProgressCallback(unsafe.Pointer(ctx), progressCallback)
+	defer registerEncoderBeginCallback(unsafe.Pointer(ctx), nil)
+	defer registerNewSegmentCallback(unsafe.Pointer(ctx), nil)
+	defer registerProgressCallback(unsafe.Pointer(ctx), nil)
 	if C.whisper_full((*C.struct_whisper_context)(ctx), (C.struct_whisper_full_params)(params), (*C.float)(&samples[0]), C.int(len(samples))) == 0 {
 		return nil
 	} else {
@@ -325,10 +378,10 @@ func (ctx *Context) Whisper_full(
 // It seems this approach can offer some speedup in some cases.
 // However, the transcription accuracy can be worse at the beginning and end of each chunk.
 func (ctx *Context) Whisper_full_parallel(params Params, samples []float32, processors int, encoderBeginCallback func() bool, newSegmentCallback func(int)) error {
-	registerEncoderBeginCallback(ctx, encoderBeginCallback)
-	registerNewSegmentCallback(ctx, newSegmentCallback)
-	defer registerEncoderBeginCallback(ctx, nil)
-	defer registerNewSegmentCallback(ctx, nil)
+	registerEncoderBeginCallback(unsafe.Pointer(ctx), encoderBeginCallback)
+	registerNewSegmentCallback(unsafe.Pointer(ctx), newSegmentCallback)
+	defer registerEncoderBeginCallback(unsafe.Pointer(ctx), nil)
+	defer registerNewSegmentCallback(unsafe.Pointer(ctx), nil)
 
 	if C.whisper_full_parallel((*C.struct_whisper_context)(ctx), (C.struct_whisper_full_params)(params), (*C.float)(&samples[0]), C.int(len(samples)), C.int(processors)) == 0 {
 		return nil
@@ -337,6 +390,61 @@ func (ctx *Context) Whisper_full_parallel(params Params, samples []float32, proc
 	}
 }
 
+// Same as Whisper_full, but the results are stored in the provided state.
+// Thread safe as long as each call uses a separate state. The samples are not copied.
+func (ctx *Context) Whisper_full_with_state(
+	state *State,
+	params Params,
+	samples []float32,
+	encoderBeginCallback func() bool,
+	newSegmentCallback func(int),
+	progressCallback func(int),
+) error {
+	if len(samples) == 0 {
+		return ErrConversionFailed
+	}
+	registerEncoderBeginCallback(unsafe.Pointer(state), encoderBeginCallback)
+	registerNewSegmentCallback(unsafe.Pointer(state), newSegmentCallback)
+	registerProgressCallback(unsafe.Pointer(state), progressCallback)
+	defer registerEncoderBeginCallback(unsafe.Pointer(state), nil)
+	defer registerNewSegmentCallback(unsafe.Pointer(state), nil)
+	defer registerProgressCallback(unsafe.Pointer(state), nil)
+	cParams := C.whisper_full_params_with_state_cb((C.struct_whisper_full_params)(params), (*C.struct_whisper_state)(state))
+	if C.whisper_full_with_state((*C.struct_whisper_context)(ctx), (*C.struct_whisper_state)(state), cParams, (*C.float)(&samples[0]), C.int(len(samples))) == 0 {
+		return nil
+	} else {
+		return ErrConversionFailed
+	}
+}
+
+// Same as Whisper_full_parallel, but the results of all the chunks are combined into the provided state.
+// Thread safe as long as each call uses a separate state.
+func (ctx *Context) Whisper_full_parallel_with_state(state *State, params Params, samples []float32, processors int, encoderBeginCallback func() bool, newSegmentCallback func(int)) error {
+	if len(samples) == 0 {
+		return ErrConversionFailed
+	}
+	registerEncoderBeginCallback(unsafe.Pointer(state), encoderBeginCallback)
+	registerNewSegmentCallback(unsafe.Pointer(state), newSegmentCallback)
+	defer registerEncoderBeginCallback(unsafe.Pointer(state), nil)
+	defer registerNewSegmentCallback(unsafe.Pointer(state), nil)
+	cParams := C.whisper_full_params_with_state_cb((C.struct_whisper_full_params)(params), (*C.struct_whisper_state)(state))
+	if C.whisper_full_parallel_with_state((*C.struct_whisper_context)(ctx), (*C.struct_whisper_state)(state), cParams, (*C.float)(&samples[0]), C.int(len(samples)), C.int(processors)) == 0 {
+		return nil
+	} else {
+		return ErrConversionFailed
+	}
+}
+
+// Same as Whisper_lang_auto_detect, with the log mel spectrogram of the provided state.
+func (ctx *Context) Whisper_lang_auto_detect_with_state(state *State, offset_ms, n_threads int) ([]float32, error) {
+	probs := make([]float32, Whisper_lang_max_id()+1)
+	if n := int(C.whisper_lang_auto_detect_with_state((*C.struct_whisper_context)(ctx), (*C.struct_whisper_state)(state), C.int(offset_ms), C.int(n_threads), (*C.float)(&probs[0]))); n < 0 {
+		return nil, ErrAutoDetectFailed
+	} else {
+		return probs, nil
+	}
+}
+
 // Return the id of the autodetected language, returns -1 if not found
 // Added to whisper.cpp in
 // https://github.com/ggerganov/whisper.cpp/commit/a1c1583cc7cd8b75222857afc936f0638c5683d6
@@ -396,56 +504,131 @@ func (ctx *Context) Whisper_full_get_token_p(segment int, token int) float32 {
 	return float32(C.whisper_full_get_token_p((*C.struct_whisper_context)(ctx), C.int(segment), C.int(token)))
 }
 
+// Language id of the provided state
+func (state *State) Whisper_full_lang_id_from_state() int {
+	return int(C.whisper_full_lang_id_from_state((*C.struct_whisper_state)(state)))
+}
+
+// Number of generated text segments in the provided state.
+func (state *State) Whisper_full_n_segments_from_state() int {
+	return int(C.whisper_full_n_segments_from_state((*C.struct_whisper_state)(state)))
+}
+
+// Get the start time of the specified segment in the provided state.
+func (state *State) Whisper_full_get_segment_t0_from_state(segment int) int64 {
+	return int64(C.whisper_full_get_segment_t0_from_state((*C.struct_whisper_state)(state), C.int(segment)))
+}
+
+// Get the end time of the specified segment in the provided state.
+func (state *State) Whisper_full_get_segment_t1_from_state(segment int) int64 {
+	return int64(C.whisper_full_get_segment_t1_from_state((*C.struct_whisper_state)(state), C.int(segment)))
+}
+
+// Get the text of the specified segment in the provided state.
+func (state *State) Whisper_full_get_segment_text_from_state(segment int) string {
+	return C.GoString(C.whisper_full_get_segment_text_from_state((*C.struct_whisper_state)(state), C.int(segment)))
+}
+
+// Get number of tokens in the specified segment in the provided state.
+func (state *State) Whisper_full_n_tokens_from_state(segment int) int {
+	return int(C.whisper_full_n_tokens_from_state((*C.struct_whisper_state)(state), C.int(segment)))
+}
+
+// Get the token data and the token texts of all the tokens of the specified segment in the provided state.
+// This is a single cgo call, instead of one call per token and per field.
+func (ctx *Context) Whisper_full_get_tokens_from_state(state *State, segment int) ([]TokenData, []string) {
+	n := state.Whisper_full_n_tokens_from_state(segment)
+	if n <= 0 {
+		return nil, nil
+	}
+	data := make([]TokenData, n)
+	ptrs := make([]*C.char, n)
+	C.whisper_full_get_tokens_from_state((*C.struct_whisper_context)(ctx), (*C.struct_whisper_state)(state), C.int(segment), (*C.struct_whisper_token_data)(&data[0]), &ptrs[0], C.int(n))
+	text := make([]string, n)
+	for i, ptr := range ptrs {
+		text[i] = C.GoString(ptr)
+	}
+	return data, text
+}
+
+// Counters of the provided state since it was created or reset
+func (state *State) Whisper_get_state_stats() StateStats {
+	return StateStats(C.whisper_get_state_stats((*C.struct_whisper_state)(state)))
+}
+
+// Resets the timings and the counters of the provided state
+func (state *State) Whisper_reset_timings_from_state() {
+	C.whisper_reset_timings_from_state((*C.struct_whisper_state)(state))
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // CALLBACKS
 
+// The callbacks are keyed by the user data of the call: the context for the calls with its default state, the
+// state for the calls with a state. Calls with separate states can run concurrently.
 var (
+	cbMutex        sync.RWMutex
 	cbNewSegment   = make(map[unsafe.Pointer]func(int))
 	cbProgress     = make(map[unsafe.Pointer]func(int))
 	cbEncoderBegin = make(map[unsafe.Pointer]func() bool)
 )
 
-func registerNewSegmentCallback(ctx *Context, fn func(int)) {
+func registerNewSegmentCallback(key unsafe.Pointer, fn func(int)) {
+	cbMutex.Lock()
+	defer cbMutex.Unlock()
 	if fn == nil {
-		delete(cbNewSegment, unsafe.Pointer(ctx))
+		delete(cbNewSegment, key)
 	} else {
-		cbNewSegment[unsafe.Pointer(ctx)] = fn
+		cbNewSegment[key] = fn
 	}
 }
 
-func registerProgressCallback(ctx *Context, fn func(int)) {
+func registerProgressCallback(key unsafe.Pointer, fn func(int)) {
+	cbMutex.Lock()
+	defer cbMutex.Unlock()
 	if fn == nil {
-		delete(cbProgress, unsafe.Pointer(ctx))
+		delete(cbProgress, key)
 	} else {
-		cbProgress[unsafe.Pointer(ctx)] = fn
+		cbProgress[key] = fn
 	}
 }
 
-func registerEncoderBeginCallback(ctx *Context, fn func() bool) {
+func registerEncoderBeginCallback(key unsafe.Pointer, fn func() bool) {
+	cbMutex.Lock()
+	defer cbMutex.Unlock()
 	if fn == nil {
-		delete(cbEncoderBegin, unsafe.Pointer(ctx))
+		delete(cbEncoderBegin, key)
 	} else {
-		cbEncoderBegin[unsafe.Pointer(ctx)] = fn
+		cbEncoderBegin[key] = fn
 	}
 }
 
 //export callNewSegment
 func callNewSegment(user_data unsafe.Pointer, new C.int) {
-	if fn, ok := cbNewSegment[user_data]; ok {
+	cbMutex.RLock()
+	fn, ok := cbNewSegment[user_data]
+	cbMutex.RUnlock()
+	if ok {
 		fn(int(new))
 	}
 }
 
 //export callProgress
 func callProgress(user_data unsafe.Pointer, progress C.int) {
-	if fn, ok := cbProgress[user_data]; ok {
+	cbMutex.RLock()
+	fn, ok := cbProgress[user_data]
+	cbMutex.RUnlock()
+	if ok {
 		fn(int(progress))
 	}
 }
 
 //export callEncoderBegin
 func callEncoderBegin(user_data unsafe.Pointer) C.bool {
-	if fn, ok := cbEncoderBegin[user_data]; ok {
+	cbMutex.RLock()
+	fn, ok := cbEncoderBegin[user_data]
+	cbMutex.RUnlock()
+	if ok {
 		if fn() {
 			return C.bool(true)
 		} else {
@@ -466,3 +649,20 @@ func (t TokenData) T1() int64 {
 func (t TokenData) Id() Token {
 	return Token(t.id)
 }
+
+func (t TokenData) P() float32 {
+	return float32(t.p)
+}
+
+func (s StateStats) SampleMs() float32 { return float32(s.sample_ms) }
+func (s StateStats) EncodeMs() float32 { return float32(s.encode_ms) }
+func (s StateStats) DecodeMs() float32 { return float32(s.decode_ms) }
+func (s StateStats) BatchdMs() float32 { return float32(s.batchd_ms) }
+func (s StateStats) PromptMs() float32 { return float32(s.prompt_ms) }
+func (s StateStats) MelMs() float32 { return float32(s.mel_ms) }
+
+func (s StateStats) NumSample() int { return int(s.n_sample) }
+func (s StateStats) NumEncode() int { return int(s.n_encode) }
+func (s StateStats) NumDecode() int { return int(s.n_decode) }
+func (s StateStats) NumBatchd() int { return int(s.n_batchd) }
+func (s StateStats) NumPrompt() int { return int(s.n_prompt) }
@@ -111,3 +111,51 @@ func Test_Whisper_003(t *testing.T) {
 		t.Logf("%s: %f", whisper.Whisper_lang_str(i), p)
 	}
 }
+
+func Test_Whisper_004(t *testing.T) {
+	assert := assert.New(t)
+	if _, err := os.Stat(ModelPath); os.IsNotExist(err) {
+		t.Skip("Skipping test, model not found:", ModelPath)
+	}
+	if _, err := os.Stat(SamplePath); os.IsNotExist(err) {
+		t.Skip("Skipping test, sample not found:", SamplePath)
+	}
+
+	// Open samples
+	fh, err := os.Open(SamplePath)
+	assert.NoError(err)
+	defer fh.Close()
+
+	// Read samples
+	d := wav.NewDecoder(fh)
+	buf, err := d.FullPCMBuffer()
+	assert.NoError(err)
+	data := buf.AsFloat32Buffer().Data
+
+	// Run whisper with the default state
+	ctx := whisper.Whisper_init(ModelPath)
+	assert.NotNil(ctx)
+	defer ctx.Whisper_free()
+	params := ctx.Whisper_full_default_params(whisper.SAMPLING_GREEDY)
+	assert.NoError(ctx.Whisper_full(params, data, nil, nil, nil))
+
+	// Run whisper again with a state of its own, its results are separate from the default state
+	state := ctx.Whisper_init_state()
+	assert.NotNil(state)
+	defer ctx.Whisper_recycle_state(state)
+	assert.NoError(ctx.Whisper_full_with_state(state, params, data, nil, nil, nil))
+
+	// The tokens read with one call match the ones read one by one
+	num_segments := state.Whisper_full_n_segments_from_state()
+	assert.Equal(ctx.Whisper_full_n_segments(), num_segments)
+	for i := 0; i < num_segments; i++ {
+		tokens, texts := ctx.Whisper_full_get_tokens_from_state(state, i)
+		assert.Equal(ctx.Whisper_full_n_tokens(i), len(tokens))
+		assert.Equal(len(tokens), len(texts))
+		for j := range tokens {
+			assert.Equal(ctx.Whisper_full_get_token_id(i, j), tokens[j].Id())
+			assert.Equal(ctx.Whisper_full_get_token_text(i, j), texts[j])
+		}
+	}
+	assert.Greater(state.Whisper_get_state_stats().NumEncode(), 0)
+}
@@ -266,6 +266,12 @@ public interface WhisperCppJnaLibrary extends Library {
      */
     Pointer whisper_full_default_params_by_ref(int strategy);
 
+    /** Size of whisper_context_params, to check the layout of WhisperContextParams. */
+    long whisper_context_params_size();
+
+    /** Size of whisper_full_params, to check the layout of WhisperFullParams. */
+    long whisper_full_params_size();
+
     void whisper_free_params(Pointer params);
 
     /**
@@ -40,11 +40,17 @@ public class WhisperTokenData extends Structure {
      */
     public long t1;
 
+    /**
+     * Token-level timestamp with DTW.
+     * Do not use if you haven't computed token-level timestamps with DTW.
+     */
+    public long t_dtw;
+
     /** Voice length of the token. */
     public float vlen;
 
     @Override
     protected List<String> getFieldOrder() {
-        return Arrays.asList("id", "tid", "p", "plog", "pt", "ptsum", "t0", "t1", "vlen");
+        return Arrays.asList("id", "tid", "p", "plog", "pt", "ptsum", "t0", "t1", "t_dtw", "vlen");
     }
 }
@@ -23,9 +23,30 @@ public class WhisperContextParams extends Structure {
     /** Use flash attention (default = false) */
     public CBool flash_attn;
 
+    /** [EXPERIMENTAL] Fuse the self-attention Q, K and V projections at load time (default = false) */
+    public CBool fuse_qkv;
+
     /** CUDA device to use (default = 0) */
     public int gpu_device;
 
+    /** [EXPERIMENTAL] GPU device for the decoder and its KV caches (default = -1, same as gpu_device) */
+    public int gpu_device_dec;
+
+    /** [EXPERIMENTAL] Number of encoder layers to keep on the GPU (default = -1, all) */
+    public int n_gpu_layers_enc;
+
+    /** [EXPERIMENTAL] Number of decoder layers to keep on the GPU (default = -1, all) */
+    public int n_gpu_layers_dec;
+
+    /** [EXPERIMENTAL] Comma-separated RPC servers (host:port) used as GPU devices (default = null, none) */
+    public String rpc_servers;
+
+    /** Map the model file into memory when loading from a path (default = true) */
+    public CBool use_mmap;
+
+    /** [EXPERIMENTAL] Release unused mapped weights when they exceed this many bytes (default = 0, no limit) */
+    public NativeLong mmap_budget;
+
     /** [EXPERIMENTAL] Enable token-level timestamps with DTW (default = false) */
     public CBool dtw_token_timestamps;
 
@@ -40,6 +61,54 @@ public class WhisperContextParams extends Structure {
     /** DTW memory size (internal use) */
     public NativeLong dtw_mem_size;
 
+    /** [EXPERIMENTAL] Write a Chrome trace of each state to trace_path-&lt;id&gt;.json (default = null, disabled) */
+    public String trace_path;
+
+    /** [EXPERIMENTAL] NUMA strategy of the CPU threads, applied once per process (0 = disabled) */
+    public int numa;
+
+    /** [EXPERIMENTAL] Move the weights held in host memory to this NUMA node (default = -1, off) */
+    public int numa_node;
+
+    /** [EXPERIMENTAL] Back the host memory of the weights, KV caches and compute buffers with huge pages (default = false) */
+    public CBool huge_pages;
+
+    /** [EXPERIMENTAL] ggml type of the K cache, quantized types require flash attention (default = 1, f16) */
+    public int type_k;
+
+    /** [EXPERIMENTAL] ggml type of the V cache, quantized types require flash attention (default = 1, f16) */
+    public int type_v;
+
+    /** [EXPERIMENTAL] ggml type of the intermediate encoder attention: f16, bf16 or f32 (default = 1, f16) */
+    public int type_i;
+
+    /** [EXPERIMENTAL] Share the cross-attention caches of the states through a pool (default = false) */
+    public CBool kv_cross_pool;
+
+    /** [EXPERIMENTAL] Allocate the encoder and decoder graphs in the same compute buffers (default = false) */
+    public CBool share_compute;
+
+    /** [EXPERIMENTAL] Run the decoder graph on its own instance of the GPU backend (default = true) */
+    public CBool gpu_dec_instance;
+
+    /** [EXPERIMENTAL] Number of the decoder layers to load, evenly spaced (default = 0, all of them) */
+    public int dec_layers;
+
+    /** [EXPERIMENTAL] Compute the log mel spectrogram on the device of the encoder (default = false) */
+    public CBool mel_gpu;
+
+    /** [EXPERIMENTAL] Use the extra CPU buffer types (AMX, repack) for the encoder weights (default = true) */
+    public CBool cpu_repack_enc;
+
+    /** [EXPERIMENTAL] Use the extra CPU buffer types (AMX, repack) for the decoder weights (default = true) */
+    public CBool cpu_repack_dec;
+
+    /** [EXPERIMENTAL] Cache file of the weights converted for the extra CPU buffer types (default = null, disabled) */
+    public String repack_cache;
+
+    /** [EXPERIMENTAL] Decode the steps of the states that run at the same time in one batch (default = false) */
+    public CBool decode_batch;
+
     /** Use GPU for inference */
     public void useGpu(boolean enable) {
         use_gpu = enable ? CBool.TRUE : CBool.FALSE;
@@ -50,6 +119,16 @@ public class WhisperContextParams extends Structure {
         flash_attn = enable ? CBool.TRUE : CBool.FALSE;
     }
 
+    /** Fuse the self-attention Q, K and V projections */
+    public void useFusedQkv(boolean enable) {
+        fuse_qkv = enable ? CBool.TRUE : CBool.FALSE;
+    }
+
+    /** Map the model file into memory */
+    public void useMmap(boolean enable) {
+        use_mmap = enable ? CBool.TRUE : CBool.FALSE;
+    }
+
     /** Enable DTW token-level timestamps */
     public void enableDtwTokenTimestamps(boolean enable) {
         dtw_token_timestamps = enable ? CBool.TRUE : CBool.FALSE;
@@ -65,12 +144,35 @@ public class WhisperContextParams extends Structure {
         return Arrays.asList(
             "use_gpu",
             "flash_attn",
+            "fuse_qkv",
             "gpu_device",
+            "gpu_device_dec",
+            "n_gpu_layers_enc",
+            "n_gpu_layers_dec",
+            "rpc_servers",
+            "use_mmap",
+            "mmap_budget",
             "dtw_token_timestamps",
             "dtw_aheads_preset",
             "dtw_n_top",
             "dtw_aheads",
-            "dtw_mem_size"
+            "dtw_mem_size",
+            "trace_path",
+            "numa",
+            "numa_node",
+            "huge_pages",
+            "type_k",
+            "type_v",
+            "type_i",
+            "kv_cross_pool",
+            "share_compute",
+            "gpu_dec_instance",
+            "dec_layers",
+            "mel_gpu",
+            "cpu_repack_enc",
+            "cpu_repack_dec",
+            "repack_cache",
+            "decode_batch"
         );
     }
 
@@ -0,0 +1,32 @@
+package io.github.ggerganov.whispercpp.params;
+
+import com.sun.jna.Structure;
+
+import java.util.Arrays;
+import java.util.List;
+
+public class WhisperVadParams extends Structure {
+    /** Probability threshold to consider as speech. (default = 0.5) */
+    public float threshold;
+
+    /** Min duration for a valid speech segment. (default = 250) */
+    public int min_speech_duration_ms;
+
+    /** Min silence duration to consider speech as ended. (default = 100) */
+    public int min_silence_duration_ms;
+
+    /** Max duration of a speech segment before forcing a new segment. (default = FLT_MAX) */
+    public float max_speech_duration_s;
+
+    /** Padding added before and after speech segments. (default = 30) */
+    public int speech_pad_ms;
+
+    /** Overlap in seconds when copying audio samples from speech segment. (default = 0.1) */
+    public float samples_overlap;
+
+    @Override
+    protected List<String> getFieldOrder() {
+        return Arrays.asList("threshold", "min_speech_duration_ms", "min_silence_duration_ms",
+                "max_speech_duration_s", "speech_pad_ms", "samples_overlap");
+    }
+}
@@ -1,17 +1,43 @@
-package io.github.ggerganov.whispercpp;
-
-import static org.junit.jupiter.api.Assertions.*;
-
-import org.junit.jupiter.api.Test;
-
-class WhisperJnaLibraryTest {
-
-    @Test
-    void testWhisperPrint_system_info() {
-        String systemInfo = WhisperCppJnaLibrary.instance.whisper_print_system_info();
-        // eg: "AVX = 1 | AVX2 = 1 | AVX512 = 0 | FMA = 1 | NEON = 0 | ARM_FMA = 0 | F16C = 1 | FP16_VA = 0
-        //    | WASM_SIMD = 0 | BLAS = 0 | SSE3 = 1 | VSX = 0 | COREML = 0 | "
-        System.out.println("System info: " + systemInfo);
-        assertTrue(systemInfo.length() > 10);
-    }
-}
+package io.github.ggerganov.whispercpp;
+
+import static org.junit.jupiter.api.Assertions.*;
+
+import io.github.ggerganov.whispercpp.params.WhisperContextParams;
+import io.github.ggerganov.whispercpp.params.WhisperFullParams;
+import io.github.ggerganov.whispercpp.params.WhisperSamplingStrategy;
+import org.junit.jupiter.api.Test;
+
+class WhisperJnaLibraryTest {
+
+    @Test
+    void testWhisperPrint_system_info() {
+        String systemInfo = WhisperCppJnaLibrary.instance.whisper_print_system_info();
+        // eg: "AVX = 1 | AVX2 = 1 | AVX512 = 0 | FMA = 1 | NEON = 0 | ARM_FMA = 0 | F16C = 1 | FP16_VA = 0
+        //    | WASM_SIMD = 0 | BLAS = 0 | SSE3 = 1 | VSX = 0 | COREML = 0 | "
+        System.out.println("System info: " + systemInfo);
+        assertTrue(systemInfo.length() > 10);
+    }
+
+    @Test
+    void testParamsSize() {
+        // the structs are passed by value, a field missing from the mirror shifts all the fields after it
+        assertEquals(WhisperCppJnaLibrary.instance.whisper_context_params_size(), new WhisperContextParams().size());
+        assertEquals(WhisperCppJnaLibrary.instance.whisper_full_params_size(), new WhisperFullParams().size());
+    }
+
+    @Test
+    void testFullDefaultParams() {
+        WhisperFullParams params = new WhisperFullParams(
+            WhisperCppJnaLibrary.instance.whisper_full_default_params_by_ref(WhisperSamplingStrategy.WHISPER_SAMPLING_GREEDY.ordinal()));
+        params.read();
+
+        // n_threads_dec = 0 runs the decoder with n_threads
+        assertTrue(params.n_threads > 0);
+        assertEquals(0, params.n_threads_dec);
+
+        // the last field, read at the right offset
+        assertEquals(0.5f, params.vad_params.threshold);
+
+        WhisperCppJnaLibrary.instance.whisper_free_params(params.getPointer());
+    }
+}
@@ -14,8 +14,8 @@ ID id_to_s;
 ID id_call;
 ID id___method__;
 ID id_to_enum;
+ID id_to_a;
 ID id_length;
-ID id_next;
 ID id_new;
 ID id_to_path;
 ID id_URI;
@@ -32,6 +32,7 @@ extern void init_ruby_whisper_error(VALUE *mWhisper);
 extern void init_ruby_whisper_segment(VALUE *mWhisper, VALUE *cSegment);
 extern void init_ruby_whisper_model(VALUE *mWhisper);
 extern void register_callbacks(ruby_whisper_params *rwp, VALUE *context);
+extern bool ruby_whisper_call_with_gvl(void (*fn)(void *), void *data);
 
 /*
  * call-seq:
@@ -85,14 +86,27 @@ static VALUE ruby_whisper_s_finalize_log_callback(VALUE self, VALUE id) {
   return Qnil;
 }
 
+typedef struct {
+  enum ggml_log_level level;
+  const char * buffer;
+} ruby_whisper_log_args;
+
+static void
+ruby_whisper_log_callback_with_gvl(void * data) {
+  ruby_whisper_log_args * args = (ruby_whisper_log_args *)data;
+  VALUE log_callback = rb_iv_get(mWhisper, "log_callback");
+  VALUE udata = rb_iv_get(mWhisper, "user_data");
+  rb_funcall(log_callback, id_call, 3, INT2NUM(args->level), rb_str_new2(args->buffer), udata);
+}
+
+// whisper logs from the native threads of Context#full too, their messages are passed to a Ruby thread
 static void
 ruby_whisper_log_callback(enum ggml_log_level level, const char * buffer, void * user_data) {
   if (is_log_callback_finalized) {
     return;
   }
-  VALUE log_callback = rb_iv_get(mWhisper, "log_callback");
-  VALUE udata = rb_iv_get(mWhisper, "user_data");
-  rb_funcall(log_callback, id_call, 3, INT2NUM(level), rb_str_new2(buffer), udata);
+  ruby_whisper_log_args args = { level, buffer };
+  ruby_whisper_call_with_gvl(ruby_whisper_log_callback_with_gvl, &args);
 }
 
 /*
@@ -131,8 +145,8 @@ void Init_whisper() {
   id_call = rb_intern("call");
   id___method__ = rb_intern("__method__");
   id_to_enum = rb_intern("to_enum");
+  id_to_a = rb_intern("to_a");
   id_length = rb_intern("length");
-  id_next = rb_intern("next");
   id_new = rb_intern("new");
   id_to_path = rb_intern("to_path");
   id_URI = rb_intern("URI");
@@ -5,8 +5,8 @@
 extern ID id_to_s;
 extern ID id___method__;
 extern ID id_to_enum;
+extern ID id_to_a;
 extern ID id_length;
-extern ID id_next;
 extern ID id_new;
 extern ID id_to_path;
 extern ID id_URI;
@@ -20,6 +20,7 @@ extern VALUE ruby_whisper_transcribe(int argc, VALUE *argv, VALUE self);
 extern VALUE rb_whisper_model_initialize(VALUE context);
 extern VALUE rb_whisper_segment_initialize(VALUE context, int index);
 extern void register_callbacks(ruby_whisper_params *rwp, VALUE *context);
+extern int ruby_whisper_full_without_gvl(struct whisper_context *context, struct whisper_full_params params, const float *samples, int n_samples, int n_processors);
 
 static void
 ruby_whisper_free(ruby_whisper *rw)
@@ -229,10 +230,119 @@ VALUE ruby_whisper_model_type(VALUE self)
   return rb_str_new2(whisper_model_type_readable(rw->context));
 }
 
+typedef struct {
+  VALUE self;
+  ruby_whisper *rw;
+  ruby_whisper_params *rwp;
+  VALUE samples;
+  VALUE n_samples;  // can be nil
+  int n_processors; // 0: whisper_full
+  float *c_samples;
+  float *buffer;    // converted samples, owned
+  bool view_p;
+  rb_memory_view_t view;
+} ruby_whisper_full_args;
+
+// the first n_samples samples of an Array, or of an object that responds to :to_a
+static void
+ruby_whisper_convert_samples(VALUE samples, float *c_samples, int n_samples)
+{
+  VALUE ary = TYPE(samples) == T_ARRAY ? samples : rb_funcall(samples, id_to_a, 0);
+  Check_Type(ary, T_ARRAY);
+  if (RARRAY_LEN(ary) < n_samples) {
+    rb_raise(rb_eArgError, "samples length %ld is less than n_samples %d", RARRAY_LEN(ary), n_samples);
+  }
+  for (int i = 0; i < n_samples; i++) {
+    const VALUE sample = rb_ary_entry(ary, i);
+    c_samples[i] = RB_FLOAT_TYPE_P(sample) ? (float)RFLOAT_VALUE(sample) : (float)NUM2DBL(sample);
+  }
+  RB_GC_GUARD(ary);
+}
+
+static VALUE
+ruby_whisper_full_body(VALUE data)
+{
+  ruby_whisper_full_args *args = (ruby_whisper_full_args *)data;
+  const VALUE samples = args->samples;
+
+  int n_samples;
+  if (!NIL_P(args->n_samples)) {
+    n_samples = NUM2INT(args->n_samples);
+  } else if (args->view_p) {
+    n_samples = args->view.byte_size / args->view.item_size;
+  } else if (TYPE(samples) == T_ARRAY) {
+    n_samples = RARRAY_LEN(samples);
+  } else if (rb_respond_to(samples, id_length)) {
+    n_samples = NUM2INT(rb_funcall(samples, id_length, 0));
+  } else {
+    rb_raise(rb_eArgError, "samples must respond to :length or be a MemoryView of an array of flaot when n_samples is not given");
+  }
+
+  if (args->view_p) {
+    if (args->view.byte_size / args->view.item_size < n_samples) {
+      rb_raise(rb_eArgError, "samples length %ld is less than n_samples %d", (long)(args->view.byte_size / args->view.item_size), n_samples);
+    }
+    args->c_samples = (float *)args->view.data;
+  } else {
+    args->buffer = ALLOC_N(float, n_samples);
+    ruby_whisper_convert_samples(samples, args->buffer, n_samples);
+    args->c_samples = args->buffer;
+  }
+
+  register_callbacks(args->rwp, &args->self);
+  const int result = ruby_whisper_full_without_gvl(args->rw->context, args->rwp->params, args->c_samples, n_samples, args->n_processors);
+  if (0 != result) {
+    rb_exc_raise(rb_funcall(eError, id_new, 1, INT2NUM(result)));
+  }
+  return args->self;
+}
+
+static VALUE
+ruby_whisper_full_ensure(VALUE data)
+{
+  ruby_whisper_full_args *args = (ruby_whisper_full_args *)data;
+  if (args->buffer) {
+    xfree(args->buffer);
+    args->buffer = NULL;
+  }
+  if (args->view_p) {
+    rb_memory_view_release(&args->view);
+    args->view_p = false;
+  }
+  return Qnil;
+}
+
+// runs whisper_full (n_processors == 0) or whisper_full_parallel on samples, n_samples can be nil
+// the transcription runs without the GVL, the samples of a MemoryView are read in place
+static VALUE
+ruby_whisper_full_samples(VALUE self, VALUE params, VALUE samples, VALUE n_samples, int n_processors)
+{
+  ruby_whisper_full_args args;
+  Data_Get_Struct(self, ruby_whisper, args.rw);
+  Data_Get_Struct(params, ruby_whisper_params, args.rwp);
+  args.self = self;
+  args.samples = samples;
+  args.n_samples = n_samples;
+  args.n_processors = n_processors;
+  args.c_samples = NULL;
+  args.buffer = NULL;
+  args.view_p = false;
+
+  if (rb_memory_view_available_p(samples)) {
+    if (!rb_memory_view_get(samples, &args.view, RUBY_MEMORY_VIEW_SIMPLE)) {
+      rb_raise(rb_eArgError, "unable to get a memory view");
+    }
+    args.view_p = true;
+  }
+
+  return rb_ensure(ruby_whisper_full_body, (VALUE)&args, ruby_whisper_full_ensure, (VALUE)&args);
+}
+
 /*
  * Run the entire model: PCM -> log mel spectrogram -> encoder -> decoder -> text
  * Not thread safe for same context
  * Uses the specified decoding strategy to obtain the text.
+ * The other Ruby threads run during the transcription, the callbacks are called on the calling thread.
  *
  * call-seq:
  *   full(params, samples, n_samples) -> nil
@@ -246,63 +356,7 @@ VALUE ruby_whisper_full(int argc, VALUE *argv, VALUE self)
     rb_raise(rb_eArgError, "wrong number of arguments (given %d, expected 2..3)", argc);
   }
 
-  ruby_whisper *rw;
-  ruby_whisper_params *rwp;
-  Data_Get_Struct(self, ruby_whisper, rw);
-  VALUE params = argv[0];
-  Data_Get_Struct(params, ruby_whisper_params, rwp);
-  VALUE samples = argv[1];
-  int n_samples;
-  rb_memory_view_t view;
-  const bool memory_view_available_p = rb_memory_view_available_p(samples);
-  if (argc == 3) {
-    n_samples = NUM2INT(argv[2]);
-    if (TYPE(samples) == T_ARRAY) {
-      if (RARRAY_LEN(samples) < n_samples) {
-        rb_raise(rb_eArgError, "samples length %ld is less than n_samples %d", RARRAY_LEN(samples), n_samples);
-      }
-    }
-    // Should check when samples.respond_to?(:length)?
-  } else {
-    if (TYPE(samples) == T_ARRAY) {
-      n_samples = RARRAY_LEN(samples);
-    } else if (memory_view_available_p) {
-      if (!rb_memory_view_get(samples, &view, RUBY_MEMORY_VIEW_SIMPLE)) {
-        view.obj = Qnil;
-        rb_raise(rb_eArgError, "unable to get a memory view");
-      }
-      n_samples = view.byte_size / view.item_size;
-    } else if (rb_respond_to(samples, id_length)) {
-      n_samples = NUM2INT(rb_funcall(samples, id_length, 0));
-    } else {
-      rb_raise(rb_eArgError, "samples must respond to :length or be a MemoryView of an array of flaot when n_samples is not given");
-    }
-  }
-  float * c_samples = (float *)malloc(n_samples * sizeof(float));
-  if (memory_view_available_p)  {
-    c_samples = (float *)view.data;
-  } else {
-    if (TYPE(samples) == T_ARRAY) {
-      for (int i = 0; i < n_samples; i++) {
-        c_samples[i] = RFLOAT_VALUE(rb_ary_entry(samples, i));
-      }
-    } else {
-      // TODO: use rb_block_call
-      VALUE iter = rb_funcall(samples, id_to_enum, 1, rb_str_new2("each"));
-      for (int i = 0; i < n_samples; i++) {
-        // TODO: check if iter is exhausted and raise ArgumentError appropriately
-        VALUE sample = rb_funcall(iter, id_next, 0);
-        c_samples[i] = RFLOAT_VALUE(sample);
-      }
-    }
-  }
-  register_callbacks(rwp, &self);
-  const int result = whisper_full(rw->context, rwp->params, c_samples, n_samples);
-  if (0 == result) {
-    return self;
-  } else {
-    rb_exc_raise(rb_funcall(eError, id_new, 1, result));
-  }
+  return ruby_whisper_full_samples(self, argv[0], argv[1], argc == 3 ? argv[2] : Qnil, 0);
 }
 
 /*
@@ -311,6 +365,7 @@ VALUE ruby_whisper_full(int argc, VALUE *argv, VALUE self)
  * Not thread safe if executed in parallel on the same context.
  * It seems this approach can offer some speedup in some cases.
  * However, the transcription accuracy can be worse at the beginning and end of each chunk.
+ * The other Ruby threads run during the transcription, the callbacks are called on the calling thread.
  *
  * call-seq:
  *   full_parallel(params, samples) -> nil
@@ -325,75 +380,9 @@ ruby_whisper_full_parallel(int argc, VALUE *argv,VALUE self)
     rb_raise(rb_eArgError, "wrong number of arguments (given %d, expected 2..3)", argc);
   }
 
-  ruby_whisper *rw;
-  ruby_whisper_params *rwp;
-  Data_Get_Struct(self, ruby_whisper, rw);
-  VALUE params = argv[0];
-  Data_Get_Struct(params, ruby_whisper_params, rwp);
-  VALUE samples = argv[1];
-  int n_samples;
-  int n_processors;
-  rb_memory_view_t view;
-  const bool memory_view_available_p = rb_memory_view_available_p(samples);
-  switch (argc) {
-  case 2:
-    n_processors = 1;
-    break;
-  case 3:
-    n_processors = 1;
-    break;
-  case 4:
-    n_processors = NUM2INT(argv[3]);
-    break;
-  }
-  if (argc >= 3 && !NIL_P(argv[2])) {
-    n_samples = NUM2INT(argv[2]);
-    if (TYPE(samples) == T_ARRAY) {
-      if (RARRAY_LEN(samples) < n_samples) {
-        rb_raise(rb_eArgError, "samples length %ld is less than n_samples %d", RARRAY_LEN(samples), n_samples);
-      }
-    }
-    // Should check when samples.respond_to?(:length)?
-  } else if (memory_view_available_p) {
-    if (!rb_memory_view_get(samples, &view, RUBY_MEMORY_VIEW_SIMPLE)) {
-      view.obj = Qnil;
-      rb_raise(rb_eArgError, "unable to get a memory view");
-    }
-    n_samples = view.byte_size / view.item_size;
-  } else {
-    if (TYPE(samples) == T_ARRAY) {
-      n_samples = RARRAY_LEN(samples);
-    } else if (rb_respond_to(samples, id_length)) {
-      n_samples = NUM2INT(rb_funcall(samples, id_length, 0));
-    } else {
-      rb_raise(rb_eArgError, "samples must respond to :length or be a MemoryView of an array of flaot when n_samples is not given");
-    }
-  }
-  float * c_samples = (float *)malloc(n_samples * sizeof(float));
-  if (memory_view_available_p) {
-    c_samples = (float *)view.data;
-  } else {
-    if (TYPE(samples) == T_ARRAY) {
-      for (int i = 0; i < n_samples; i++) {
-        c_samples[i] = RFLOAT_VALUE(rb_ary_entry(samples, i));
-      }
-    } else {
-      // FIXME: use rb_block_call
-      VALUE iter = rb_funcall(samples, id_to_enum, 1, rb_str_new2("each"));
-      for (int i = 0; i < n_samples; i++) {
-        // TODO: check if iter is exhausted and raise ArgumentError
-        VALUE sample = rb_funcall(iter, id_next, 0);
-        c_samples[i] = RFLOAT_VALUE(sample);
-      }
-    }
-  }
-  register_callbacks(rwp, &self);
-  const int result = whisper_full_parallel(rw->context, rwp->params, c_samples, n_samples, n_processors);
-  if (0 == result) {
-    return self;
-  } else {
-    rb_exc_raise(rb_funcall(eError, id_new, 1, result));
-  }
+  const int n_processors = argc == 4 ? NUM2INT(argv[3]) : 1;
+
+  return ruby_whisper_full_samples(self, argv[0], argv[1], argc >= 3 ? argv[2] : Qnil, n_processors);
 }
 
 /*
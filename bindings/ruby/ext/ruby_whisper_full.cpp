@@ -0,0 +1,325 @@
+#include <ruby.h>
+#include <ruby/thread.h>
+#include "ruby_whisper.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * whisper_full runs without the GVL, so the other Ruby threads are not blocked during a transcription.
+ *
+ * The transcription runs on a native thread while the calling Ruby thread waits for it. The callbacks of whisper
+ * can be called on any thread (whisper_full_parallel calls them on its worker threads), so they are queued to the
+ * Ruby thread, which runs them with the GVL. The first exception of a callback aborts the transcription and is
+ * raised once it is done. The log messages of the native threads are passed to any of the waiting Ruby threads.
+ */
+
+namespace {
+
+struct full_task {
+  std::function<void()> fn;
+  bool done = false;
+};
+
+struct full_call {
+  struct whisper_context *context;
+  struct whisper_full_params params; // with the callbacks of the caller
+  const float *samples;
+  int n_samples;
+  int n_processors;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<full_task *> tasks;
+  bool started = false;
+  bool done = false;
+  bool closed = false;      // no more tasks are run
+  bool interrupted = false; // Thread#kill, Thread#raise, signal
+  bool failed = false;      // a callback has raised
+
+  int result = 0;
+
+  // kept alive by the stack of the Ruby thread, which is scanned by the GC
+  VALUE exception = Qnil;
+};
+
+// runs fn on the Ruby thread and waits for it
+// returns false when the transcription is interrupted or has failed, fn is not run then
+static bool
+post(full_call &call, std::function<void()> fn)
+{
+  full_task task;
+  task.fn = std::move(fn);
+
+  std::unique_lock<std::mutex> lock(call.mutex);
+  if (call.interrupted || call.failed || call.closed) {
+    return false;
+  }
+  call.tasks.push_back(&task);
+  call.cv.notify_all();
+  call.cv.wait(lock, [&]() { return task.done; });
+
+  return !call.interrupted && !call.failed;
+}
+
+static void
+new_segment_trampoline(struct whisper_context *ctx, struct whisper_state *state, int n_new, void *user_data)
+{
+  full_call &call = *(full_call *)user_data;
+  post(call, [&]() {
+    call.params.new_segment_callback(ctx, state, n_new, call.params.new_segment_callback_user_data);
+  });
+}
+
+static void
+progress_trampoline(struct whisper_context *ctx, struct whisper_state *state, int progress, void *user_data)
+{
+  full_call &call = *(full_call *)user_data;
+  post(call, [&]() {
+    call.params.progress_callback(ctx, state, progress, call.params.progress_callback_user_data);
+  });
+}
+
+static bool
+encoder_begin_trampoline(struct whisper_context *ctx, struct whisper_state *state, void *user_data)
+{
+  full_call &call = *(full_call *)user_data;
+  bool result = true;
+  const bool ok = post(call, [&]() {
+    result = call.params.encoder_begin_callback(ctx, state, call.params.encoder_begin_callback_user_data);
+  });
+  return ok && result;
+}
+
+// always installed, so an interrupt of the Ruby thread stops the computation
+static bool
+abort_trampoline(void *user_data)
+{
+  full_call &call = *(full_call *)user_data;
+  {
+    std::lock_guard<std::mutex> lock(call.mutex);
+    if (call.interrupted || call.failed) {
+      return true;
+    }
+  }
+  if (!call.params.abort_callback) {
+    return false;
+  }
+  bool result = false;
+  const bool ok = post(call, [&]() {
+    result = call.params.abort_callback(call.params.abort_callback_user_data);
+  });
+  return !ok || result;
+}
+
+// the calls waiting without the GVL - only changed without the GVL, a native thread can wait for a call while it holds
+// active_mutex
+static std::mutex active_mutex;
+static std::vector<full_call *> active;
+
+// the call of a Ruby thread while it waits without the GVL
+static thread_local full_call *current = nullptr;
+
+static VALUE
+run_task_protected(VALUE data)
+{
+  ((full_task *)data)->fn();
+  return Qnil;
+}
+
+struct task_with_gvl {
+  full_call *call;
+  full_task *task;
+};
+
+static void *
+run_task_with_gvl(void *data)
+{
+  task_with_gvl &t = *(task_with_gvl *)data;
+
+  int state = 0;
+  rb_protect(run_task_protected, (VALUE)t.task, &state);
+  if (state) {
+    VALUE exception = rb_errinfo();
+    rb_set_errinfo(Qnil);
+    if (!rb_obj_is_kind_of(exception, rb_eException)) {
+      // throw or break out of a callback
+      exception = rb_exc_new_cstr(rb_eRuntimeError, "non-local exit from a callback");
+    }
+
+    std::lock_guard<std::mutex> lock(t.call->mutex);
+    t.call->exception = exception;
+    t.call->failed = true;
+  }
+
+  return NULL;
+}
+
+static void
+unblock(void *data)
+{
+  full_call &call = *(full_call *)data;
+
+  std::lock_guard<std::mutex> lock(call.mutex);
+  call.interrupted = true;
+  call.cv.notify_all();
+}
+
+// runs without the GVL: starts the transcription and runs the queued callbacks until it is done
+static void *
+run_without_gvl(void *data)
+{
+  full_call &call = *(full_call *)data;
+  call.started = true;
+
+  struct whisper_full_params params = call.params;
+  if (params.new_segment_callback) {
+    params.new_segment_callback = new_segment_trampoline;
+    params.new_segment_callback_user_data = &call;
+  }
+  if (params.progress_callback) {
+    params.progress_callback = progress_trampoline;
+    params.progress_callback_user_data = &call;
+  }
+  if (params.encoder_begin_callback) {
+    params.encoder_begin_callback = encoder_begin_trampoline;
+    params.encoder_begin_callback_user_data = &call;
+  }
+  params.abort_callback = abort_trampoline;
+  params.abort_callback_user_data = &call;
+
+  current = &call;
+  {
+    std::lock_guard<std::mutex> lock(active_mutex);
+    active.push_back(&call);
+  }
+
+  std::thread worker([&call, params]() {
+    const int result = call.n_processors > 0 ?
+      whisper_full_parallel(call.context, params, call.samples, call.n_samples, call.n_processors) :
+      whisper_full(call.context, params, call.samples, call.n_samples);
+
+    std::lock_guard<std::mutex> lock(call.mutex);
+    call.result = result;
+    call.done = true;
+    call.cv.notify_all();
+  });
+
+  {
+    std::unique_lock<std::mutex> lock(call.mutex);
+    while (true) {
+      call.cv.wait(lock, [&]() { return call.done || !call.tasks.empty(); });
+
+      if (call.tasks.empty()) {
+        call.closed = true;
+        break;
+      }
+
+      full_task *task = call.tasks.front();
+      call.tasks.pop_front();
+
+      if (!call.interrupted && !call.failed) {
+        lock.unlock();
+        task_with_gvl t = { &call, task };
+        current = nullptr;
+        rb_thread_call_with_gvl(run_task_with_gvl, &t);
+        current = &call;
+        lock.lock();
+      }
+
+      task->done = true;
+      call.cv.notify_all();
+    }
+  }
+
+  worker.join();
+
+  {
+    std::lock_guard<std::mutex> lock(active_mutex);
+    active.erase(std::find(active.begin(), active.end(), &call));
+  }
+  current = nullptr;
+
+  return NULL;
+}
+
+} // namespace
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int
+ruby_whisper_full_without_gvl(struct whisper_context *context, struct whisper_full_params params, const float *samples, int n_samples, int n_processors)
+{
+  int result = 0;
+  VALUE exception = Qnil;
+
+  while (true) {
+    bool started;
+    {
+      full_call call;
+      call.context = context;
+      call.params = params;
+      call.samples = samples;
+      call.n_samples = n_samples;
+      call.n_processors = n_processors;
+
+      // unlike rb_thread_call_without_gvl, does not raise on the pending interrupts, so call is destroyed first
+      rb_thread_call_without_gvl2(run_without_gvl, &call, unblock, &call);
+
+      started = call.started;
+      result = call.result;
+      if (call.failed) {
+        exception = call.exception;
+      }
+    }
+
+    // raises on Thread#kill, Thread#raise and signals
+    rb_thread_check_ints();
+
+    // not started because of an interrupt that did not raise
+    if (started) {
+      break;
+    }
+  }
+
+  if (!NIL_P(exception)) {
+    rb_exc_raise(exception);
+  }
+
+  return result;
+}
+
+bool
+ruby_whisper_call_with_gvl(void (*fn)(void *), void *data)
+{
+  if (ruby_native_thread_p()) {
+    if (current == nullptr) {
+      fn(data);
+    } else {
+      task_with_gvl t = { current, nullptr };
+      full_task task;
+      task.fn = [&]() { fn(data); };
+      t.task = &task;
+      rb_thread_call_with_gvl(run_task_with_gvl, &t);
+    }
+    return true;
+  }
+
+  std::lock_guard<std::mutex> lock(active_mutex);
+  for (full_call *call : active) {
+    if (post(*call, [&]() { fn(data); })) {
+      return true;
+    }
+  }
+  return false;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -14,6 +14,9 @@ extern ID id_call;
 extern void
 register_callbacks(ruby_whisper_params * rwp, VALUE * self);
 
+extern int
+ruby_whisper_full_without_gvl(struct whisper_context * context, struct whisper_full_params params, const float * samples, int n_samples, int n_processors);
+
 /*
  * transcribe a single file
  * can emit to a block results
@@ -63,7 +66,7 @@ ruby_whisper_transcribe(int argc, VALUE *argv, VALUE self) {
 
   register_callbacks(rwp, &self);
 
-  if (whisper_full_parallel(rw->context, rwp->params, pcmf32.data(), pcmf32.size(), 1) != 0) {
+  if (ruby_whisper_full_without_gvl(rw->context, rwp->params, pcmf32.data(), pcmf32.size(), 1) != 0) {
     fprintf(stderr, "failed to process audio\n");
     return self;
   }
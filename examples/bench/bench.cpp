@@ -1,23 +1,98 @@
 #include "whisper.h"
+#include "common-whisper.h"
 
+#include "ggml-backend.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstring>
+#include <mutex>
+#include <sstream>
 #include <string>
 #include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <fstream>
+#endif
 
 // command-line parameters
 struct whisper_params {
     int32_t n_threads = std::min(4, (int32_t) std::thread::hardware_concurrency());
-    int32_t what = 0; // what to benchmark: 0 - whisper encoder, 1 - memcpy, 2 - ggml_mul_mat
+    int32_t what = 0; // what to benchmark: 0 - whisper encoder, 1 - memcpy, 2 - ggml_mul_mat, 3 - whisper_full, 4 - throughput
+
+    // what = 3
+    int32_t n_warmup  = 1;
+    int32_t n_repeat  = 3;
+    int32_t beam_size = -1;
+    int32_t n_profile = 0; // print the n_profile slowest ops of the graphs
 
     std::string model = "models/ggml-base.en.bin";
 
+    // what = 3
+    std::string language = "en";
+    std::string vad_model;
+    std::string fname_json;
+
+    std::vector<std::string> fname_inp;
+
+    // what = 4 - the configurations are all the combinations of the lists
+    std::vector<int32_t> sweep_states  = { 1, 2 };
+    std::vector<int32_t> sweep_threads = { 1, 2, 4 };
+    std::vector<int32_t> sweep_batch   = { 1 };
+
+    // what = 5 - tokens per decode call and KV length, with and without flash attention
+    std::vector<int32_t> sweep_tokens = { 1, 2, 4, 8, 16, 32 };
+    std::vector<int32_t> sweep_kv     = { 16, 64, 128, 256, 448 };
+
     bool use_gpu    = true;
     bool flash_attn = false;
+    bool repack_enc = true;
+    bool repack_dec = true;
+
+    // KV cache and intermediate type, see whisper_context_params::type_k and type_i
+    std::string type = "f16";
 };
 
 void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
 
+// comma-separated list of integers, e.g. "1,2,4"
+static std::vector<int32_t> parse_int_list(const std::string & str) {
+    std::vector<int32_t> res;
+
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        res.push_back(std::max(1, std::stoi(item)));
+    }
+
+    return res;
+}
+
+static std::string format_int_list(const std::vector<int32_t> & v) {
+    std::string res;
+    for (size_t i = 0; i < v.size(); ++i) {
+        res += (i > 0 ? "," : "") + std::to_string(v[i]);
+    }
+
+    return res;
+}
+
+static ggml_type bench_type(const whisper_params & params) {
+    for (ggml_type type : { GGML_TYPE_F16, GGML_TYPE_BF16, GGML_TYPE_F32 }) {
+        if (params.type == ggml_type_name(type)) {
+            return type;
+        }
+    }
+
+    fprintf(stderr, "warning: unknown type '%s' - using f16\n", params.type.c_str());
+
+    return GGML_TYPE_F16;
+}
+
 static bool whisper_params_parse(int argc, char ** argv, whisper_params & params) {
     for (int i = 1; i < argc; i++) {
         std::string arg = argv[i];
@@ -31,6 +106,25 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-w"  || arg == "--what")       { params.what       = atoi(argv[++i]); }
         else if (arg == "-ng" || arg == "--no-gpu")     { params.use_gpu    = false; }
         else if (arg == "-fa" || arg == "--flash-attn") { params.flash_attn = true; }
+        else if (arg == "-ct" || arg == "--type")       { params.type       = argv[++i]; }
+        else if (arg == "-nrp"|| arg == "--no-repack")  {
+            const std::string phase = argv[++i];
+            params.repack_enc = params.repack_enc && phase == "dec";
+            params.repack_dec = params.repack_dec && phase == "enc";
+        }
+        else if (arg == "-f"  || arg == "--file")       { params.fname_inp.emplace_back(argv[++i]); }
+        else if (arg == "-wu" || arg == "--warmup")     { params.n_warmup   = std::stoi(argv[++i]); }
+        else if (arg == "-r"  || arg == "--repeat")     { params.n_repeat   = std::stoi(argv[++i]); }
+        else if (arg == "-l"  || arg == "--language")   { params.language   = argv[++i]; }
+        else if (arg == "-bs" || arg == "--beam-size")  { params.beam_size  = std::stoi(argv[++i]); }
+        else if (arg == "-vm" || arg == "--vad-model")  { params.vad_model  = argv[++i]; }
+        else if (arg == "-oj" || arg == "--output-json"){ params.fname_json = argv[++i]; }
+        else if (arg == "-pr" || arg == "--profile")    { params.n_profile  = std::stoi(argv[++i]); }
+        else if (arg == "-ns" || arg == "--states")     { params.sweep_states  = parse_int_list(argv[++i]); }
+        else if (arg == "-nt" || arg == "--threads-per-state") { params.sweep_threads = parse_int_list(argv[++i]); }
+        else if (arg == "-nb" || arg == "--batch")      { params.sweep_batch   = parse_int_list(argv[++i]); }
+        else if (arg == "-dt" || arg == "--dec-tokens") { params.sweep_tokens  = parse_int_list(argv[++i]); }
+        else if (arg == "-dk" || arg == "--dec-kv")     { params.sweep_kv      = parse_int_list(argv[++i]); }
         else {
             fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
             whisper_print_usage(argc, argv, params);
@@ -53,8 +147,33 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "                           %-7s  0 - whisper\n",                                 "");
     fprintf(stderr, "                           %-7s  1 - memcpy\n",                                  "");
     fprintf(stderr, "                           %-7s  2 - ggml_mul_mat\n",                            "");
+    fprintf(stderr, "                           %-7s  3 - whisper_full on audio files\n",             "");
+    fprintf(stderr, "                           %-7s  4 - throughput of concurrent states\n",         "");
+    fprintf(stderr, "                           %-7s  5 - decoder roofline\n",                        "");
     fprintf(stderr, "  -ng,      --no-gpu      [%-7s] disable GPU\n",                                 params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,      --flash-attn  [%-7s] enable flash attention\n",                      params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -ct TYPE, --type TYPE   [%-7s] KV cache and intermediate type: f16, bf16, f32\n", params.type.c_str());
+    fprintf(stderr, "  -nrp P,   --no-repack P [%-7s] keep the enc, dec or all CPU weights out of the AMX / repack buffers\n", "none");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options of -w 3:\n");
+    fprintf(stderr, "  -f FNAME,  --file FNAME        [%-7s] audio file, can be repeated\n",                 "samples/jfk.wav");
+    fprintf(stderr, "  -wu N,     --warmup N          [%-7d] untimed runs of each file\n",                   params.n_warmup);
+    fprintf(stderr, "  -r N,      --repeat N          [%-7d] timed runs of each file\n",                     params.n_repeat);
+    fprintf(stderr, "  -l LANG,   --language LANG     [%-7s] spoken language ('auto' for auto-detect)\n",    params.language.c_str());
+    fprintf(stderr, "  -bs N,     --beam-size N       [%-7d] beam size for beam search (-1 - greedy)\n",     params.beam_size);
+    fprintf(stderr, "  -vm FNAME, --vad-model FNAME   [%-7s] VAD model path, enables VAD\n",                 params.vad_model.c_str());
+    fprintf(stderr, "  -oj FNAME, --output-json FNAME [%-7s] write the results to a JSON file\n",            params.fname_json.c_str());
+    fprintf(stderr, "  -pr N,     --profile N         [%-7d] profile the ops of the timed runs and print the N slowest (slower runs)\n", params.n_profile);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options of -w 4 (and -f, -wu, -r, -l, -bs, -vm, -oj):\n");
+    fprintf(stderr, "  -ns LIST,  --states LIST            [%-7s] concurrent workers, each with its own states\n",        format_int_list(params.sweep_states).c_str());
+    fprintf(stderr, "  -nt LIST,  --threads-per-state LIST [%-7s] threads of each worker\n",                               format_int_list(params.sweep_threads).c_str());
+    fprintf(stderr, "  -nb LIST,  --batch LIST             [%-7s] inputs of each worker processed together (see whisper_full_batch_with_states)\n", format_int_list(params.sweep_batch).c_str());
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options of -w 5 (and -wu, -r, -oj), with and without flash attention:\n");
+    fprintf(stderr, "  -dt LIST,  --dec-tokens LIST        [%-7s] tokens per whisper_decode() call\n", format_int_list(params.sweep_tokens).c_str());
+    fprintf(stderr, "  -dk LIST,  --dec-kv LIST            [%-7s] KV cache length after the call, at most n_text_ctx\n", format_int_list(params.sweep_kv).c_str());
     fprintf(stderr, "\n");
 }
 
@@ -66,6 +185,11 @@ static int whisper_bench_full(const whisper_params & params) {
     cparams.use_gpu    = params.use_gpu;
     cparams.flash_attn = params.flash_attn;
 
+    cparams.cpu_repack_enc = params.repack_enc;
+    cparams.cpu_repack_dec = params.repack_dec;
+
+    cparams.type_k = cparams.type_v = cparams.type_i = bench_type(params);
+
     struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
 
     {
@@ -155,6 +279,742 @@ static int whisper_bench_full(const whisper_params & params) {
     return 0;
 }
 
+// the stages of a whisper_full() run, in ms
+struct bench_run {
+    float wall_ms;
+    whisper_state_stats stats;
+};
+
+struct bench_stage {
+    const char * name;
+    float (*get)(const bench_run & run);
+};
+
+static const bench_stage k_bench_stages[] = {
+    { "wall",   [](const bench_run & r) { return r.wall_ms;         } },
+    { "mel",    [](const bench_run & r) { return r.stats.mel_ms;    } },
+    { "vad",    [](const bench_run & r) { return r.stats.vad_ms;    } },
+    { "encode", [](const bench_run & r) { return r.stats.encode_ms; } },
+    { "decode", [](const bench_run & r) { return r.stats.decode_ms; } },
+    { "batchd", [](const bench_run & r) { return r.stats.batchd_ms; } },
+    { "prompt", [](const bench_run & r) { return r.stats.prompt_ms; } },
+    { "sample", [](const bench_run & r) { return r.stats.sample_ms; } },
+    // the rest of whisper_full(): the setup of the decoders, the segments, the timestamps, ...
+    { "other",  [](const bench_run & r) {
+        const auto & s = r.stats;
+        return r.wall_ms - s.mel_ms - s.vad_ms - s.encode_ms - s.decode_ms - s.batchd_ms - s.prompt_ms - s.sample_ms;
+    } },
+};
+
+// the audio files of -f, samples/jfk.wav by default
+static bool bench_read_audio(const whisper_params & params, std::vector<std::string> & fname_inp, std::vector<std::vector<float>> & pcmf32) {
+    fname_inp = params.fname_inp;
+    if (fname_inp.empty()) {
+        fname_inp.push_back("samples/jfk.wav");
+    }
+
+    pcmf32.resize(fname_inp.size());
+    for (size_t f = 0; f < fname_inp.size(); ++f) {
+        std::vector<std::vector<float>> pcmf32s;
+        if (!::read_audio_data(fname_inp[f], pcmf32[f], pcmf32s, false)) {
+            fprintf(stderr, "error: failed to read audio file '%s'\n", fname_inp[f].c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static whisper_full_params bench_full_params(const whisper_params & params) {
+    whisper_full_params wparams = whisper_full_default_params(params.beam_size > 1 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
+
+    wparams.print_progress = false;
+    wparams.language       = params.language.c_str();
+    wparams.n_threads      = params.n_threads;
+
+    if (params.beam_size > 1) {
+        wparams.beam_search.beam_size = params.beam_size;
+    }
+
+    if (!params.vad_model.empty()) {
+        wparams.vad            = true;
+        wparams.vad_model_path = params.vad_model.c_str();
+    }
+
+    return wparams;
+}
+
+// whisper_full() over real audio, so that the mel spectrogram, VAD, logits processing, sampling, beam search and
+// temperature fallbacks are measured together with the encoder and the decoder
+static int whisper_bench_pipeline(const whisper_params & params) {
+    std::vector<std::string> fname_inp;
+    std::vector<std::vector<float>> pcmf32;
+    if (!bench_read_audio(params, fname_inp, pcmf32)) {
+        return 2;
+    }
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+
+    cparams.use_gpu    = params.use_gpu;
+    cparams.flash_attn = params.flash_attn;
+
+    cparams.cpu_repack_enc = params.repack_enc;
+    cparams.cpu_repack_dec = params.repack_dec;
+
+    cparams.type_k = cparams.type_v = cparams.type_i = bench_type(params);
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+
+    {
+        fprintf(stderr, "\n");
+        fprintf(stderr, "system_info: n_threads = %d / %d | %s\n", params.n_threads, std::thread::hardware_concurrency(), whisper_print_system_info());
+    }
+
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 2;
+    }
+
+    const whisper_full_params wparams = bench_full_params(params);
+
+    // runs[f][r] - repeat r of file f
+    std::vector<std::vector<bench_run>> runs(fname_inp.size());
+
+    for (size_t f = 0; f < fname_inp.size(); ++f) {
+        for (int r = 0; r < params.n_warmup + params.n_repeat; ++r) {
+            whisper_reset_timings(ctx);
+
+            // only the timed runs are profiled
+            if (params.n_profile > 0) {
+                whisper_profile_enable_from_state(whisper_get_state(ctx), r >= params.n_warmup);
+            }
+
+            const auto t_start = std::chrono::steady_clock::now();
+
+            if (whisper_full(ctx, wparams, pcmf32[f].data(), pcmf32[f].size()) != 0) {
+                fprintf(stderr, "error: failed to process '%s'\n", fname_inp[f].c_str());
+                whisper_free(ctx);
+                return 4;
+            }
+
+            const auto t_end = std::chrono::steady_clock::now();
+
+            if (r >= params.n_warmup) {
+                runs[f].push_back({ std::chrono::duration<float, std::milli>(t_end - t_start).count(), whisper_get_stats(ctx) });
+            }
+        }
+    }
+
+    // median and minimum of the repeats
+    auto summarize = [](std::vector<float> v, float & med, float & min) {
+        std::sort(v.begin(), v.end());
+        med = v.empty() ? 0.0f : v[v.size()/2];
+        min = v.empty() ? 0.0f : v[0];
+    };
+
+    FILE * fout = nullptr;
+    if (!params.fname_json.empty()) {
+        fout = fopen(params.fname_json.c_str(), "w");
+        if (fout == nullptr) {
+            fprintf(stderr, "error: failed to open '%s' for writing\n", params.fname_json.c_str());
+        }
+    }
+
+    if (fout) {
+        fprintf(fout, "{\n");
+        fprintf(fout, "  \"model\": \"%s\",\n", params.model.c_str());
+        fprintf(fout, "  \"system_info\": \"%s\",\n", whisper_print_system_info());
+        fprintf(fout, "  \"n_threads\": %d,\n", params.n_threads);
+        fprintf(fout, "  \"flash_attn\": %s,\n", params.flash_attn ? "true" : "false");
+        fprintf(fout, "  \"type\": \"%s\",\n", params.type.c_str());
+        fprintf(fout, "  \"beam_size\": %d,\n", params.beam_size);
+        fprintf(fout, "  \"vad\": %s,\n", wparams.vad ? "true" : "false");
+        fprintf(fout, "  \"n_warmup\": %d,\n", params.n_warmup);
+        fprintf(fout, "  \"n_repeat\": %d,\n", params.n_repeat);
+        fprintf(fout, "  \"files\": [\n");
+    }
+
+    fprintf(stderr, "\n");
+    fprintf(stderr, "%s: median (min) of %d runs after %d warm-up runs, in ms\n", __func__, params.n_repeat, params.n_warmup);
+
+    for (size_t f = 0; f < fname_inp.size(); ++f) {
+        const float audio_ms = 1000.0f*pcmf32[f].size()/WHISPER_SAMPLE_RATE;
+
+        fprintf(stderr, "\n");
+        fprintf(stderr, "%s: '%s' (%.1f sec)\n", __func__, fname_inp[f].c_str(), 1e-3f*audio_ms);
+
+        if (fout) {
+            fprintf(fout, "    {\n");
+            fprintf(fout, "      \"file\": \"%s\",\n", fname_inp[f].c_str());
+            fprintf(fout, "      \"audio_ms\": %.1f,\n", audio_ms);
+        }
+
+        float wall_med = 0.0f;
+
+        for (const auto & stage : k_bench_stages) {
+            std::vector<float> v;
+            for (const auto & run : runs[f]) {
+                v.push_back(stage.get(run));
+            }
+
+            float med, min;
+            summarize(v, med, min);
+
+            if (&stage == &k_bench_stages[0]) {
+                wall_med = med;
+            }
+
+            fprintf(stderr, "%s: %8s = %9.2f (%9.2f)\n", __func__, stage.name, med, min);
+
+            if (fout) {
+                fprintf(fout, "      \"%s_ms\": { \"median\": %.3f, \"min\": %.3f },\n", stage.name, med, min);
+            }
+        }
+
+        // the counters are the same for all the runs unless the decoding is not deterministic
+        const auto & last = runs[f].back().stats;
+
+        fprintf(stderr, "%s: %8s = %9.3f\n", __func__, "rtf", wall_med/audio_ms);
+        fprintf(stderr, "%s: runs: encode = %d, decode = %d, batchd = %d, prompt = %d, sample = %d, fallbacks = %d p / %d h\n", __func__,
+                last.n_encode, last.n_decode, last.n_batchd, last.n_prompt, last.n_sample, last.n_fail_p, last.n_fail_h);
+
+        if (fout) {
+            fprintf(fout, "      \"rtf\": %.4f,\n", wall_med/audio_ms);
+            fprintf(fout, "      \"n_encode\": %d,\n", last.n_encode);
+            fprintf(fout, "      \"n_decode\": %d,\n", last.n_decode);
+            fprintf(fout, "      \"n_batchd\": %d,\n", last.n_batchd);
+            fprintf(fout, "      \"n_prompt\": %d,\n", last.n_prompt);
+            fprintf(fout, "      \"n_sample\": %d,\n", last.n_sample);
+            fprintf(fout, "      \"n_fail_p\": %d,\n", last.n_fail_p);
+            fprintf(fout, "      \"n_fail_h\": %d\n", last.n_fail_h);
+            fprintf(fout, "    }%s\n", f + 1 < fname_inp.size() ? "," : "");
+        }
+    }
+
+    if (fout) {
+        fprintf(fout, "  ]\n");
+        fprintf(fout, "}\n");
+        fclose(fout);
+
+        fprintf(stderr, "\n");
+        fprintf(stderr, "%s: results saved to '%s'\n", __func__, params.fname_json.c_str());
+    }
+
+    if (params.n_profile > 0) {
+        whisper_profile_print_from_state(whisper_get_state(ctx), params.n_profile);
+    }
+
+    whisper_free(ctx);
+
+    return 0;
+}
+
+// peak resident memory of the process in MB, -1 if not available
+// the peak is reset when reset is true, so that each configuration of -w 4 gets its own peak (Linux only)
+static double bench_host_peak_mb(bool reset) {
+#if defined(__linux__)
+    if (reset) {
+        std::ofstream("/proc/self/clear_refs") << "5";
+    }
+
+    std::ifstream fin("/proc/self/status");
+    std::string line;
+    while (std::getline(fin, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::stod(line.substr(6))/1e3;
+        }
+    }
+#else
+    (void) reset;
+#endif
+
+    return -1.0;
+}
+
+// used memory of the GPU devices in MB, including the other processes, -1 without a GPU
+static double bench_device_used_mb() {
+    double used = -1.0;
+
+    for (size_t i = 0; i < ggml_backend_dev_count(); ++i) {
+        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+        if (ggml_backend_dev_type(dev) != GGML_BACKEND_DEVICE_TYPE_GPU) {
+            continue;
+        }
+
+        size_t free  = 0;
+        size_t total = 0;
+        ggml_backend_dev_memory(dev, &free, &total);
+
+        used = std::max(used, 0.0) + (total - free)/1e6;
+    }
+
+    return used;
+}
+
+// one configuration of -w 4
+struct bench_throughput {
+    int32_t n_states;
+    int32_t n_threads;
+    int32_t n_batch;
+
+    double wall_ms;
+    double audio_ms;
+
+    float lat_p50_ms;
+    float lat_p99_ms;
+
+    double host_peak_mb;
+    double device_peak_mb;
+};
+
+// latencies of the inputs of one whisper_full_batch_with_states() call, from the start of the call
+struct bench_batch_data {
+    std::chrono::steady_clock::time_point t_start;
+    std::vector<float> lat_ms;
+};
+
+static void bench_batch_callback(struct whisper_context * /*ctx*/, struct whisper_state * /*state*/, int i_input, int /*result*/, void * user_data) {
+    bench_batch_data * data = (bench_batch_data *) user_data;
+
+    data->lat_ms[i_input] = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - data->t_start).count();
+}
+
+// n_states workers share one context and take the next inputs of the corpus as soon as they are done, so the result
+// is the throughput of a server with that many concurrent requests. each worker owns n_batch states and processes
+// n_batch inputs per call with whisper_full_batch_with_states() when n_batch > 1
+static int whisper_bench_throughput(const whisper_params & params) {
+    std::vector<std::string> fname_inp;
+    std::vector<std::vector<float>> pcmf32;
+    if (!bench_read_audio(params, fname_inp, pcmf32)) {
+        return 2;
+    }
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+
+    cparams.use_gpu    = params.use_gpu;
+    cparams.flash_attn = params.flash_attn;
+
+    cparams.cpu_repack_enc = params.repack_enc;
+    cparams.cpu_repack_dec = params.repack_dec;
+
+    cparams.type_k = cparams.type_v = cparams.type_i = bench_type(params);
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params_no_state(params.model.c_str(), cparams);
+
+    {
+        fprintf(stderr, "\n");
+        fprintf(stderr, "system_info: %s\n", whisper_print_system_info());
+    }
+
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 2;
+    }
+
+    // the states log their buffers, once per configuration
+    whisper_log_set([](enum ggml_log_level level, const char * text, void * /*user_data*/) {
+        if (level == GGML_LOG_LEVEL_ERROR || level == GGML_LOG_LEVEL_WARN) {
+            fputs(text, stderr);
+        }
+    }, nullptr);
+
+    const whisper_full_params wparams = bench_full_params(params);
+
+    // the corpus is processed n_repeat times, the warm-up runs n_warmup inputs on each state
+    const int n_files = (int) fname_inp.size();
+    const int n_jobs  = n_files*params.n_repeat;
+
+    double audio_ms_corpus = 0.0;
+    for (const auto & pcm : pcmf32) {
+        audio_ms_corpus += 1000.0*pcm.size()/WHISPER_SAMPLE_RATE;
+    }
+
+    std::vector<bench_throughput> results;
+
+    for (const int n_states : params.sweep_states) {
+    for (const int n_threads : params.sweep_threads) {
+    for (const int n_batch : params.sweep_batch) {
+        bench_host_peak_mb(true);
+
+        std::vector<whisper_state *> states(n_states*n_batch);
+        for (auto & state : states) {
+            state = whisper_init_state(ctx);
+            if (state == nullptr) {
+                fprintf(stderr, "error: failed to initialize %d states\n", (int) states.size());
+                for (auto * s : states) {
+                    whisper_free_state(s);
+                }
+                whisper_free(ctx);
+                return 3;
+            }
+        }
+
+        whisper_full_params wparams_cur = wparams;
+        wparams_cur.n_threads = n_threads;
+
+        std::atomic<bool> failed(false);
+
+        // processes jobs [0, n) with input j % n_files, returns the latency of each job
+        auto run_jobs = [&](int n) {
+            std::vector<float> lat_ms;
+            std::mutex lat_mutex;
+
+            std::atomic<int> next(0);
+
+            std::vector<std::thread> workers;
+            for (int w = 0; w < n_states; ++w) {
+                workers.emplace_back([&, w]() {
+                    whisper_state ** wstates = states.data() + w*n_batch;
+
+                    std::vector<const float *> samples(n_batch);
+                    std::vector<int>           n_samples(n_batch);
+
+                    bench_batch_data data;
+
+                    while (!failed) {
+                        const int j0 = next.fetch_add(n_batch);
+                        if (j0 >= n) {
+                            break;
+                        }
+
+                        const int n_cur = std::min(n_batch, n - j0);
+                        for (int i = 0; i < n_cur; ++i) {
+                            samples[i]   = pcmf32[(j0 + i) % n_files].data();
+                            n_samples[i] = pcmf32[(j0 + i) % n_files].size();
+                        }
+
+                        data.t_start = std::chrono::steady_clock::now();
+                        data.lat_ms.assign(n_cur, 0.0f);
+
+                        int ret = 0;
+                        if (n_batch == 1) {
+                            ret = whisper_full_with_state(ctx, wstates[0], wparams_cur, samples[0], n_samples[0]);
+                            bench_batch_callback(ctx, wstates[0], 0, ret, &data);
+                        } else {
+                            ret = whisper_full_batch_with_states(ctx, wstates, wparams_cur, samples.data(), n_samples.data(), n_cur, bench_batch_callback, &data);
+                        }
+
+                        if (ret != 0) {
+                            failed = true;
+                            break;
+                        }
+
+                        std::lock_guard<std::mutex> lock(lat_mutex);
+                        lat_ms.insert(lat_ms.end(), data.lat_ms.begin(), data.lat_ms.end());
+                    }
+                });
+            }
+
+            for (auto & worker : workers) {
+                worker.join();
+            }
+
+            return lat_ms;
+        };
+
+        run_jobs(params.n_warmup*(int) states.size());
+
+        // the device memory is sampled while the workers run, the host peak is tracked by the kernel
+        std::atomic<bool> running(true);
+        double device_peak_mb = bench_device_used_mb();
+
+        std::thread monitor([&]() {
+            while (running) {
+                device_peak_mb = std::max(device_peak_mb, bench_device_used_mb());
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        });
+
+        const auto t_start = std::chrono::steady_clock::now();
+
+        std::vector<float> lat_ms = run_jobs(n_jobs);
+
+        const auto t_end = std::chrono::steady_clock::now();
+
+        running = false;
+        monitor.join();
+
+        for (auto * state : states) {
+            whisper_free_state(state);
+        }
+
+        if (failed) {
+            fprintf(stderr, "error: failed to process the corpus with %d states x %d threads x %d batch\n", n_states, n_threads, n_batch);
+            whisper_free(ctx);
+            return 4;
+        }
+
+        std::sort(lat_ms.begin(), lat_ms.end());
+
+        auto percentile = [&](float p) {
+            const size_t i = std::min(lat_ms.size() - 1, (size_t) std::max(0.0f, std::ceil(p*lat_ms.size()) - 1.0f));
+            return lat_ms[i];
+        };
+
+        bench_throughput res;
+
+        res.n_states       = n_states;
+        res.n_threads      = n_threads;
+        res.n_batch        = n_batch;
+        res.wall_ms        = std::chrono::duration<double, std::milli>(t_end - t_start).count();
+        res.audio_ms       = audio_ms_corpus*params.n_repeat;
+        res.lat_p50_ms     = percentile(0.50f);
+        res.lat_p99_ms     = percentile(0.99f);
+        res.host_peak_mb   = bench_host_peak_mb(false);
+        res.device_peak_mb = device_peak_mb;
+
+        if (results.empty()) {
+            fprintf(stderr, "\n");
+            fprintf(stderr, "%s: %d files, %.1f sec of audio processed %d times per configuration\n", __func__, n_files, 1e-3*audio_ms_corpus, params.n_repeat);
+            fprintf(stderr, "\n");
+            fprintf(stderr, "%6s %7s %5s | %8s %8s | %9s %9s | %9s %9s\n", "states", "threads", "batch", "rtf", "x real", "p50 ms", "p99 ms", "host MB", "device MB");
+        }
+
+        auto format_mb = [](double mb) {
+            char buf[32];
+            snprintf(buf, sizeof(buf), mb < 0.0 ? "-" : "%.1f", mb);
+            return std::string(buf);
+        };
+
+        fprintf(stderr, "%6d %7d %5d | %8.4f %8.2f | %9.1f %9.1f | %9s %9s\n",
+                res.n_states, res.n_threads, res.n_batch, res.wall_ms/res.audio_ms, res.audio_ms/res.wall_ms,
+                res.lat_p50_ms, res.lat_p99_ms, format_mb(res.host_peak_mb).c_str(), format_mb(res.device_peak_mb).c_str());
+
+        results.push_back(res);
+    }
+    }
+    }
+
+    whisper_log_set(nullptr, nullptr);
+
+    if (!params.fname_json.empty()) {
+        FILE * fout = fopen(params.fname_json.c_str(), "w");
+        if (fout == nullptr) {
+            fprintf(stderr, "error: failed to open '%s' for writing\n", params.fname_json.c_str());
+        } else {
+            fprintf(fout, "{\n");
+            fprintf(fout, "  \"model\": \"%s\",\n", params.model.c_str());
+            fprintf(fout, "  \"system_info\": \"%s\",\n", whisper_print_system_info());
+            fprintf(fout, "  \"flash_attn\": %s,\n", params.flash_attn ? "true" : "false");
+            fprintf(fout, "  \"type\": \"%s\",\n", params.type.c_str());
+            fprintf(fout, "  \"beam_size\": %d,\n", params.beam_size);
+            fprintf(fout, "  \"vad\": %s,\n", wparams.vad ? "true" : "false");
+            fprintf(fout, "  \"n_files\": %d,\n", n_files);
+            fprintf(fout, "  \"n_warmup\": %d,\n", params.n_warmup);
+            fprintf(fout, "  \"n_repeat\": %d,\n", params.n_repeat);
+            fprintf(fout, "  \"configurations\": [\n");
+
+            for (size_t i = 0; i < results.size(); ++i) {
+                const auto & res = results[i];
+
+                fprintf(fout, "    { \"n_states\": %d, \"n_threads\": %d, \"n_batch\": %d, \"wall_ms\": %.3f, \"audio_ms\": %.1f, \"rtf\": %.4f, "
+                              "\"lat_p50_ms\": %.3f, \"lat_p99_ms\": %.3f, \"host_peak_mb\": %.1f, \"device_peak_mb\": %.1f }%s\n",
+                        res.n_states, res.n_threads, res.n_batch, res.wall_ms, res.audio_ms, res.wall_ms/res.audio_ms,
+                        res.lat_p50_ms, res.lat_p99_ms, res.host_peak_mb, res.device_peak_mb, i + 1 < results.size() ? "," : "");
+            }
+
+            fprintf(fout, "  ]\n");
+            fprintf(fout, "}\n");
+            fclose(fout);
+
+            fprintf(stderr, "\n");
+            fprintf(stderr, "%s: results saved to '%s'\n", __func__, params.fname_json.c_str());
+        }
+    }
+
+    whisper_free(ctx);
+
+    return 0;
+}
+
+struct bench_decoder {
+    bool    flash_attn;
+    int32_t n_tokens;
+    int32_t n_kv;
+
+    double ms;    // median time of a call
+    double bytes; // estimate of the bytes read by a call
+};
+
+// the fastest memcpy of whisper_bench_memcpy_str(), in GB/s
+static double bench_memcpy_gbs(int n_threads) {
+    double res = 0.0;
+
+    std::stringstream ss(whisper_bench_memcpy_str(n_threads));
+    std::string line;
+    while (std::getline(ss, line)) {
+        double gbs = 0.0;
+        if (sscanf(line.c_str(), "memcpy: %lf GB/s", &gbs) == 1) {
+            res = std::max(res, gbs);
+        }
+    }
+
+    return res;
+}
+
+// times whisper_decode() for every number of tokens and KV length, with and without flash attention. the prompt of
+// n_kv - n_tokens tokens is decoded first, then the same n_tokens are decoded again after it. a decoder step reads all
+// its weights, the output projection (the token embedding), the KV cache up to n_kv and the whole cross-attention
+// cache, that estimate over the time is compared with the memory bandwidth of memcpy to see where the decoder stops
+// being bound by the memory
+static int whisper_bench_decoder(const whisper_params & params) {
+    std::vector<bench_decoder> results;
+
+    const double memcpy_gbs = bench_memcpy_gbs(params.n_threads);
+
+    for (bool flash_attn : { false, true }) {
+        struct whisper_context_params cparams = whisper_context_default_params();
+
+        cparams.use_gpu    = params.use_gpu;
+        cparams.flash_attn = flash_attn;
+
+        cparams.cpu_repack_enc = params.repack_enc;
+        cparams.cpu_repack_dec = params.repack_dec;
+
+        cparams.type_k = cparams.type_v = cparams.type_i = bench_type(params);
+
+        struct whisper_context * ctx = whisper_init_from_file_with_params_no_state(params.model.c_str(), cparams);
+        if (ctx == nullptr) {
+            fprintf(stderr, "error: failed to initialize whisper context\n");
+            return 2;
+        }
+
+        whisper_state * state = whisper_init_state(ctx);
+        if (state == nullptr) {
+            fprintf(stderr, "error: failed to initialize whisper state\n");
+            whisper_free(ctx);
+            return 2;
+        }
+
+        // the KV cache is not logged again for every configuration
+        whisper_log_set([](enum ggml_log_level level, const char * text, void * /*user_data*/) {
+            if (level == GGML_LOG_LEVEL_ERROR || level == GGML_LOG_LEVEL_WARN) {
+                fputs(text, stderr);
+            }
+        }, nullptr);
+
+        if (whisper_set_mel_with_state(ctx, state, nullptr, 0, whisper_model_n_mels(ctx)) != 0 ||
+            whisper_encode_with_state(ctx, state, 0, params.n_threads) != 0) {
+            fprintf(stderr, "error: failed to encode\n");
+            whisper_free_state(state);
+            whisper_free(ctx);
+            return 4;
+        }
+
+        const int n_text_ctx = whisper_model_n_text_ctx(ctx);
+        const int n_state    = whisper_model_n_text_state(ctx);
+        const int n_layer    = whisper_model_n_text_layer(ctx);
+
+        const ggml_type wtype = ggml_ftype_to_ggml_type((ggml_ftype) whisper_model_ftype(ctx));
+        const ggml_type ktype = bench_type(params);
+
+        const double w_elt  = (double) ggml_type_size(wtype)/ggml_blck_size(wtype);
+        const double kv_elt = (double) ggml_type_size(ktype);
+
+        // self-attention 4*n^2, query and output of the cross-attention 2*n^2 and MLP 8*n^2 per layer
+        const double bytes_weights = w_elt*((double) n_layer*14*n_state*n_state + (double) whisper_model_n_vocab(ctx)*n_state);
+        const double bytes_cross   = kv_elt*2.0*n_layer*n_state*whisper_model_n_audio_ctx(ctx);
+
+        std::vector<whisper_token> tokens(n_text_ctx, whisper_token_not(ctx));
+
+        for (int n_tokens : params.sweep_tokens) {
+        for (int n_kv     : params.sweep_kv) {
+            if (n_tokens > n_kv || n_kv > n_text_ctx) {
+                continue;
+            }
+
+            const int n_past = n_kv - n_tokens;
+
+            if (n_past > 0 && whisper_decode_with_state(ctx, state, tokens.data(), n_past, 0, params.n_threads) != 0) {
+                fprintf(stderr, "error: failed to decode\n");
+                whisper_free_state(state);
+                whisper_free(ctx);
+                return 4;
+            }
+
+            std::vector<double> ms;
+
+            for (int i = 0; i < params.n_warmup + params.n_repeat; ++i) {
+                const auto t_start = std::chrono::steady_clock::now();
+
+                if (whisper_decode_with_state(ctx, state, tokens.data(), n_tokens, n_past, params.n_threads) != 0) {
+                    fprintf(stderr, "error: failed to decode\n");
+                    whisper_free_state(state);
+                    whisper_free(ctx);
+                    return 4;
+                }
+
+                if (i >= params.n_warmup) {
+                    ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count());
+                }
+            }
+
+            std::sort(ms.begin(), ms.end());
+
+            bench_decoder res;
+
+            res.flash_attn = flash_attn;
+            res.n_tokens   = n_tokens;
+            res.n_kv       = n_kv;
+            res.ms         = ms.empty() ? 0.0 : ms[ms.size()/2];
+            res.bytes      = bytes_weights + bytes_cross + kv_elt*2.0*n_layer*n_state*n_kv;
+
+            if (results.empty()) {
+                fprintf(stderr, "\n");
+                fprintf(stderr, "%s: %s, %d threads, memcpy %.2f GB/s\n", __func__, params.model.c_str(), params.n_threads, memcpy_gbs);
+                fprintf(stderr, "\n");
+                fprintf(stderr, "%2s %6s %5s | %9s %10s | %8s %8s\n", "fa", "tokens", "kv", "ms", "tokens/s", "GB/s", "memcpy");
+            }
+
+            const double gbs = res.ms > 0.0 ? res.bytes/(res.ms*1e6) : 0.0;
+
+            fprintf(stderr, "%2d %6d %5d | %9.3f %10.1f | %8.2f %7.0f%%\n",
+                    res.flash_attn, res.n_tokens, res.n_kv, res.ms, res.ms > 0.0 ? 1e3*res.n_tokens/res.ms : 0.0,
+                    gbs, memcpy_gbs > 0.0 ? 100.0*gbs/memcpy_gbs : 0.0);
+
+            results.push_back(res);
+        }
+        }
+
+        whisper_log_set(nullptr, nullptr);
+
+        whisper_free_state(state);
+        whisper_free(ctx);
+    }
+
+    if (!params.fname_json.empty()) {
+        FILE * fout = fopen(params.fname_json.c_str(), "w");
+        if (fout == nullptr) {
+            fprintf(stderr, "error: failed to open '%s' for writing\n", params.fname_json.c_str());
+        } else {
+            fprintf(fout, "{\n");
+            fprintf(fout, "  \"model\": \"%s\",\n", params.model.c_str());
+            fprintf(fout, "  \"system_info\": \"%s\",\n", whisper_print_system_info());
+            fprintf(fout, "  \"n_threads\": %d,\n", params.n_threads);
+            fprintf(fout, "  \"type\": \"%s\",\n", params.type.c_str());
+            fprintf(fout, "  \"memcpy_gbs\": %.2f,\n", memcpy_gbs);
+            fprintf(fout, "  \"configurations\": [\n");
+
+            for (size_t i = 0; i < results.size(); ++i) {
+                const auto & res = results[i];
+
+                fprintf(fout, "    { \"flash_attn\": %s, \"n_tokens\": %d, \"n_kv\": %d, \"ms\": %.3f, \"tokens_per_s\": %.1f, \"bytes\": %.0f, \"gbs\": %.2f }%s\n",
+                        res.flash_attn ? "true" : "false", res.n_tokens, res.n_kv, res.ms, res.ms > 0.0 ? 1e3*res.n_tokens/res.ms : 0.0,
+                        res.bytes, res.ms > 0.0 ? res.bytes/(res.ms*1e6) : 0.0, i + 1 < results.size() ? "," : "");
+            }
+
+            fprintf(fout, "  ]\n");
+            fprintf(fout, "}\n");
+            fclose(fout);
+
+            fprintf(stderr, "\n");
+            fprintf(stderr, "%s: results saved to '%s'\n", __func__, params.fname_json.c_str());
+        }
+    }
+
+    return 0;
+}
+
 int main(int argc, char ** argv) {
     whisper_params params;
 
@@ -168,6 +1028,9 @@ int main(int argc, char ** argv) {
         case 0: ret = whisper_bench_full(params);                break;
         case 1: ret = whisper_bench_memcpy(params.n_threads);       break;
         case 2: ret = whisper_bench_ggml_mul_mat(params.n_threads); break;
+        case 3: ret = whisper_bench_pipeline(params);            break;
+        case 4: ret = whisper_bench_throughput(params);          break;
+        case 5: ret = whisper_bench_decoder(params);             break;
         default: fprintf(stderr, "error: unknown benchmark: %d\n", params.what); break;
     }
 
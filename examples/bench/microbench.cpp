@@ -0,0 +1,277 @@
+// micro benchmarks of the CPU helpers of whisper.cpp: FFT, mel spectrogram, logprobs, top-k sampling, DTW, tokenizer
+// and VAD segments
+//
+// the inputs are generated with fixed seeds and have the sizes of a real model (vocabulary, mel bands, 30 s windows)
+
+#include "whisper.h"
+#include "whisper-internal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// command-line parameters
+struct whisper_params {
+    int32_t min_ms = 500; // minimum run time of each benchmark
+
+    std::string model     = "models/ggml-base.en.bin";
+    std::string vad_model = "";
+    std::string filter    = "";
+};
+
+static void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
+
+static bool whisper_params_parse(int argc, char ** argv, whisper_params & params) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            whisper_print_usage(argc, argv, params);
+            exit(0);
+        }
+        else if (arg == "-m"  || arg == "--model")     { params.model     = argv[++i]; }
+        else if (arg == "-vm" || arg == "--vad-model") { params.vad_model = argv[++i]; }
+        else if (arg == "-b"  || arg == "--bench")     { params.filter    = argv[++i]; }
+        else if (arg == "-n"  || arg == "--min-ms")    { params.min_ms    = std::stoi(argv[++i]); }
+        else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            whisper_print_usage(argc, argv, params);
+            exit(0);
+        }
+    }
+
+    return true;
+}
+
+static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,        --help            [default] show this help message and exit\n");
+    fprintf(stderr, "  -m FNAME,  --model FNAME     [%-7s] model path, for the mel filters and the vocabulary\n", params.model.c_str());
+    fprintf(stderr, "  -vm FNAME, --vad-model FNAME [%-7s] VAD model path, the VAD benchmark is skipped without it\n", params.vad_model.c_str());
+    fprintf(stderr, "  -b NAME,   --bench NAME      [%-7s] run only the benchmarks whose name contains NAME\n", params.filter.c_str());
+    fprintf(stderr, "  -n N,      --min-ms N        [%-7d] minimum run time of each benchmark in ms\n", params.min_ms);
+    fprintf(stderr, "\n");
+}
+
+// time stamp counter - reference cycles, which can differ from the core cycles with frequency scaling
+static uint64_t bench_cycles() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// runs op once to warm up, then repeatedly for at least min_ms, and prints the time per call and per element
+static void bench_run(const whisper_params & params, const char * name, const char * size, int64_t n_elements, const std::function<void()> & op) {
+    if (!params.filter.empty() && strstr(name, params.filter.c_str()) == nullptr) {
+        return;
+    }
+
+    op();
+
+    int64_t n_ops = 0;
+
+    const auto     t_start = std::chrono::steady_clock::now();
+    const uint64_t c_start = bench_cycles();
+
+    double t_ns = 0.0;
+    while (t_ns < 1e6*params.min_ms || n_ops == 0) {
+        op();
+        n_ops++;
+        t_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t_start).count();
+    }
+
+    const uint64_t c_end = bench_cycles();
+
+    const double ns_op  = t_ns/n_ops;
+    const double ns_el  = ns_op/n_elements;
+    const double cyc_el = double(c_end - c_start)/n_ops/n_elements;
+
+    if (c_end > c_start) {
+        printf("%-12s %-22s %14.1f %12.3f %12.3f %10lld\n", name, size, ns_op, ns_el, cyc_el, (long long) n_ops);
+    } else {
+        printf("%-12s %-22s %14.1f %12.3f %12s %10lld\n", name, size, ns_op, ns_el, "n/a", (long long) n_ops);
+    }
+    fflush(stdout);
+}
+
+static void cb_log_disable(enum ggml_log_level , const char * , void * ) { }
+
+int main(int argc, char ** argv) {
+    whisper_params params;
+
+    if (whisper_params_parse(argc, argv, params) == false) {
+        return 1;
+    }
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params_no_state(params.model.c_str(), whisper_context_default_params());
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 2;
+    }
+
+    struct whisper_vad_context * vctx = nullptr;
+    if (!params.vad_model.empty()) {
+        vctx = whisper_vad_init_from_file_with_params(params.vad_model.c_str(), whisper_vad_default_context_params());
+        if (vctx == nullptr) {
+            fprintf(stderr, "error: failed to initialize VAD context\n");
+            whisper_free(ctx);
+            return 2;
+        }
+    }
+
+    // the helpers log on every call
+    whisper_log_set(cb_log_disable, nullptr);
+
+    const int n_vocab = whisper_n_vocab(ctx);
+
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> dist_normal(0.0f, 1.0f);
+
+    printf("\n");
+    printf("%-12s %-22s %14s %12s %12s %10s\n", "bench", "size", "ns/op", "ns/elem", "cycles/elem", "runs");
+
+    // FFT of one STFT frame
+    {
+        std::vector<float> in(WHISPER_N_FFT);
+        std::vector<float> out(2*(WHISPER_N_FFT/2 + 1));
+        for (auto & v : in) {
+            v = dist_normal(rng);
+        }
+
+        bench_run(params, "fft", std::to_string(WHISPER_N_FFT).c_str(), WHISPER_N_FFT, [&]() {
+            whisper_internal_fft(in.data(), out.data());
+        });
+    }
+
+    // mel spectrogram of a 30 s window on one thread
+    {
+        const int n_samples = 30*WHISPER_SAMPLE_RATE;
+        const int n_len     = n_samples/WHISPER_HOP_LENGTH;
+
+        std::vector<float> pcm(n_samples);
+        for (auto & v : pcm) {
+            v = 0.1f*dist_normal(rng);
+        }
+
+        std::vector<float> mel;
+        const int n_mel = whisper_internal_log_mel_frames(ctx, pcm.data(), n_samples, n_len, mel);
+
+        bench_run(params, "mel", (std::to_string(n_mel) + " x " + std::to_string(n_len)).c_str(), n_len, [&]() {
+            whisper_internal_log_mel_frames(ctx, pcm.data(), n_samples, n_len, mel);
+        });
+    }
+
+    // logits of one decoder - the timestamp tokens are suppressed as in the first steps of a segment
+    std::vector<float> logits(n_vocab);
+    std::vector<float> logprobs(n_vocab);
+    std::vector<float> probs(n_vocab);
+    {
+        for (auto & v : logits) {
+            v = 4.0f*dist_normal(rng);
+        }
+        for (int i = whisper_token_beg(ctx) + 1; i < n_vocab; ++i) {
+            logits[i] = -INFINITY;
+        }
+
+        bench_run(params, "logprobs", std::to_string(n_vocab).c_str(), n_vocab, [&]() {
+            whisper_internal_compute_logprobs(logits.data(), n_vocab, logprobs.data(), probs.data());
+        });
+    }
+
+    // beam search candidates
+    {
+        const int k = 5;
+
+        whisper_internal_compute_logprobs(logits.data(), n_vocab, logprobs.data(), probs.data());
+
+        std::vector<whisper_token_data> result;
+
+        bench_run(params, "topk", (std::to_string(n_vocab) + ", k = " + std::to_string(k)).c_str(), n_vocab, [&]() {
+            whisper_internal_sample_token_topk(ctx, probs, logprobs, k, 1234, result);
+        });
+    }
+
+    // DTW of the tokens of a 30 s window
+    {
+        const int n_tokens = 128;
+        const int n_frames = 1500;
+
+        std::vector<float> cost((size_t) n_tokens*n_frames);
+        for (auto & v : cost) {
+            v = dist_normal(rng);
+        }
+
+        std::vector<int32_t> path;
+
+        bench_run(params, "dtw", (std::to_string(n_tokens) + " x " + std::to_string(n_frames)).c_str(), (int64_t) n_tokens*n_frames, [&]() {
+            whisper_internal_dtw(cost.data(), n_tokens, n_frames, path);
+        });
+    }
+
+    // tokenizer
+    {
+        std::string text;
+        while (text.size() < 4096) {
+            text += " And so my fellow Americans, ask not what your country can do for you, ask what you can do for your country.";
+        }
+
+        std::vector<whisper_token> tokens(text.size());
+
+        bench_run(params, "tokenize", (std::to_string(text.size()) + " chars").c_str(), text.size(), [&]() {
+            whisper_tokenize(ctx, text.c_str(), tokens.data(), tokens.size());
+        });
+    }
+
+    // VAD segments of 10 minutes of speech probabilities - runs of speech and silence of 0.5 to 10 s
+    if (vctx) {
+        const int n_samples = 600*WHISPER_SAMPLE_RATE;
+
+        std::vector<float> pcm(n_samples, 0.0f);
+        whisper_vad_detect_speech(vctx, pcm.data(), n_samples);
+
+        const int n_probs = whisper_vad_n_probs(vctx);
+        float   * vprobs  = whisper_vad_probs(vctx);
+
+        std::uniform_int_distribution<int> dist_run(16, 312);
+        std::uniform_real_distribution<float> dist_p(0.0f, 0.4f);
+
+        bool speech = false;
+        for (int i = 0; i < n_probs; ) {
+            const int n = std::min(n_probs - i, dist_run(rng));
+            for (int j = 0; j < n; ++j) {
+                vprobs[i + j] = speech ? 1.0f - dist_p(rng) : dist_p(rng);
+            }
+            i += n;
+            speech = !speech;
+        }
+
+        const whisper_vad_params vparams = whisper_vad_default_params();
+
+        bench_run(params, "vad_segments", std::to_string(n_probs).c_str(), n_probs, [&]() {
+            whisper_vad_free_segments(whisper_vad_segments_from_probs(vctx, vparams));
+        });
+
+        whisper_vad_free(vctx);
+    }
+
+    whisper_free(ctx);
+
+    return 0;
+}
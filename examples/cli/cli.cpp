@@ -4,9 +4,14 @@
 #include "whisper.h"
 #include "grammar-parser.h"
 
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <cstdio>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -18,6 +23,13 @@
 #define NOMINMAX
 #endif
 #include <windows.h>
+#else
+#include <csignal>
+#include <cerrno>
+#include <climits>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #endif
 
 // helper function to replace substrings
@@ -33,7 +45,14 @@ static void replace_all(std::string & s, const std::string & search, const std::
 // command-line parameters
 struct whisper_params {
     int32_t n_threads     = std::min(4, (int32_t) std::thread::hardware_concurrency());
+    int32_t n_threads_dec = 0;
     int32_t n_processors  = 1;
+    int32_t n_parallel_files = 1;
+    int32_t n_io_threads     = 2;
+    int32_t split_search_ms  = whisper_full_default_params(WHISPER_SAMPLING_GREEDY).split_search_ms;
+    int32_t split_overlap_ms = whisper_full_default_params(WHISPER_SAMPLING_GREEDY).split_overlap_ms;
+    int32_t split_chunk_ms   = whisper_full_default_params(WHISPER_SAMPLING_GREEDY).split_chunk_ms;
+    int32_t n_chunked        = 0;
     int32_t offset_t_ms   = 0;
     int32_t offset_n      = 0;
     int32_t duration_ms   = 0;
@@ -43,22 +62,38 @@ struct whisper_params {
     int32_t best_of       = whisper_full_default_params(WHISPER_SAMPLING_GREEDY).greedy.best_of;
     int32_t beam_size     = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH).beam_search.beam_size;
     int32_t audio_ctx     = 0;
+    int32_t mel_lazy_ms   = 0;
+    int32_t gpu_device       = 0;
+    int32_t gpu_device_dec   = -1;
+    int32_t n_gpu_layers_enc = -1;
+    int32_t n_gpu_layers_dec = -1;
+    int32_t dec_layers       = 0;
 
     float word_thold      =  0.01f;
     float entropy_thold   =  2.40f;
     float logprob_thold   = -1.00f;
     float no_speech_thold =  0.6f;
+    int32_t repeat_max    =  0;
+    float no_speech_skip_thold = 1.0f;
+    float silence_thold   =  0.0f;
     float grammar_penalty = 100.0f;
     float temperature     = 0.0f;
     float temperature_inc = 0.2f;
 
     bool debug_mode      = false;
     bool translate       = false;
+    bool translate_also  = false;
     bool detect_language = false;
+    int32_t lang_detect_n_windows = 1;
     bool diarize         = false;
     bool tinydiarize     = false;
+    bool multichannel    = false; // transcribe each channel on its own, see whisper_full_multichannel_with_state()
+    bool multichannel_seq = false;
     bool split_on_word   = false;
+    bool audio_ctx_auto  = false;
     bool no_fallback     = false;
+    bool fallback_par    = false;
+    bool callback_async  = false;
     bool output_txt      = false;
     bool output_vtt      = false;
     bool output_srt      = false;
@@ -72,9 +107,17 @@ struct whisper_params {
     bool print_colors    = false;
     bool print_progress  = false;
     bool no_timestamps   = false;
+    bool restrict_vocab  = false;
     bool log_score       = false;
     bool use_gpu         = true;
     bool flash_attn      = false;
+    bool fuse_qkv        = false;
+    bool use_mmap        = true;
+    bool huge_pages      = false;
+    bool repack_enc      = true;
+    bool repack_dec      = true;
+    bool share_compute   = false;
+    bool mel_gpu         = false;
     bool suppress_nst    = false;
 
     std::string language  = "en";
@@ -92,11 +135,55 @@ struct whisper_params {
 
     std::string openvino_encode_device = "CPU";
 
+    // pick n_threads and flash_attn with whisper_autotune(), the result is cached in this file ("-" = no cache)
+    std::string autotune = "";
+
+    // persistent CPU threadpool of each state, see whisper_state_set_threadpool()
+    bool        threadpool      = false;
+    std::string threadpool_cpus = "";
+    bool        threadpool_perf = false;
+
+    // NUMA strategy and node of the weights and of the threadpools, see whisper_context_params::numa
+    std::string numa      = "";
+    int32_t     numa_node = -1;
+
+    // types of the KV caches, see whisper_context_params::type_k
+    std::string cache_type_k = "f16";
+    std::string cache_type_v = "f16";
+
+    // intermediate type of the encoder attention, see whisper_context_params::type_i
+    std::string itype = "f16";
+
     std::string dtw = "";
 
+    // see whisper_context_params::repack_cache
+    std::string repack_cache = "";
+
+    // see whisper_context_params::rpc_servers
+    std::string rpc_servers = "";
+
     std::vector<std::string> fname_inp = {};
     std::vector<std::string> fname_out = {};
 
+    std::string capture = ""; // see whisper_full_params::capture_path
+
+    std::string encoder_cache = ""; // see whisper_full_params::encoder_cache_path
+
+    // keep the model loaded and transcribe the requests of the clients on this Unix socket
+    std::string daemon  = "";
+    // send the arguments to the daemon on this Unix socket instead of loading the model
+    std::string connect = "";
+
+    // transcribe the low confidence segments again with this model, see whisper_full_cascade_with_state()
+    std::string cascade_model           = "";
+    float       cascade_logprob_thold   = whisper_cascade_default_params().logprob_thold;
+    float       cascade_token_p_thold   = whisper_cascade_default_params().token_p_thold;
+    float       cascade_no_speech_thold = whisper_cascade_default_params().no_speech_thold;
+    int32_t     cascade_merge_ms        = whisper_cascade_default_params().merge_ms;
+
+    // LoRA adapters of the decoder and their scales, see whisper_adapter_lora_init()
+    std::vector<std::pair<std::string, float>> lora;
+
     grammar_parser::parse_state grammar_parsed;
 
     // Voice Activity Detection (VAD) parameters
@@ -108,6 +195,7 @@ struct whisper_params {
     float       vad_max_speech_duration_s = FLT_MAX;
     int         vad_speech_pad_ms = 30;
     float       vad_samples_overlap = 0.1f;
+    int         vad_chunk_ms = 0;
 };
 
 static void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
@@ -145,7 +233,14 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         }
         #define ARGV_NEXT (((i + 1) < argc) ? argv[++i] : requires_value_error(arg))
         else if (arg == "-t"    || arg == "--threads")         { params.n_threads       = std::stoi(ARGV_NEXT); }
+        else if (arg == "-td"   || arg == "--threads-dec")     { params.n_threads_dec   = std::stoi(ARGV_NEXT); }
         else if (arg == "-p"    || arg == "--processors")      { params.n_processors    = std::stoi(ARGV_NEXT); }
+        else if (arg == "-pf"   || arg == "--parallel-files")  { params.n_parallel_files = std::stoi(ARGV_NEXT); }
+        else if (arg == "-pio"  || arg == "--io-threads")      { params.n_io_threads     = std::stoi(ARGV_NEXT); }
+        else if (arg == "-pss"  || arg == "--split-search-ms") { params.split_search_ms  = std::stoi(ARGV_NEXT); }
+        else if (arg == "-pso"  || arg == "--split-overlap-ms"){ params.split_overlap_ms = std::stoi(ARGV_NEXT); }
+        else if (arg == "-psc"  || arg == "--split-chunk-ms")  { params.split_chunk_ms   = std::stoi(ARGV_NEXT); }
+        else if (arg == "-ck"   || arg == "--chunked")         { params.n_chunked        = std::stoi(ARGV_NEXT); }
         else if (arg == "-ot"   || arg == "--offset-t")        { params.offset_t_ms     = std::stoi(ARGV_NEXT); }
         else if (arg == "-on"   || arg == "--offset-n")        { params.offset_n        = std::stoi(ARGV_NEXT); }
         else if (arg == "-d"    || arg == "--duration")        { params.duration_ms     = std::stoi(ARGV_NEXT); }
@@ -154,18 +249,28 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-bo"   || arg == "--best-of")         { params.best_of         = std::stoi(ARGV_NEXT); }
         else if (arg == "-bs"   || arg == "--beam-size")       { params.beam_size       = std::stoi(ARGV_NEXT); }
         else if (arg == "-ac"   || arg == "--audio-ctx")       { params.audio_ctx       = std::stoi(ARGV_NEXT); }
+        else if (arg == "-aca"  || arg == "--audio-ctx-auto")  { params.audio_ctx_auto  = true; }
         else if (arg == "-wt"   || arg == "--word-thold")      { params.word_thold      = std::stof(ARGV_NEXT); }
         else if (arg == "-et"   || arg == "--entropy-thold")   { params.entropy_thold   = std::stof(ARGV_NEXT); }
+        else if (arg == "-rm"   || arg == "--repeat-max")      { params.repeat_max      = std::stoi(ARGV_NEXT); }
         else if (arg == "-lpt"  || arg == "--logprob-thold")   { params.logprob_thold   = std::stof(ARGV_NEXT); }
         else if (arg == "-nth"  || arg == "--no-speech-thold") { params.no_speech_thold = std::stof(ARGV_NEXT); }
+        else if (arg == "-nst"  || arg == "--no-speech-skip-thold") { params.no_speech_skip_thold = std::stof(ARGV_NEXT); }
+        else if (arg == "-st"   || arg == "--silence-thold")   { params.silence_thold   = std::stof(ARGV_NEXT); }
+        else if (arg == "-mlz"  || arg == "--mel-lazy-ms")     { params.mel_lazy_ms     = std::stoi(ARGV_NEXT); }
         else if (arg == "-tp"   || arg == "--temperature")     { params.temperature     = std::stof(ARGV_NEXT); }
         else if (arg == "-tpi"  || arg == "--temperature-inc") { params.temperature_inc = std::stof(ARGV_NEXT); }
         else if (arg == "-debug"|| arg == "--debug-mode")      { params.debug_mode      = true; }
         else if (arg == "-tr"   || arg == "--translate")       { params.translate       = true; }
+        else if (arg == "-tra"  || arg == "--translate-also")  { params.translate_also  = true; }
         else if (arg == "-di"   || arg == "--diarize")         { params.diarize         = true; }
         else if (arg == "-tdrz" || arg == "--tinydiarize")     { params.tinydiarize     = true; }
+        else if (arg == "-mch"  || arg == "--multichannel")    { params.multichannel    = true; }
+        else if (                  arg == "--multichannel-sequential") { params.multichannel = true; params.multichannel_seq = true; }
         else if (arg == "-sow"  || arg == "--split-on-word")   { params.split_on_word   = true; }
         else if (arg == "-nf"   || arg == "--no-fallback")     { params.no_fallback     = true; }
+        else if (arg == "-fbp"  || arg == "--fallback-parallel") { params.fallback_par  = true; }
+        else if (arg == "-cba"  || arg == "--callback-async")  { params.callback_async  = true; }
         else if (arg == "-otxt" || arg == "--output-txt")      { params.output_txt      = true; }
         else if (arg == "-ovtt" || arg == "--output-vtt")      { params.output_vtt      = true; }
         else if (arg == "-osrt" || arg == "--output-srt")      { params.output_srt      = true; }
@@ -181,8 +286,10 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-pc"   || arg == "--print-colors")    { params.print_colors    = true; }
         else if (arg == "-pp"   || arg == "--print-progress")  { params.print_progress  = true; }
         else if (arg == "-nt"   || arg == "--no-timestamps")   { params.no_timestamps   = true; }
+        else if (arg == "-rv"   || arg == "--restrict-vocab")  { params.restrict_vocab  = true; }
         else if (arg == "-l"    || arg == "--language")        { params.language        = whisper_param_turn_lowercase(ARGV_NEXT); }
         else if (arg == "-dl"   || arg == "--detect-language") { params.detect_language = true; }
+        else if (arg == "-dlw"  || arg == "--detect-windows")  { params.lang_detect_n_windows = std::stoi(ARGV_NEXT); }
         else if (                  arg == "--prompt")          { params.prompt          = ARGV_NEXT; }
         else if (arg == "-m"    || arg == "--model")           { params.model           = ARGV_NEXT; }
         else if (arg == "-f"    || arg == "--file")            { params.fname_inp.emplace_back(ARGV_NEXT); }
@@ -191,11 +298,53 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-ls"   || arg == "--log-score")       { params.log_score       = true; }
         else if (arg == "-ng"   || arg == "--no-gpu")          { params.use_gpu         = false; }
         else if (arg == "-fa"   || arg == "--flash-attn")      { params.flash_attn      = true; }
+        else if (arg == "-fqkv" || arg == "--fuse-qkv")        { params.fuse_qkv        = true; }
+        else if (arg == "-at"   || arg == "--autotune")        { params.autotune        = ARGV_NEXT; }
+        else if (arg == "-thp"  || arg == "--threadpool")      { params.threadpool      = true; }
+        else if (arg == "-thpc" || arg == "--threadpool-cpus") { params.threadpool      = true; params.threadpool_cpus = ARGV_NEXT; }
+        else if (arg == "-thpp" || arg == "--threadpool-perf") { params.threadpool      = true; params.threadpool_perf = true; }
+        else if (                  arg == "--numa")            { params.numa            = ARGV_NEXT; }
+        else if (                  arg == "--numa-node")       { params.numa_node       = std::stoi(ARGV_NEXT); params.threadpool = true; }
+        else if (arg == "-ctk"  || arg == "--cache-type-k")    { params.cache_type_k    = ARGV_NEXT; }
+        else if (arg == "-ctv"  || arg == "--cache-type-v")    { params.cache_type_v    = ARGV_NEXT; }
+        else if (arg == "-it"   || arg == "--itype")           { params.itype           = ARGV_NEXT; }
+        else if (arg == "-nmm"  || arg == "--no-mmap")         { params.use_mmap        = false; }
+        else if (                  arg == "--huge-pages")      { params.huge_pages      = true; }
+        else if (arg == "-nrp"  || arg == "--no-repack")       {
+            const std::string phase = ARGV_NEXT;
+            if (phase != "enc" && phase != "dec" && phase != "all") {
+                fprintf(stderr, "error: unknown phase '%s', use enc, dec or all\n", phase.c_str());
+                whisper_print_usage(argc, argv, params);
+                exit(0);
+            }
+            params.repack_enc = params.repack_enc && phase == "dec";
+            params.repack_dec = params.repack_dec && phase == "enc";
+        }
+        else if (                  arg == "--share-compute")   { params.share_compute   = true; }
+        else if (arg == "-ndl"  || arg == "--dec-layers")      { params.dec_layers      = std::stoi(ARGV_NEXT); }
+        else if (                  arg == "--mel-gpu")         { params.mel_gpu         = true; }
+        else if (                  arg == "--repack-cache")    { params.repack_cache    = ARGV_NEXT; }
+        else if (arg == "-dev"  || arg == "--device")          { params.gpu_device      = std::stoi(ARGV_NEXT); }
+        else if (arg == "-devd" || arg == "--device-dec")      { params.gpu_device_dec  = std::stoi(ARGV_NEXT); }
+        else if (arg == "-ngle" || arg == "--gpu-layers-enc")  { params.n_gpu_layers_enc = std::stoi(ARGV_NEXT); }
+        else if (arg == "-ngld" || arg == "--gpu-layers-dec")  { params.n_gpu_layers_dec = std::stoi(ARGV_NEXT); }
+        else if (                  arg == "--rpc")             { params.rpc_servers     = ARGV_NEXT; }
         else if (arg == "-sns"  || arg == "--suppress-nst")    { params.suppress_nst    = true; }
         else if (                  arg == "--suppress-regex")  { params.suppress_regex  = ARGV_NEXT; }
         else if (                  arg == "--grammar")         { params.grammar         = ARGV_NEXT; }
         else if (                  arg == "--grammar-rule")    { params.grammar_rule    = ARGV_NEXT; }
         else if (                  arg == "--grammar-penalty") { params.grammar_penalty = std::stof(ARGV_NEXT); }
+        else if (                  arg == "--capture")         { params.capture         = ARGV_NEXT; }
+        else if (                  arg == "--encoder-cache")   { params.encoder_cache   = ARGV_NEXT; }
+        else if (                  arg == "--daemon")          { params.daemon          = ARGV_NEXT; }
+        else if (                  arg == "--connect")         { params.connect         = ARGV_NEXT; }
+        else if (arg == "-cm"   || arg == "--cascade-model")           { params.cascade_model           = ARGV_NEXT; }
+        else if (                  arg == "--cascade-logprob-thold")   { params.cascade_logprob_thold   = std::stof(ARGV_NEXT); }
+        else if (                  arg == "--cascade-token-p-thold")   { params.cascade_token_p_thold   = std::stof(ARGV_NEXT); }
+        else if (                  arg == "--cascade-no-speech-thold") { params.cascade_no_speech_thold = std::stof(ARGV_NEXT); }
+        else if (                  arg == "--cascade-merge-ms")        { params.cascade_merge_ms        = std::stoi(ARGV_NEXT); }
+        else if (                  arg == "--lora")                    { params.lora.emplace_back(ARGV_NEXT, 1.0f); }
+        else if (                  arg == "--lora-scaled")             { const std::string fname = ARGV_NEXT; params.lora.emplace_back(fname, std::stof(ARGV_NEXT)); }
         // Voice Activity Detection (VAD)
         else if (arg == "-v"    || arg == "--vad")                         { params.vad                         = true; }
         else if (arg == "-vm"   || arg == "--vad-model")                   { params.vad_model                   = ARGV_NEXT; }
@@ -205,6 +354,7 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-vmsd" || arg == "--vad-max-speech-duration-s")   { params.vad_max_speech_duration_s   = std::stof(ARGV_NEXT); }
         else if (arg == "-vp"   || arg == "--vad-speech-pad-ms")           { params.vad_speech_pad_ms           = std::stoi(ARGV_NEXT); }
         else if (arg == "-vo"   || arg == "--vad-samples-overlap")         { params.vad_samples_overlap         = std::stof(ARGV_NEXT); }
+        else if (arg == "-vcm"  || arg == "--vad-chunk-ms")                { params.vad_chunk_ms                = std::stoi(ARGV_NEXT); }
         else {
             fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
             whisper_print_usage(argc, argv, params);
@@ -223,7 +373,14 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
     fprintf(stderr, "options:\n");
     fprintf(stderr, "  -h,        --help              [default] show this help message and exit\n");
     fprintf(stderr, "  -t N,      --threads N         [%-7d] number of threads to use during computation\n",    params.n_threads);
+    fprintf(stderr, "  -td N,     --threads-dec N     [%-7d] number of threads of the decoder (0 - same as -t)\n", params.n_threads_dec);
     fprintf(stderr, "  -p N,      --processors N      [%-7d] number of processors to use during computation\n", params.n_processors);
+    fprintf(stderr, "  -pf N,     --parallel-files N  [%-7d] number of input files to transcribe at the same time, each with -t threads\n", params.n_parallel_files);
+    fprintf(stderr, "  -pio N,    --io-threads N      [%-7d] number of threads decoding the input files ahead with -pf\n", params.n_io_threads);
+    fprintf(stderr, "  -pss N,    --split-search-ms N [%-7d] search window around the chunk splits for a pause (ms)\n", params.split_search_ms);
+    fprintf(stderr, "  -pso N,    --split-overlap-ms N [%-7d] audio overlap between the parallel chunks (ms)\n", params.split_overlap_ms);
+    fprintf(stderr, "  -psc N,    --split-chunk-ms N  [%-7d] length of the jobs shared by the processors, 0 - one per processor (ms)\n", params.split_chunk_ms);
+    fprintf(stderr, "  -ck N,     --chunked N         [%-7d] transcribe independent 30 s windows, N at a time, 0 - off\n", params.n_chunked);
     fprintf(stderr, "  -ot N,     --offset-t N        [%-7d] time offset in milliseconds\n",                    params.offset_t_ms);
     fprintf(stderr, "  -on N,     --offset-n N        [%-7d] segment index offset\n",                           params.offset_n);
     fprintf(stderr, "  -d  N,     --duration N        [%-7d] duration of audio to process in milliseconds\n",   params.duration_ms);
@@ -233,17 +390,27 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
     fprintf(stderr, "  -bo N,     --best-of N         [%-7d] number of best candidates to keep\n",              params.best_of);
     fprintf(stderr, "  -bs N,     --beam-size N       [%-7d] beam size for beam search\n",                      params.beam_size);
     fprintf(stderr, "  -ac N,     --audio-ctx N       [%-7d] audio context size (0 - all)\n",                   params.audio_ctx);
+    fprintf(stderr, "  -aca,      --audio-ctx-auto    [%-7s] reduce the audio context size for short inputs\n", params.audio_ctx_auto ? "true" : "false");
     fprintf(stderr, "  -wt N,     --word-thold N      [%-7.2f] word timestamp probability threshold\n",         params.word_thold);
     fprintf(stderr, "  -et N,     --entropy-thold N   [%-7.2f] entropy threshold for decoder fail\n",           params.entropy_thold);
+    fprintf(stderr, "  -rm N,     --repeat-max N      [%-7d] decoder fail after more than N repetitions (0 - off)\n", params.repeat_max);
     fprintf(stderr, "  -lpt N,    --logprob-thold N   [%-7.2f] log probability threshold for decoder fail\n",   params.logprob_thold);
     fprintf(stderr, "  -nth N,    --no-speech-thold N [%-7.2f] no speech threshold\n",                          params.no_speech_thold);
+    fprintf(stderr, "  -nst N,    --no-speech-skip-thold N [%-7.2f] skip the decoding above this no speech probability\n", params.no_speech_skip_thold);
+    fprintf(stderr, "  -st N,     --silence-thold N   [%-7.2f] skip the windows N dB below the loudest part (0 - off)\n", params.silence_thold);
+    fprintf(stderr, "  -mlz N,    --mel-lazy-ms N     [%-7d] compute the mel spectrogram in chunks of N ms ahead of the windows (0 - off)\n", params.mel_lazy_ms);
     fprintf(stderr, "  -tp,       --temperature N     [%-7.2f] The sampling temperature, between 0 and 1\n",    params.temperature);
     fprintf(stderr, "  -tpi,      --temperature-inc N [%-7.2f] The increment of temperature, between 0 and 1\n",params.temperature_inc);
     fprintf(stderr, "  -debug,    --debug-mode        [%-7s] enable debug mode (eg. dump log_mel)\n",           params.debug_mode ? "true" : "false");
     fprintf(stderr, "  -tr,       --translate         [%-7s] translate from source language to english\n",      params.translate ? "true" : "false");
+    fprintf(stderr, "  -tra,      --translate-also    [%-7s] also print the english translation, encoding the audio once\n", params.translate_also ? "true" : "false");
     fprintf(stderr, "  -di,       --diarize           [%-7s] stereo audio diarization\n",                       params.diarize ? "true" : "false");
     fprintf(stderr, "  -tdrz,     --tinydiarize       [%-7s] enable tinydiarize (requires a tdrz model)\n",     params.tinydiarize ? "true" : "false");
+    fprintf(stderr, "  -mch,      --multichannel      [%-7s] transcribe each channel of stereo audio as a speaker\n", params.multichannel ? "true" : "false");
+    fprintf(stderr, "  --multichannel-sequential      [%-7s] ... and list the segments channel by channel\n",  params.multichannel_seq ? "true" : "false");
     fprintf(stderr, "  -nf,       --no-fallback       [%-7s] do not use temperature fallback while decoding\n", params.no_fallback ? "true" : "false");
+    fprintf(stderr, "  -fbp,      --fallback-parallel [%-7s] decode the first fallback temperature together with the first one\n", params.fallback_par ? "true" : "false");
+    fprintf(stderr, "  -cba,      --callback-async    [%-7s] print the segments and the progress from a separate thread\n", params.callback_async ? "true" : "false");
     fprintf(stderr, "  -otxt,     --output-txt        [%-7s] output result in a text file\n",                   params.output_txt ? "true" : "false");
     fprintf(stderr, "  -ovtt,     --output-vtt        [%-7s] output result in a vtt file\n",                    params.output_vtt ? "true" : "false");
     fprintf(stderr, "  -osrt,     --output-srt        [%-7s] output result in a srt file\n",                    params.output_srt ? "true" : "false");
@@ -259,8 +426,10 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
     fprintf(stderr, "  -pc,       --print-colors      [%-7s] print colors\n",                                   params.print_colors ? "true" : "false");
     fprintf(stderr, "  -pp,       --print-progress    [%-7s] print progress\n",                                 params.print_progress ? "true" : "false");
     fprintf(stderr, "  -nt,       --no-timestamps     [%-7s] do not print timestamps\n",                        params.no_timestamps ? "true" : "false");
+    fprintf(stderr, "  -rv,       --restrict-vocab    [%-7s] with -nt, compute only the logits of the text tokens\n", params.restrict_vocab ? "true" : "false");
     fprintf(stderr, "  -l LANG,   --language LANG     [%-7s] spoken language ('auto' for auto-detect)\n",       params.language.c_str());
     fprintf(stderr, "  -dl,       --detect-language   [%-7s] exit after automatically detecting language\n",    params.detect_language ? "true" : "false");
+    fprintf(stderr, "  -dlw N,    --detect-windows N  [%-7d] detect the language from up to N windows of the audio\n", params.lang_detect_n_windows);
     fprintf(stderr, "             --prompt PROMPT     [%-7s] initial prompt (max n_text_ctx/2 tokens)\n",       params.prompt.c_str());
     fprintf(stderr, "  -m FNAME,  --model FNAME       [%-7s] model path\n",                                     params.model.c_str());
     fprintf(stderr, "  -f FNAME,  --file FNAME        [%-7s] input audio file path\n",                            "");
@@ -269,11 +438,44 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
     fprintf(stderr, "  -ls,       --log-score         [%-7s] log best decoder scores of tokens\n",              params.log_score?"true":"false");
     fprintf(stderr, "  -ng,       --no-gpu            [%-7s] disable GPU\n",                                    params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,       --flash-attn        [%-7s] flash attention\n",                                params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -fqkv,     --fuse-qkv          [%-7s] fuse the self-attention Q, K, V projections\n",    params.fuse_qkv ? "true" : "false");
+    fprintf(stderr, "  -at FNAME, --autotune FNAME    [%-7s] tune -t and -fa at startup, cached in FNAME (- = no cache)\n", params.autotune.c_str());
+    fprintf(stderr, "  -thp,      --threadpool        [%-7s] keep the CPU threads of each state between the graphs\n", params.threadpool ? "true" : "false");
+    fprintf(stderr, "  -thpc LIST, --threadpool-cpus LIST [%-7s] pin the threadpool to these cores, e.g. 0-7,16-23\n", params.threadpool_cpus.c_str());
+    fprintf(stderr, "  -thpp,     --threadpool-perf   [%-7s] pin the threadpool to the performance cores (big.LITTLE, hybrid CPUs)\n", params.threadpool_perf ? "true" : "false");
+    fprintf(stderr, "  --numa TYPE                    [%-7s] NUMA strategy: distribute, isolate or numactl\n", params.numa.c_str());
+    fprintf(stderr, "  --numa-node N                  [%-7d] keep the weights, the KV caches and the threads on NUMA node N\n", params.numa_node);
+    fprintf(stderr, "  -ctk TYPE, --cache-type-k TYPE [%-7s] KV cache type of K: f16, bf16, f32, q8_0, q5_0, q5_1, q4_0, q4_1, iq4_nl (quantized with -fa)\n", params.cache_type_k.c_str());
+    fprintf(stderr, "  -ctv TYPE, --cache-type-v TYPE [%-7s] KV cache type of V\n", params.cache_type_v.c_str());
+    fprintf(stderr, "  -it TYPE,  --itype TYPE        [%-7s] intermediate type of the encoder attention: f16, bf16, f32\n", params.itype.c_str());
+    fprintf(stderr, "  -nmm,      --no-mmap           [%-7s] do not memory-map the model file\n",               params.use_mmap ? "false" : "true");
+    fprintf(stderr, "  --huge-pages                   [%-7s] back the weights, KV caches and compute buffers with huge pages\n", params.huge_pages ? "true" : "false");
+    fprintf(stderr, "  -nrp P,    --no-repack P       [%-7s] keep the enc, dec or all CPU weights out of the AMX / repack buffers\n", "none");
+    fprintf(stderr, "  --share-compute                [%-7s] one compute buffer for the encoder and the decoder\n", params.share_compute ? "true" : "false");
+    fprintf(stderr, "  -ndl N,    --dec-layers N      [%-7d] load only N evenly spaced decoder layers (0 = all)\n", params.dec_layers);
+    fprintf(stderr, "  --mel-gpu                      [%-7s] compute the mel spectrogram on the device of the encoder\n", params.mel_gpu ? "true" : "false");
+    fprintf(stderr, "  --repack-cache FNAME           [%-7s] cache the weights converted for the AMX / repack buffers in FNAME\n", params.repack_cache.c_str());
+    fprintf(stderr, "  -dev N,    --device N          [%-7d] GPU device to use\n",                               params.gpu_device);
+    fprintf(stderr, "  -devd N,   --device-dec N      [%-7d] GPU device for the decoder (-1 = same as --device)\n", params.gpu_device_dec);
+    fprintf(stderr, "  -ngle N,   --gpu-layers-enc N  [%-7d] number of encoder layers on the GPU (-1 = all)\n", params.n_gpu_layers_enc);
+    fprintf(stderr, "  -ngld N,   --gpu-layers-dec N  [%-7d] number of decoder layers on the GPU (-1 = all)\n", params.n_gpu_layers_dec);
+    fprintf(stderr, "  --rpc SERVERS                  [%-7s] comma-separated host:port of RPC servers, used as GPU devices after the local ones\n", params.rpc_servers.c_str());
     fprintf(stderr, "  -sns,      --suppress-nst      [%-7s] suppress non-speech tokens\n",                     params.suppress_nst ? "true" : "false");
     fprintf(stderr, "  --suppress-regex REGEX         [%-7s] regular expression matching tokens to suppress\n", params.suppress_regex.c_str());
     fprintf(stderr, "  --grammar GRAMMAR              [%-7s] GBNF grammar to guide decoding\n",                 params.grammar.c_str());
     fprintf(stderr, "  --grammar-rule RULE            [%-7s] top-level GBNF grammar rule name\n",               params.grammar_rule.c_str());
     fprintf(stderr, "  --grammar-penalty N            [%-7.1f] scales down logits of nongrammar tokens\n",      params.grammar_penalty);
+    fprintf(stderr, "  --capture PATH                 [%-7s] capture the requests for whisper-replay to PATH[-N].json/pcm\n", params.capture.c_str());
+    fprintf(stderr, "  --encoder-cache FNAME          [%-7s] save the encoder outputs in FNAME and reuse them in the next runs\n", params.encoder_cache.c_str());
+    fprintf(stderr, "  --daemon PATH                  [%-7s] keep the model loaded and serve the runs with --connect PATH\n", params.daemon.c_str());
+    fprintf(stderr, "  --connect PATH                 [%-7s] run on the daemon listening on PATH, without loading the model\n", params.connect.c_str());
+    fprintf(stderr, "  -cm FNAME, --cascade-model FNAME [%-7s] transcribe the low confidence segments again with this model\n", params.cascade_model.c_str());
+    fprintf(stderr, "  --cascade-logprob-thold N      [%-7.2f] cascade a segment below this average token log probability\n", params.cascade_logprob_thold);
+    fprintf(stderr, "  --cascade-token-p-thold N      [%-7.2f] cascade a segment with a token less probable than this\n", params.cascade_token_p_thold);
+    fprintf(stderr, "  --cascade-no-speech-thold N    [%-7.2f] cascade a segment above this no speech probability\n", params.cascade_no_speech_thold);
+    fprintf(stderr, "  --cascade-merge-ms N           [%-7d] cascade the segments closer than this together\n", params.cascade_merge_ms);
+    fprintf(stderr, "  --lora FNAME                   [%-7s] apply a LoRA adapter to the decoder (can be repeated)\n", "");
+    fprintf(stderr, "  --lora-scaled FNAME S          [%-7s] apply a LoRA adapter with the scale S (can be repeated)\n", "");
     // Voice Activity Detection (VAD) parameters
     fprintf(stderr, "\nVoice Activity Detection (VAD) options:\n");
     fprintf(stderr, "  -v,        --vad                           [%-7s] enable Voice Activity Detection (VAD)\n",            params.vad ? "true" : "false");
@@ -286,47 +488,36 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
                                                                                                                                   std::to_string(params.vad_max_speech_duration_s).c_str());
     fprintf(stderr, "  -vp N,     --vad-speech-pad-ms           N [%-7d] VAD speech padding (extend segments)\n",             params.vad_speech_pad_ms);
     fprintf(stderr, "  -vo N,     --vad-samples-overlap         N [%-7.2f] VAD samples overlap (seconds between segments)\n", params.vad_samples_overlap);
+    fprintf(stderr, "  -vcm N,    --vad-chunk-ms                N [%-7d] transcribe the speech in chunks of N ms while VAD runs (0 - off)\n", params.vad_chunk_ms);
     fprintf(stderr, "\n");
 }
 
+struct output_writer;
+
 struct whisper_print_user_data {
     const whisper_params * params;
 
-    const std::vector<std::vector<float>> * pcmf32s;
+    const stereo_energy * energy;
     int progress_prev;
-};
-
-static std::string estimate_diarization_speaker(std::vector<std::vector<float>> pcmf32s, int64_t t0, int64_t t1, bool id_only = false) {
-    std::string speaker = "";
-    const int64_t n_samples = pcmf32s[0].size();
-
-    const int64_t is0 = timestamp_to_sample(t0, n_samples, WHISPER_SAMPLE_RATE);
-    const int64_t is1 = timestamp_to_sample(t1, n_samples, WHISPER_SAMPLE_RATE);
 
-    double energy0 = 0.0f;
-    double energy1 = 0.0f;
-
-    for (int64_t j = is0; j < is1; j++) {
-        energy0 += fabs(pcmf32s[0][j]);
-        energy1 += fabs(pcmf32s[1][j]);
-    }
-
-    if (energy0 > 1.1*energy1) {
-        speaker = "0";
-    } else if (energy1 > 1.1*energy0) {
-        speaker = "1";
-    } else {
-        speaker = "?";
-    }
+    // the segments are printed to stdout unless it is used for an output file
+    bool print_segments;
+    std::vector<std::unique_ptr<output_writer>> * writers;
+};
 
-    //printf("is0 = %lld, is1 = %lld, energy0 = %f, energy1 = %f, speaker = %s\n", is0, is1, energy0, energy1, speaker.c_str());
+// with --multichannel, the speaker of a segment is its channel, with --diarize it is estimated from the channel energies
+static bool has_speaker(const whisper_params & params, const stereo_energy & energy) {
+    return params.multichannel || (params.diarize && !energy.empty());
+}
 
-    if (!id_only) {
-        speaker.insert(0, "(speaker ");
-        speaker.append(")");
+static std::string segment_speaker(
+        const whisper_params & params, const stereo_energy & energy, struct whisper_state * state, int i, int64_t t0, int64_t t1, bool id_only = false) {
+    if (params.multichannel) {
+        const std::string id = std::to_string(whisper_full_get_segment_channel_from_state(state, i));
+        return id_only ? id : "(speaker " + id + ")";
     }
 
-    return speaker;
+    return estimate_diarization_speaker(energy, t0, t1, id_only);
 }
 
 static void whisper_print_progress_callback(struct whisper_context * /*ctx*/, struct whisper_state * /*state*/, int progress, void * user_data) {
@@ -338,11 +529,11 @@ static void whisper_print_progress_callback(struct whisper_context * /*ctx*/, st
     }
 }
 
-static void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * /*state*/, int n_new, void * user_data) {
+static void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * state, int n_new, void * user_data) {
     const auto & params  = *((whisper_print_user_data *) user_data)->params;
-    const auto & pcmf32s = *((whisper_print_user_data *) user_data)->pcmf32s;
+    const auto & energy  = *((whisper_print_user_data *) user_data)->energy;
 
-    const int n_segments = whisper_full_n_segments(ctx);
+    const int n_segments = whisper_full_n_segments_from_state(state);
 
     std::string speaker = "";
 
@@ -358,42 +549,42 @@ static void whisper_print_segment_callback(struct whisper_context * ctx, struct
 
     for (int i = s0; i < n_segments; i++) {
         if (!params.no_timestamps || params.diarize) {
-            t0 = whisper_full_get_segment_t0(ctx, i);
-            t1 = whisper_full_get_segment_t1(ctx, i);
+            t0 = whisper_full_get_segment_t0_from_state(state, i);
+            t1 = whisper_full_get_segment_t1_from_state(state, i);
         }
 
         if (!params.no_timestamps) {
             printf("[%s --> %s]  ", to_timestamp(t0).c_str(), to_timestamp(t1).c_str());
         }
 
-        if (params.diarize && pcmf32s.size() == 2) {
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+        if (has_speaker(params, energy)) {
+            speaker = segment_speaker(params, energy, state, i, t0, t1);
         }
 
         if (params.print_colors) {
-            for (int j = 0; j < whisper_full_n_tokens(ctx, i); ++j) {
+            for (int j = 0; j < whisper_full_n_tokens_from_state(state, i); ++j) {
                 if (params.print_special == false) {
-                    const whisper_token id = whisper_full_get_token_id(ctx, i, j);
+                    const whisper_token id = whisper_full_get_token_id_from_state(state, i, j);
                     if (id >= whisper_token_eot(ctx)) {
                         continue;
                     }
                 }
 
-                const char * text = whisper_full_get_token_text(ctx, i, j);
-                const float  p    = whisper_full_get_token_p   (ctx, i, j);
+                const char * text = whisper_full_get_token_text_from_state(ctx, state, i, j);
+                const float  p    = whisper_full_get_token_p_from_state(state, i, j);
 
                 const int col = std::max(0, std::min((int) k_colors.size() - 1, (int) (std::pow(p, 3)*float(k_colors.size()))));
 
                 printf("%s%s%s%s", speaker.c_str(), k_colors[col].c_str(), text, "\033[0m");
             }
         } else {
-            const char * text = whisper_full_get_segment_text(ctx, i);
+            const char * text = whisper_full_get_segment_text_from_state(state, i);
 
             printf("%s%s", speaker.c_str(), text);
         }
 
         if (params.tinydiarize) {
-            if (whisper_full_get_segment_speaker_turn_next(ctx, i)) {
+            if (whisper_full_get_segment_speaker_turn_next_from_state(state, i)) {
                 printf("%s", params.tdrz_speaker_turn.c_str());
             }
         }
@@ -407,36 +598,84 @@ static void whisper_print_segment_callback(struct whisper_context * ctx, struct
     }
 }
 
-static void output_txt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
-    const int n_segments = whisper_full_n_segments(ctx);
-    for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
+// Writes the results in one of the output formats while whisper_full() runs: the segments are appended as they are
+// finalized, from the new segment callback, so the output does not wait for the end of the transcription.
+// begin() is called before the first segment and end() after the last one, also if there are no segments.
+struct output_writer {
+    const whisper_params & params;
+    const stereo_energy  & energy;
+
+    std::ofstream fout;
+
+    bool started = false;
+
+    output_writer(const whisper_params & params, const stereo_energy & energy) : params(params), energy(energy) {}
+    virtual ~output_writer() = default;
+
+    virtual void begin  (struct whisper_context * /*ctx*/, struct whisper_state * /*state*/) {}
+    virtual void segment(struct whisper_context * ctx, struct whisper_state * state, int i) = 0;
+    virtual void end    (struct whisper_context * /*ctx*/, struct whisper_state * /*state*/) {}
+};
+
+using output_writers = std::vector<std::unique_ptr<output_writer>>;
+
+// write the segments [s0, s1) - the file buffers are flushed once per call, not per segment
+static void output_segments(struct whisper_context * ctx, struct whisper_state * state, output_writers & writers, int s0, int s1) {
+    for (auto & writer : writers) {
+        if (!writer->started) {
+            writer->begin(ctx, state);
+            writer->started = true;
+        }
+        for (int i = s0; i < s1; ++i) {
+            writer->segment(ctx, state, i);
+        }
+        writer->fout.flush();
+    }
+}
+
+static void output_end(struct whisper_context * ctx, struct whisper_state * state, output_writers & writers) {
+    output_segments(ctx, state, writers, 0, 0);
+
+    for (auto & writer : writers) {
+        writer->end(ctx, state);
+        writer->fout.flush();
+    }
+}
+
+struct output_txt : output_writer {
+    using output_writer::output_writer;
+
+    void segment(struct whisper_context * /*ctx*/, struct whisper_state * state, int i) override {
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
         std::string speaker = "";
 
-        if (params.diarize && pcmf32s.size() == 2)
+        if (has_speaker(params, energy))
         {
-            const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-            const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+            const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+            const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
+            speaker = segment_speaker(params, energy, state, i, t0, t1);
         }
 
         fout << speaker << text << "\n";
     }
-}
+};
+
+struct output_vtt : output_writer {
+    using output_writer::output_writer;
 
-static void output_vtt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
-    fout << "WEBVTT\n\n";
+    void begin(struct whisper_context * /*ctx*/, struct whisper_state * /*state*/) override {
+        fout << "WEBVTT\n\n";
+    }
 
-    const int n_segments = whisper_full_n_segments(ctx);
-    for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
-        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-        const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+    void segment(struct whisper_context * /*ctx*/, struct whisper_state * state, int i) override {
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
+        const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+        const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
         std::string speaker = "";
 
-        if (params.diarize && pcmf32s.size() == 2)
+        if (has_speaker(params, energy))
         {
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1, true);
+            speaker = segment_speaker(params, energy, state, i, t0, t1, true);
             speaker.insert(0, "<v Speaker");
             speaker.append(">");
         }
@@ -444,26 +683,27 @@ static void output_vtt(struct whisper_context * ctx, std::ofstream & fout, const
         fout << to_timestamp(t0) << " --> " << to_timestamp(t1) << "\n";
         fout << speaker << text << "\n\n";
     }
-}
+};
+
+struct output_srt : output_writer {
+    using output_writer::output_writer;
 
-static void output_srt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
-    const int n_segments = whisper_full_n_segments(ctx);
-    for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
-        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-        const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+    void segment(struct whisper_context * /*ctx*/, struct whisper_state * state, int i) override {
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
+        const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+        const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
         std::string speaker = "";
 
-        if (params.diarize && pcmf32s.size() == 2)
+        if (has_speaker(params, energy))
         {
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+            speaker = segment_speaker(params, energy, state, i, t0, t1);
         }
 
         fout << i + 1 + params.offset_n << "\n";
         fout << to_timestamp(t0, true) << " --> " << to_timestamp(t1, true) << "\n";
         fout << speaker << text << "\n\n";
     }
-}
+};
 
 static char * escape_double_quotes_and_backslashes(const char * str) {
     if (str == NULL) {
@@ -528,71 +768,74 @@ static char * escape_double_quotes_in_csv(const char * str) {
     return escaped;
 }
 
-static void output_csv(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
-    const int n_segments = whisper_full_n_segments(ctx);
-    fout << "start,end,";
-    if (params.diarize && pcmf32s.size() == 2)
-    {
-        fout << "speaker,";
+struct output_csv : output_writer {
+    using output_writer::output_writer;
+
+    void begin(struct whisper_context * /*ctx*/, struct whisper_state * /*state*/) override {
+        fout << "start,end,";
+        if (has_speaker(params, energy))
+        {
+            fout << "speaker,";
+        }
+        fout << "text\n";
     }
-    fout << "text\n";
 
-    for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
-        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-        const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+    void segment(struct whisper_context * /*ctx*/, struct whisper_state * state, int i) override {
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
+        const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+        const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
         char * text_escaped = escape_double_quotes_in_csv(text);
 
         //need to multiply times returned from whisper_full_get_segment_t{0,1}() by 10 to get milliseconds.
         fout << 10 * t0 << "," << 10 * t1 << ",";
-        if (params.diarize && pcmf32s.size() == 2)
+        if (has_speaker(params, energy))
         {
-            fout << estimate_diarization_speaker(pcmf32s, t0, t1, true) << ",";
+            fout << segment_speaker(params, energy, state, i, t0, t1, true) << ",";
         }
         fout << "\"" << text_escaped << "\"\n";
+        free(text_escaped);
     }
-}
+};
 
-static void output_score(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & /*params*/, std::vector<std::vector<float>> /*pcmf32s*/) {
-    const int n_segments = whisper_full_n_segments(ctx);
-    // fprintf(stderr,"segments: %d\n",n_segments);
-    for (int i = 0; i < n_segments; ++i) {
-        const int n_tokens = whisper_full_n_tokens(ctx, i);
-        // fprintf(stderr,"tokens: %d\n",n_tokens);
+struct output_score : output_writer {
+    using output_writer::output_writer;
+
+    void segment(struct whisper_context * ctx, struct whisper_state * state, int i) override {
+        const int n_tokens = whisper_full_n_tokens_from_state(state, i);
         for (int j = 0; j < n_tokens; j++) {
-            auto token = whisper_full_get_token_text(ctx, i, j);
-            auto probability = whisper_full_get_token_p(ctx, i, j);
-            fout << token << '\t' << probability << std::endl;
-            // fprintf(stderr,"token: %s %f\n",token,probability);
-	    }
+            auto token = whisper_full_get_token_text_from_state(ctx, state, i, j);
+            auto probability = whisper_full_get_token_p_from_state(state, i, j);
+            fout << token << '\t' << probability << '\n';
+        }
     }
-}
+};
+
+struct output_json : output_writer {
+    using output_writer::output_writer;
 
-static void output_json(
-             struct whisper_context * ctx,
-                      std::ofstream & fout,
-               const whisper_params & params,
-    std::vector<std::vector<float>>   pcmf32s) {
-    const bool full = params.output_jsn_full;
     int indent = 0;
+    int n_segments = 0; // written so far
 
-    auto doindent = [&]() {
-        for (int i = 0; i < indent; i++) fout << "\t";
-    };
+    void doindent() {
+        static const std::string tabs(16, '\t');
+        for (int n = indent; n > 0; n -= (int) tabs.size()) {
+            fout.write(tabs.data(), std::min(n, (int) tabs.size()));
+        }
+    }
 
-    auto start_arr = [&](const char *name) {
+    void start_arr(const char *name) {
         doindent();
         fout << "\"" << name << "\": [\n";
         indent++;
-    };
+    }
 
-    auto end_arr = [&](bool end) {
+    void end_arr(bool end) {
         indent--;
         doindent();
         fout << (end ? "]\n" : "],\n");
-    };
+    }
 
-    auto start_obj = [&](const char *name) {
+    void start_obj(const char *name) {
         doindent();
         if (name) {
             fout << "\"" << name << "\": {\n";
@@ -600,49 +843,49 @@ static void output_json(
             fout << "{\n";
         }
         indent++;
-    };
+    }
 
-    auto end_obj = [&](bool end) {
+    void end_obj(bool end) {
         indent--;
         doindent();
         fout << (end ? "}\n" : "},\n");
-    };
+    }
 
-    auto start_value = [&](const char *name) {
+    void start_value(const char *name) {
         doindent();
         fout << "\"" << name << "\": ";
-    };
+    }
 
-    auto value_s = [&](const char *name, const char *val, bool end) {
+    void value_s(const char *name, const char *val, bool end) {
         start_value(name);
         char * val_escaped = escape_double_quotes_and_backslashes(val);
         fout << "\"" << val_escaped << (end ? "\"\n" : "\",\n");
         free(val_escaped);
-    };
+    }
 
-    auto end_value = [&](bool end) {
+    void end_value(bool end) {
         fout << (end ? "\n" : ",\n");
-    };
+    }
 
-    auto value_i = [&](const char *name, const int64_t val, bool end) {
+    void value_i(const char *name, const int64_t val, bool end) {
         start_value(name);
         fout << val;
         end_value(end);
-    };
+    }
 
-    auto value_f = [&](const char *name, const float val, bool end) {
+    void value_f(const char *name, const float val, bool end) {
         start_value(name);
         fout << val;
         end_value(end);
-    };
+    }
 
-    auto value_b = [&](const char *name, const bool val, bool end) {
+    void value_b(const char *name, const bool val, bool end) {
         start_value(name);
         fout << (val ? "true" : "false");
         end_value(end);
-    };
+    }
 
-    auto times_o = [&](int64_t t0, int64_t t1, bool end) {
+    void times_o(int64_t t0, int64_t t1, bool end) {
         start_obj("timestamps");
         value_s("from", to_timestamp(t0, true).c_str(), false);
         value_s("to", to_timestamp(t1, true).c_str(), true);
@@ -651,109 +894,128 @@ static void output_json(
         value_i("from", t0 * 10, false);
         value_i("to", t1 * 10, true);
         end_obj(end);
-    };
-
-    start_obj(nullptr);
-        value_s("systeminfo", whisper_print_system_info(), false);
-        start_obj("model");
-            value_s("type", whisper_model_type_readable(ctx), false);
-            value_b("multilingual", whisper_is_multilingual(ctx), false);
-            value_i("vocab", whisper_model_n_vocab(ctx), false);
-            start_obj("audio");
-                value_i("ctx", whisper_model_n_audio_ctx(ctx), false);
-                value_i("state", whisper_model_n_audio_state(ctx), false);
-                value_i("head", whisper_model_n_audio_head(ctx), false);
-                value_i("layer", whisper_model_n_audio_layer(ctx), true);
+    }
+
+    // the language is known once the first window has been decoded
+    void begin(struct whisper_context * ctx, struct whisper_state * state) override {
+        start_obj(nullptr);
+            value_s("systeminfo", whisper_print_system_info(), false);
+            start_obj("model");
+                value_s("type", whisper_model_type_readable(ctx), false);
+                value_b("multilingual", whisper_is_multilingual(ctx), false);
+                value_i("vocab", whisper_model_n_vocab(ctx), false);
+                start_obj("audio");
+                    value_i("ctx", whisper_model_n_audio_ctx(ctx), false);
+                    value_i("state", whisper_model_n_audio_state(ctx), false);
+                    value_i("head", whisper_model_n_audio_head(ctx), false);
+                    value_i("layer", whisper_model_n_audio_layer(ctx), true);
+                end_obj(false);
+                start_obj("text");
+                    value_i("ctx", whisper_model_n_text_ctx(ctx), false);
+                    value_i("state", whisper_model_n_text_state(ctx), false);
+                    value_i("head", whisper_model_n_text_head(ctx), false);
+                    value_i("layer", whisper_model_n_text_layer(ctx), true);
+                end_obj(false);
+                value_i("mels", whisper_model_n_mels(ctx), false);
+                value_i("ftype", whisper_model_ftype(ctx), true);
             end_obj(false);
-            start_obj("text");
-                value_i("ctx", whisper_model_n_text_ctx(ctx), false);
-                value_i("state", whisper_model_n_text_state(ctx), false);
-                value_i("head", whisper_model_n_text_head(ctx), false);
-                value_i("layer", whisper_model_n_text_layer(ctx), true);
+            start_obj("params");
+                value_s("model", params.model.c_str(), false);
+                value_s("language", params.language.c_str(), false);
+                value_b("translate", params.translate, true);
             end_obj(false);
-            value_i("mels", whisper_model_n_mels(ctx), false);
-            value_i("ftype", whisper_model_ftype(ctx), true);
-        end_obj(false);
-        start_obj("params");
-            value_s("model", params.model.c_str(), false);
-            value_s("language", params.language.c_str(), false);
-            value_b("translate", params.translate, true);
-        end_obj(false);
-        start_obj("result");
-            value_s("language", whisper_lang_str(whisper_full_lang_id(ctx)), true);
-        end_obj(false);
-        start_arr("transcription");
-
-            const int n_segments = whisper_full_n_segments(ctx);
-            for (int i = 0; i < n_segments; ++i) {
-                const char * text = whisper_full_get_segment_text(ctx, i);
-
-                const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-                const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
-
-                start_obj(nullptr);
-                    times_o(t0, t1, false);
-                    value_s("text", text, !params.diarize && !params.tinydiarize && !full);
-
-                    if (full) {
-                        start_arr("tokens");
-                        const int n = whisper_full_n_tokens(ctx, i);
-                        for (int j = 0; j < n; ++j) {
-                            auto token = whisper_full_get_token_data(ctx, i, j);
-                            start_obj(nullptr);
-                                value_s("text", whisper_token_to_str(ctx, token.id), false);
-                                if(token.t0 > -1 && token.t1 > -1) {
-                                    // If we have per-token timestamps, write them out
-                                    times_o(token.t0, token.t1, false);
-                                }
-                                value_i("id", token.id, false);
-                                value_f("p", token.p, false);
-                                value_f("t_dtw", token.t_dtw, true);
-                            end_obj(j == (n - 1));
+            start_obj("result");
+                value_s("language", whisper_lang_str(whisper_full_lang_id_from_state(state)), true);
+            end_obj(false);
+            start_arr("transcription");
+    }
+
+    // the next segment is not known yet, so the separator is written before the segment instead of after it
+    void segment(struct whisper_context * ctx, struct whisper_state * state, int i) override {
+        const bool full = params.output_jsn_full;
+
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
+
+        const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+        const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
+
+        if (n_segments++ > 0) {
+            fout << ",\n";
+        }
+
+        start_obj(nullptr);
+            times_o(t0, t1, false);
+            value_s("text", text, !has_speaker(params, energy) && !params.tinydiarize && !full);
+
+            if (full) {
+                start_arr("tokens");
+                const int n = whisper_full_n_tokens_from_state(state, i);
+                for (int j = 0; j < n; ++j) {
+                    auto token = whisper_full_get_token_data_from_state(state, i, j);
+                    start_obj(nullptr);
+                        value_s("text", whisper_token_to_str(ctx, token.id), false);
+                        if(token.t0 > -1 && token.t1 > -1) {
+                            // If we have per-token timestamps, write them out
+                            times_o(token.t0, token.t1, false);
                         }
-                        end_arr(!params.diarize && !params.tinydiarize);
-                    }
+                        value_i("id", token.id, false);
+                        value_f("p", token.p, false);
+                        value_f("t_dtw", token.t_dtw, true);
+                    end_obj(j == (n - 1));
+                }
+                end_arr(!has_speaker(params, energy) && !params.tinydiarize);
+            }
 
-                    if (params.diarize && pcmf32s.size() == 2) {
-                        value_s("speaker", estimate_diarization_speaker(pcmf32s, t0, t1, true).c_str(), true);
-                    }
+            if (has_speaker(params, energy)) {
+                value_s("speaker", segment_speaker(params, energy, state, i, t0, t1, true).c_str(), !params.tinydiarize);
+            }
 
-                    if (params.tinydiarize) {
-                        value_b("speaker_turn_next", whisper_full_get_segment_speaker_turn_next(ctx, i), true);
-                    }
-                end_obj(i == (n_segments - 1));
+            if (params.tinydiarize) {
+                value_b("speaker_turn_next", whisper_full_get_segment_speaker_turn_next_from_state(state, i), true);
             }
+        indent--;
+        doindent();
+        fout << "}";
+    }
 
-        end_arr(true);
-    end_obj(true);
-}
+    void end(struct whisper_context * /*ctx*/, struct whisper_state * /*state*/) override {
+        if (n_segments > 0) {
+            fout << "\n";
+        }
+            end_arr(true);
+        end_obj(true);
+    }
+};
 
 // karaoke video generation
 // outputs a bash script that uses ffmpeg to generate a video with the subtitles
 // TODO: font parameter adjustments
-static bool output_wts(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s, const char * fname_inp, float t_sec, const char * fname_out) {
-    static const char * font = params.font_path.c_str();
+struct output_wts : output_writer {
+    const std::string fname_inp;
+    const std::string fname_out;
+    const float t_sec;
 
-    std::ifstream fin(font);
-    if (!fin.is_open()) {
-        fprintf(stderr, "%s: font not found at '%s', please specify a monospace font with -fp\n", __func__, font);
-        return false;
-    }
+    output_wts(const whisper_params & params, const stereo_energy & energy, const std::string & fname_inp, float t_sec, const std::string & fname_out) :
+        output_writer(params, energy), fname_inp(fname_inp), fname_out(fname_out), t_sec(t_sec) {}
 
-    fout << "#!/bin/bash" << "\n";
-    fout << "\n";
+    void begin(struct whisper_context * /*ctx*/, struct whisper_state * /*state*/) override {
+        fout << "#!/bin/bash" << "\n";
+        fout << "\n";
 
-    fout << "ffmpeg -i " << fname_inp << " -f lavfi -i color=size=1200x120:duration=" << t_sec << ":rate=25:color=black -vf \"";
+        fout << "ffmpeg -i " << fname_inp << " -f lavfi -i color=size=1200x120:duration=" << t_sec << ":rate=25:color=black -vf \"";
+    }
+
+    void segment(struct whisper_context * ctx, struct whisper_state * state, int i) override {
+        const char * font = params.font_path.c_str();
 
-    for (int i = 0; i < whisper_full_n_segments(ctx); i++) {
-        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-        const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+        const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+        const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
 
-        const int n = whisper_full_n_tokens(ctx, i);
+        const int n = whisper_full_n_tokens_from_state(state, i);
 
         std::vector<whisper_token_data> tokens(n);
         for (int j = 0; j < n; ++j) {
-            tokens[j] = whisper_full_get_token_data(ctx, i, j);
+            tokens[j] = whisper_full_get_token_data_from_state(state, i, j);
         }
 
         if (i > 0) {
@@ -766,8 +1028,8 @@ static bool output_wts(struct whisper_context * ctx, std::ofstream & fout, const
         bool is_first = true;
         std::string speaker = "";
 
-        if (params.diarize && pcmf32s.size() == 2) {
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+        if (has_speaker(params, energy)) {
+            speaker = segment_speaker(params, energy, state, i, t0, t1);
         }
 
         for (int j = 0; j < n; ++j) {
@@ -781,7 +1043,7 @@ static bool output_wts(struct whisper_context * ctx, std::ofstream & fout, const
             std::string txt_fg = ""; // highlight token
             std::string txt_ul = ""; // underline
 
-            if (params.diarize && pcmf32s.size() == 2) {
+            if (has_speaker(params, energy)) {
                 txt_bg = speaker;
                 txt_fg = speaker;
                 txt_ul = "\\ \\ \\ \\ \\ \\ \\ \\ \\ \\ \\ ";
@@ -837,28 +1099,31 @@ static bool output_wts(struct whisper_context * ctx, std::ofstream & fout, const
         }
     }
 
-    fout << "\" -c:v libx264 -pix_fmt yuv420p -y " << fname_inp << ".mp4" << "\n";
+    void end(struct whisper_context * /*ctx*/, struct whisper_state * /*state*/) override {
+        fout << "\" -c:v libx264 -pix_fmt yuv420p -y " << fname_inp << ".mp4" << "\n";
 
-    fout << "\n\n";
-    fout << "echo \"Your video has been saved to " << fname_inp << ".mp4\"" << "\n";
-    fout << "\n";
-    fout << "echo \"  ffplay " << fname_inp << ".mp4\"\n";
-    fout << "\n";
+        fout << "\n\n";
+        fout << "echo \"Your video has been saved to " << fname_inp << ".mp4\"" << "\n";
+        fout << "\n";
+        fout << "echo \"  ffplay " << fname_inp << ".mp4\"\n";
+        fout << "\n";
 
-    fout.close();
+        fout.close();
 
-    fprintf(stderr, "# %s: run 'source %s' to generate karaoke video\n", __func__, fname_out);
+        fprintf(stderr, "# %s: run 'source %s' to generate karaoke video\n", "output_wts", fname_out.c_str());
+    }
+};
 
-    return true;
-}
+struct output_lrc : output_writer {
+    using output_writer::output_writer;
 
-static void output_lrc(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
-    fout << "[by:whisper.cpp]\n";
+    void begin(struct whisper_context * /*ctx*/, struct whisper_state * /*state*/) override {
+        fout << "[by:whisper.cpp]\n";
+    }
 
-    const int n_segments = whisper_full_n_segments(ctx);
-    for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
-        const int64_t t = whisper_full_get_segment_t0(ctx, i);
+    void segment(struct whisper_context * /*ctx*/, struct whisper_state * state, int i) override {
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
+        const int64_t t = whisper_full_get_segment_t0_from_state(state, i);
 
         int64_t msec = t * 10;
         int64_t min = msec / (1000 * 60);
@@ -871,230 +1136,533 @@ static void output_lrc(struct whisper_context * ctx, std::ofstream & fout, const
         std::string timestamp_lrc = std::string(buf);
         std::string speaker = "";
 
-        if (params.diarize && pcmf32s.size() == 2)
+        if (has_speaker(params, energy))
         {
-            const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-            const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+            const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+            const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
+            speaker = segment_speaker(params, energy, state, i, t0, t1);
         }
 
         fout <<  '[' << timestamp_lrc << ']' << speaker << text << "\n";
     }
-}
+};
 
+struct fout_factory {
+    std::string fname_out;
+    const size_t basename_length;
+    const bool is_stdout;
+    bool used_stdout;
+    decltype(whisper_print_segment_callback) * const print_segment_callback;
+    std::ofstream fout;
+
+    fout_factory (const std::string & fname_out_, const std::string & fname_inp) :
+            fname_out{!fname_out_.empty() ? fname_out_ : fname_inp},
+            basename_length{fname_out.size()},
+            is_stdout{fname_out == "-"},
+            used_stdout{},
+            print_segment_callback{is_stdout ? nullptr : whisper_print_segment_callback} {
+    }
 
-static void cb_log_disable(enum ggml_log_level , const char * , void * ) { }
+    bool open(const char * ext, const char * function) {
+        if (is_stdout) {
+            if (used_stdout) {
+                fprintf(stderr, "warning: Not appending multiple file formats to stdout\n");
+                return false;
+            }
 
-int main(int argc, char ** argv) {
-#if defined(_WIN32)
-    // Set the console output code page to UTF-8, while command line arguments
-    // are still encoded in the system's code page. In this way, we can print
-    // non-ASCII characters to the console, and access files with non-ASCII paths.
-    SetConsoleOutputCP(CP_UTF8);
+            used_stdout = true;
+#ifdef _WIN32
+            fout = std::ofstream{"CON"};
+#else
+            fout = std::ofstream{"/dev/stdout"};
 #endif
-
-    whisper_params params;
-
-    // If the only argument starts with "@", read arguments line-by-line
-    // from the given file.
-    std::vector<std::string> vec_args;
-    if (argc == 2 && argv != nullptr && argv[1] != nullptr && argv[1][0] == '@') {
-        // Save the name of the executable.
-        vec_args.push_back(argv[0]);
-
-        // Open the response file.
-        char const * rspfile = argv[1] + sizeof(char);
-        std::ifstream fin(rspfile);
-        if (fin.is_open() == false) {
-            fprintf(stderr, "error: response file '%s' not found\n", rspfile);
-            return 1;
-        }
-
-        // Read the entire response file.
-        std::string line;
-        while (std::getline(fin, line)) {
-            vec_args.push_back(line);
+            // Not using fprintf stderr here because it might equal stdout
+            // Also assuming /dev is mounted
+            return true;
         }
 
-        // Use the contents of the response file as the command-line arguments.
-        argc = static_cast<int>(vec_args.size());
-        argv = static_cast<char **>(alloca(argc * sizeof (char *)));
-        for (int i = 0; i < argc; ++i) {
-            argv[i] = const_cast<char *>(vec_args[i].c_str());
+        fname_out.resize(basename_length);
+        fname_out += ext;
+        fout = std::ofstream{fname_out};
+        if (!fout.is_open()) {
+            fprintf(stderr, "%s: failed to open '%s' for writing\n", __func__, fname_out.c_str());
+            return false;
         }
+        fprintf(stderr, "%s: saving output to '%s'\n", function, fname_out.c_str());
+        return true;
     }
+};
 
-    if (whisper_params_parse(argc, argv, params) == false) {
-        whisper_print_usage(argc, argv, params);
-        return 1;
+// open the output files selected by params, the formats that cannot be written are skipped
+static output_writers output_open(
+                       fout_factory & fout_factory,
+               const whisper_params & params,
+                const stereo_energy & energy,
+                  const std::string & fname_inp,
+                               size_t n_samples) {
+    output_writers writers;
+
+    // macros to stringify the writer name
+#define output_func(type, ext, param, ...) if (param && fout_factory.open(ext, #type)) {\
+    writers.emplace_back(new type(params, energy, ##__VA_ARGS__)); \
+    writers.back()->fout = std::move(fout_factory.fout); \
+}
+#define output_ext(ext, ...) output_func(output_##ext, "." #ext, params.output_##ext, ##__VA_ARGS__)
+
+    bool has_font = true;
+    if (params.output_wts && !std::ifstream(params.font_path).is_open()) {
+        fprintf(stderr, "%s: font not found at '%s', please specify a monospace font with -fp\n", "output_wts", params.font_path.c_str());
+        has_font = false;
     }
 
-    // remove non-existent files
-    for (auto it = params.fname_inp.begin(); it != params.fname_inp.end();) {
-        const auto fname_inp = it->c_str();
+    output_ext(txt);
+    output_ext(vtt);
+    output_ext(srt);
+    output_func(output_wts, ".wts", params.output_wts && has_font, fname_inp, float(n_samples + 1000)/WHISPER_SAMPLE_RATE, fout_factory.fname_out);
+    output_ext(csv);
+    output_func(output_json, ".json", params.output_jsn);
+    output_ext(lrc);
+    output_func(output_score, ".score.txt", params.log_score);
 
-        if (*it != "-" && !is_file_exist(fname_inp)) {
-            fprintf(stderr, "error: input file not found '%s'\n", fname_inp);
-            it = params.fname_inp.erase(it);
-            continue;
-        }
+#undef output_ext
+#undef output_func
 
-        it++;
+    if (fout_factory.is_stdout && !fout_factory.used_stdout) {
+        fprintf(stderr, "warning: '--output-file -' used without any other '--output-*'");
     }
 
-    if (params.fname_inp.empty()) {
-        fprintf(stderr, "error: no input files specified\n");
-        whisper_print_usage(argc, argv, params);
-        return 2;
-    }
+    return writers;
+}
 
-    if (params.language != "auto" && whisper_lang_id(params.language.c_str()) == -1) {
-        fprintf(stderr, "error: unknown language '%s'\n", params.language.c_str());
-        whisper_print_usage(argc, argv, params);
-        exit(0);
-    }
+// called on each new segment
+static void whisper_cli_segment_callback(struct whisper_context * ctx, struct whisper_state * state, int n_new, void * user_data) {
+    auto & data = *(whisper_print_user_data *) user_data;
 
-    if (params.diarize && params.tinydiarize) {
-        fprintf(stderr, "error: cannot use both --diarize and --tinydiarize\n");
-        whisper_print_usage(argc, argv, params);
-        exit(0);
+    if (data.print_segments) {
+        whisper_print_segment_callback(ctx, state, n_new, user_data);
     }
 
-    if (params.no_prints) {
-        whisper_log_set(cb_log_disable, NULL);
-    }
+    const int n_segments = whisper_full_n_segments_from_state(state);
 
-    // whisper init
+    output_segments(ctx, state, *data.writers, n_segments - n_new, n_segments);
+}
 
-    struct whisper_context_params cparams = whisper_context_default_params();
+static void print_processing(const char * func, const whisper_params & params, const std::string & fname_inp, size_t n_samples) {
+    fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), %d threads, %d processors, %d beams + best of %d, lang = %s, task = %s, %stimestamps = %d ...\n",
+            func, fname_inp.c_str(), int(n_samples), float(n_samples)/WHISPER_SAMPLE_RATE,
+            params.n_threads, params.n_processors, params.beam_size, params.best_of,
+            params.language.c_str(),
+            params.translate ? "translate" : "transcribe",
+            params.tinydiarize ? "tdrz = 1, " : "",
+            params.no_timestamps ? 0 : 1);
+}
 
-    cparams.use_gpu    = params.use_gpu;
-    cparams.flash_attn = params.flash_attn;
+// the callbacks and the grammar are set by the caller
+static whisper_full_params whisper_full_params_from(const whisper_params & params) {
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
 
-    if (!params.dtw.empty()) {
-        cparams.dtw_token_timestamps = true;
-        cparams.dtw_aheads_preset = WHISPER_AHEADS_NONE;
+    const bool use_grammar = (!params.grammar_parsed.rules.empty() && !params.grammar_rule.empty());
+    wparams.strategy = (params.beam_size > 1 || use_grammar) ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY;
 
-        if (params.dtw == "tiny")      cparams.dtw_aheads_preset = WHISPER_AHEADS_TINY;
-        if (params.dtw == "tiny.en")   cparams.dtw_aheads_preset = WHISPER_AHEADS_TINY_EN;
-        if (params.dtw == "base")      cparams.dtw_aheads_preset = WHISPER_AHEADS_BASE;
-        if (params.dtw == "base.en")   cparams.dtw_aheads_preset = WHISPER_AHEADS_BASE_EN;
-        if (params.dtw == "small")     cparams.dtw_aheads_preset = WHISPER_AHEADS_SMALL;
-        if (params.dtw == "small.en")  cparams.dtw_aheads_preset = WHISPER_AHEADS_SMALL_EN;
-        if (params.dtw == "medium")    cparams.dtw_aheads_preset = WHISPER_AHEADS_MEDIUM;
-        if (params.dtw == "medium.en") cparams.dtw_aheads_preset = WHISPER_AHEADS_MEDIUM_EN;
-        if (params.dtw == "large.v1")  cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V1;
-        if (params.dtw == "large.v2")  cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V2;
-        if (params.dtw == "large.v3")  cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V3;
-        if (params.dtw == "large.v3.turbo")  cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V3_TURBO;
+    wparams.print_realtime   = false;
+    wparams.print_progress   = params.print_progress;
+    wparams.print_timestamps = !params.no_timestamps;
+    wparams.print_special    = params.print_special;
+    wparams.translate        = params.translate;
+    wparams.translate_also   = params.translate_also;
+    wparams.language         = params.language.c_str();
+    wparams.detect_language  = params.detect_language;
+    wparams.lang_detect_n_windows = params.lang_detect_n_windows;
+    wparams.n_threads        = params.n_threads;
+    wparams.n_threads_dec    = params.n_threads_dec;
+    wparams.n_max_text_ctx   = params.max_context >= 0 ? params.max_context : wparams.n_max_text_ctx;
+    wparams.offset_ms        = params.offset_t_ms;
+    wparams.split_search_ms  = params.split_search_ms;
+    wparams.split_overlap_ms = params.split_overlap_ms;
+    wparams.split_chunk_ms   = params.split_chunk_ms;
+    wparams.duration_ms      = params.duration_ms;
 
-        if (cparams.dtw_aheads_preset == WHISPER_AHEADS_NONE) {
-            fprintf(stderr, "error: unknown DTW preset '%s'\n", params.dtw.c_str());
-            return 3;
-        }
-    }
+    wparams.token_timestamps = params.output_wts || params.output_jsn_full || params.max_len > 0;
+    wparams.thold_pt         = params.word_thold;
+    wparams.max_len          = params.output_wts && params.max_len == 0 ? 60 : params.max_len;
+    wparams.split_on_word    = params.split_on_word;
+    wparams.audio_ctx        = params.audio_ctx;
+    wparams.audio_ctx_auto   = params.audio_ctx_auto;
 
-    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+    wparams.debug_mode       = params.debug_mode;
 
-    if (ctx == nullptr) {
-        fprintf(stderr, "error: failed to initialize whisper context\n");
-        return 3;
-    }
+    wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
 
-    // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
-    whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
+    wparams.suppress_regex   = params.suppress_regex.empty() ? nullptr : params.suppress_regex.c_str();
 
-    if (!params.grammar.empty()) {
-        auto & grammar = params.grammar_parsed;
-        if (is_file_exist(params.grammar.c_str())) {
-            // read grammar from file
-            std::ifstream ifs(params.grammar.c_str());
-            const std::string txt = std::string((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-            grammar = grammar_parser::parse(txt.c_str());
-        } else {
-            // read grammar from string
-            grammar = grammar_parser::parse(params.grammar.c_str());
-        }
+    wparams.initial_prompt   = params.prompt.c_str();
 
-        // will be empty (default) if there are parse errors
-        if (grammar.rules.empty()) {
-            fprintf(stderr, "error: failed to parse grammar \"%s\"\n", params.grammar.c_str());
-            return 4;
-        } else {
-            fprintf(stderr, "%s: grammar:\n", __func__);
-            grammar_parser::print_grammar(stderr, grammar);
-            fprintf(stderr, "\n");
-        }
-    }
+    wparams.greedy.best_of        = params.best_of;
+    wparams.beam_search.beam_size = params.beam_size;
 
-    for (int f = 0; f < (int) params.fname_inp.size(); ++f) {
-        const auto & fname_inp = params.fname_inp[f];
-        struct fout_factory {
-            std::string fname_out;
-            const size_t basename_length;
-            const bool is_stdout;
-            bool used_stdout;
-            decltype(whisper_print_segment_callback) * const print_segment_callback;
-            std::ofstream fout;
-
-            fout_factory (const std::string & fname_out_, const std::string & fname_inp, whisper_params & params) :
-                    fname_out{!fname_out_.empty() ? fname_out_ : fname_inp},
-                    basename_length{fname_out.size()},
-                    is_stdout{fname_out == "-"},
-                    used_stdout{},
-                    print_segment_callback{is_stdout ? nullptr : whisper_print_segment_callback} {
-                if (!print_segment_callback) {
-                    params.print_progress = false;
-                }
-            }
+    wparams.temperature_inc  = params.no_fallback ? 0.0f : params.temperature_inc;
+    wparams.temperature      = params.temperature;
+    wparams.fallback_parallel = params.fallback_par;
+    wparams.callback_async    = params.callback_async;
 
-            bool open(const char * ext, const char * function) {
-                if (is_stdout) {
-                    if (used_stdout) {
-                        fprintf(stderr, "warning: Not appending multiple file formats to stdout\n");
-                        return false;
-                    }
+    wparams.entropy_thold    = params.entropy_thold;
+    wparams.repeat_max       = params.repeat_max;
+    wparams.logprob_thold    = params.logprob_thold;
+    wparams.no_speech_thold  = params.no_speech_thold;
 
-                    used_stdout = true;
-#ifdef _WIN32
-                    fout = std::ofstream{"CON"};
-#else
-                    fout = std::ofstream{"/dev/stdout"};
-#endif
-                    // Not using fprintf stderr here because it might equal stdout
-                    // Also assuming /dev is mounted
-                    return true;
-                }
+    wparams.no_speech_skip_thold = params.no_speech_skip_thold;
+    wparams.silence_thold        = params.silence_thold;
+    wparams.mel_lazy_ms          = params.mel_lazy_ms;
 
-                fname_out.resize(basename_length);
-                fname_out += ext;
-                fout = std::ofstream{fname_out};
-                if (!fout.is_open()) {
-                    fprintf(stderr, "%s: failed to open '%s' for writing\n", __func__, fname_out.c_str());
-                    return false;
-                }
-                fprintf(stderr, "%s: saving output to '%s'\n", function, fname_out.c_str());
-                return true;
-            }
-        } fout_factory{f < (int) params.fname_out.size() ? params.fname_out[f] : "", fname_inp, params};
+    wparams.encoder_cache_path   = params.encoder_cache.empty() ? nullptr : params.encoder_cache.c_str();
 
-        std::vector<float> pcmf32;               // mono-channel F32 PCM
-        std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
+    wparams.no_timestamps    = params.no_timestamps;
+    wparams.restrict_vocab   = params.restrict_vocab;
 
-        if (!::read_audio_data(fname_inp, pcmf32, pcmf32s, params.diarize)) {
-            fprintf(stderr, "error: failed to read audio file '%s'\n", fname_inp.c_str());
-            continue;
-        }
+    wparams.suppress_nst     = params.suppress_nst;
 
-        if (!whisper_is_multilingual(ctx)) {
-            if (params.language != "en" || params.translate) {
-                params.language = "en";
-                params.translate = false;
-                fprintf(stderr, "%s: WARNING: model is not multilingual, ignoring language and translation options\n", __func__);
-            }
-        }
-        if (params.detect_language) {
-            params.language = "auto";
+    wparams.vad            = params.vad;
+    wparams.vad_model_path = params.vad_model.c_str();
+
+    wparams.vad_params.threshold               = params.vad_threshold;
+    wparams.vad_params.min_speech_duration_ms  = params.vad_min_speech_duration_ms;
+    wparams.vad_params.min_silence_duration_ms = params.vad_min_silence_duration_ms;
+    wparams.vad_params.max_speech_duration_s   = params.vad_max_speech_duration_s;
+    wparams.vad_params.speech_pad_ms           = params.vad_speech_pad_ms;
+    wparams.vad_params.samples_overlap         = params.vad_samples_overlap;
+
+    wparams.vad_chunk_ms = params.vad_chunk_ms;
+
+    return wparams;
+}
+
+// bounded FIFO between the stages of the batch mode
+// pop() returns false once the queue is closed and empty
+template <typename T>
+class batch_queue {
+public:
+    explicit batch_queue(size_t capacity) : m_capacity(capacity) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv_push.wait(lock, [&] { return m_items.size() < m_capacity; });
+        m_items.push_back(std::move(item));
+        m_cv_pop.notify_one();
+    }
+
+    bool pop(T & item) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv_pop.wait(lock, [&] { return !m_items.empty() || m_closed; });
+        if (m_items.empty()) {
+            return false;
+        }
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        m_cv_push.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_cv_pop.notify_all();
+    }
+
+private:
+    const size_t m_capacity;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv_push;
+    std::condition_variable m_cv_pop;
+    std::deque<T> m_items;
+    bool m_closed = false;
+};
+
+// an input file of the batch mode, from the decoding to the output
+struct batch_file {
+    int f = 0;
+
+    std::vector<float> pcmf32;
+    stereo_energy energy;
+    size_t n_samples = 0;
+
+    whisper_state * state = nullptr;
+    int result = 0;
+};
+
+// a failure is not fatal, the graphs then start their threads each time
+static void whisper_cli_set_threadpool(const whisper_params & params, whisper_state * state) {
+    whisper_threadpool_params tpp = whisper_threadpool_default_params(params.n_threads);
+    tpp.cpus = params.threadpool_cpus.empty() ? nullptr : params.threadpool_cpus.c_str();
+    tpp.numa_node = params.numa_node;
+    tpp.perf_cores = params.threadpool_perf;
+
+    if (whisper_state_set_threadpool(state, &tpp) != 0) {
+        fprintf(stderr, "%s: failed to create the threadpool, continuing without it\n", __func__);
+    }
+}
+
+// Transcribe the input files concurrently, params.n_parallel_files at a time, each with its own state of the shared
+// context. The audio is decoded ahead on params.n_io_threads threads, and the results are written by the calling
+// thread, so the states only wait for the decoding and the output when both fall behind the transcription.
+// There is one more state than transcribing threads: a state is released when its outputs have been written.
+// Returns the number of files that failed to transcribe.
+static int whisper_cli_batch(
+        struct whisper_context * ctx, const whisper_params & params, const whisper_full_params & wparams,
+        const std::vector<std::pair<whisper_adapter_lora *, float>> & loras) {
+    const int n_files   = (int) params.fname_inp.size();
+    const int n_workers = std::min(params.n_parallel_files, n_files);
+    const int n_io      = std::max(1, std::min(params.n_io_threads, n_files));
+
+    batch_queue<std::unique_ptr<batch_file>> decoded (n_workers);
+    batch_queue<std::unique_ptr<batch_file>> done    (n_workers + 1);
+    batch_queue<whisper_state *>             states  (n_workers + 1);
+
+    for (int i = 0; i < n_workers + 1; ++i) {
+        whisper_state * state = whisper_init_state(ctx);
+        if (state == nullptr) {
+            fprintf(stderr, "%s: failed to initialize whisper state %d\n", __func__, i);
+            return n_files;
+        }
+        whisper_ctx_init_openvino_encoder_with_state(ctx, state, nullptr, params.openvino_encode_device.c_str(), nullptr);
+        if (params.threadpool) {
+            whisper_cli_set_threadpool(params, state);
+        }
+        for (const auto & lora : loras) {
+            whisper_set_adapter_lora(state, lora.first, lora.second);
+        }
+        states.push(state);
+    }
+
+    std::atomic<int> f_next(0);
+    std::atomic<int> n_io_running(n_io);
+    std::atomic<int> n_workers_running(n_workers);
+
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < n_io; ++i) {
+        threads.emplace_back([&]() {
+            for (int f = f_next++; f < n_files; f = f_next++) {
+                const auto & fname_inp = params.fname_inp[f];
+
+                std::unique_ptr<batch_file> file(new batch_file());
+                file->f = f;
+
+                std::vector<std::vector<float>> pcmf32s;
+                if (!::read_audio_data(fname_inp, file->pcmf32, pcmf32s, params.diarize)) {
+                    fprintf(stderr, "error: failed to read audio file '%s'\n", fname_inp.c_str());
+                    continue;
+                }
+
+                file->energy    = stereo_energy(pcmf32s);
+                file->n_samples = file->pcmf32.size();
+
+                decoded.push(std::move(file));
+            }
+
+            if (--n_io_running == 0) {
+                decoded.close();
+            }
+        });
+    }
+
+    for (int i = 0; i < n_workers; ++i) {
+        threads.emplace_back([&]() {
+            std::unique_ptr<batch_file> file;
+            while (decoded.pop(file)) {
+                states.pop(file->state);
+
+                if (!params.no_prints) {
+                    print_processing("whisper_cli_batch", params, params.fname_inp[file->f], file->n_samples);
+                }
+
+                if (params.n_chunked > 0) {
+                    file->result = whisper_full_chunked_with_state(ctx, file->state, wparams, file->pcmf32.data(), file->pcmf32.size(), params.n_chunked);
+                } else {
+                    file->result = whisper_full_parallel_with_state(ctx, file->state, wparams, file->pcmf32.data(), file->pcmf32.size(), params.n_processors);
+                }
+
+                // the samples are not needed for the output
+                file->pcmf32.clear();
+                file->pcmf32.shrink_to_fit();
+
+                done.push(std::move(file));
+            }
+
+            if (--n_workers_running == 0) {
+                done.close();
+            }
+        });
+    }
+
+    int n_failed = 0;
+
+    std::unique_ptr<batch_file> file;
+    while (done.pop(file)) {
+        const auto & fname_inp = params.fname_inp[file->f];
+
+        if (file->result != 0) {
+            fprintf(stderr, "%s: failed to process audio file '%s'\n", __func__, fname_inp.c_str());
+            n_failed++;
+        } else {
+            fout_factory fout_factory{file->f < (int) params.fname_out.size() ? params.fname_out[file->f] : "", fname_inp};
+
+            output_writers writers = output_open(fout_factory, params, file->energy, fname_inp, file->n_samples);
+
+            whisper_print_user_data user_data = { &params, &file->energy, 0, fout_factory.print_segment_callback != nullptr, &writers };
+
+            if (user_data.print_segments) {
+                printf("\n%s:", fname_inp.c_str());
+            }
+
+            whisper_cli_segment_callback(ctx, file->state, whisper_full_n_segments_from_state(file->state), &user_data);
+            output_end(ctx, file->state, writers);
+        }
+
+        states.push(file->state);
+    }
+
+    for (auto & thread : threads) {
+        thread.join();
+    }
+
+    states.close();
+
+    whisper_state * state = nullptr;
+    while (states.pop(state)) {
+        whisper_free_state(state);
+    }
+
+    return n_failed;
+}
+
+// the KV cache type by its ggml name, e.g. "q8_0"
+static bool whisper_parse_cache_type(const std::string & name, ggml_type & type) {
+    for (int i = 0; i < GGML_TYPE_COUNT; ++i) {
+        if (ggml_blck_size(ggml_type(i)) > 0 && name == ggml_type_name(ggml_type(i))) {
+            type = ggml_type(i);
+            return true;
+        }
+    }
+
+    fprintf(stderr, "error: unknown KV cache type '%s'\n", name.c_str());
+
+    return false;
+}
+
+// parses the grammar of params and sets up the parameters of whisper_full() for them, grammar_rules must outlive wparams
+// returns 0 or the exit code of the error
+static int whisper_cli_prepare(
+        struct whisper_context * ctx,
+               whisper_params & params,
+          whisper_full_params & wparams,
+        std::vector<const whisper_grammar_element *> & grammar_rules) {
+    if (!params.grammar.empty()) {
+        auto & grammar = params.grammar_parsed;
+        if (is_file_exist(params.grammar.c_str())) {
+            // read grammar from file
+            std::ifstream ifs(params.grammar.c_str());
+            const std::string txt = std::string((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+            grammar = grammar_parser::parse(txt.c_str());
+        } else {
+            // read grammar from string
+            grammar = grammar_parser::parse(params.grammar.c_str());
+        }
+
+        // will be empty (default) if there are parse errors
+        if (grammar.rules.empty()) {
+            fprintf(stderr, "error: failed to parse grammar \"%s\"\n", params.grammar.c_str());
+            return 4;
+        } else {
+            fprintf(stderr, "%s: grammar:\n", __func__);
+            grammar_parser::print_grammar(stderr, grammar);
+            fprintf(stderr, "\n");
+        }
+    }
+
+    if (!whisper_is_multilingual(ctx)) {
+        if (params.language != "en" || params.translate) {
+            params.language = "en";
+            params.translate = false;
+            fprintf(stderr, "%s: WARNING: model is not multilingual, ignoring language and translation options\n", __func__);
+        }
+    }
+    if (params.detect_language) {
+        params.language = "auto";
+    }
+
+    wparams = whisper_full_params_from(params);
+
+    const bool use_grammar = (!params.grammar_parsed.rules.empty() && !params.grammar_rule.empty());
+
+    const auto & grammar_parsed = params.grammar_parsed;
+    grammar_rules = grammar_parsed.c_rules();
+
+    if (use_grammar) {
+        if (grammar_parsed.symbol_ids.find(params.grammar_rule) == grammar_parsed.symbol_ids.end()) {
+            fprintf(stderr, "%s: warning: grammar rule '%s' not found - skipping grammar sampling\n", __func__, params.grammar_rule.c_str());
+        } else {
+            wparams.grammar_rules = grammar_rules.data();
+            wparams.n_grammar_rules = grammar_rules.size();
+            wparams.i_start_rule = grammar_parsed.symbol_ids.at(params.grammar_rule);
+            wparams.grammar_penalty = params.grammar_penalty;
+        }
+    }
+
+    // examples for abort mechanism
+    // in examples below, we do not abort the processing, but we could if the flag is set to true
+
+    // the callback is called before every encoder run - if it returns false, the processing is aborted
+    {
+        static bool is_aborted = false; // NOTE: this should be atomic to avoid data race
+
+        wparams.encoder_begin_callback = [](struct whisper_context * /*ctx*/, struct whisper_state * /*state*/, void * user_data) {
+            bool is_aborted = *(bool*)user_data;
+            return !is_aborted;
+        };
+        wparams.encoder_begin_callback_user_data = &is_aborted;
+    }
+
+    // the callback is called before every computation - if it returns true, the computation is aborted
+    {
+        static bool is_aborted = false; // NOTE: this should be atomic to avoid data race
+
+        wparams.abort_callback = [](void * user_data) {
+            bool is_aborted = *(bool*)user_data;
+            return is_aborted;
+        };
+        wparams.abort_callback_user_data = &is_aborted;
+    }
+
+
+    return 0;
+}
+
+// transcribes the input files of params one after the other on the default state of ctx
+// returns 0 or the exit code of the error
+static int whisper_cli_transcribe(
+        struct whisper_context * ctx, struct whisper_context * ctx_large, whisper_params & params, const whisper_full_params & wparams, const char * argv0) {
+    for (int f = 0; f < (int) params.fname_inp.size(); ++f) {
+        const auto & fname_inp = params.fname_inp[f];
+
+        fout_factory fout_factory{f < (int) params.fname_out.size() ? params.fname_out[f] : "", fname_inp};
+        if (!fout_factory.print_segment_callback) {
+            params.print_progress = false;
+        }
+
+        std::vector<float> pcmf32;               // mono-channel F32 PCM
+        std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
+
+        if (!::read_audio_data(fname_inp, pcmf32, pcmf32s, params.diarize || params.multichannel)) {
+            fprintf(stderr, "error: failed to read audio file '%s'\n", fname_inp.c_str());
+            continue;
+        }
+
+        // the speaker of each segment is estimated from the channel energies
+        const stereo_energy energy(pcmf32s);
+
+        if (params.multichannel && pcmf32s.size() < 2) {
+            fprintf(stderr, "%s: warning: '%s' has a single channel, it is transcribed as speaker 0\n", __func__, fname_inp.c_str());
         }
 
         if (!params.no_prints) {
@@ -1105,13 +1673,7 @@ int main(int argc, char ** argv) {
 
             // print some info about the processing
             fprintf(stderr, "\n");
-            fprintf(stderr, "%s: processing '%s' (%d samples, %.1f sec), %d threads, %d processors, %d beams + best of %d, lang = %s, task = %s, %stimestamps = %d ...\n",
-                    __func__, fname_inp.c_str(), int(pcmf32.size()), float(pcmf32.size())/WHISPER_SAMPLE_RATE,
-                    params.n_threads, params.n_processors, params.beam_size, params.best_of,
-                    params.language.c_str(),
-                    params.translate ? "translate" : "transcribe",
-                    params.tinydiarize ? "tdrz = 1, " : "",
-                    params.no_timestamps ? 0 : 1);
+            print_processing(__func__, params, fname_inp, pcmf32.size());
 
             if (params.print_colors) {
                 fprintf(stderr, "%s: color scheme: red (low confidence), yellow (medium), green (high confidence)\n", __func__);
@@ -1119,150 +1681,657 @@ int main(int argc, char ** argv) {
             fprintf(stderr, "\n");
         }
 
+        // the outputs are written as the segments are finalized
+        output_writers writers = output_open(fout_factory, params, energy, fname_inp, pcmf32.size());
+
         // run the inference
         {
-            whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+            whisper_full_params wparams_cur = wparams;
+            wparams_cur.print_progress = params.print_progress;
 
-            const bool use_grammar = (!params.grammar_parsed.rules.empty() && !params.grammar_rule.empty());
-            wparams.strategy = (params.beam_size > 1 || use_grammar) ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY;
+            // one capture per input file
+            const std::string capture = params.fname_inp.size() > 1 ? params.capture + "-" + std::to_string(f) : params.capture;
+            if (!params.capture.empty()) {
+                wparams_cur.capture_path = capture.c_str();
+            }
 
-            wparams.print_realtime   = false;
-            wparams.print_progress   = params.print_progress;
-            wparams.print_timestamps = !params.no_timestamps;
-            wparams.print_special    = params.print_special;
-            wparams.translate        = params.translate;
-            wparams.language         = params.language.c_str();
-            wparams.detect_language  = params.detect_language;
-            wparams.n_threads        = params.n_threads;
-            wparams.n_max_text_ctx   = params.max_context >= 0 ? params.max_context : wparams.n_max_text_ctx;
-            wparams.offset_ms        = params.offset_t_ms;
-            wparams.duration_ms      = params.duration_ms;
+            whisper_print_user_data user_data = { &params, &energy, 0, fout_factory.print_segment_callback != nullptr, &writers };
 
-            wparams.token_timestamps = params.output_wts || params.output_jsn_full || params.max_len > 0;
-            wparams.thold_pt         = params.word_thold;
-            wparams.max_len          = params.output_wts && params.max_len == 0 ? 60 : params.max_len;
-            wparams.split_on_word    = params.split_on_word;
-            wparams.audio_ctx        = params.audio_ctx;
+            // this callback is called on each new segment
+            // with a cascade, the segments are only final once the large model has transcribed the flagged ones again
+            if (!wparams_cur.print_realtime && ctx_large == nullptr) {
+                wparams_cur.new_segment_callback           = whisper_cli_segment_callback;
+                wparams_cur.new_segment_callback_user_data = &user_data;
+            }
 
-            wparams.debug_mode       = params.debug_mode;
+            if (wparams_cur.print_progress) {
+                wparams_cur.progress_callback           = whisper_print_progress_callback;
+                wparams_cur.progress_callback_user_data = &user_data;
+            }
 
-            wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
+            int ret = 0;
+            if (params.multichannel && pcmf32s.size() >= 2) {
+                const float * channels[2] = { pcmf32s[0].data(), pcmf32s[1].data() };
+                ret = whisper_full_multichannel(ctx, wparams_cur, channels, 2, pcmf32s[0].size(), !params.multichannel_seq);
+            } else if (params.n_chunked > 0) {
+                ret = whisper_full_chunked (ctx, wparams_cur, pcmf32.data(), pcmf32.size(), params.n_chunked);
+            } else {
+                ret = whisper_full_parallel(ctx, wparams_cur, pcmf32.data(), pcmf32.size(), params.n_processors);
+            }
 
-            wparams.suppress_regex   = params.suppress_regex.empty() ? nullptr : params.suppress_regex.c_str();
+            if (ret != 0) {
+                fprintf(stderr, "%s: failed to process audio\n", argv0);
+                return 10;
+            }
 
-            wparams.initial_prompt   = params.prompt.c_str();
+            if (ctx_large != nullptr) {
+                whisper_cascade_params cparams = whisper_cascade_default_params();
 
-            wparams.greedy.best_of        = params.best_of;
-            wparams.beam_search.beam_size = params.beam_size;
+                cparams.logprob_thold   = params.cascade_logprob_thold;
+                cparams.token_p_thold   = params.cascade_token_p_thold;
+                cparams.no_speech_thold = params.cascade_no_speech_thold;
+                cparams.merge_ms        = params.cascade_merge_ms;
 
-            wparams.temperature_inc  = params.no_fallback ? 0.0f : params.temperature_inc;
-            wparams.temperature      = params.temperature;
+                const int n_segments = whisper_full_n_segments(ctx);
+                const int n_flagged  = whisper_full_cascade(ctx, ctx_large, wparams_cur, cparams, pcmf32.data(), pcmf32.size());
+                if (n_flagged < 0) {
+                    fprintf(stderr, "%s: failed to process audio with the cascade model\n", argv0);
+                    return 10;
+                }
 
-            wparams.entropy_thold    = params.entropy_thold;
-            wparams.logprob_thold    = params.logprob_thold;
-            wparams.no_speech_thold  = params.no_speech_thold;
+                if (!params.no_prints) {
+                    fprintf(stderr, "%s: cascade: %d of %d segments transcribed again with '%s'\n", __func__,
+                            n_flagged, n_segments, params.cascade_model.c_str());
+                }
 
-            wparams.no_timestamps    = params.no_timestamps;
+                if (!wparams_cur.print_realtime && whisper_full_n_segments(ctx) > 0) {
+                    whisper_cli_segment_callback(ctx, whisper_get_state(ctx), whisper_full_n_segments(ctx), &user_data);
+                }
+            }
+        }
 
-            wparams.suppress_nst     = params.suppress_nst;
+        output_end(ctx, whisper_get_state(ctx), writers);
 
-            wparams.vad            = params.vad;
-            wparams.vad_model_path = params.vad_model.c_str();
+        if (params.translate_also) {
+            printf("\ntranslation:\n");
+            for (int i = 0; i < whisper_full_n_translated_segments(ctx); ++i) {
+                if (!params.no_timestamps) {
+                    printf("[%s --> %s]  ", to_timestamp(whisper_full_get_translated_segment_t0(ctx, i)).c_str(),
+                                            to_timestamp(whisper_full_get_translated_segment_t1(ctx, i)).c_str());
+                }
+                printf("%s\n", whisper_full_get_translated_segment_text(ctx, i));
+            }
+            fflush(stdout);
+        }
+    }
 
-            wparams.vad_params.threshold               = params.vad_threshold;
-            wparams.vad_params.min_speech_duration_ms  = params.vad_min_speech_duration_ms;
-            wparams.vad_params.min_silence_duration_ms = params.vad_min_silence_duration_ms;
-            wparams.vad_params.max_speech_duration_s   = params.vad_max_speech_duration_s;
-            wparams.vad_params.speech_pad_ms           = params.vad_speech_pad_ms;
-            wparams.vad_params.samples_overlap         = params.vad_samples_overlap;
+    return 0;
+}
 
-            whisper_print_user_data user_data = { &params, &pcmf32s, 0 };
+#if !defined(_WIN32)
+static bool write_all(int fd, const void * data, size_t size) {
+    const char * p = (const char *) data;
+    while (size > 0) {
+        const ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p    += n;
+        size -= n;
+    }
+    return true;
+}
 
-            const auto & grammar_parsed = params.grammar_parsed;
-            auto grammar_rules = grammar_parsed.c_rules();
+static bool unix_socket_addr(const std::string & path, sockaddr_un & addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
 
-            if (use_grammar) {
-                if (grammar_parsed.symbol_ids.find(params.grammar_rule) == grammar_parsed.symbol_ids.end()) {
-                    fprintf(stderr, "%s: warning: grammar rule '%s' not found - skipping grammar sampling\n", __func__, params.grammar_rule.c_str());
-                } else {
-                    wparams.grammar_rules = grammar_rules.data();
-                    wparams.n_grammar_rules = grammar_rules.size();
-                    wparams.i_start_rule = grammar_parsed.symbol_ids.at(params.grammar_rule);
-                    wparams.grammar_penalty = params.grammar_penalty;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "error: socket path '%s' is too long\n", path.c_str());
+        return false;
+    }
+
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    return true;
+}
+#endif
+
+// --daemon: the model and its state stay loaded, and each client connection is one run of whisper-cli with the
+// arguments of the client. the client sends its working directory and its arguments, 0-terminated, and closes its end
+// the daemon sends back the stdout of the run, followed by a 0 byte and the exit code
+// the options of the model and of the context are those of the daemon, the ones of the clients are ignored
+static int whisper_cli_daemon(struct whisper_context * ctx, struct whisper_context * ctx_large, const whisper_params & params, const char * argv0) {
+#if defined(_WIN32)
+    GGML_UNUSED(ctx);
+    GGML_UNUSED(params);
+    GGML_UNUSED(argv0);
+
+    fprintf(stderr, "error: --daemon is not supported on Windows\n");
+    return 1;
+#else
+    sockaddr_un addr;
+    if (!unix_socket_addr(params.daemon, addr)) {
+        return 1;
+    }
+
+    // a client that goes away while its output is written must not stop the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        fprintf(stderr, "error: failed to create a socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // the socket of a previous daemon that was killed
+    unlink(params.daemon.c_str());
+
+    if (bind(fd, (const sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        fprintf(stderr, "error: failed to listen on '%s': %s\n", params.daemon.c_str(), strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+        cwd[0] = '\0';
+    }
+
+    fprintf(stderr, "%s: listening on '%s'\n", __func__, params.daemon.c_str());
+
+    while (true) {
+        const int conn = accept(fd, nullptr, nullptr);
+        if (conn < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "error: failed to accept a connection: %s\n", strerror(errno));
+            break;
+        }
+
+        std::string msg;
+        {
+            char buf[4096];
+            ssize_t n;
+            while ((n = read(conn, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+                if (n > 0) {
+                    msg.append(buf, n);
                 }
             }
+        }
 
-            // this callback is called on each new segment
-            if (!wparams.print_realtime) {
-                wparams.new_segment_callback           = fout_factory.print_segment_callback;
-                wparams.new_segment_callback_user_data = &user_data;
+        // the working directory of the client, then its arguments
+        std::vector<std::string> args;
+        for (size_t i = 0; i < msg.size(); ) {
+            const size_t end = msg.find('\0', i);
+            if (end == std::string::npos) {
+                break;
             }
+            args.push_back(msg.substr(i, end - i));
+            i = end + 1;
+        }
+
+        int ret = 1;
 
-            if (wparams.print_progress) {
-                wparams.progress_callback           = whisper_print_progress_callback;
-                wparams.progress_callback_user_data = &user_data;
+        if (!args.empty() && chdir(args[0].c_str()) == 0) {
+            std::vector<char *> argv_req = { const_cast<char *>(argv0) };
+            for (size_t i = 1; i < args.size(); ++i) {
+                argv_req.push_back(const_cast<char *>(args[i].c_str()));
             }
 
-            // examples for abort mechanism
-            // in examples below, we do not abort the processing, but we could if the flag is set to true
+            whisper_params params_req = params;
+            params_req.fname_inp.clear();
+            params_req.fname_out.clear();
 
-            // the callback is called before every encoder run - if it returns false, the processing is aborted
-            {
-                static bool is_aborted = false; // NOTE: this should be atomic to avoid data race
+            // the arguments have been checked by the client
+            whisper_params_parse(argv_req.size(), argv_req.data(), params_req);
 
-                wparams.encoder_begin_callback = [](struct whisper_context * /*ctx*/, struct whisper_state * /*state*/, void * user_data) {
-                    bool is_aborted = *(bool*)user_data;
-                    return !is_aborted;
-                };
-                wparams.encoder_begin_callback_user_data = &is_aborted;
+            if (params_req.model != params.model) {
+                fprintf(stderr, "%s: warning: the client asked for '%s', '%s' is used\n", __func__, params_req.model.c_str(), params.model.c_str());
+            }
+            if (params_req.cascade_model != params.cascade_model) {
+                fprintf(stderr, "%s: warning: the client asked for the cascade model '%s', '%s' is used\n", __func__,
+                        params_req.cascade_model.c_str(), params.cascade_model.c_str());
+                params_req.cascade_model = params.cascade_model;
             }
 
-            // the callback is called before every computation - if it returns true, the computation is aborted
-            {
-                static bool is_aborted = false; // NOTE: this should be atomic to avoid data race
+            whisper_full_params wparams;
+            std::vector<const whisper_grammar_element *> grammar_rules;
+
+            ret = whisper_cli_prepare(ctx, params_req, wparams, grammar_rules);
+            if (ret == 0) {
+                whisper_reset_timings(ctx);
+
+                // the output of the run goes to the client
+                fflush(stdout);
+                const int fd_stdout = dup(STDOUT_FILENO);
+                dup2(conn, STDOUT_FILENO);
+
+                ret = whisper_cli_transcribe(ctx, ctx_large, params_req, wparams, argv0);
+
+                fflush(stdout);
+                dup2(fd_stdout, STDOUT_FILENO);
+                close(fd_stdout);
 
-                wparams.abort_callback = [](void * user_data) {
-                    bool is_aborted = *(bool*)user_data;
-                    return is_aborted;
-                };
-                wparams.abort_callback_user_data = &is_aborted;
+                if (!params_req.no_prints) {
+                    whisper_print_timings(ctx);
+                }
             }
 
-            if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
-                fprintf(stderr, "%s: failed to process audio\n", argv[0]);
-                return 10;
+            if (cwd[0] != '\0' && chdir(cwd) != 0) {
+                fprintf(stderr, "%s: warning: failed to return to '%s'\n", __func__, cwd);
             }
+        } else {
+            fprintf(stderr, "%s: error: bad request\n", __func__);
         }
 
-        // output stuff
-        {
-            // macros to stringify function name
-#define output_func(func, ext, param, ...) if (param && fout_factory.open(ext, #func)) {\
-    func(ctx, fout_factory.fout, params, __VA_ARGS__); \
+        const char trailer[2] = { 0, (char) ret };
+        write_all(conn, trailer, sizeof(trailer));
+
+        close(conn);
+    }
+
+    close(fd);
+    unlink(params.daemon.c_str());
+
+    return 1;
+#endif
 }
-#define output_ext(ext, ...) output_func(output_##ext, "." #ext, params.output_##ext, __VA_ARGS__)
 
-            output_ext(txt, pcmf32s);
-            output_ext(vtt, pcmf32s);
-            output_ext(srt, pcmf32s);
-            output_ext(wts, pcmf32s, fname_inp.c_str(), float(pcmf32.size() + 1000)/WHISPER_SAMPLE_RATE, fout_factory.fname_out.c_str());
-            output_ext(csv, pcmf32s);
-            output_func(output_json, ".json", params.output_jsn, pcmf32s);
-            output_ext(lrc, pcmf32s);
-            output_func(output_score, ".score.txt", params.log_score, pcmf32s);
+// --connect: runs whisper-cli with the arguments on the daemon, see whisper_cli_daemon()
+static int whisper_cli_client(const std::string & path, int argc, char ** argv) {
+#if defined(_WIN32)
+    GGML_UNUSED(path);
+    GGML_UNUSED(argc);
+    GGML_UNUSED(argv);
 
-#undef output_ext
-#undef output_func
+    fprintf(stderr, "error: --connect is not supported on Windows\n");
+    return 1;
+#else
+    sockaddr_un addr;
+    if (!unix_socket_addr(path, addr)) {
+        return 1;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (const sockaddr *) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "error: failed to connect to the daemon on '%s': %s\n", path.c_str(), strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr) {
+        fprintf(stderr, "error: failed to get the working directory: %s\n", strerror(errno));
+        close(fd);
+        return 1;
+    }
+
+    std::string msg(cwd, strlen(cwd) + 1);
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--connect") == 0) {
+            ++i;
+            continue;
+        }
+        msg.append(argv[i], strlen(argv[i]) + 1);
+    }
+
+    if (!write_all(fd, msg.data(), msg.size())) {
+        fprintf(stderr, "error: failed to send the request to the daemon: %s\n", strerror(errno));
+        close(fd);
+        return 1;
+    }
+    shutdown(fd, SHUT_WR);
+
+    // the last 2 bytes are the trailer with the exit code, they are held back until the end
+    std::string tail;
+
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+        if (n <= 0) {
+            continue;
+        }
+
+        tail.append(buf, n);
+        if (tail.size() > 2) {
+            fwrite(tail.data(), 1, tail.size() - 2, stdout);
+            tail.erase(0, tail.size() - 2);
+        }
+    }
+    fflush(stdout);
 
-            if (fout_factory.is_stdout && !fout_factory.used_stdout) {
-                fprintf(stderr, "warning: '--output-file -' used without any other '--output-*'");
+    close(fd);
+
+    if (tail.size() != 2 || tail[0] != '\0') {
+        fwrite(tail.data(), 1, tail.size(), stdout);
+        fprintf(stderr, "error: the daemon on '%s' closed the connection\n", path.c_str());
+        return 1;
+    }
+
+    return (uint8_t) tail[1];
+#endif
+}
+
+static void cb_log_disable(enum ggml_log_level , const char * , void * ) { }
+
+int main(int argc, char ** argv) {
+#if defined(_WIN32)
+    // Set the console output code page to UTF-8, while command line arguments
+    // are still encoded in the system's code page. In this way, we can print
+    // non-ASCII characters to the console, and access files with non-ASCII paths.
+    SetConsoleOutputCP(CP_UTF8);
+#endif
+
+    whisper_params params;
+
+    // If the only argument starts with "@", read arguments line-by-line
+    // from the given file.
+    std::vector<std::string> vec_args;
+    if (argc == 2 && argv != nullptr && argv[1] != nullptr && argv[1][0] == '@') {
+        // Save the name of the executable.
+        vec_args.push_back(argv[0]);
+
+        // Open the response file.
+        char const * rspfile = argv[1] + sizeof(char);
+        std::ifstream fin(rspfile);
+        if (fin.is_open() == false) {
+            fprintf(stderr, "error: response file '%s' not found\n", rspfile);
+            return 1;
+        }
+
+        // Read the entire response file.
+        std::string line;
+        while (std::getline(fin, line)) {
+            vec_args.push_back(line);
+        }
+
+        // Use the contents of the response file as the command-line arguments.
+        argc = static_cast<int>(vec_args.size());
+        argv = static_cast<char **>(alloca(argc * sizeof (char *)));
+        for (int i = 0; i < argc; ++i) {
+            argv[i] = const_cast<char *>(vec_args[i].c_str());
+        }
+    }
+
+    if (whisper_params_parse(argc, argv, params) == false) {
+        whisper_print_usage(argc, argv, params);
+        return 1;
+    }
+
+    // remove non-existent files
+    for (auto it = params.fname_inp.begin(); it != params.fname_inp.end();) {
+        const auto fname_inp = it->c_str();
+
+        if (*it != "-" && !is_file_exist(fname_inp)) {
+            fprintf(stderr, "error: input file not found '%s'\n", fname_inp);
+            it = params.fname_inp.erase(it);
+            continue;
+        }
+
+        it++;
+    }
+
+    if (params.fname_inp.empty() && params.daemon.empty()) {
+        fprintf(stderr, "error: no input files specified\n");
+        whisper_print_usage(argc, argv, params);
+        return 2;
+    }
+
+    if (params.language != "auto" && whisper_lang_id(params.language.c_str()) == -1) {
+        fprintf(stderr, "error: unknown language '%s'\n", params.language.c_str());
+        whisper_print_usage(argc, argv, params);
+        exit(0);
+    }
+
+    if (params.diarize && params.tinydiarize) {
+        fprintf(stderr, "error: cannot use both --diarize and --tinydiarize\n");
+        whisper_print_usage(argc, argv, params);
+        exit(0);
+    }
+
+    if (params.multichannel && (params.diarize || !params.cascade_model.empty())) {
+        fprintf(stderr, "error: cannot use --multichannel with --diarize or --cascade-model\n");
+        whisper_print_usage(argc, argv, params);
+        exit(0);
+    }
+
+    if (!params.connect.empty()) {
+        for (const auto & fname_inp : params.fname_inp) {
+            if (fname_inp == "-") {
+                fprintf(stderr, "error: the daemon cannot read the audio from stdin\n");
+                return 2;
+            }
+        }
+
+        return whisper_cli_client(params.connect, argc, argv);
+    }
+
+    if (params.no_prints) {
+        whisper_log_set(cb_log_disable, NULL);
+    }
+
+    // several input files are transcribed at the same time on separate states, the context needs no default state
+    const bool use_batch = params.n_parallel_files > 1 && params.fname_inp.size() > 1 && params.daemon.empty() && params.cascade_model.empty() &&
+        !params.multichannel;
+
+    // whisper init
+
+    struct whisper_context_params cparams = whisper_context_default_params();
+
+    cparams.use_gpu    = params.use_gpu;
+    cparams.flash_attn = params.flash_attn;
+    cparams.fuse_qkv   = params.fuse_qkv;
+    cparams.use_mmap   = params.use_mmap;
+    cparams.huge_pages = params.huge_pages;
+
+    cparams.cpu_repack_enc = params.repack_enc;
+    cparams.cpu_repack_dec = params.repack_dec;
+    cparams.share_compute  = params.share_compute;
+    cparams.dec_layers     = params.dec_layers;
+    cparams.mel_gpu        = params.mel_gpu;
+    cparams.repack_cache   = params.repack_cache.empty() ? nullptr : params.repack_cache.c_str();
+
+    cparams.gpu_device       = params.gpu_device;
+    cparams.gpu_device_dec   = params.gpu_device_dec;
+    cparams.n_gpu_layers_enc = params.n_gpu_layers_enc;
+    cparams.n_gpu_layers_dec = params.n_gpu_layers_dec;
+    cparams.rpc_servers      = params.rpc_servers.empty() ? nullptr : params.rpc_servers.c_str();
+
+    cparams.numa_node = params.numa_node;
+    if (params.numa_node >= 0) {
+        // the pages of the mapped model file cannot be moved
+        cparams.use_mmap = false;
+    }
+
+    if (!whisper_parse_cache_type(params.cache_type_k, cparams.type_k) ||
+        !whisper_parse_cache_type(params.cache_type_v, cparams.type_v) ||
+        !whisper_parse_cache_type(params.itype,        cparams.type_i)) {
+        return 3;
+    }
+
+    if (!params.numa.empty()) {
+        if      (params.numa == "distribute") cparams.numa = WHISPER_NUMA_DISTRIBUTE;
+        else if (params.numa == "isolate")    cparams.numa = WHISPER_NUMA_ISOLATE;
+        else if (params.numa == "numactl")    cparams.numa = WHISPER_NUMA_NUMACTL;
+        else {
+            fprintf(stderr, "error: unknown NUMA strategy '%s'\n", params.numa.c_str());
+            return 3;
+        }
+    }
+
+    if (!params.dtw.empty()) {
+        cparams.dtw_token_timestamps = true;
+        cparams.dtw_aheads_preset = WHISPER_AHEADS_NONE;
+
+        if (params.dtw == "tiny")      cparams.dtw_aheads_preset = WHISPER_AHEADS_TINY;
+        if (params.dtw == "tiny.en")   cparams.dtw_aheads_preset = WHISPER_AHEADS_TINY_EN;
+        if (params.dtw == "base")      cparams.dtw_aheads_preset = WHISPER_AHEADS_BASE;
+        if (params.dtw == "base.en")   cparams.dtw_aheads_preset = WHISPER_AHEADS_BASE_EN;
+        if (params.dtw == "small")     cparams.dtw_aheads_preset = WHISPER_AHEADS_SMALL;
+        if (params.dtw == "small.en")  cparams.dtw_aheads_preset = WHISPER_AHEADS_SMALL_EN;
+        if (params.dtw == "medium")    cparams.dtw_aheads_preset = WHISPER_AHEADS_MEDIUM;
+        if (params.dtw == "medium.en") cparams.dtw_aheads_preset = WHISPER_AHEADS_MEDIUM_EN;
+        if (params.dtw == "large.v1")  cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V1;
+        if (params.dtw == "large.v2")  cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V2;
+        if (params.dtw == "large.v3")  cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V3;
+        if (params.dtw == "large.v3.turbo")  cparams.dtw_aheads_preset = WHISPER_AHEADS_LARGE_V3_TURBO;
+
+        if (cparams.dtw_aheads_preset == WHISPER_AHEADS_NONE) {
+            fprintf(stderr, "error: unknown DTW preset '%s'\n", params.dtw.c_str());
+            return 3;
+        }
+    }
+
+    struct whisper_context * ctx = use_batch ?
+        whisper_init_from_file_with_params_no_state(params.model.c_str(), cparams) :
+        whisper_init_from_file_with_params         (params.model.c_str(), cparams);
+
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context\n");
+        return 3;
+    }
+
+    if (!params.autotune.empty()) {
+        whisper_autotune_params aparams = whisper_autotune_default_params();
+        aparams.cache_path = params.autotune == "-" ? nullptr : params.autotune.c_str();
+
+        const whisper_autotune_result tuned = whisper_autotune(ctx, aparams);
+        if (tuned.n_threads > 0) {
+            fprintf(stderr, "%s: autotune: n_threads = %d, flash_attn = %d (encoder batch %d)%s\n", __func__,
+                    tuned.n_threads, tuned.flash_attn, tuned.n_batch, tuned.from_cache ? " - cached" : "");
+
+            params.n_threads = tuned.n_threads;
+
+            if (tuned.flash_attn != cparams.flash_attn) {
+                whisper_free(ctx);
+
+                cparams.flash_attn = tuned.flash_attn;
+
+                ctx = use_batch ?
+                    whisper_init_from_file_with_params_no_state(params.model.c_str(), cparams) :
+                    whisper_init_from_file_with_params         (params.model.c_str(), cparams);
+
+                if (ctx == nullptr) {
+                    fprintf(stderr, "error: failed to initialize whisper context\n");
+                    return 3;
+                }
             }
         }
     }
 
+    // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
+    // in the batch mode, it is initialized for each state
+    if (!use_batch) {
+        whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
+
+        if (params.threadpool) {
+            whisper_cli_set_threadpool(params, whisper_get_state(ctx));
+        }
+    }
+
+    // the LoRA adapters are loaded once, in the batch mode they are set on each state
+    std::vector<std::pair<whisper_adapter_lora *, float>> loras;
+    for (const auto & lora : params.lora) {
+        whisper_adapter_lora * adapter = whisper_adapter_lora_init(ctx, lora.first.c_str());
+        if (adapter == nullptr) {
+            fprintf(stderr, "error: failed to load the LoRA adapter '%s'\n", lora.first.c_str());
+            whisper_free(ctx);
+            return 3;
+        }
+
+        loras.emplace_back(adapter, lora.second);
+
+        if (!use_batch) {
+            whisper_set_adapter_lora(whisper_get_state(ctx), adapter, lora.second);
+        }
+    }
+
+    // the cascade model has the same context parameters, it only runs on the flagged segments
+    struct whisper_context * ctx_large = nullptr;
+    if (!params.cascade_model.empty()) {
+        ctx_large = whisper_init_from_file_with_params(params.cascade_model.c_str(), cparams);
+        if (ctx_large == nullptr) {
+            fprintf(stderr, "error: failed to initialize the cascade model '%s'\n", params.cascade_model.c_str());
+            whisper_free(ctx);
+            return 3;
+        }
+
+        if (whisper_is_multilingual(ctx) != whisper_is_multilingual(ctx_large)) {
+            fprintf(stderr, "error: the cascade model must be %s like '%s'\n",
+                    whisper_is_multilingual(ctx) ? "multilingual" : "English-only", params.model.c_str());
+            whisper_free(ctx_large);
+            whisper_free(ctx);
+            return 3;
+        }
+
+        whisper_ctx_init_openvino_encoder(ctx_large, nullptr, params.openvino_encode_device.c_str(), nullptr);
+
+        if (params.threadpool) {
+            whisper_cli_set_threadpool(params, whisper_get_state(ctx_large));
+        }
+    }
+
+    if (!params.daemon.empty()) {
+        const int ret = whisper_cli_daemon(ctx, ctx_large, params, argv[0]);
+        whisper_free(ctx_large);
+        whisper_free(ctx);
+        return ret;
+    }
+
+    whisper_full_params wparams;
+    std::vector<const whisper_grammar_element *> grammar_rules;
+
+    int ret = whisper_cli_prepare(ctx, params, wparams, grammar_rules);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (use_batch) {
+        if (!params.no_prints) {
+            fprintf(stderr, "\n");
+            fprintf(stderr, "system_info: n_threads = %d / %d | %s\n",
+                    params.n_threads*params.n_processors*std::min(params.n_parallel_files, (int) params.fname_inp.size()),
+                    std::thread::hardware_concurrency(), whisper_print_system_info());
+            fprintf(stderr, "\n");
+            fprintf(stderr, "%s: transcribing %d files, %d at a time, decoding on %d threads\n",
+                    __func__, (int) params.fname_inp.size(), params.n_parallel_files, params.n_io_threads);
+            fprintf(stderr, "\n");
+        }
+
+        // the segments are printed when the outputs of a file are written
+        wparams.print_progress = false;
+
+        const int n_failed = whisper_cli_batch(ctx, params, wparams, loras);
+
+        if (!params.no_prints) {
+            whisper_print_timings(ctx);
+        }
+        whisper_free(ctx);
+
+        return n_failed == 0 ? 0 : 10;
+    }
+
+    ret = whisper_cli_transcribe(ctx, ctx_large, params, wparams, argv[0]);
+    if (ret != 0) {
+        return ret;
+    }
+
     if (!params.no_prints) {
         whisper_print_timings(ctx);
+
+        if (ctx_large != nullptr) {
+            fprintf(stderr, "\n%s: cascade model '%s':\n", __func__, params.cascade_model.c_str());
+            whisper_print_timings(ctx_large);
+        }
     }
+    whisper_free(ctx_large);
     whisper_free(ctx);
 
     return 0;
@@ -20,6 +20,7 @@ cmake --build build --config Release
 #include "whisper.h"
 #include "grammar-parser.h"
 
+#include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <cstdio>
@@ -30,6 +31,9 @@ cmake --build build --config Release
 #include <cfloat>
 #include <csignal>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 
 #include <portaudio.h>
 
@@ -145,16 +149,52 @@ void signalHandler(int signum) {
     is_running = false;
 }
 
-// PortAudio callback function
-typedef struct {
-    std::vector<float> *recorded_data;
-    whisper_context *ctx;
-    whisper_params *params;
-    bool processing;
-    std::vector<float> buffer;
-    size_t buffer_size;
-    size_t buffer_index;
-} paUserData;
+// the audio is transcribed in chunks - while the worker transcribes one chunk, the PortAudio callback fills the
+// next one. the chunks are allocated up front, so the callback does not allocate or lock
+// with a VAD model the chunks are short and only fed to the streaming VAD, the worker transcribes each utterance when
+// its speech ends, and the other chunks hold the audio that arrives meanwhile
+static const int N_CHUNKS = 16;
+
+struct paUserData {
+    whisper_context *ctx    = nullptr;
+    whisper_params  *params = nullptr;
+
+    std::vector<float> chunks[N_CHUNKS];
+    size_t             chunk_size = 0;
+    int                n_chunks   = 2;
+
+    // set by the callback when a chunk is full, cleared by the worker once it is transcribed
+    std::atomic<bool> full[N_CHUNKS];
+    size_t            n_samples[N_CHUNKS] = {};
+    std::chrono::steady_clock::time_point t_full[N_CHUNKS];
+
+    // used only by the callback while the stream runs
+    int    chunk_index  = 0;
+    size_t sample_index = 0;
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::atomic<bool>       stop{false};
+
+    // backpressure
+    std::atomic<size_t> n_recorded{0};
+    std::atomic<size_t> n_dropped{0}; // samples that arrived while all chunks were waiting to be transcribed
+
+    // used only by the worker
+    size_t n_transcribed = 0;
+    double t_process_s   = 0.0;
+    double t_process_max = 0.0;
+    double t_wait_max    = 0.0; // time a full chunk waited for the worker
+
+    // the streaming VAD, used only by the worker
+    whisper_vad_context * vctx = nullptr;
+    whisper_vad_params    vad_params = whisper_vad_default_params();
+
+    // the audio since the end of the last utterance, starting at sample n_vad_past of the stream
+    std::vector<float> pcm_vad;
+    int64_t n_vad_past  = 0;
+    int64_t n_vad_start = 0;
+};
 
 static int recordCallback(const void *inputBuffer, void *outputBuffer,
                          unsigned long framesPerBuffer,
@@ -167,77 +207,189 @@ static int recordCallback(const void *inputBuffer, void *outputBuffer,
     (void)timeInfo;
     (void)statusFlags;
 
+    data->n_recorded += framesPerBuffer;
+
     if (in == NULL) {
-        // No input data - fill with zeros
-        for (unsigned long i = 0; i < framesPerBuffer; i++) {
-            data->recorded_data->push_back(0.0f);
-        }
-    } else {
-        // Copy input data to our buffer
-        for (unsigned long i = 0; i < framesPerBuffer; i++) {
-            data->recorded_data->push_back(in[i]);
-            
-            // Also add to the processing buffer
-            if (data->buffer_index < data->buffer_size) {
-                data->buffer[data->buffer_index++] = in[i];
-            }
+        return is_running ? paContinue : paComplete;
+    }
+
+    size_t i = 0;
+    while (i < framesPerBuffer) {
+        const int idx = data->chunk_index;
+        if (data->full[idx].load(std::memory_order_acquire)) {
+            // the worker has not transcribed this chunk yet - the audio cannot be kept
+            data->n_dropped += framesPerBuffer - i;
+            break;
         }
-        
-        // If buffer is full and we're not already processing
-        if (data->buffer_index >= data->buffer_size && !data->processing) {
-            // Process the audio buffer in a separate thread
-            data->processing = true;
-            std::thread([data]() {
-                // Create a copy of the buffer for processing
-                std::vector<float> process_buffer(data->buffer.begin(), data->buffer.end());
-                
-                // Process audio with whisper
-                whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-                
-                wparams.print_realtime   = true;
-                wparams.print_progress   = false;
-                wparams.print_timestamps = !data->params->no_timestamps;
-                wparams.print_special    = data->params->print_special;
-                wparams.translate        = data->params->translate;
-                wparams.language         = data->params->language.c_str();
-                wparams.detect_language  = data->params->detect_language;
-                wparams.n_threads        = data->params->n_threads;
-                wparams.offset_ms        = 0;
-                wparams.duration_ms      = 0;
-                
-                wparams.token_timestamps = false;
-                wparams.thold_pt         = data->params->word_thold;
-                wparams.max_len          = data->params->max_len;
-                wparams.split_on_word    = data->params->split_on_word;
-                
-                wparams.suppress_nst     = data->params->suppress_nst;
-                
-                // VAD options
-                wparams.vad              = data->params->vad;
-                if (data->params->vad) {
-                    wparams.vad_model_path = data->params->vad_model.c_str();
-                    wparams.vad_params.threshold = data->params->vad_threshold;
-                    wparams.vad_params.min_speech_duration_ms = data->params->vad_min_speech_duration_ms;
-                    wparams.vad_params.min_silence_duration_ms = data->params->vad_min_silence_duration_ms;
-                    wparams.vad_params.max_speech_duration_s = data->params->vad_max_speech_duration_s;
-                    wparams.vad_params.speech_pad_ms = data->params->vad_speech_pad_ms;
-                    wparams.vad_params.samples_overlap = data->params->vad_samples_overlap;
-                }
-                
-                if (whisper_full(data->ctx, wparams, process_buffer.data(), process_buffer.size()) != 0) {
-                    fprintf(stderr, "Failed to process audio\n");
-                }
-                
-                // Reset the buffer for the next chunk
-                data->buffer_index = 0;
-                data->processing = false;
-            }).detach();
+
+        const size_t n = std::min<size_t>(framesPerBuffer - i, data->chunk_size - data->sample_index);
+        memcpy(data->chunks[idx].data() + data->sample_index, in + i, n*sizeof(float));
+        data->sample_index += n;
+        i += n;
+
+        if (data->sample_index == data->chunk_size) {
+            data->n_samples[idx] = data->chunk_size;
+            data->t_full[idx]    = std::chrono::steady_clock::now();
+            data->full[idx].store(true, std::memory_order_release);
+
+            // notified without the mutex, so the callback never blocks - the worker also wakes up periodically in
+            // case the notification is missed
+            data->cv.notify_one();
+
+            data->chunk_index  = (idx + 1) % data->n_chunks;
+            data->sample_index = 0;
         }
     }
 
     return is_running ? paContinue : paComplete;
 }
 
+static void transcribe_chunk(whisper_context * ctx, const whisper_params & params, const float * samples, int n_samples, bool vad) {
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.print_realtime   = true;
+    wparams.print_progress   = false;
+    wparams.print_timestamps = !params.no_timestamps;
+    wparams.print_special    = params.print_special;
+    wparams.translate        = params.translate;
+    wparams.language         = params.language.c_str();
+    wparams.detect_language  = params.detect_language;
+    wparams.n_threads        = params.n_threads;
+    wparams.offset_ms        = 0;
+    wparams.duration_ms      = 0;
+
+    wparams.token_timestamps = false;
+    wparams.thold_pt         = params.word_thold;
+    wparams.max_len          = params.max_len;
+    wparams.split_on_word    = params.split_on_word;
+
+    wparams.suppress_nst     = params.suppress_nst;
+
+    // VAD options
+    wparams.vad              = vad;
+    if (vad) {
+        wparams.vad_model_path = params.vad_model.c_str();
+        wparams.vad_params.threshold = params.vad_threshold;
+        wparams.vad_params.min_speech_duration_ms = params.vad_min_speech_duration_ms;
+        wparams.vad_params.min_silence_duration_ms = params.vad_min_silence_duration_ms;
+        wparams.vad_params.max_speech_duration_s = params.vad_max_speech_duration_s;
+        wparams.vad_params.speech_pad_ms = params.vad_speech_pad_ms;
+        wparams.vad_params.samples_overlap = params.vad_samples_overlap;
+    }
+
+    if (whisper_full(ctx, wparams, samples, n_samples) != 0) {
+        fprintf(stderr, "Failed to process audio\n");
+    }
+}
+
+// feeds a chunk to the streaming VAD and transcribes the utterances that end in it, returns the transcribed samples
+static size_t transcribe_vad(paUserData * data, const float * samples, int n_samples, bool flush) {
+    const int sample_rate = data->params->sample_rate;
+
+    size_t n_transcribed = 0;
+
+    data->pcm_vad.insert(data->pcm_vad.end(), samples, samples + n_samples);
+
+    const int n_events = whisper_vad_feed(data->vctx, data->vad_params, samples, n_samples);
+    if (n_events < 0) {
+        fprintf(stderr, "Failed to process audio with VAD\n");
+        return 0;
+    }
+
+    std::vector<whisper_vad_event> events;
+    for (int i = 0; i < n_events; ++i) {
+        events.push_back(whisper_vad_get_event(data->vctx, i));
+    }
+
+    // the speech that is still going on when the recording stops ends with it
+    if (flush && whisper_vad_in_speech(data->vctx)) {
+        events.push_back({ false, float(data->n_vad_past + data->pcm_vad.size())/sample_rate });
+    }
+
+    for (const auto & event : events) {
+        const int64_t n_event = std::max(data->n_vad_past, (int64_t) (event.t*sample_rate));
+
+        if (event.speech) {
+            data->n_vad_start = n_event;
+            continue;
+        }
+
+        const int64_t i0 = std::max<int64_t>(0, data->n_vad_start - data->n_vad_past);
+        const int64_t i1 = std::min((int64_t) data->pcm_vad.size(), n_event - data->n_vad_past);
+
+        if (i1 > i0) {
+            transcribe_chunk(data->ctx, *data->params, data->pcm_vad.data() + i0, i1 - i0, false);
+            n_transcribed += i1 - i0;
+        }
+
+        data->pcm_vad.erase(data->pcm_vad.begin(), data->pcm_vad.begin() + i1);
+        data->n_vad_past += i1;
+    }
+
+    // outside of speech only the audio that can still be part of the next utterance is kept
+    const int n_keep = 30*sample_rate;
+    if (!whisper_vad_in_speech(data->vctx) && (int) data->pcm_vad.size() > n_keep) {
+        const int n_drop = data->pcm_vad.size() - n_keep;
+
+        data->pcm_vad.erase(data->pcm_vad.begin(), data->pcm_vad.begin() + n_drop);
+        data->n_vad_past += n_drop;
+    }
+
+    return n_transcribed;
+}
+
+// transcribes the chunks in the order they were filled, until the stream is stopped and all chunks are done
+static void transcribe_worker(paUserData * data) {
+    int idx = 0;
+    size_t n_dropped_prev = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(data->mutex);
+            data->cv.wait_for(lock, std::chrono::milliseconds(100), [&]() {
+                return data->full[idx].load(std::memory_order_acquire) || data->stop;
+            });
+        }
+
+        if (!data->full[idx].load(std::memory_order_acquire)) {
+            if (data->stop) {
+                if (data->vctx) {
+                    data->n_transcribed += transcribe_vad(data, nullptr, 0, true);
+                }
+                break;
+            }
+            continue;
+        }
+
+        const auto t_start = std::chrono::steady_clock::now();
+
+        if (data->vctx) {
+            data->n_transcribed += transcribe_vad(data, data->chunks[idx].data(), data->n_samples[idx], false);
+        } else {
+            transcribe_chunk(data->ctx, *data->params, data->chunks[idx].data(), data->n_samples[idx], data->params->vad);
+
+            data->n_transcribed += data->n_samples[idx];
+        }
+
+        const double t_wait    = std::chrono::duration<double>(t_start - data->t_full[idx]).count();
+        const double t_process = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+
+        data->t_process_s   += t_process;
+        data->t_process_max  = std::max(data->t_process_max, t_process);
+        data->t_wait_max     = std::max(data->t_wait_max, t_wait);
+
+        data->full[idx].store(false, std::memory_order_release);
+        idx = (idx + 1) % data->n_chunks;
+
+        const size_t n_dropped = data->n_dropped;
+        if (n_dropped > n_dropped_prev) {
+            fprintf(stderr, "\nwarning: transcription is slower than real time, dropped %.1f s of audio (%.1f s of audio took %.1f s)\n",
+                    double(n_dropped - n_dropped_prev)/data->params->sample_rate, double(data->chunk_size)/data->params->sample_rate, t_process);
+            n_dropped_prev = n_dropped;
+        }
+    }
+}
+
 static void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
 
 static char * whisper_param_turn_lowercase(char * in){
@@ -423,43 +575,10 @@ static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params
 struct whisper_print_user_data {
     const whisper_params * params;
 
-    const std::vector<std::vector<float>> * pcmf32s;
+    const stereo_energy * energy;
     int progress_prev;
 };
 
-static std::string estimate_diarization_speaker(std::vector<std::vector<float>> pcmf32s, int64_t t0, int64_t t1, bool id_only = false) {
-    std::string speaker = "";
-    const int64_t n_samples = pcmf32s[0].size();
-
-    const int64_t is0 = timestamp_to_sample(t0, n_samples, WHISPER_SAMPLE_RATE);
-    const int64_t is1 = timestamp_to_sample(t1, n_samples, WHISPER_SAMPLE_RATE);
-
-    double energy0 = 0.0f;
-    double energy1 = 0.0f;
-
-    for (int64_t j = is0; j < is1; j++) {
-        energy0 += fabs(pcmf32s[0][j]);
-        energy1 += fabs(pcmf32s[1][j]);
-    }
-
-    if (energy0 > 1.1*energy1) {
-        speaker = "0";
-    } else if (energy1 > 1.1*energy0) {
-        speaker = "1";
-    } else {
-        speaker = "?";
-    }
-
-    //printf("is0 = %lld, is1 = %lld, energy0 = %f, energy1 = %f, speaker = %s\n", is0, is1, energy0, energy1, speaker.c_str());
-
-    if (!id_only) {
-        speaker.insert(0, "(speaker ");
-        speaker.append(")");
-    }
-
-    return speaker;
-}
-
 static void whisper_print_progress_callback(struct whisper_context * /*ctx*/, struct whisper_state * /*state*/, int progress, void * user_data) {
     int progress_step = ((whisper_print_user_data *) user_data)->params->progress_step;
     int * progress_prev  = &(((whisper_print_user_data *) user_data)->progress_prev);
@@ -471,7 +590,7 @@ static void whisper_print_progress_callback(struct whisper_context * /*ctx*/, st
 
 static void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * /*state*/, int n_new, void * user_data) {
     const auto & params  = *((whisper_print_user_data *) user_data)->params;
-    const auto & pcmf32s = *((whisper_print_user_data *) user_data)->pcmf32s;
+    const auto & energy  = *((whisper_print_user_data *) user_data)->energy;
 
     const int n_segments = whisper_full_n_segments(ctx);
 
@@ -497,8 +616,8 @@ static void whisper_print_segment_callback(struct whisper_context * ctx, struct
             printf("[%s --> %s]  ", to_timestamp(t0).c_str(), to_timestamp(t1).c_str());
         }
 
-        if (params.diarize && pcmf32s.size() == 2) {
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+        if (params.diarize && !energy.empty()) {
+            speaker = estimate_diarization_speaker(energy, t0, t1);
         }
 
         if (params.print_colors) {
@@ -538,24 +657,24 @@ static void whisper_print_segment_callback(struct whisper_context * ctx, struct
     }
 }
 
-static void output_txt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
+static void output_txt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, const stereo_energy & energy) {
     const int n_segments = whisper_full_n_segments(ctx);
     for (int i = 0; i < n_segments; ++i) {
         const char * text = whisper_full_get_segment_text(ctx, i);
         std::string speaker = "";
 
-        if (params.diarize && pcmf32s.size() == 2)
+        if (params.diarize && !energy.empty())
         {
             const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
             const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+            speaker = estimate_diarization_speaker(energy, t0, t1);
         }
 
         fout << speaker << text << "\n";
     }
 }
 
-static void output_vtt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
+static void output_vtt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, const stereo_energy & energy) {
     fout << "WEBVTT\n\n";
 
     const int n_segments = whisper_full_n_segments(ctx);
@@ -565,9 +684,9 @@ static void output_vtt(struct whisper_context * ctx, std::ofstream & fout, const
         const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
         std::string speaker = "";
 
-        if (params.diarize && pcmf32s.size() == 2)
+        if (params.diarize && !energy.empty())
         {
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1, true);
+            speaker = estimate_diarization_speaker(energy, t0, t1, true);
             speaker.insert(0, "<v Speaker");
             speaker.append(">");
         }
@@ -577,7 +696,7 @@ static void output_vtt(struct whisper_context * ctx, std::ofstream & fout, const
     }
 }
 
-static void output_srt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
+static void output_srt(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, const stereo_energy & energy) {
     const int n_segments = whisper_full_n_segments(ctx);
     for (int i = 0; i < n_segments; ++i) {
         const char * text = whisper_full_get_segment_text(ctx, i);
@@ -585,9 +704,9 @@ static void output_srt(struct whisper_context * ctx, std::ofstream & fout, const
         const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
         std::string speaker = "";
 
-        if (params.diarize && pcmf32s.size() == 2)
+        if (params.diarize && !energy.empty())
         {
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+            speaker = estimate_diarization_speaker(energy, t0, t1);
         }
 
         fout << i + 1 + params.offset_n << "\n";
@@ -659,10 +778,10 @@ static char * escape_double_quotes_in_csv(const char * str) {
     return escaped;
 }
 
-static void output_csv(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
+static void output_csv(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, const stereo_energy & energy) {
     const int n_segments = whisper_full_n_segments(ctx);
     fout << "start,end,";
-    if (params.diarize && pcmf32s.size() == 2)
+    if (params.diarize && !energy.empty())
     {
         fout << "speaker,";
     }
@@ -676,15 +795,15 @@ static void output_csv(struct whisper_context * ctx, std::ofstream & fout, const
 
         //need to multiply times returned from whisper_full_get_segment_t{0,1}() by 10 to get milliseconds.
         fout << 10 * t0 << "," << 10 * t1 << ",";
-        if (params.diarize && pcmf32s.size() == 2)
+        if (params.diarize && !energy.empty())
         {
-            fout << estimate_diarization_speaker(pcmf32s, t0, t1, true) << ",";
+            fout << estimate_diarization_speaker(energy, t0, t1, true) << ",";
         }
         fout << "\"" << text_escaped << "\"\n";
     }
 }
 
-static void output_score(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & /*params*/, std::vector<std::vector<float>> /*pcmf32s*/) {
+static void output_score(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & /*params*/, const stereo_energy & /*energy*/) {
     const int n_segments = whisper_full_n_segments(ctx);
     // fprintf(stderr,"segments: %d\n",n_segments);
     for (int i = 0; i < n_segments; ++i) {
@@ -703,7 +822,7 @@ static void output_json(
              struct whisper_context * ctx,
                       std::ofstream & fout,
                const whisper_params & params,
-    std::vector<std::vector<float>>   pcmf32s) {
+    const stereo_energy &             energy) {
     const bool full = params.output_jsn_full;
     int indent = 0;
 
@@ -845,8 +964,8 @@ static void output_json(
                         end_arr(!params.diarize && !params.tinydiarize);
                     }
 
-                    if (params.diarize && pcmf32s.size() == 2) {
-                        value_s("speaker", estimate_diarization_speaker(pcmf32s, t0, t1, true).c_str(), true);
+                    if (params.diarize && !energy.empty()) {
+                        value_s("speaker", estimate_diarization_speaker(energy, t0, t1, true).c_str(), true);
                     }
 
                     if (params.tinydiarize) {
@@ -862,7 +981,7 @@ static void output_json(
 // karaoke video generation
 // outputs a bash script that uses ffmpeg to generate a video with the subtitles
 // TODO: font parameter adjustments
-static bool output_wts(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s, const char * fname_inp, float t_sec, const char * fname_out) {
+static bool output_wts(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, const stereo_energy & energy, const char * fname_inp, float t_sec, const char * fname_out) {
     static const char * font = params.font_path.c_str();
 
     std::ifstream fin(font);
@@ -897,8 +1016,8 @@ static bool output_wts(struct whisper_context * ctx, std::ofstream & fout, const
         bool is_first = true;
         std::string speaker = "";
 
-        if (params.diarize && pcmf32s.size() == 2) {
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+        if (params.diarize && !energy.empty()) {
+            speaker = estimate_diarization_speaker(energy, t0, t1);
         }
 
         for (int j = 0; j < n; ++j) {
@@ -912,7 +1031,7 @@ static bool output_wts(struct whisper_context * ctx, std::ofstream & fout, const
             std::string txt_fg = ""; // highlight token
             std::string txt_ul = ""; // underline
 
-            if (params.diarize && pcmf32s.size() == 2) {
+            if (params.diarize && !energy.empty()) {
                 txt_bg = speaker;
                 txt_fg = speaker;
                 txt_ul = "\\ \\ \\ \\ \\ \\ \\ \\ \\ \\ \\ ";
@@ -983,7 +1102,7 @@ static bool output_wts(struct whisper_context * ctx, std::ofstream & fout, const
     return true;
 }
 
-static void output_lrc(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
+static void output_lrc(struct whisper_context * ctx, std::ofstream & fout, const whisper_params & params, const stereo_energy & energy) {
     fout << "[by:whisper.cpp]\n";
 
     const int n_segments = whisper_full_n_segments(ctx);
@@ -1002,11 +1121,11 @@ static void output_lrc(struct whisper_context * ctx, std::ofstream & fout, const
         std::string timestamp_lrc = std::string(buf);
         std::string speaker = "";
 
-        if (params.diarize && pcmf32s.size() == 2)
+        if (params.diarize && !energy.empty())
         {
             const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
             const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+            speaker = estimate_diarization_speaker(energy, t0, t1);
         }
 
         fout <<  '[' << timestamp_lrc << ']' << speaker << text << "\n";
@@ -1206,15 +1325,40 @@ int main(int argc, char ** argv) {
     inputParameters.hostApiSpecificStreamInfo = NULL;
 
     // Create user data for the audio callback
-    std::vector<float> recorded_data;
     paUserData userData;
-    userData.recorded_data = &recorded_data;
     userData.ctx = ctx;
     userData.params = &params;
-    userData.processing = false;
-    userData.buffer_size = params.sample_rate * 3; // 3 seconds buffer
-    userData.buffer.resize(userData.buffer_size);
-    userData.buffer_index = 0;
+    userData.chunk_size = params.sample_rate * 3; // 3 seconds chunks
+
+    // with a VAD model, the inference runs when the speech ends instead of after each chunk
+    if (params.vad && !params.vad_model.empty()) {
+        whisper_vad_context_params vcparams = whisper_vad_default_context_params();
+        vcparams.n_threads = params.n_threads;
+
+        userData.vctx = whisper_vad_init_from_file_with_params(params.vad_model.c_str(), vcparams);
+        if (userData.vctx == nullptr) {
+            fprintf(stderr, "error: failed to load the VAD model '%s'\n", params.vad_model.c_str());
+            whisper_free(ctx);
+            Pa_Terminate();
+            return 3;
+        }
+
+        userData.vad_params.threshold               = params.vad_threshold;
+        userData.vad_params.min_speech_duration_ms  = params.vad_min_speech_duration_ms;
+        userData.vad_params.min_silence_duration_ms = params.vad_min_silence_duration_ms;
+        userData.vad_params.max_speech_duration_s   = std::min(params.vad_max_speech_duration_s, 30.0f);
+        userData.vad_params.speech_pad_ms           = params.vad_speech_pad_ms;
+
+        userData.chunk_size = params.sample_rate / 2; // 0.5 seconds chunks, the latency of the speech events
+        userData.n_chunks   = N_CHUNKS;
+    }
+
+    for (int i = 0; i < N_CHUNKS; i++) {
+        userData.chunks[i].resize(i < userData.n_chunks ? userData.chunk_size : 0);
+        userData.full[i] = false;
+    }
+
+    std::thread worker(transcribe_worker, &userData);
 
     // Open the audio stream
     PaStream *stream;
@@ -1229,6 +1373,9 @@ int main(int argc, char ** argv) {
     
     if (err != paNoError) {
         fprintf(stderr, "PortAudio error: %s\n", Pa_GetErrorText(err));
+        userData.stop = true;
+        worker.join();
+        whisper_vad_free(userData.vctx);
         whisper_free(ctx);
         Pa_Terminate();
         return 1;
@@ -1239,6 +1386,9 @@ int main(int argc, char ** argv) {
     if (err != paNoError) {
         fprintf(stderr, "PortAudio error: %s\n", Pa_GetErrorText(err));
         Pa_CloseStream(stream);
+        userData.stop = true;
+        worker.join();
+        whisper_vad_free(userData.vctx);
         whisper_free(ctx);
         Pa_Terminate();
         return 1;
@@ -1277,10 +1427,32 @@ int main(int argc, char ** argv) {
         fprintf(stderr, "PortAudio error: %s\n", Pa_GetErrorText(err));
     }
 
+    // the callback is stopped - the partial chunk is transcribed too
+    {
+        const int idx = userData.chunk_index;
+        if (userData.sample_index > 0 && !userData.full[idx]) {
+            userData.n_samples[idx] = userData.sample_index;
+            userData.t_full[idx]    = std::chrono::steady_clock::now();
+            userData.full[idx]      = true;
+        }
+    }
+
+    userData.stop = true;
+    userData.cv.notify_one();
+    worker.join();
+
     // Clean up
     Pa_Terminate();
+    whisper_vad_free(userData.vctx);
     whisper_free(ctx);
 
-    printf("Recording stopped. Processed %zu samples.\n", recorded_data.size());
+    const double sr = params.sample_rate;
+
+    printf("Recording stopped. Recorded %.1f s, transcribed %.1f s, dropped %.1f s of audio.\n",
+            userData.n_recorded/sr, userData.n_transcribed/sr, userData.n_dropped/sr);
+    if (userData.n_transcribed > 0) {
+        printf("Transcription: %.2fx real time, slowest chunk %.2f s, longest wait for the worker %.2f s.\n",
+                userData.t_process_s/(userData.n_transcribed/sr), userData.t_process_max, userData.t_wait_max);
+    }
     return 0;
 }
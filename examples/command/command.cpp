@@ -16,6 +16,7 @@
 #include <cstdio>
 #include <fstream>
 #include <map>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -29,6 +30,7 @@ struct whisper_params {
     int32_t capture_id = -1;
     int32_t max_tokens = 32;
     int32_t audio_ctx  = 0;
+    int32_t enc_reuse_ms = 200;
 
     float vad_thold  = 0.6f;
     float freq_thold = 100.0f;
@@ -72,6 +74,7 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-c"   || arg == "--capture")       { params.capture_id    = std::stoi(argv[++i]); }
         else if (arg == "-mt"  || arg == "--max-tokens")    { params.max_tokens    = std::stoi(argv[++i]); }
         else if (arg == "-ac"  || arg == "--audio-ctx")     { params.audio_ctx     = std::stoi(argv[++i]); }
+        else if (arg == "-erm" || arg == "--enc-reuse-ms")  { params.enc_reuse_ms  = std::stoi(argv[++i]); }
         else if (arg == "-vth" || arg == "--vad-thold")     { params.vad_thold     = std::stof(argv[++i]); }
         else if (arg == "-fth" || arg == "--freq-thold")    { params.freq_thold    = std::stof(argv[++i]); }
         else if (arg == "-tr"  || arg == "--translate")     { params.translate     = true; }
@@ -110,6 +113,7 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  -c ID,      --capture ID     [%-7d] capture device ID\n",                           params.capture_id);
     fprintf(stderr, "  -mt N,      --max-tokens N   [%-7d] maximum number of tokens per audio chunk\n",    params.max_tokens);
     fprintf(stderr, "  -ac N,      --audio-ctx N    [%-7d] audio context size (0 - all)\n",                params.audio_ctx);
+    fprintf(stderr, "  -erm N,     --enc-reuse-ms N [%-7d] reuse the last encode if the audio moved less (0 - never)\n", params.enc_reuse_ms);
     fprintf(stderr, "  -vth N,     --vad-thold N    [%-7.2f] voice activity detection threshold\n",        params.vad_thold);
     fprintf(stderr, "  -fth N,     --freq-thold N   [%-7.2f] high-pass frequency cutoff\n",                params.freq_thold);
     fprintf(stderr, "  -tr,        --translate      [%-7s] translate from source language to english\n",   params.translate ? "true" : "false");
@@ -264,39 +268,25 @@ static int process_command_list(struct whisper_context * ctx, audio_async &audio
 
     int max_len = 0;
 
-    std::vector<std::vector<whisper_token>> allowed_tokens;
-
+    std::vector<const char *> allowed_cstrs;
     for (const auto & cmd : allowed_commands) {
-        whisper_token tokens[1024];
-        allowed_tokens.emplace_back();
-
-        for (int l = 0; l < (int) cmd.size(); ++l) {
-            // NOTE: very important to add the whitespace !
-            //       the reason is that the first decoded token starts with a whitespace too!
-            std::string ss = std::string(" ") + cmd.substr(0, l + 1);
-
-            const int n = whisper_tokenize(ctx, ss.c_str(), tokens, 1024);
-            if (n < 0) {
-                fprintf(stderr, "%s: error: failed to tokenize command '%s'\n", __func__, cmd.c_str());
-                return 3;
-            }
+        allowed_cstrs.push_back(cmd.c_str());
+        max_len = std::max(max_len, (int) cmd.size());
+    }
 
-            if (n == 1) {
-                allowed_tokens.back().push_back(tokens[0]);
-            }
-        }
+    // the token trie of the commands, scored after a single encode and prompt decode
+    std::unique_ptr<whisper_commands, decltype(&whisper_commands_free)> commands(
+            whisper_commands_init(ctx, allowed_cstrs.data(), allowed_cstrs.size()), whisper_commands_free);
 
-        max_len = std::max(max_len, (int) cmd.size());
+    if (!commands) {
+        fprintf(stderr, "%s: error: failed to tokenize the commands\n", __func__);
+        return 3;
     }
 
     fprintf(stderr, "%s: allowed commands [ tokens ]:\n", __func__);
     fprintf(stderr, "\n");
     for (int i = 0; i < (int) allowed_commands.size(); ++i) {
-        fprintf(stderr, "  - \033[1m%-*s\033[0m = [", max_len, allowed_commands[i].c_str());
-        for (const auto & token : allowed_tokens[i]) {
-            fprintf(stderr, " %5d", token);
-        }
-        fprintf(stderr, " ]\n");
+        fprintf(stderr, "  - \033[1m%-*s\033[0m = [ %d ]\n", max_len, allowed_commands[i].c_str(), whisper_commands_n_tokens(commands.get(), i));
     }
 
     std::string k_prompt = "select one from the available words: ";
@@ -337,6 +327,8 @@ static int process_command_list(struct whisper_context * ctx, audio_async &audio
     std::vector<float> pcmf32_cur;
     std::vector<float> pcmf32_prompt;
 
+    std::vector<whisper_command_score> scores(allowed_commands.size());
+
     // main loop
     while (is_running) {
         // handle Ctrl + C
@@ -354,103 +346,42 @@ static int process_command_list(struct whisper_context * ctx, audio_async &audio
 
             whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
 
-            wparams.print_progress   = false;
-            wparams.print_special    = params.print_special;
-            wparams.print_realtime   = false;
-            wparams.print_timestamps = !params.no_timestamps;
             wparams.translate        = params.translate;
-            wparams.no_context       = true;
-            wparams.single_segment   = true;
-            wparams.max_tokens       = 1;
             wparams.language         = params.language.c_str();
             wparams.n_threads        = params.n_threads;
 
             wparams.audio_ctx        = params.audio_ctx;
+            wparams.enc_reuse_ms     = params.enc_reuse_ms;
 
             wparams.prompt_tokens    = k_tokens.data();
             wparams.prompt_n_tokens  = k_tokens.size();
 
-            // run the transformer and a single decoding pass
-            if (whisper_full(ctx, wparams, pcmf32_cur.data(), pcmf32_cur.size()) != 0) {
-                fprintf(stderr, "%s: ERROR: whisper_full() failed\n", __func__);
+            // run the encoder and score all commands in a single batched decode
+            if (whisper_commands_score(ctx, commands.get(), wparams, pcmf32_cur.data(), pcmf32_cur.size(), scores.data()) != 0) {
+                fprintf(stderr, "%s: ERROR: whisper_commands_score() failed\n", __func__);
                 break;
             }
 
-            // estimate command probability
-            // NOTE: not optimal
+            // print the commands and the respective probabilities
             {
-                const auto * logits = whisper_get_logits(ctx);
-
-                std::vector<float> probs(whisper_n_vocab(ctx), 0.0f);
-
-                // compute probs from logits via softmax
-                {
-                    float max = -1e9;
-                    for (int i = 0; i < (int) probs.size(); ++i) {
-                        max = std::max(max, logits[i]);
-                    }
-
-                    float sum = 0.0f;
-                    for (int i = 0; i < (int) probs.size(); ++i) {
-                        probs[i] = expf(logits[i] - max);
-                        sum += probs[i];
-                    }
-
-                    for (int i = 0; i < (int) probs.size(); ++i) {
-                        probs[i] /= sum;
-                    }
-                }
-
-                std::vector<std::pair<float, int>> probs_id;
-
-                double psum = 0.0;
-                for (int i = 0; i < (int) allowed_commands.size(); ++i) {
-                    probs_id.emplace_back(probs[allowed_tokens[i][0]], i);
-                    for (int j = 1; j < (int) allowed_tokens[i].size(); ++j) {
-                        probs_id.back().first += probs[allowed_tokens[i][j]];
-                    }
-                    probs_id.back().first /= allowed_tokens[i].size();
-                    psum += probs_id.back().first;
-                }
-
-                // normalize
-                for (auto & p : probs_id) {
-                    p.first /= psum;
-                }
-
-                // sort descending
-                {
-                    using pair_type = decltype(probs_id)::value_type;
-                    std::sort(probs_id.begin(), probs_id.end(), [](const pair_type & a, const pair_type & b) {
-                        return a.first > b.first;
-                    });
-                }
-
-                // print the commands and the respective probabilities
-                {
-                    fprintf(stdout, "\n");
-                    for (const auto & cmd : probs_id) {
-                        fprintf(stdout, "%s: %s%-*s%s = %f | ", __func__, "\033[1m", max_len, allowed_commands[cmd.second].c_str(), "\033[0m", cmd.first);
-                        for (int token : allowed_tokens[cmd.second]) {
-                            fprintf(stdout, "'%4s' %f ", whisper_token_to_str(ctx, token), probs[token]);
-                        }
-                        fprintf(stdout, "\n");
-                    }
+                fprintf(stdout, "\n");
+                for (const auto & score : scores) {
+                    fprintf(stdout, "%s: %s%-*s%s = %f | logprob = %f\n", __func__, "\033[1m", max_len, allowed_commands[score.id].c_str(), "\033[0m", score.p, score.logprob);
                 }
+            }
 
-                // best command
-                {
-                    const auto t_end = std::chrono::high_resolution_clock::now();
+            // best command
+            {
+                const auto t_end = std::chrono::high_resolution_clock::now();
 
-                    const float prob = probs_id[0].first;
-                    const int index = probs_id[0].second;
+                const float prob = scores[0].p;
+                const int index = scores[0].id;
 
-                    fprintf(stdout, "\n");
-                    fprintf(stdout, "%s: detected command: %s%s%s | p = %f | t = %d ms\n", __func__,
-                            "\033[1m", allowed_commands[index].c_str(), "\033[0m", prob,
-                            (int) std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_start).count());
-                    fprintf(stdout, "\n");
-                }
+                fprintf(stdout, "\n");
+                fprintf(stdout, "%s: detected command: %s%s%s | p = %f | t = %d ms\n", __func__,
+                        "\033[1m", allowed_commands[index].c_str(), "\033[0m", prob,
+                        (int) std::chrono::duration_cast<std::chrono::milliseconds>(t_end - t_start).count());
+                fprintf(stdout, "\n");
             }
 
             audio.clear();
@@ -1,7 +1,11 @@
 #include "common-ggml.h"
 
+#include <algorithm>
+#include <atomic>
+#include <future>
 #include <regex>
 #include <map>
+#include <thread>
 
 static const std::map<std::string, enum ggml_ftype> GGML_FTYPE_MAP = {
     {"q4_0", GGML_FTYPE_MOSTLY_Q4_0},
@@ -38,12 +42,57 @@ enum ggml_ftype ggml_parse_ftype(const char * str) {
     return ftype;
 }
 
+// quantizes the nrows rows of src (F32 or F16) to dst on nthread threads
+// the F16 rows are converted to F32 in chunks, so no F32 copy of the whole tensor is needed
+static size_t ggml_common_quantize_rows(ggml_type qtype, ggml_type ttype, const void * src, void * dst, int64_t nrows, int64_t n_per_row, int nthread) {
+    const int64_t chunk_rows = 16;
+    const int64_t n_chunks   = (nrows + chunk_rows - 1)/chunk_rows;
+
+    const size_t row_size = ggml_row_size(qtype, n_per_row);
+
+    std::atomic<int64_t> next { 0 };
+    std::atomic<size_t>  total { 0 };
+
+    auto worker = [&]() {
+        std::vector<float> f32;
+
+        for (int64_t ic = next++; ic < n_chunks; ic = next++) {
+            const int64_t row0 = ic*chunk_rows;
+            const int64_t n    = std::min(chunk_rows, nrows - row0);
+
+            const float * rows = (const float *) src + row0*n_per_row;
+            if (ttype == GGML_TYPE_F16) {
+                f32.resize(n*n_per_row);
+                ggml_fp16_to_fp32_row((const ggml_fp16_t *) src + row0*n_per_row, f32.data(), n*n_per_row);
+                rows = f32.data();
+            }
+
+            total += ggml_quantize_chunk(qtype, rows, (char *) dst + row0*row_size, 0, n, n_per_row, nullptr);
+        }
+    };
+
+    nthread = (int) std::max<int64_t>(1, std::min<int64_t>(nthread, n_chunks));
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < nthread; ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto & w : workers) {
+        w.join();
+    }
+
+    return total;
+}
+
 bool ggml_common_quantize_0(
         std::ifstream & finp,
         std::ofstream & fout,
         const ggml_ftype ftype,
         const std::vector<std::string> & to_quant,
-        const std::vector<std::string> & to_skip) {
+        const std::vector<std::string> & to_skip,
+        int nthread,
+        const std::vector<std::pair<std::string, ggml_type>> & to_type) {
 
     ggml_type qtype = GGML_TYPE_F32;
 
@@ -83,14 +132,34 @@ bool ggml_common_quantize_0(
         return false;
     }
 
+    for (const auto & t : to_type) {
+        if (!ggml_is_quantized(t.second)) {
+            fprintf(stderr, "%s: invalid quantization type %d (%s) for '%s'\n", __func__, t.second, ggml_type_name(t.second), t.first.c_str());
+            return false;
+        }
+    }
+
+    if (nthread <= 0) {
+        nthread = std::max(1u, std::thread::hardware_concurrency());
+    }
+
     size_t total_size_org = 0;
     size_t total_size_new = 0;
 
-    std::vector<float> work;
+    std::vector<uint8_t> data_u8;
+
+    // the output of a tensor (header and data) is written while the next one is read and quantized
+    std::vector<char> out;
+    std::vector<char> out_prev;
+    std::future<bool> write_prev;
 
-    std::vector<uint8_t>     data_u8;
-    std::vector<ggml_fp16_t> data_f16;
-    std::vector<float>       data_f32;
+    auto wait_write = [&]() {
+        if (write_prev.valid() && !write_prev.get()) {
+            fprintf(stderr, "%s: failed to write the output file\n", __func__);
+            return false;
+        }
+        return true;
+    };
 
     while (true) {
         int32_t n_dims;
@@ -138,97 +207,75 @@ bool ggml_common_quantize_0(
         // quantize only 2D tensors
         quantize &= (n_dims == 2);
 
-        if (quantize) {
-            if (ttype != GGML_TYPE_F32 && ttype != GGML_TYPE_F16) {
-                fprintf(stderr, "%s: unsupported ttype %d (%s) for integer quantization\n", __func__, ttype, ggml_type_name((ggml_type) ttype));
-                return false;
-            }
+        if (quantize && ttype != GGML_TYPE_F32 && ttype != GGML_TYPE_F16) {
+            fprintf(stderr, "%s: unsupported ttype %d (%s) for integer quantization\n", __func__, ttype, ggml_type_name((ggml_type) ttype));
+            return false;
+        }
 
-            if (ttype == GGML_TYPE_F16) {
-                data_f16.resize(nelements);
-                finp.read(reinterpret_cast<char *>(data_f16.data()), nelements * sizeof(ggml_fp16_t));
-                data_f32.resize(nelements);
-                for (int i = 0; i < nelements; ++i) {
-                    data_f32[i] = ggml_fp16_to_fp32(data_f16[i]);
-                }
-            } else {
-                data_f32.resize(nelements);
-                finp.read(reinterpret_cast<char *>(data_f32.data()), nelements * sizeof(float));
-            }
+        const int bpe = (ttype == 0) ? sizeof(float) : sizeof(uint16_t);
 
-            ttype = qtype;
-        } else {
-            const int bpe = (ttype == 0) ? sizeof(float) : sizeof(uint16_t);
+        data_u8.resize((size_t) nelements*bpe);
+        finp.read(reinterpret_cast<char *>(data_u8.data()), data_u8.size());
+
+        // the type of this tensor
+        ggml_type ctype = qtype;
+        for (const auto & t : to_type) {
+            if (quantize && std::regex_match(name, std::regex(t.first))) {
+                ctype = t.second;
+                break;
+            }
+        }
 
-            data_u8.resize(nelements*bpe);
-            finp.read(reinterpret_cast<char *>(data_u8.data()), nelements * bpe);
+        const int32_t ttype_src = ttype;
+        if (quantize) {
+            ttype = ctype;
         }
 
-        fout.write(reinterpret_cast<char *>(&n_dims), sizeof(n_dims));
-        fout.write(reinterpret_cast<char *>(&length), sizeof(length));
-        fout.write(reinterpret_cast<char *>(&ttype),  sizeof(ttype));
+        out.clear();
+
+        auto append = [&](const void * data, size_t size) {
+            out.insert(out.end(), (const char *) data, (const char *) data + size);
+        };
+
+        append(&n_dims, sizeof(n_dims));
+        append(&length, sizeof(length));
+        append(&ttype,  sizeof(ttype));
         for (int i = 0; i < n_dims; ++i) {
-            fout.write(reinterpret_cast<char *>(&ne[i]), sizeof(ne[i]));
+            append(&ne[i], sizeof(ne[i]));
         }
-        fout.write(&name[0], length);
+        append(&name[0], length);
 
         if (quantize) {
-            work.resize(nelements); // for quantization
-
-            size_t cur_size = 0;
-            switch ((ggml_type) ttype) {
-                case GGML_TYPE_Q4_0:
-                case GGML_TYPE_Q4_1:
-                case GGML_TYPE_Q5_0:
-                case GGML_TYPE_Q5_1:
-                case GGML_TYPE_Q8_0:
-                case GGML_TYPE_Q2_K:
-                case GGML_TYPE_Q3_K:
-                case GGML_TYPE_Q4_K:
-                case GGML_TYPE_Q5_K:
-                case GGML_TYPE_Q6_K:
-                    {
-                        cur_size = ggml_quantize_chunk((ggml_type) ttype, data_f32.data(), work.data(), 0, nelements/ne[0], ne[0], nullptr);
-                    } break;
-                case GGML_TYPE_F32:
-                case GGML_TYPE_F16:
-                case GGML_TYPE_I8:
-                case GGML_TYPE_I16:
-                case GGML_TYPE_I32:
-                case GGML_TYPE_I64:
-                case GGML_TYPE_F64:
-                case GGML_TYPE_Q8_1:
-                case GGML_TYPE_Q8_K:
-                case GGML_TYPE_IQ2_XXS:
-                case GGML_TYPE_IQ2_XS:
-                case GGML_TYPE_IQ2_S:
-                case GGML_TYPE_IQ3_XXS:
-                case GGML_TYPE_IQ3_S:
-                case GGML_TYPE_IQ1_S:
-                case GGML_TYPE_IQ4_NL:
-                case GGML_TYPE_IQ4_XS:
-                case GGML_TYPE_IQ1_M:
-                case GGML_TYPE_BF16:
-                case GGML_TYPE_TQ1_0:
-                case GGML_TYPE_TQ2_0:
-                case GGML_TYPE_COUNT:
-                    {
-                        fprintf(stderr, "%s: unsupported quantization type %d (%s)\n", __func__, ttype, ggml_type_name((ggml_type) ttype));
-                        return false;
-                    }
-            }
+            const size_t offs = out.size();
+
+            out.resize(offs + ggml_row_size(ctype, ne[0])*(nelements/ne[0]));
+
+            const size_t cur_size = ggml_common_quantize_rows(ctype, (ggml_type) ttype_src, data_u8.data(), out.data() + offs, nelements/ne[0], ne[0], nthread);
 
-            fout.write(reinterpret_cast<char *>(work.data()), cur_size);
             total_size_new += cur_size;
 
-            printf("size = %8.2f MB -> %8.2f MB\n", nelements * sizeof(float)/1024.0/1024.0, cur_size/1024.0/1024.0);
+            printf("size = %8.2f MB -> %8.2f MB (%s)\n", nelements * sizeof(float)/1024.0/1024.0, cur_size/1024.0/1024.0, ggml_type_name(ctype));
         } else {
             printf("size = %8.3f MB\n", data_u8.size()/1024.0/1024.0);
-            fout.write(reinterpret_cast<char *>(data_u8.data()), data_u8.size());
+            append(data_u8.data(), data_u8.size());
             total_size_new += data_u8.size();
         }
 
         total_size_org += nelements * sizeof(float);
+
+        if (!wait_write()) {
+            return false;
+        }
+
+        std::swap(out, out_prev);
+        write_prev = std::async(std::launch::async, [&fout, &out_prev]() {
+            fout.write(out_prev.data(), out_prev.size());
+            return fout.good();
+        });
+    }
+
+    if (!wait_write()) {
+        return false;
     }
 
     printf("%s: model size  = %8.2f MB\n", __func__, total_size_org/1024.0/1024.0);
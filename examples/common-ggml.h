@@ -5,6 +5,7 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include <utility>
 
 enum ggml_ftype ggml_parse_ftype(const char * str);
 
@@ -15,4 +16,6 @@ bool ggml_common_quantize_0(
         std::ofstream & fout,
         const ggml_ftype ftype,
         const std::vector<std::string> & to_quant,
-        const std::vector<std::string> & to_skip);
+        const std::vector<std::string> & to_skip,
+        int nthread = 0, // 0 = number of hardware threads
+        const std::vector<std::pair<std::string, ggml_type>> & to_type = {}); // regexes of quantized tensors with their own type, the first match wins
@@ -1,11 +1,18 @@
 #include "common-sdl.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
 
 audio_async::audio_async(int len_ms) {
     m_len_ms = len_ms;
 
     m_running = false;
+
+    m_n_writing = 0;
+    m_n_written = 0;
+    m_n_wait    = UINT64_MAX;
 }
 
 audio_async::~audio_async() {
@@ -125,12 +132,7 @@ bool audio_async::clear() {
         return false;
     }
 
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
-
-        m_audio_pos = 0;
-        m_audio_len = 0;
-    }
+    m_n_cleared = m_n_written.load(std::memory_order_acquire);
 
     return true;
 }
@@ -149,65 +151,114 @@ void audio_async::callback(uint8_t * stream, int len) {
         stream += (len - (n_samples * sizeof(float)));
     }
 
-    //fprintf(stderr, "%s: %zu samples, pos %zu, len %zu\n", __func__, n_samples, m_audio_pos, m_audio_len);
+    //fprintf(stderr, "%s: %zu samples, written %llu\n", __func__, n_samples, (unsigned long long) m_n_written.load());
 
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
+    const uint64_t n_written = m_n_written.load(std::memory_order_relaxed);
+    const size_t   pos       = n_written % m_audio.size();
+
+    // announce the range that is about to be overwritten before touching the samples (see overrun())
+    m_n_writing.store(n_written + n_samples, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (pos + n_samples > m_audio.size()) {
+        const size_t n0 = m_audio.size() - pos;
+
+        memcpy(&m_audio[pos], stream, n0 * sizeof(float));
+        memcpy(&m_audio[0], stream + n0 * sizeof(float), (n_samples - n0) * sizeof(float));
+    } else {
+        memcpy(&m_audio[pos], stream, n_samples * sizeof(float));
+    }
+
+    m_n_written.store(n_written + n_samples, std::memory_order_release);
 
-        if (m_audio_pos + n_samples > m_audio.size()) {
-            const size_t n0 = m_audio.size() - m_audio_pos;
+    if (n_written + n_samples >= m_n_wait.load(std::memory_order_acquire)) {
+        m_wait_cv.notify_one();
+    }
+}
+
+void audio_async::get(int ms, std::vector<float> & result, uint64_t * pos) {
+    result.clear();
+
+    audio_span span;
 
-            memcpy(&m_audio[m_audio_pos], stream, n0 * sizeof(float));
-            memcpy(&m_audio[0], stream + n0 * sizeof(float), (n_samples - n0) * sizeof(float));
-        } else {
-            memcpy(&m_audio[m_audio_pos], stream, n_samples * sizeof(float));
+    // retry if the callback wrapped around the oldest samples while they were copied
+    do {
+        if (!peek(ms, span)) {
+            return;
         }
-        m_audio_pos = (m_audio_pos + n_samples) % m_audio.size();
-        m_audio_len = std::min(m_audio_len + n_samples, m_audio.size());
+
+        result.resize(span.size());
+
+        memcpy(result.data(), span.p0, span.n0 * sizeof(float));
+        memcpy(result.data() + span.n0, span.p1, span.n1 * sizeof(float));
+    } while (overrun(span));
+
+    if (pos) {
+        *pos = span.pos;
     }
 }
 
-void audio_async::get(int ms, std::vector<float> & result) {
+bool audio_async::peek(int ms, audio_span & span) {
     if (!m_dev_id_in) {
         fprintf(stderr, "%s: no audio device to get audio from!\n", __func__);
-        return;
+        return false;
     }
 
     if (!m_running) {
         fprintf(stderr, "%s: not running!\n", __func__);
-        return;
+        return false;
     }
 
-    result.clear();
+    if (ms <= 0) {
+        ms = m_len_ms;
+    }
 
-    {
-        std::lock_guard<std::mutex> lock(m_mutex);
+    const uint64_t n_written = m_n_written.load(std::memory_order_acquire);
+    const uint64_t n_avail   = std::min<uint64_t>(n_written - m_n_cleared, m_audio.size());
+    const size_t   n_samples = std::min<uint64_t>((uint64_t) m_sample_rate * ms / 1000, n_avail);
 
-        if (ms <= 0) {
-            ms = m_len_ms;
-        }
+    const size_t s0 = (n_written - n_samples) % m_audio.size();
+    const size_t n0 = std::min(n_samples, m_audio.size() - s0);
 
-        size_t n_samples = (m_sample_rate * ms) / 1000;
-        if (n_samples > m_audio_len) {
-            n_samples = m_audio_len;
-        }
+    span.p0  = m_audio.data() + s0;
+    span.n0  = n0;
+    span.p1  = m_audio.data();
+    span.n1  = n_samples - n0;
+    span.pos = n_written - n_samples;
 
-        result.resize(n_samples);
+    return true;
+}
 
-        int s0 = m_audio_pos - n_samples;
-        if (s0 < 0) {
-            s0 += m_audio.size();
-        }
+bool audio_async::overrun(const audio_span & span) const {
+    // the samples read before this point are intact if the callback has not started overwriting them yet
+    std::atomic_thread_fence(std::memory_order_acquire);
 
-        if (s0 + n_samples > m_audio.size()) {
-            const size_t n0 = m_audio.size() - s0;
+    return span.pos + m_audio.size() < m_n_writing.load(std::memory_order_relaxed);
+}
 
-            memcpy(result.data(), &m_audio[s0], n0 * sizeof(float));
-            memcpy(&result[n0], &m_audio[0], (n_samples - n0) * sizeof(float));
-        } else {
-            memcpy(result.data(), &m_audio[s0], n_samples * sizeof(float));
-        }
+bool audio_async::wait(int ms, int timeout_ms) {
+    if (!m_running) {
+        fprintf(stderr, "%s: not running!\n", __func__);
+        return false;
     }
+
+    const uint64_t n_target = m_n_cleared + (uint64_t) m_sample_rate * ms / 1000;
+
+    const auto t_end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    // the callback notifies without taking the mutex - a wakeup lost between the check and the sleep is repeated by
+    // the next callback, since it notifies every time the target has been reached
+    std::unique_lock<std::mutex> lock(m_wait_mutex);
+
+    m_n_wait.store(n_target, std::memory_order_release);
+
+    const bool res = m_wait_cv.wait_until(lock, t_end, [&] {
+        return m_n_written.load(std::memory_order_acquire) >= n_target;
+    });
+
+    m_n_wait.store(UINT64_MAX, std::memory_order_relaxed);
+
+    return res;
 }
 
 bool sdl_poll_events() {
@@ -4,6 +4,7 @@
 #include <SDL_audio.h>
 
 #include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <vector>
 #include <mutex>
@@ -12,6 +13,20 @@
 // SDL Audio capture
 //
 
+// two contiguous views into the capture ring buffer - the samples in [p0, p0 + n0) are followed by [p1, p1 + n1)
+struct audio_span {
+    const float * p0 = nullptr;
+    size_t        n0 = 0;
+    const float * p1 = nullptr;
+    size_t        n1 = 0;
+
+    uint64_t pos = 0; // index of the first sample since the start of the capture
+
+    size_t size() const { return n0 + n1; }
+};
+
+// the SDL callback is the single producer and the thread calling get() / peek() / wait() / clear() is the single
+// consumer - the callback never takes a lock, so a slow consumer cannot block the audio thread
 class audio_async {
 public:
     audio_async(int len_ms);
@@ -29,7 +44,17 @@ public:
     void callback(uint8_t * stream, int len);
 
     // get audio data from the circular buffer
-    void get(int ms, std::vector<float> & audio);
+    // pos is set to the index of the first sample since the start of the capture
+    void get(int ms, std::vector<float> & audio, uint64_t * pos = nullptr);
+
+    // zero-copy access to the last ms of audio (or less, if not captured yet)
+    // the views stay valid until the callback wraps around them - check with overrun() after using them
+    bool peek(int ms, audio_span & span);
+    bool overrun(const audio_span & span) const;
+
+    // block until at least ms of audio has been captured since the last clear(), or until timeout_ms has passed
+    // returns false on timeout
+    bool wait(int ms, int timeout_ms);
 
 private:
     SDL_AudioDeviceID m_dev_id_in = 0;
@@ -38,11 +63,22 @@ private:
     int m_sample_rate = 0;
 
     std::atomic_bool m_running;
-    std::mutex       m_mutex;
 
     std::vector<float> m_audio;
-    size_t             m_audio_pos = 0;
-    size_t             m_audio_len = 0;
+
+    // number of samples written by the callback since the start of the capture
+    // m_n_writing is advanced before the callback overwrites the ring and m_n_written after it is done
+    std::atomic<uint64_t> m_n_writing;
+    std::atomic<uint64_t> m_n_written;
+
+    // consumer side: m_n_written at the last clear()
+    uint64_t m_n_cleared = 0;
+
+    // value of m_n_written that the consumer is waiting for (UINT64_MAX if not waiting)
+    std::atomic<uint64_t> m_n_wait;
+
+    std::mutex              m_wait_mutex;
+    std::condition_variable m_wait_cv;
 };
 
 // Return false if need to quit
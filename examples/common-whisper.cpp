@@ -29,17 +29,405 @@
 #ifdef _WIN32
 #include <fcntl.h>
 #include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstring>
 #include <fstream>
 
 #ifdef WHISPER_FFMPEG
 // as implemented in ffmpeg_trancode.cpp only embedded in common lib if whisper built with ffmpeg support
-extern bool ffmpeg_decode_audio(const std::string & ifname, std::vector<uint8_t> & wav_data);
+extern int ffmpeg_decode_audio(const std::string & ifname, std::vector<uint8_t> & wav_data);
+extern int ffmpeg_decode_audio_memory(const uint8_t * data, size_t size, std::vector<uint8_t> & wav_data);
+#endif
+
+// read-only view of the content of a file, memory-mapped so that the samples are converted straight from the page cache
+struct audio_file_view {
+    const uint8_t * data = nullptr;
+    size_t          size = 0;
+
+#ifdef _WIN32
+    HANDLE h_map = nullptr;
+#endif
+
+    audio_file_view() = default;
+    audio_file_view(const audio_file_view &) = delete;
+    audio_file_view & operator=(const audio_file_view &) = delete;
+
+    bool open(const std::string & fname) {
+#ifdef _WIN32
+        HANDLE h_file = CreateFileA(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (h_file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER file_size;
+        if (!GetFileSizeEx(h_file, &file_size) || file_size.QuadPart == 0) {
+            CloseHandle(h_file);
+            return false;
+        }
+
+        h_map = CreateFileMappingA(h_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(h_file);
+        if (h_map == nullptr) {
+            return false;
+        }
+
+        data = (const uint8_t *) MapViewOfFile(h_map, FILE_MAP_READ, 0, 0, 0);
+        if (data == nullptr) {
+            return false;
+        }
+
+        size = (size_t) file_size.QuadPart;
+#else
+        const int fd = ::open(fname.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void * addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+
+#if defined(MADV_SEQUENTIAL)
+        madvise(addr, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+        data = (const uint8_t *) addr;
+        size = st.st_size;
+#endif
+
+        return true;
+    }
+
+    ~audio_file_view() {
+#ifdef _WIN32
+        if (data) {
+            UnmapViewOfFile(data);
+        }
+        if (h_map) {
+            CloseHandle(h_map);
+        }
+#else
+        if (data) {
+            munmap((void *) data, size);
+        }
 #endif
+    }
+};
+
+// the samples of a WAV file that can be converted without miniaudio - 16-bit PCM or 32-bit float, mono or stereo
+struct wav_samples {
+    bool            is_float    = false;
+    int             n_channels  = 0;
+    int             sample_rate = 0;
+    const uint8_t * data        = nullptr;
+    size_t          n_frames    = 0;
+};
+
+static uint32_t wav_read_u16(const uint8_t * p) { return p[0] | (p[1] << 8); }
+static uint32_t wav_read_u32(const uint8_t * p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24); }
+
+static bool wav_parse(const uint8_t * data, size_t size, wav_samples & wav) {
+    if (size < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+
+    bool has_fmt = false;
+
+    for (size_t offs = 12; offs + 8 <= size; ) {
+        const uint8_t * chunk = data + offs;
+
+        const size_t n_chunk = wav_read_u32(chunk + 4);
+        const size_t n_avail = size - offs - 8;
+
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            if (n_chunk < 16 || n_avail < 16) {
+                return false;
+            }
+
+            uint32_t format = wav_read_u16(chunk + 8);
+            if (format == 0xFFFE) {
+                // WAVE_FORMAT_EXTENSIBLE - the format is at the start of the sub-format GUID
+                if (n_chunk < 40 || n_avail < 40) {
+                    return false;
+                }
+                format = wav_read_u16(chunk + 8 + 24);
+            }
+
+            const uint32_t bits = wav_read_u16(chunk + 8 + 14);
+
+            if (!(format == 1 && bits == 16) && !(format == 3 && bits == 32)) {
+                return false;
+            }
+
+            wav.is_float    = format == 3;
+            wav.n_channels  = wav_read_u16(chunk + 8 + 2);
+            wav.sample_rate = wav_read_u32(chunk + 8 + 4);
+
+            has_fmt = true;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!has_fmt || wav.n_channels < 1 || wav.n_channels > 2 || wav.sample_rate <= 0) {
+                return false;
+            }
+
+            // a streamed file can have a placeholder size, the samples then run to the end of the file
+            wav.data     = chunk + 8;
+            wav.n_frames = std::min(n_chunk, n_avail)/((wav.is_float ? 4 : 2)*wav.n_channels);
+
+            return true;
+        }
+
+        offs += 8 + n_chunk + (n_chunk & 1);
+    }
+
+    return false;
+}
+
+// converts n frames to float in a single pass: the channels are averaged into dst0 or split into dst0 and dst1 when
+// dst1 is set, and dsti (optional) gets them interleaved as well. the loads go through memcpy, the chunk of the
+// samples is not always aligned, and each loop is simple enough to be vectorized by the compiler
+template <typename T>
+static void wav_to_f32(const uint8_t * GGML_RESTRICT src, int n_channels, size_t n, float scale,
+        float * GGML_RESTRICT dst0, float * GGML_RESTRICT dst1, float * GGML_RESTRICT dsti) {
+    T x[2];
+
+    if (n_channels == 1) {
+        for (size_t i = 0; i < n; ++i) {
+            memcpy(x, src + i*sizeof(T), sizeof(T));
+            dst0[i] = scale*x[0];
+        }
+        if (dst1) {
+            memcpy(dst1, dst0, n*sizeof(float));
+        }
+        if (dsti) {
+            for (size_t i = 0; i < n; ++i) {
+                dsti[2*i + 0] = dst0[i];
+                dsti[2*i + 1] = dst0[i];
+            }
+        }
+    } else if (dst1 == nullptr) {
+        const float scale_mix = 0.5f*scale;
+        for (size_t i = 0; i < n; ++i) {
+            memcpy(x, src + 2*i*sizeof(T), 2*sizeof(T));
+            dst0[i] = scale_mix*((float) x[0] + (float) x[1]);
+        }
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            memcpy(x, src + 2*i*sizeof(T), 2*sizeof(T));
+            dst0[i] = scale*x[0];
+            dst1[i] = scale*x[1];
+        }
+        if (dsti) {
+            for (size_t i = 0; i < 2*n; i += 2) {
+                memcpy(x, src + i*sizeof(T), 2*sizeof(T));
+                dsti[i + 0] = scale*x[0];
+                dsti[i + 1] = scale*x[1];
+            }
+        }
+    }
+}
+
+static void wav_to_f32(const wav_samples & wav, size_t n, float * dst0, float * dst1, float * dsti) {
+    if (wav.is_float) {
+        wav_to_f32<float>  (wav.data, wav.n_channels, n, 1.0f,        dst0, dst1, dsti);
+    } else {
+        wav_to_f32<int16_t>(wav.data, wav.n_channels, n, 1.0f/32768, dst0, dst1, dsti);
+    }
+}
+
+// polyphase windowed-sinc resampler to WHISPER_SAMPLE_RATE
+// the output sample n is at the input position n*M/L, between the input samples i and i + 1 at the phase p/L
+struct audio_resampler {
+    static constexpr int n_zeros    = 16;   // zero crossings of the sinc on each side
+    static constexpr int n_phases_max = 1024; // other ratios are left to miniaudio
+
+    int L = 1;
+    int M = 1;
+    int K = 0;      // the taps of the output sample n are at the input samples i - K + 1 ... i + K
+    int n_taps = 0; // 2*K, rounded up to a multiple of 8
+
+    std::vector<float> filter; // L phases of n_taps coefficients
+
+    bool init(int sample_rate) {
+        int a = sample_rate;
+        int b = WHISPER_SAMPLE_RATE;
+        while (b != 0) {
+            const int t = a % b;
+            a = b;
+            b = t;
+        }
+
+        L = WHISPER_SAMPLE_RATE/a;
+        M = sample_rate/a;
+
+        if (L > n_phases_max) {
+            return false;
+        }
+
+        // cut slightly below the lower of the two Nyquist frequencies, relative to the input one
+        const double fc = 0.95*std::min(1.0, (double) L/M);
+
+        K      = (int) std::ceil(n_zeros/fc);
+        n_taps = (2*K + 7)/8*8;
+
+        filter.assign((size_t) L*n_taps, 0.0f);
+
+        for (int p = 0; p < L; ++p) {
+            float * h = filter.data() + (size_t) p*n_taps;
+
+            double sum = 0.0;
+            for (int k = 0; k < 2*K; ++k) {
+                const double t = k - K + 1 - (double) p/L;
+                const double u = t/K;
+
+                const double sinc   = t == 0.0 ? 1.0 : std::sin(M_PI*fc*t)/(M_PI*fc*t);
+                const double window = std::fabs(u) >= 1.0 ? 0.0 : 0.42 + 0.5*std::cos(M_PI*u) + 0.08*std::cos(2.0*M_PI*u);
+
+                h[k] = (float) (fc*sinc*window);
+                sum += h[k];
+            }
+
+            // unit gain at DC for every phase
+            for (int k = 0; k < 2*K; ++k) {
+                h[k] = (float) (h[k]/sum);
+            }
+        }
+
+        return true;
+    }
+
+    int64_t n_out(int64_t n_in) const {
+        return (n_in*L + M - 1)/M;
+    }
+
+    // x must be readable from x[-K] to x[n_in + n_taps - 1], zero outside of the n_in samples
+    void run(const float * GGML_RESTRICT x, float * GGML_RESTRICT y, int64_t n) const {
+        int64_t i = 0;
+        int     p = 0;
+
+        for (int64_t j = 0; j < n; ++j) {
+            const float * GGML_RESTRICT xs = x + i - K + 1;
+            const float * GGML_RESTRICT h  = filter.data() + (size_t) p*n_taps;
+
+            // independent partial sums, so that the compiler can vectorize the dot product
+            float acc[8] = { 0.0f };
+            for (int k = 0; k < n_taps; k += 8) {
+                for (int l = 0; l < 8; ++l) {
+                    acc[l] += xs[k + l]*h[k + l];
+                }
+            }
+
+            y[j] = ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+
+            i += M/L;
+            p += M%L;
+            if (p >= L) {
+                p -= L;
+                i += 1;
+            }
+        }
+    }
+};
+
+// decodes the WAV data without miniaudio, in the layout of read_audio_data
+// returns false, without touching the outputs, for the formats and the sample rates that are left to miniaudio
+static bool read_wav_fast(const uint8_t * data, size_t size, std::vector<float> & pcmf32, std::vector<std::vector<float>> & pcmf32s, bool stereo) {
+    wav_samples wav;
+    if (!wav_parse(data, size, wav)) {
+        return false;
+    }
+
+    if (wav.sample_rate == WHISPER_SAMPLE_RATE) {
+        const size_t n = wav.n_frames;
+
+        if (stereo) {
+            pcmf32.resize(2*n);
+            pcmf32s.resize(2);
+            pcmf32s[0].resize(n);
+            pcmf32s[1].resize(n);
+
+            wav_to_f32(wav, n, pcmf32s[0].data(), pcmf32s[1].data(), pcmf32.data());
+        } else {
+            pcmf32.resize(n);
+
+            wav_to_f32(wav, n, pcmf32.data(), nullptr, nullptr);
+        }
+
+        return true;
+    }
+
+    audio_resampler resampler;
+    if (!resampler.init(wav.sample_rate)) {
+        return false;
+    }
+
+    const int n_ch = stereo ? 2 : 1;
+
+    const int64_t n_in  = wav.n_frames;
+    const int64_t n_out = resampler.n_out(n_in);
+
+    // the channels of the input, with the zero padding of the resampler at both ends
+    const int64_t n_pad_l = resampler.K;
+    const int64_t n_pad_r = resampler.n_taps;
+
+    std::vector<float> planar(n_ch*(n_pad_l + n_in + n_pad_r), 0.0f);
+
+    float * x0 = planar.data() + n_pad_l;
+    float * x1 = stereo ? x0 + n_in + n_pad_r + n_pad_l : nullptr;
+
+    wav_to_f32(wav, n_in, x0, x1, nullptr);
+
+    if (stereo) {
+        pcmf32s.resize(2);
+        pcmf32s[0].resize(n_out);
+        pcmf32s[1].resize(n_out);
+
+        resampler.run(x0, pcmf32s[0].data(), n_out);
+        resampler.run(x1, pcmf32s[1].data(), n_out);
+
+        pcmf32.resize(2*n_out);
+        for (int64_t i = 0; i < n_out; ++i) {
+            pcmf32[2*i + 0] = pcmf32s[0][i];
+            pcmf32[2*i + 1] = pcmf32s[1][i];
+        }
+    } else {
+        pcmf32.resize(n_out);
+
+        resampler.run(x0, pcmf32.data(), n_out);
+    }
+
+    return true;
+}
 
 bool read_audio_data(const std::string & fname, std::vector<float>& pcmf32, std::vector<std::vector<float>>& pcmf32s, bool stereo) {
+    // 16-bit PCM and 32-bit float WAV data is converted directly, from a memory mapping for files
+    if (fname != "-") {
+        audio_file_view view;
+
+        const bool is_file = fname.find('\0') == std::string::npos && view.open(fname);
+
+        if (is_file ? read_wav_fast(view.data, view.size, pcmf32, pcmf32s, stereo) :
+                      read_wav_fast((const uint8_t *) fname.data(), fname.size(), pcmf32, pcmf32s, stereo)) {
+            return true;
+        }
+    }
+
     std::vector<uint8_t> audio_data; // used for pipe input from stdin or ffmpeg decoding output
 
     ma_result result;
@@ -63,6 +451,12 @@ bool read_audio_data(const std::string & fname, std::vector<float>& pcmf32, std:
 			audio_data.insert(audio_data.end(), buf, buf + n);
 		}
 
+		if (read_wav_fast(audio_data.data(), audio_data.size(), pcmf32, pcmf32s, stereo)) {
+			fprintf(stderr, "%s: read %zu bytes from stdin\n", __func__, audio_data.size());
+
+			return true;
+		}
+
 		if ((result = ma_decoder_init_memory(audio_data.data(), audio_data.size(), &decoder_config, &decoder)) != MA_SUCCESS) {
 
 			fprintf(stderr, "Error: failed to open audio data from stdin (%s)\n", ma_result_description(result));
@@ -73,25 +467,30 @@ bool read_audio_data(const std::string & fname, std::vector<float>& pcmf32, std:
 		fprintf(stderr, "%s: read %zu bytes from stdin\n", __func__, audio_data.size());
     }
     else if (((result = ma_decoder_init_file(fname.c_str(), &decoder_config, &decoder)) != MA_SUCCESS)) {
+		// not a path - try to decode the content in memory (WAV, MP3, FLAC, OGG)
+		if ((result = ma_decoder_init_memory(fname.c_str(), fname.size(), &decoder_config, &decoder)) != MA_SUCCESS) {
 #if defined(WHISPER_FFMPEG)
-		if (ffmpeg_decode_audio(fname, audio_data) != 0) {
-			fprintf(stderr, "error: failed to ffmpeg decode '%s'\n", fname.c_str());
-
-			return false;
-		}
+			// let libav* decode any other container to an in-memory WAV
+			const bool is_path = fname.find('\0') == std::string::npos && std::ifstream(fname).good();
+			const int ret = is_path ? ffmpeg_decode_audio(fname, audio_data) :
+				ffmpeg_decode_audio_memory((const uint8_t *) fname.data(), fname.size(), audio_data);
+			if (ret != 0) {
+				fprintf(stderr, "error: failed to ffmpeg decode '%s'\n", is_path ? fname.c_str() : "<memory>");
+
+				return false;
+			}
 
-		if ((result = ma_decoder_init_memory(audio_data.data(), audio_data.size(), &decoder_config, &decoder)) != MA_SUCCESS) {
-			fprintf(stderr, "error: failed to read audio data as wav (%s)\n", ma_result_description(result));
+			if ((result = ma_decoder_init_memory(audio_data.data(), audio_data.size(), &decoder_config, &decoder)) != MA_SUCCESS) {
+				fprintf(stderr, "error: failed to read audio data as wav (%s)\n", ma_result_description(result));
 
-			return false;
-		}
+				return false;
+			}
 #else
-		if ((result = ma_decoder_init_memory(fname.c_str(), fname.size(), &decoder_config, &decoder)) != MA_SUCCESS) {
 			fprintf(stderr, "error: failed to read audio data as wav (%s)\n", ma_result_description(result));
 
 			return false;
-		}
 #endif
+		}
     }
 
     ma_uint64 frame_count;
@@ -147,6 +546,225 @@ int timestamp_to_sample(int64_t t, int n_samples, int whisper_sample_rate) {
     return std::max(0, std::min((int) n_samples - 1, (int) ((t*whisper_sample_rate)/100)));
 }
 
+stereo_energy::stereo_energy(const std::vector<std::vector<float>> & pcmf32s) {
+    if (pcmf32s.size() != 2) {
+        return;
+    }
+
+    for (int c = 0; c < 2; ++c) {
+        const auto & pcm = pcmf32s[c];
+
+        cum[c].resize(pcm.size() + 1);
+        cum[c][0] = 0.0;
+        for (size_t i = 0; i < pcm.size(); ++i) {
+            cum[c][i + 1] = cum[c][i] + fabs(pcm[i]);
+        }
+    }
+}
+
+std::string estimate_diarization_speaker(const stereo_energy & energy, int64_t t0, int64_t t1, bool id_only) {
+    std::string speaker = "";
+    const int n_samples = energy.n_samples();
+
+    const int is0 = timestamp_to_sample(t0, n_samples, WHISPER_SAMPLE_RATE);
+    const int is1 = timestamp_to_sample(t1, n_samples, WHISPER_SAMPLE_RATE);
+
+    const double energy0 = energy.energy(0, is0, is1);
+    const double energy1 = energy.energy(1, is0, is1);
+
+    if (energy0 > 1.1*energy1) {
+        speaker = "0";
+    } else if (energy1 > 1.1*energy0) {
+        speaker = "1";
+    } else {
+        speaker = "?";
+    }
+
+    if (!id_only) {
+        speaker.insert(0, "(speaker ");
+        speaker.append(")");
+    }
+
+    return speaker;
+}
+
+void whisper_get_result_tokens(struct whisper_context * ctx, std::vector<int32_t> & tokens) {
+    tokens.clear();
+
+    const int n_max = whisper_n_text_ctx(ctx)/2;
+
+    // count from the end, so only the kept tokens are copied
+    int n_skip = -n_max;
+
+    const int n_segments = whisper_full_n_segments(ctx);
+    for (int i = 0; i < n_segments; ++i) {
+        n_skip += whisper_full_n_tokens(ctx, i);
+    }
+
+    tokens.reserve(std::min(n_max, n_max + n_skip));
+
+    for (int i = 0; i < n_segments; ++i) {
+        const int n_tokens = whisper_full_n_tokens(ctx, i);
+        for (int j = std::max(0, std::min(n_tokens, n_skip)); j < n_tokens; ++j) {
+            tokens.push_back(whisper_full_get_token_id(ctx, i, j));
+        }
+        n_skip -= n_tokens;
+    }
+}
+
+static int64_t stream_metrics_time_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+stream_metrics::stream_metrics() : t_end_us(stream_metrics_time_us()) {
+}
+
+void stream_metrics::audio_ready(struct whisper_context * ctx) {
+    const whisper_state_stats stats = whisper_get_stats(ctx);
+
+    t_audio_us = stream_metrics_time_us();
+
+    mel0_ms    = stats.mel_ms;
+    encode0_ms = stats.encode_ms;
+    decode0_ms = stats.decode_ms + stats.batchd_ms + stats.prompt_ms + stats.sample_ms;
+}
+
+void stream_metrics::inferred(struct whisper_context * ctx) {
+    const whisper_state_stats stats = whisper_get_stats(ctx);
+
+    t_inferred_us = stream_metrics_time_us();
+
+    mel_ms    = stats.mel_ms    - mel0_ms;
+    encode_ms = stats.encode_ms - encode0_ms;
+    decode_ms = stats.decode_ms + stats.batchd_ms + stats.prompt_ms + stats.sample_ms - decode0_ms;
+}
+
+void stream_metrics::emitted(int n_samples) {
+    const int64_t t_now_us = stream_metrics_time_us();
+
+    step s;
+    s.audio_ms   = 1000.0f*n_samples/WHISPER_SAMPLE_RATE;
+    s.wait_ms    = 1e-3f*(t_audio_us - t_end_us);
+    s.mel_ms     = mel_ms;
+    s.encode_ms  = encode_ms;
+    s.decode_ms  = decode_ms;
+    s.emit_ms    = 1e-3f*(t_now_us - t_inferred_us);
+    s.latency_ms = 1e-3f*(t_now_us - t_audio_us);
+    s.rtf        = s.audio_ms > 0.0f ? s.latency_ms/s.audio_ms : 0.0f;
+
+    steps.push_back(s);
+
+    t_end_us = t_now_us;
+}
+
+void stream_metrics::drop(int n_samples) {
+    n_drops++;
+    n_dropped += n_samples;
+}
+
+struct stream_metrics_stage {
+    const char * name;
+    float stream_metrics::step::* value;
+};
+
+static const stream_metrics_stage k_stream_metrics_stages[] = {
+    { "wait_ms",    &stream_metrics::step::wait_ms    },
+    { "mel_ms",     &stream_metrics::step::mel_ms     },
+    { "encode_ms",  &stream_metrics::step::encode_ms  },
+    { "decode_ms",  &stream_metrics::step::decode_ms  },
+    { "emit_ms",    &stream_metrics::step::emit_ms    },
+    { "latency_ms", &stream_metrics::step::latency_ms },
+    { "rtf",        &stream_metrics::step::rtf        },
+};
+
+// upper bounds of the buckets of the real time factor histogram, the last bucket is everything above
+static const float k_stream_metrics_rtf_buckets[] = { 0.1f, 0.25f, 0.5f, 0.75f, 1.0f, 1.5f, 2.0f };
+
+struct stream_metrics_percentiles {
+    float p50 = 0.0f;
+    float p99 = 0.0f;
+    float max = 0.0f;
+};
+
+static stream_metrics_percentiles stream_metrics_get_percentiles(const std::vector<stream_metrics::step> & steps, float stream_metrics::step::* value) {
+    stream_metrics_percentiles res;
+    if (steps.empty()) {
+        return res;
+    }
+
+    std::vector<float> v(steps.size());
+    for (size_t i = 0; i < steps.size(); ++i) {
+        v[i] = steps[i].*value;
+    }
+    std::sort(v.begin(), v.end());
+
+    res.p50 = v[(v.size() - 1)*50/100];
+    res.p99 = v[(v.size() - 1)*99/100];
+    res.max = v.back();
+
+    return res;
+}
+
+void stream_metrics::print(FILE * f) const {
+    double audio_ms = 0.0;
+    for (const auto & s : steps) {
+        audio_ms += s.audio_ms;
+    }
+
+    fprintf(f, "\n");
+    fprintf(f, "stream metrics: %d steps, %.1f s of audio, %d drops (%.1f s of audio dropped)\n",
+            (int) steps.size(), 1e-3*audio_ms, (int) n_drops, (double) n_dropped/WHISPER_SAMPLE_RATE);
+    fprintf(f, "  %-12s %9s %9s %9s\n", "", "p50", "p99", "max");
+    for (const auto & stage : k_stream_metrics_stages) {
+        const stream_metrics_percentiles p = stream_metrics_get_percentiles(steps, stage.value);
+        fprintf(f, "  %-12s %9.2f %9.2f %9.2f\n", stage.name, p.p50, p.p99, p.max);
+    }
+    fprintf(f, "\n");
+}
+
+bool stream_metrics::write_json(const std::string & fname) const {
+    FILE * f = fopen(fname.c_str(), "w");
+    if (f == nullptr) {
+        return false;
+    }
+
+    double audio_ms = 0.0;
+    for (const auto & s : steps) {
+        audio_ms += s.audio_ms;
+    }
+
+    const int n_buckets = sizeof(k_stream_metrics_rtf_buckets)/sizeof(k_stream_metrics_rtf_buckets[0]);
+
+    std::vector<int> counts(n_buckets + 1, 0);
+    for (const auto & s : steps) {
+        counts[std::upper_bound(k_stream_metrics_rtf_buckets, k_stream_metrics_rtf_buckets + n_buckets, s.rtf) - k_stream_metrics_rtf_buckets]++;
+    }
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"steps\": %d,\n", (int) steps.size());
+    fprintf(f, "  \"audio_ms\": %.1f,\n", audio_ms);
+    fprintf(f, "  \"drops\": %d,\n", (int) n_drops);
+    fprintf(f, "  \"dropped_ms\": %.1f,\n", 1000.0*n_dropped/WHISPER_SAMPLE_RATE);
+    for (const auto & stage : k_stream_metrics_stages) {
+        const stream_metrics_percentiles p = stream_metrics_get_percentiles(steps, stage.value);
+        fprintf(f, "  \"%s\": { \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n", stage.name, p.p50, p.p99, p.max);
+    }
+    fprintf(f, "  \"rtf_histogram\": { \"le\": [");
+    for (int i = 0; i < n_buckets; ++i) {
+        fprintf(f, "%s%.2f", i > 0 ? ", " : "", k_stream_metrics_rtf_buckets[i]);
+    }
+    fprintf(f, ", \"inf\"], \"count\": [");
+    for (int i = 0; i <= n_buckets; ++i) {
+        fprintf(f, "%s%d", i > 0 ? ", " : "", counts[i]);
+    }
+    fprintf(f, "] }\n");
+    fprintf(f, "}\n");
+
+    fclose(f);
+
+    return true;
+}
+
 bool speak_with_file(const std::string & command, const std::string & text, const std::string & path, int voice_id) {
     std::ofstream speak_file(path.c_str());
     if (speak_file.fail()) {
@@ -3,11 +3,14 @@
 #include <string>
 #include <vector>
 #include <cstdint>
+#include <cstdio>
 
 // Read WAV audio file and store the PCM data into pcmf32
 // fname can be a buffer of WAV data instead of a filename
 // The sample rate of the audio must be equal to COMMON_SAMPLE_RATE
 // If stereo flag is set and the audio has 2 channels, the pcmf32s will contain 2 channel PCM
+// Mono and stereo WAV data of 16-bit PCM or 32-bit float samples is converted without miniaudio, from a memory
+// mapping of the file, and resampled with a polyphase filter when its sample rate is not WHISPER_SAMPLE_RATE
 bool read_audio_data(
         const std::string & fname,
         std::vector<float> & pcmf32,
@@ -20,5 +23,80 @@ std::string to_timestamp(int64_t t, bool comma = false);
 // given a timestamp get the sample
 int timestamp_to_sample(int64_t t, int n_samples, int whisper_sample_rate);
 
+// cumulative absolute amplitude of the two channels of a stereo recording, for the energy-based speaker detection
+// of --diarize - it is built once per input and the energy of any range of samples is the difference of two entries
+struct stereo_energy {
+    std::vector<double> cum[2]; // cum[c][i] - sum of |pcmf32s[c][j]| for j < i
+
+    stereo_energy() = default;
+
+    // empty unless pcmf32s has 2 channels
+    explicit stereo_energy(const std::vector<std::vector<float>> & pcmf32s);
+
+    bool empty() const { return cum[0].empty(); }
+
+    int n_samples() const { return empty() ? 0 : (int) cum[0].size() - 1; }
+
+    // energy of channel c in the samples [i0, i1)
+    double energy(int c, int i0, int i1) const { return i1 > i0 ? cum[c][i1] - cum[c][i0] : 0.0; }
+};
+
+// "0" or "1" if the channel has over 1.1 times the energy of the other one between t0 and t1, "?" otherwise
+// the result is formatted as "(speaker 0)" unless id_only is set
+std::string estimate_diarization_speaker(const stereo_energy & energy, int64_t t0, int64_t t1, bool id_only = false);
+
+struct whisper_context;
+
+// replace tokens with the tokens (whisper_token) of the last whisper_full() result, for the prompt of the next call
+// only the last n_text_ctx/2 tokens are kept - whisper_full() does not use more of the prompt
+void whisper_get_result_tokens(struct whisper_context * ctx, std::vector<int32_t> & tokens);
+
+// latency and real time factor of the steps of the streaming examples
+// a step starts when its audio is available and ends when its text is emitted - the stages are measured with the
+// counters of the default state of the context, so whisper_full() must run on it
+struct stream_metrics {
+    struct step {
+        float audio_ms;   // new audio transcribed by the step
+        float wait_ms;    // from the end of the previous step until the audio was available
+        float mel_ms;
+        float encode_ms;
+        float decode_ms;  // decoder passes, prompt and sampling
+        float emit_ms;    // printing and writing the result
+        float latency_ms; // from the audio being available until its text was emitted
+        float rtf;        // latency_ms / audio_ms
+    };
+
+    std::vector<step> steps;
+
+    int64_t n_drops   = 0; // times audio was dropped because the processing was too slow
+    int64_t n_dropped = 0; // dropped samples
+
+    stream_metrics();
+
+    void audio_ready(struct whisper_context * ctx);
+    void inferred   (struct whisper_context * ctx);
+    void emitted    (int n_samples);
+
+    void drop(int n_samples);
+
+    // p50 / p99 / max of the stages and a histogram of the real time factor
+    void print(FILE * f) const;
+    bool write_json(const std::string & fname) const;
+
+private:
+    int64_t t_end_us      = 0; // end of the previous step
+    int64_t t_audio_us    = 0;
+    int64_t t_inferred_us = 0;
+
+    float mel_ms    = 0.0f;
+    float encode_ms = 0.0f;
+    float decode_ms = 0.0f;
+
+    // the counters at audio_ready()
+    float mel0_ms    = 0.0f;
+    float encode0_ms = 0.0f;
+    float decode0_ms = 0.0f;
+};
+
 // write text to file, and call system("command voice_id file")
 bool speak_with_file(const std::string & command, const std::string & text, const std::string & path, int voice_id);
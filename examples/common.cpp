@@ -2,6 +2,7 @@
 
 #include "common.h"
 
+#include <algorithm>
 #include <cmath>
 #include <codecvt>
 #include <cstring>
@@ -645,6 +646,120 @@ bool vad_simple(std::vector<float> & pcmf32, int sample_rate, int last_ms, float
     return true;
 }
 
+vad_energy::vad_energy(int sample_rate, int window_ms, int last_ms, float vad_thold, float freq_thold)
+    : n_block(std::max(1, sample_rate/100)),
+      n_blocks_all(std::max(2, window_ms/10)),
+      n_blocks_last(std::min(std::max(1, last_ms/10), n_blocks_all - 1)),
+      vad_thold(vad_thold),
+      hp_enabled(freq_thold > 0.0f) {
+    const float rc = 1.0f / (2.0f * M_PI * std::max(freq_thold, 1.0f));
+    const float dt = 1.0f / sample_rate;
+
+    hp_alpha = dt / (rc + dt);
+
+    blocks.resize(n_blocks_all, 0.0f);
+}
+
+int vad_energy::feed(const float * samples, size_t n_samples) {
+    events.clear();
+
+    if (n_samples == 0) {
+        return 0;
+    }
+
+    const float * x = samples;
+
+    // the filter is recursive, so it runs first and the energy below is a plain sum over contiguous samples, which
+    // the compiler vectorizes
+    if (hp_enabled) {
+        filtered.resize(n_samples);
+
+        size_t i0 = 0;
+        if (!hp_init) {
+            hp_x = hp_y = filtered[0] = samples[0];
+            hp_init = true;
+            i0 = 1;
+        }
+
+        float xp = hp_x;
+        float y  = hp_y;
+        for (size_t i = i0; i < n_samples; i++) {
+            y = hp_alpha * (y + samples[i] - xp);
+            xp = samples[i];
+            filtered[i] = y;
+        }
+        hp_x = xp;
+        hp_y = y;
+
+        x = filtered.data();
+    }
+
+    size_t i = 0;
+    while (i < n_samples) {
+        const size_t n = std::min<size_t>(n_samples - i, n_block - block_n);
+
+        float sum = 0.0f;
+        for (size_t j = 0; j < n; j++) {
+            sum += fabsf(x[i + j]);
+        }
+
+        block_sum += sum;
+        block_n   += n;
+        i         += n;
+
+        if (block_n == n_block) {
+            pos += n_block;
+            push_block(block_sum / n_block);
+
+            block_sum = 0.0f;
+            block_n   = 0;
+        }
+    }
+
+    return events.size();
+}
+
+void vad_energy::push_block(float energy) {
+    const uint64_t k = n_blocks++;
+
+    // the block that leaves the last last_ms is still in the window
+    if (k >= (uint64_t) n_blocks_last) {
+        sum_last -= blocks[(k - n_blocks_last) % n_blocks_all];
+    }
+    if (k >= (uint64_t) n_blocks_all) {
+        sum_all -= blocks[k % n_blocks_all];
+    }
+
+    blocks[k % n_blocks_all] = energy;
+
+    sum_all  += energy;
+    sum_last += energy;
+
+    if (n_blocks < (uint64_t) n_blocks_all) {
+        // not enough samples - assume no speech
+        return;
+    }
+
+    energy_all  = sum_all  / n_blocks_all;
+    energy_last = sum_last / n_blocks_last;
+
+    // the events are reported when the conditions become true, not for every block while they hold
+    const bool drop = energy_last < vad_thold*energy_all;
+    const bool rise = energy_last > energy_all/vad_thold;
+
+    if (rise && !is_rise) {
+        in_speech = true;
+        events.push_back({ true, pos });
+    }
+    if (drop && !is_drop) {
+        in_speech = false;
+        events.push_back({ false, pos });
+    }
+
+    is_drop = drop;
+    is_rise = rise;
+}
+
 float similarity(const std::string & s0, const std::string & s1) {
     const size_t len0 = s0.size() + 1;
     const size_t len1 = s1.size() + 1;
@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <map>
 #include <vector>
@@ -248,6 +249,58 @@ bool vad_simple(
         float freq_thold,
         bool  verbose);
 
+// Streaming version of vad_simple() - the state is kept between the calls, so only the new samples are filtered
+// The energy is averaged over blocks of 10 ms. The speech ends (offset) when the mean energy of the last last_ms drops
+// below vad_thold times the mean energy of the last window_ms, the same rule as vad_simple(), and it starts (onset)
+// when the mean energy of the last last_ms rises above the mean of the window divided by vad_thold
+struct vad_energy {
+    struct event {
+        bool     speech; // true - onset, false - offset
+        uint64_t pos;    // index of the sample since the first call to feed()
+    };
+
+    vad_energy(int sample_rate, int window_ms, int last_ms, float vad_thold, float freq_thold);
+
+    // returns the number of new events, in events[0, n)
+    int feed(const float * samples, size_t n_samples);
+
+    std::vector<event> events;
+
+    bool  in_speech   = false;
+    float energy_all  = 0.0f; // mean over the window, after the last block
+    float energy_last = 0.0f; // mean over the last last_ms, after the last block
+
+private:
+    void push_block(float energy);
+
+    int   n_block;       // samples per block
+    int   n_blocks_all;  // blocks in the window
+    int   n_blocks_last; // blocks in last_ms
+    float vad_thold;
+
+    // high-pass filter state
+    bool  hp_enabled;
+    float hp_alpha;
+    float hp_x = 0.0f;
+    float hp_y = 0.0f;
+    bool  hp_init = false;
+
+    std::vector<float> filtered; // scratch buffer, reused between the calls
+
+    // energy of the last n_blocks_all blocks
+    std::vector<float> blocks;
+    uint64_t n_blocks = 0;
+    double   sum_all  = 0.0;
+    double   sum_last = 0.0;
+
+    float    block_sum = 0.0f;
+    int      block_n   = 0;
+    uint64_t pos       = 0;
+
+    bool is_drop = false;
+    bool is_rise = false;
+};
+
 // compute similarity between two strings using Levenshtein distance
 float similarity(const std::string & s0, const std::string & s1);
 
@@ -322,35 +322,22 @@ static int decode_audio(struct audio_buffer *audio_buf, s16 **data, int *size)
 }
 
 // in mem decoding/conversion/resampling:
-// ifname: input file path
+// idata, isize: input file content
 // owav_data: in mem wav file. Can be forwarded as it to whisper/drwav
 // return 0 on success
-int ffmpeg_decode_audio(const std::string &ifname, std::vector<uint8_t>& owav_data) {
-    LOG("ffmpeg_decode_audio: %s\n", ifname.c_str());
-    int ifd = open(ifname.c_str(), O_RDONLY);
-    if (ifd == -1) {
-        fprintf(stderr, "Couldn't open input file %s\n", ifname.c_str());
-        return -1;
-    }
-    u8 *ibuf = NULL;
-    size_t ibuf_size;
-    int err = map_file(ifd, &ibuf, &ibuf_size);
-    if (err) {
-        LOG("Couldn't map input file %s\n", ifname.c_str());
-        return err;
-    }
-    LOG("Mapped input file: %s size: %d\n", ibuf, (int) ibuf_size);
+int ffmpeg_decode_audio_memory(const uint8_t * idata, size_t isize, std::vector<uint8_t>& owav_data) {
     struct audio_buffer inaudio_buf;
-    inaudio_buf.ptr = ibuf;
-    inaudio_buf.size = ibuf_size;
+    inaudio_buf.ptr = (u8 *) idata; // read_packet() only reads from the buffer
+    inaudio_buf.size = isize;
 
     s16 *odata=NULL;
     int osize=0;
 
-    err = decode_audio(&inaudio_buf, &odata, &osize);
+    int err = decode_audio(&inaudio_buf, &odata, &osize);
     LOG("decode_audio returned %d \n", err);
     if (err != 0) {
         LOG("decode_audio failed\n");
+        free(odata);
         return err;
     }
     LOG("decode_audio output size: %d\n", osize);
@@ -364,5 +351,35 @@ int ffmpeg_decode_audio(const std::string &ifname, std::vector<uint8_t>& owav_da
     // the data:
     memcpy(owav_data.data() + sizeof(wave_hdr), odata, osize* sizeof(s16));
 
+    free(odata);
+
     return 0;
 }
+
+// in mem decoding/conversion/resampling:
+// ifname: input file path
+// owav_data: in mem wav file. Can be forwarded as it to whisper/drwav
+// return 0 on success
+int ffmpeg_decode_audio(const std::string &ifname, std::vector<uint8_t>& owav_data) {
+    LOG("ffmpeg_decode_audio: %s\n", ifname.c_str());
+    int ifd = open(ifname.c_str(), O_RDONLY);
+    if (ifd == -1) {
+        fprintf(stderr, "Couldn't open input file %s\n", ifname.c_str());
+        return -1;
+    }
+    u8 *ibuf = NULL;
+    size_t ibuf_size;
+    int err = map_file(ifd, &ibuf, &ibuf_size);
+    if (err) {
+        LOG("Couldn't map input file %s\n", ifname.c_str());
+        return err;
+    }
+    LOG("Mapped input file: %s size: %d\n", ibuf, (int) ibuf_size);
+
+    err = ffmpeg_decode_audio_memory(ibuf, ibuf_size, owav_data);
+
+    munmap(ibuf, ibuf_size);
+    close(ifd);
+
+    return err;
+}
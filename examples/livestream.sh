@@ -75,11 +75,26 @@ printf "[+] Transcribing stream with model '$model', step_s $step_s (press Ctrl+
 
 # continuous stream in native fmt (this file will grow forever!)
 ffmpeg -loglevel quiet -y -re -probesize 32 -i $url -c copy /tmp/whisper-live0.${fmt} &
+
 if [ $? -ne 0 ]; then
     printf "Error: ffmpeg failed to capture audio stream\n"
     exit 1
 fi
 
+# load the model once and keep it resident, each step below only sends the new chunk to it
+rm -f /tmp/whisper-live.sock
+./build/bin/whisper-cli -t 8 -m ./models/ggml-${model}.bin --daemon /tmp/whisper-live.sock 2> /tmp/whisper-daemon.err &
+daemon_pid=$!
+
+# the daemon listens once the model is loaded
+while [ ! -S /tmp/whisper-live.sock ]; do
+    if ! kill -0 $daemon_pid 2> /dev/null; then
+        printf "Error: whisper-cli failed to load the model, see /tmp/whisper-daemon.err\n"
+        exit 1
+    fi
+    sleep 1
+done
+
 printf "Buffering audio. Please wait...\n\n"
 sleep $(($step_s))
 
@@ -100,7 +115,7 @@ while [ $running -eq 1 ]; do
         err=$(cat /tmp/whisper-live.err | wc -l)
     done
 
-    ./build/bin/whisper-cli -t 8 -m ./models/ggml-${model}.bin -f /tmp/whisper-live.wav --no-timestamps -otxt 2> /tmp/whispererr | tail -n 1
+    ./build/bin/whisper-cli --connect /tmp/whisper-live.sock -f /tmp/whisper-live.wav --no-timestamps -otxt 2> /tmp/whispererr | tail -n 1
 
     while [ $SECONDS -lt $((($i+1)*$step_s)) ]; do
         sleep 1
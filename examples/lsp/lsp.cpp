@@ -8,6 +8,7 @@
 #include <cstdio>
 #include <deque>
 #include <iostream>
+#include <memory>
 #include <set>
 #include <string>
 #include <thread>
@@ -23,6 +24,7 @@ struct whisper_params {
     int32_t capture_id = -1;
     int32_t max_tokens = 32;
     int32_t audio_ctx  = 0;
+    int32_t enc_reuse_ms = 200;
 
     float vad_thold    = 0.6f;
     float freq_thold   = 100.0f;
@@ -43,13 +45,8 @@ struct command {
 struct commandset {
     std::vector<struct command> commands;
     std::vector<whisper_token> prompt_tokens;
-    // TODO: Store longest command?
-    // Multi-token commands should have probabilities of subsequent logits
-    // given that the prior logit is correct.
-    // In this case, all commands must be iterated.
-    // This however, is likely highly involved as different tokens
-    // almost certainly have different spoken lengths
-    // It would also have performance implications equivalent to a beam search
+    // the token trie of the commands, multi-token commands are scored with all of their tokens
+    std::shared_ptr<whisper_commands> trie;
 };
 
 void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
@@ -68,6 +65,7 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-c"   || arg == "--capture")       { params.capture_id    = std::stoi(argv[++i]); }
         else if (arg == "-mt"  || arg == "--max-tokens")    { params.max_tokens    = std::stoi(argv[++i]); }
         else if (arg == "-ac"  || arg == "--audio-ctx")     { params.audio_ctx     = std::stoi(argv[++i]); }
+        else if (arg == "-erm" || arg == "--enc-reuse-ms")  { params.enc_reuse_ms  = std::stoi(argv[++i]); }
         else if (arg == "-vth" || arg == "--vad-thold")     { params.vad_thold     = std::stof(argv[++i]); }
         else if (arg == "-fth" || arg == "--freq-thold")    { params.freq_thold    = std::stof(argv[++i]); }
         else if (arg == "-tr"  || arg == "--translate")     { params.translate     = true; }
@@ -99,6 +97,7 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  -c ID,      --capture ID     [%-7d] capture device ID\n",                           params.capture_id);
     fprintf(stderr, "  -mt N,      --max-tokens N   [%-7d] maximum number of tokens per audio chunk\n",    params.max_tokens);
     fprintf(stderr, "  -ac N,      --audio-ctx N    [%-7d] audio context size (0 - all)\n",                params.audio_ctx);
+    fprintf(stderr, "  -erm N,     --enc-reuse-ms N [%-7d] reuse the last encode if the audio moved less (0 - never)\n", params.enc_reuse_ms);
     fprintf(stderr, "  -vth N,     --vad-thold N    [%-7.2f] voice activity detection threshold\n",        params.vad_thold);
     fprintf(stderr, "  -fth N,     --freq-thold N   [%-7.2f] high-pass frequency cutoff\n",                params.freq_thold);
     fprintf(stderr, "  -tr,        --translate      [%-7s] translate from source language to english\n",   params.translate ? "true" : "false");
@@ -208,115 +207,70 @@ static json guided_transcription(struct whisper_context * ctx, audio_async &audi
     fprintf(stderr, "%s: Speech detected! Processing ...\n", __func__);
     whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
 
-    wparams.print_progress   = false;
-    wparams.print_special    = params.print_special;
-    wparams.print_realtime   = false;
-    wparams.print_timestamps = false;
     wparams.translate        = params.translate;
-    wparams.no_context       = true;
-    wparams.single_segment   = true;
-    wparams.max_tokens       = 1;
     wparams.language         = params.language.c_str();
     wparams.n_threads        = params.n_threads;
 
     wparams.audio_ctx        = params.audio_ctx;
+    wparams.enc_reuse_ms     = params.enc_reuse_ms;
 
     // TODO: Do some time testing. Does an overly long prompt slow down processing?
     // Set up command sets/precompute prompts
     wparams.prompt_tokens    = cs.prompt_tokens.data();
     wparams.prompt_n_tokens  = cs.prompt_tokens.size();
-    // TODO: properly expose as option
-    wparams.suppress_nst     = true;
 
-    // run the transformer and a single decoding pass
-    if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
-        fprintf(stderr, "%s: ERROR: whisper_full() failed\n", __func__);
+    // run the encoder and score all commands in a single batched decode
+    std::vector<whisper_command_score> scores(cs.commands.size());
+    if (whisper_commands_score(ctx, cs.trie.get(), wparams, pcmf32.data(), pcmf32.size(), scores.data()) != 0) {
+        fprintf(stderr, "%s: ERROR: whisper_commands_score() failed\n", __func__);
         throw json{
             {"code", -32803},
-            {"message", "ERROR: whisper_full() failed"}//TODO: format string (sprintf?)
+            {"message", "ERROR: whisper_commands_score() failed"}//TODO: format string (sprintf?)
         };
     }
 
-    // estimate command probability
-    // NOTE: not optimal
-    {
-        const auto * logits = whisper_get_logits(ctx);
-
-        std::vector<float> probs(whisper_n_vocab(ctx), 0.0f);
-
-        // compute probs from logits via softmax
-        {
-            float max = -1e9;
-            for (int i = 0; i < (int) probs.size(); ++i) {
-                max = std::max(max, logits[i]);
-            }
-
-            float sum = 0.0f;
-            for (int i = 0; i < (int) probs.size(); ++i) {
-                probs[i] = expf(logits[i] - max);
-                sum += probs[i];
-            }
-
-            for (int i = 0; i < (int) probs.size(); ++i) {
-                probs[i] /= sum;
-            }
-        }
-
-        std::vector<std::pair<float, int>> probs_id;
-
-        // In my testing, the most verbose token is always the desired.
-        // TODO: Trim commandset struct once efficacy has been verified
-        for (int i = 0; i < (int) cs.commands.size(); ++i) {
-            probs_id.emplace_back(probs[cs.commands[i].tokens[0]], i);
-        }
-
-        // sort descending
-        {
-            using pair_type = decltype(probs_id)::value_type;
-            std::sort(probs_id.begin(), probs_id.end(), [](const pair_type & a, const pair_type & b) {
-                    return a.first > b.first;
-                    });
-        }
-        int id = probs_id[0].second;
-        return json{
-            {"command_index", id},
-                {"command_text", cs.commands[id].plaintext},
-                {"timestamp", unprocessed_audio_timestamp},
-        };
-    }
+    int id = scores[0].id;
+    return json{
+        {"command_index", id},
+            {"command_text", cs.commands[id].plaintext},
+            {"timestamp", unprocessed_audio_timestamp},
+    };
 }
 
 static json register_commandset(struct whisper_context * ctx, json jparams, std::vector<struct commandset> &commandset_list) {
-    // TODO: check for token collision
     struct commandset cs;
 
     std::string  k_prompt = " select one from the available words: ";
-    std::set<whisper_token> token_set;
+    std::set<std::string> command_set;
+    std::vector<const char *> command_cstrs;
     whisper_token tokens[32];
     for (std::string s : jparams) {
-        std::vector<whisper_token> token_vec;
-        // The existing command implementation uses a nested for loop to tokenize single characters
-        // I fail to see the purpose of this when ' a' has a wholly different pronunciation than the start of ' apple'
-        const int n = whisper_tokenize(ctx, (" " + s).c_str(), tokens, 32);
-        if (n < 0) {
-            fprintf(stderr, "%s: error: failed to tokenize command '%s'\n", __func__, s.c_str());
-            return 3;
-        }
-        token_vec.push_back(tokens[0]);
-        if (!token_set.insert(tokens[0]).second) {
-            fprintf(stderr, "%s: warning: %s is a duplicate of an existing token\n", __func__, s.c_str());
+        if (!command_set.insert(s).second) {
+            fprintf(stderr, "%s: warning: %s is a duplicate of an existing command\n", __func__, s.c_str());
             throw json{
                 {"code",-31000},
-                {"message", "Duplicate token in token set: " + s}
+                {"message", "Duplicate command in command set: " + s}
             };
         }
-        if (n > 1) {// empty string if n=0? Should never occur
-            fprintf(stderr, "%s: error: command is more than a single token: %s\n", __func__, s.c_str());
+        const int n = whisper_tokenize(ctx, (" " + s).c_str(), tokens, 32);
+        if (n < 0) {
+            fprintf(stderr, "%s: error: failed to tokenize command '%s'\n", __func__, s.c_str());
+            return 3;
         }
-        struct command command = {token_vec, s};
+        struct command command = {std::vector<whisper_token>(tokens, tokens + n), s};
         cs.commands.push_back(command);
         k_prompt += s;
     }
+    for (const auto & command : cs.commands) {
+        command_cstrs.push_back(command.plaintext.c_str());
+    }
+    cs.trie.reset(whisper_commands_init(ctx, command_cstrs.data(), command_cstrs.size()), whisper_commands_free);
+    if (!cs.trie) {
+        throw json{
+            {"code",-31000},
+            {"message", "Failed to tokenize the command set"}
+        };
+    }
     k_prompt = k_prompt.substr(0,k_prompt.length()-2) + ". Selected word:";
     cs.prompt_tokens.resize(1024);
     int n = whisper_tokenize(ctx, k_prompt.c_str(), cs.prompt_tokens.data(), 1024);
@@ -0,0 +1,472 @@
+// Python extension module with a persistent model
+//
+//   import whisper_cpp
+//
+//   ctx = whisper_cpp.Context("models/ggml-base.en.bin")
+//   res = ctx.transcribe(whisper_cpp.load_audio("samples/jfk.wav"), language="en")
+//
+//   for seg in res["segments"]:
+//       print(seg["start"], seg["end"], seg["text"])
+//
+// The audio is any C-contiguous buffer of 16 kHz mono float32 samples (numpy.float32 array, array.array('f'), ...),
+// it is read in place. The GIL is released during the inference, so that several threads can transcribe at the same
+// time, each with its own whisper_cpp.State.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "common-whisper.h"
+
+#include "whisper.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// a whisper_state and whether it is transcribing with the GIL released
+struct py_state_ref {
+    whisper_state * state = nullptr;
+    bool            busy  = false;
+};
+
+struct py_context {
+    PyObject_HEAD
+    whisper_context * ctx;
+    py_state_ref    * state; // used by transcribe() without a state, created on first use
+};
+
+struct py_state {
+    PyObject_HEAD
+    py_context   * owner; // keeps the model alive
+    py_state_ref * ref;
+};
+
+static PyTypeObject py_context_type = { PyVarObject_HEAD_INIT(nullptr, 0) };
+static PyTypeObject py_state_type   = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+static PyObject * py_str(const char * text) {
+    // the text of a token can end in the middle of a multi-byte character
+    return PyUnicode_DecodeUTF8(text, strlen(text), "replace");
+}
+
+//
+// Context
+//
+
+static int py_context_init(py_context * self, PyObject * args, PyObject * kwargs) {
+    static const char * kwlist[] = { "model", "use_gpu", "flash_attn", "gpu_device", nullptr };
+
+    const char * path = nullptr;
+
+    auto cparams = whisper_context_default_params();
+
+    int use_gpu    = cparams.use_gpu;
+    int flash_attn = cparams.flash_attn;
+    int gpu_device = cparams.gpu_device;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|$ppi", (char **) kwlist, &path, &use_gpu, &flash_attn, &gpu_device)) {
+        return -1;
+    }
+
+    if (self->ctx) {
+        PyErr_SetString(PyExc_RuntimeError, "the context is already initialized");
+        return -1;
+    }
+
+    cparams.use_gpu    = use_gpu;
+    cparams.flash_attn = flash_attn;
+    cparams.gpu_device = gpu_device;
+
+    whisper_context * ctx = nullptr;
+
+    Py_BEGIN_ALLOW_THREADS
+    ctx = whisper_init_from_file_with_params_no_state(path, cparams);
+    Py_END_ALLOW_THREADS
+
+    if (ctx == nullptr) {
+        PyErr_Format(PyExc_RuntimeError, "failed to load the model '%s'", path);
+        return -1;
+    }
+
+    self->ctx   = ctx;
+    self->state = new py_state_ref();
+
+    return 0;
+}
+
+static void py_context_dealloc(py_context * self) {
+    if (self->state) {
+        if (self->state->state) {
+            whisper_free_state(self->state->state);
+        }
+        delete self->state;
+    }
+    if (self->ctx) {
+        whisper_free(self->ctx);
+    }
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static bool py_context_check(py_context * self) {
+    if (self->ctx == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "the context is not initialized");
+        return false;
+    }
+
+    return true;
+}
+
+// reads a buffer of float32 samples in place, the buffer is locked until PyBuffer_Release
+static bool py_get_samples(PyObject * obj, Py_buffer & view) {
+    if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0) {
+        return false;
+    }
+
+    const char * fmt = view.format ? view.format : "B";
+    if (fmt[0] == '@' || fmt[0] == '=' || fmt[0] == '<') {
+        fmt++;
+    }
+
+    if (strcmp(fmt, "f") != 0 || view.itemsize != sizeof(float)) {
+        PyErr_Format(PyExc_TypeError, "expected a buffer of float32 samples, got the format '%s'", view.format ? view.format : "B");
+        PyBuffer_Release(&view);
+        return false;
+    }
+
+    if (view.len/sizeof(float) > INT32_MAX) {
+        PyErr_SetString(PyExc_ValueError, "the audio is too long");
+        PyBuffer_Release(&view);
+        return false;
+    }
+
+    return true;
+}
+
+static PyObject * py_result(whisper_context * ctx, whisper_state * state, bool with_tokens) {
+    PyObject * segments = PyList_New(0);
+    if (segments == nullptr) {
+        return nullptr;
+    }
+
+    const int n_segments = whisper_full_n_segments_from_state(state);
+
+    for (int i = 0; i < n_segments; ++i) {
+        PyObject * seg = Py_BuildValue("{s:d,s:d,s:N,s:d,s:O}",
+                "start",             0.01*whisper_full_get_segment_t0_from_state(state, i),
+                "end",               0.01*whisper_full_get_segment_t1_from_state(state, i),
+                "text",              py_str(whisper_full_get_segment_text_from_state(state, i)),
+                "no_speech_prob",    (double) whisper_full_get_segment_no_speech_prob_from_state(state, i),
+                "speaker_turn_next", whisper_full_get_segment_speaker_turn_next_from_state(state, i) ? Py_True : Py_False);
+
+        if (seg && with_tokens) {
+            PyObject * tokens = PyList_New(0);
+
+            const int n_tokens = whisper_full_n_tokens_from_state(state, i);
+            for (int j = 0; tokens && j < n_tokens; ++j) {
+                const whisper_token_data data = whisper_full_get_token_data_from_state(state, i, j);
+
+                PyObject * token = Py_BuildValue("{s:i,s:N,s:d,s:d,s:d}",
+                        "id",    data.id,
+                        "text",  py_str(whisper_token_to_str(ctx, data.id)),
+                        "p",     (double) data.p,
+                        "start", 0.01*data.t0,
+                        "end",   0.01*data.t1);
+
+                if (token == nullptr || PyList_Append(tokens, token) != 0) {
+                    Py_CLEAR(tokens);
+                }
+                Py_XDECREF(token);
+            }
+
+            if (tokens == nullptr || PyDict_SetItemString(seg, "tokens", tokens) != 0) {
+                Py_CLEAR(seg);
+            }
+            Py_XDECREF(tokens);
+        }
+
+        if (seg == nullptr || PyList_Append(segments, seg) != 0) {
+            Py_XDECREF(seg);
+            Py_DECREF(segments);
+            return nullptr;
+        }
+        Py_DECREF(seg);
+    }
+
+    return Py_BuildValue("{s:s,s:N}",
+            "language", whisper_lang_str(whisper_full_lang_id_from_state(state)),
+            "segments", segments);
+}
+
+static PyObject * py_context_transcribe(py_context * self, PyObject * args, PyObject * kwargs) {
+    static const char * kwlist[] = {
+        "audio", "state", "language", "translate", "n_threads", "beam_size", "best_of", "temperature",
+        "initial_prompt", "no_context", "single_segment", "token_timestamps", "tokens", "offset_ms", "duration_ms",
+        nullptr,
+    };
+
+    if (!py_context_check(self)) {
+        return nullptr;
+    }
+
+    PyObject   * audio          = nullptr;
+    PyObject   * state          = Py_None;
+    const char * language       = "en";
+    int          translate      = false;
+    int          n_threads      = std::min(4, (int) std::thread::hardware_concurrency());
+    int          beam_size      = 0;
+    int          best_of        = -1;
+    float        temperature    = 0.0f;
+    const char * initial_prompt = nullptr;
+    int          no_context     = true;
+    int          single_segment = false;
+    int          token_ts       = false;
+    int          with_tokens    = false;
+    int          offset_ms      = 0;
+    int          duration_ms    = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$Ozpiiifzppppii", (char **) kwlist,
+                &audio, &state, &language, &translate, &n_threads, &beam_size, &best_of, &temperature,
+                &initial_prompt, &no_context, &single_segment, &token_ts, &with_tokens, &offset_ms, &duration_ms)) {
+        return nullptr;
+    }
+
+    py_state_ref * ref = self->state;
+
+    if (state != Py_None) {
+        if (!PyObject_TypeCheck(state, &py_state_type) || ((py_state *) state)->owner != self) {
+            PyErr_SetString(PyExc_TypeError, "state must be a State of this Context");
+            return nullptr;
+        }
+        ref = ((py_state *) state)->ref;
+    }
+
+    if (ref->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "the state is already transcribing, use one State per thread");
+        return nullptr;
+    }
+
+    if (ref->state == nullptr && (ref->state = whisper_init_state(self->ctx)) == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "failed to create the state");
+        return nullptr;
+    }
+
+    Py_buffer view;
+    if (!py_get_samples(audio, view)) {
+        return nullptr;
+    }
+
+    whisper_full_params wparams = whisper_full_default_params(beam_size > 0 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
+
+    wparams.print_progress   = false;
+    wparams.print_realtime   = false;
+    wparams.print_timestamps = false;
+    wparams.print_special    = false;
+
+    wparams.language         = language ? language : "auto";
+    wparams.translate        = translate;
+    wparams.n_threads        = std::max(1, n_threads);
+    wparams.temperature      = temperature;
+    wparams.initial_prompt   = initial_prompt;
+    wparams.no_context       = no_context;
+    wparams.single_segment   = single_segment;
+    wparams.token_timestamps = token_ts;
+    wparams.offset_ms        = offset_ms;
+    wparams.duration_ms      = duration_ms;
+
+    if (beam_size > 0) {
+        wparams.beam_search.beam_size = beam_size;
+    }
+    if (best_of > 0) {
+        wparams.greedy.best_of = best_of;
+    }
+
+    int ret = 0;
+
+    ref->busy = true;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = whisper_full_with_state(self->ctx, ref->state, wparams, (const float *) view.buf, (int) (view.len/sizeof(float)));
+    Py_END_ALLOW_THREADS
+
+    ref->busy = false;
+
+    PyBuffer_Release(&view);
+
+    if (ret != 0) {
+        PyErr_Format(PyExc_RuntimeError, "failed to transcribe the audio (%d)", ret);
+        return nullptr;
+    }
+
+    return py_result(self->ctx, ref->state, with_tokens);
+}
+
+static PyMethodDef py_context_methods[] = {
+    { "transcribe", (PyCFunction) (void (*)(void)) py_context_transcribe, METH_VARARGS | METH_KEYWORDS,
+      "transcribe(audio, *, state=None, language='en', translate=False, n_threads=4, beam_size=0, best_of=-1,\n"
+      "           temperature=0.0, initial_prompt=None, no_context=True, single_segment=False,\n"
+      "           token_timestamps=False, tokens=False, offset_ms=0, duration_ms=0)\n"
+      "--\n\n"
+      "Transcribes 16 kHz mono float32 samples, read in place from any buffer.\n"
+      "Returns {'language': str, 'segments': [{'start', 'end', 'text', 'no_speech_prob', 'speaker_turn_next'}]},\n"
+      "the times are in seconds. With tokens=True, each segment also has a list of\n"
+      "{'id', 'text', 'p', 'start', 'end'} tokens. language=None detects the language.\n"
+      "Without a state, the default state of the context is used." },
+    { nullptr, nullptr, 0, nullptr },
+};
+
+//
+// State
+//
+
+static int py_state_init(py_state * self, PyObject * args, PyObject * kwargs) {
+    static const char * kwlist[] = { "context", nullptr };
+
+    PyObject * owner = nullptr;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!", (char **) kwlist, &py_context_type, &owner)) {
+        return -1;
+    }
+
+    if (self->ref) {
+        PyErr_SetString(PyExc_RuntimeError, "the state is already initialized");
+        return -1;
+    }
+
+    if (!py_context_check((py_context *) owner)) {
+        return -1;
+    }
+
+    whisper_state * state = whisper_init_state(((py_context *) owner)->ctx);
+    if (state == nullptr) {
+        PyErr_SetString(PyExc_RuntimeError, "failed to create the state");
+        return -1;
+    }
+
+    Py_INCREF(owner);
+
+    self->owner = (py_context *) owner;
+    self->ref   = new py_state_ref();
+
+    self->ref->state = state;
+
+    return 0;
+}
+
+static void py_state_dealloc(py_state * self) {
+    if (self->ref) {
+        whisper_free_state(self->ref->state);
+        delete self->ref;
+    }
+    Py_XDECREF(self->owner);
+
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+//
+// module
+//
+
+static PyObject * py_load_audio(PyObject * /*self*/, PyObject * args) {
+    const char * fname = nullptr;
+
+    if (!PyArg_ParseTuple(args, "s", &fname)) {
+        return nullptr;
+    }
+
+    std::vector<float> pcmf32;
+    std::vector<std::vector<float>> pcmf32s;
+
+    bool ok = false;
+
+    Py_BEGIN_ALLOW_THREADS
+    ok = read_audio_data(fname, pcmf32, pcmf32s, false);
+    Py_END_ALLOW_THREADS
+
+    if (!ok) {
+        PyErr_Format(PyExc_RuntimeError, "failed to read the audio file '%s'", fname);
+        return nullptr;
+    }
+
+    PyObject * module = PyImport_ImportModule("array");
+    if (module == nullptr) {
+        return nullptr;
+    }
+
+    PyObject * samples = PyObject_CallMethod(module, "array", "s", "f");
+    Py_DECREF(module);
+    if (samples == nullptr) {
+        return nullptr;
+    }
+
+    PyObject * ret = PyObject_CallMethod(samples, "frombytes", "y#", (const char *) pcmf32.data(), (Py_ssize_t) (pcmf32.size()*sizeof(float)));
+    if (ret == nullptr) {
+        Py_DECREF(samples);
+        return nullptr;
+    }
+    Py_DECREF(ret);
+
+    return samples;
+}
+
+static PyObject * py_system_info(PyObject * /*self*/, PyObject * /*args*/) {
+    return PyUnicode_FromString(whisper_print_system_info());
+}
+
+static PyMethodDef py_methods[] = {
+    { "load_audio",  py_load_audio,  METH_VARARGS, "load_audio(path)\n--\n\nReads an audio file as an array.array('f') of 16 kHz mono samples." },
+    { "system_info", py_system_info, METH_NOARGS,  "system_info()\n--\n\nThe features of the backends." },
+    { nullptr, nullptr, 0, nullptr },
+};
+
+static PyModuleDef py_module = {
+    PyModuleDef_HEAD_INIT,
+    "whisper_cpp",
+    "Speech recognition with whisper.cpp, with a persistent model",
+    -1,
+    py_methods,
+    nullptr, nullptr, nullptr, nullptr,
+};
+
+PyMODINIT_FUNC PyInit_whisper_cpp(void) {
+    py_context_type.tp_name      = "whisper_cpp.Context";
+    py_context_type.tp_doc       = "Context(model, *, use_gpu=True, flash_attn=True, gpu_device=0)\n--\n\nA loaded model.";
+    py_context_type.tp_basicsize = sizeof(py_context);
+    py_context_type.tp_flags     = Py_TPFLAGS_DEFAULT;
+    py_context_type.tp_new       = PyType_GenericNew;
+    py_context_type.tp_init      = (initproc) py_context_init;
+    py_context_type.tp_dealloc   = (destructor) py_context_dealloc;
+    py_context_type.tp_methods   = py_context_methods;
+
+    py_state_type.tp_name      = "whisper_cpp.State";
+    py_state_type.tp_doc       = "State(context)\n--\n\nThe buffers of a transcription, one per thread transcribing with the same Context.";
+    py_state_type.tp_basicsize = sizeof(py_state);
+    py_state_type.tp_flags     = Py_TPFLAGS_DEFAULT;
+    py_state_type.tp_new       = PyType_GenericNew;
+    py_state_type.tp_init      = (initproc) py_state_init;
+    py_state_type.tp_dealloc   = (destructor) py_state_dealloc;
+
+    if (PyType_Ready(&py_context_type) < 0 || PyType_Ready(&py_state_type) < 0) {
+        return nullptr;
+    }
+
+    PyObject * m = PyModule_Create(&py_module);
+    if (m == nullptr) {
+        return nullptr;
+    }
+
+    Py_INCREF(&py_context_type);
+    Py_INCREF(&py_state_type);
+
+    if (PyModule_AddObject(m, "Context", (PyObject *) &py_context_type) < 0 ||
+        PyModule_AddObject(m, "State",   (PyObject *) &py_state_type)   < 0) {
+        Py_DECREF(&py_context_type);
+        Py_DECREF(&py_state_type);
+        Py_DECREF(m);
+        return nullptr;
+    }
+
+    return m;
+}
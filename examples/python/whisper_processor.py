@@ -2,6 +2,15 @@ import subprocess
 import sys
 import os
 
+# the whisper_cpp extension module (cmake -DWHISPER_PYTHON=ON) keeps the models loaded between the calls,
+# without it each call runs the whisper-cli binary
+try:
+    import whisper_cpp
+except ImportError:
+    whisper_cpp = None
+
+_contexts = {}
+
 def process_audio(wav_file, model_name="base.en"):
     """
     Processes an audio file using a specified model and returns the processed string.
@@ -21,6 +30,15 @@ def process_audio(wav_file, model_name="base.en"):
     if not os.path.exists(wav_file):
         raise FileNotFoundError(f"WAV file not found: {wav_file}")
 
+    if whisper_cpp is not None:
+        ctx = _contexts.get(model)
+        if ctx is None:
+            ctx = _contexts[model] = whisper_cpp.Context(model)
+
+        result = ctx.transcribe(whisper_cpp.load_audio(wav_file))
+
+        return "".join(seg["text"] for seg in result["segments"]).replace('[BLANK_AUDIO]', '').strip()
+
     full_command = f"./main -m {model} -f {wav_file} -nt"
 
     # Execute the command
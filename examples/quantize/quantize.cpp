@@ -2,6 +2,7 @@
 
 #include "common.h"
 #include "common-ggml.h"
+#include "whisper-internal.h"
 
 #include <cassert>
 #include <cmath>
@@ -36,7 +37,7 @@ struct whisper_filters {
 };
 
 // quantize a model
-static bool whisper_model_quantize(const std::string & fname_inp, const std::string & fname_out, ggml_ftype ftype) {
+static bool whisper_model_quantize(const std::string & fname_inp, const std::string & fname_out, ggml_ftype ftype, int recipe, int nthread) {
     gpt_vocab vocab;
 
     printf("%s: loading model from '%s'\n", __func__, fname_inp.c_str());
@@ -82,7 +83,7 @@ static bool whisper_model_quantize(const std::string & fname_inp, const std::str
         finp.read((char *) &hparams.ftype,         sizeof(hparams.ftype));
 
         const int32_t qntvr_src =    hparams.ftype / GGML_QNT_VERSION_FACTOR;
-        const int32_t ftype_dst = GGML_QNT_VERSION * GGML_QNT_VERSION_FACTOR + ftype;
+        const int32_t ftype_dst = GGML_QNT_VERSION * GGML_QNT_VERSION_FACTOR + recipe * WHISPER_QUANT_RECIPE_FACTOR + ftype;
 
         fprintf(stderr, "%s: n_vocab       = %d\n", __func__, hparams.n_vocab);
         fprintf(stderr, "%s: n_audio_ctx   = %d\n", __func__, hparams.n_audio_ctx);
@@ -98,6 +99,7 @@ static bool whisper_model_quantize(const std::string & fname_inp, const std::str
         fprintf(stderr, "%s: qntvr (src)   = %d\n", __func__, qntvr_src);
         fprintf(stderr, "%s: ftype (dst)   = %d\n", __func__, ftype_dst);
         fprintf(stderr, "%s: qntvr (dst)   = %d\n", __func__, GGML_QNT_VERSION);
+        fprintf(stderr, "%s: recipe        = %s\n", __func__, whisper_internal_quant_recipe_name(recipe));
 
         fout.write((const char *) &hparams.n_vocab,       sizeof(hparams.n_vocab));
         fout.write((const char *) &hparams.n_audio_ctx,   sizeof(hparams.n_audio_ctx));
@@ -164,7 +166,10 @@ static bool whisper_model_quantize(const std::string & fname_inp, const std::str
         "decoder.positional_embedding",
     };
 
-    if (!ggml_common_quantize_0(finp, fout, ftype, { ".*" }, to_skip)) {
+    // the types of the weights of a mixed precision recipe, the loader applies the same rules
+    const auto to_type = whisper_internal_quant_recipe(recipe, ggml_ftype_to_ggml_type(ftype), hparams.n_audio_layer, hparams.n_text_layer);
+
+    if (!ggml_common_quantize_0(finp, fout, ftype, { ".*" }, to_skip, nthread, to_type)) {
         fprintf(stderr, "%s: failed to quantize model '%s'\n", __func__, fname_inp.c_str());
         return false;
     }
@@ -176,9 +181,11 @@ static bool whisper_model_quantize(const std::string & fname_inp, const std::str
 }
 
 int main(int argc, char ** argv) {
-    if (argc != 4) {
-        fprintf(stderr, "usage: %s model-f32.bin model-quant.bin type\n", argv[0]);
+    if (argc != 4 && argc != 5) {
+        fprintf(stderr, "usage: %s model-f32.bin model-quant.bin type[-recipe] [nthread]\n", argv[0]);
         ggml_print_ftypes(stderr);
+        fprintf(stderr, "  recipe = \"mix\": the token embedding and the first and last layers of encoder and decoder in q8_0\n");
+        fprintf(stderr, "  recipe = \"mix-small\": mix, and the MLPs of the other encoder layers one type below type\n");
         return 1;
     }
 
@@ -192,7 +199,20 @@ int main(int argc, char ** argv) {
     const std::string fname_inp = argv[1];
     const std::string fname_out = argv[2];
 
-    const ggml_ftype ftype = ggml_parse_ftype(argv[3]);
+    // e.g. "q5_0" or "q5_0-mix"
+    const std::string type = argv[3];
+    const size_t      dash = type.find('-');
+
+    const ggml_ftype ftype = ggml_parse_ftype(type.substr(0, dash).c_str());
+
+    const int recipe = dash == std::string::npos ? (int) WHISPER_QUANT_RECIPE_NONE : whisper_internal_quant_recipe_from_str(type.c_str() + dash + 1);
+    if (recipe < 0) {
+        fprintf(stderr, "%s: unknown recipe '%s'\n", __func__, type.c_str() + dash + 1);
+        return 1;
+    }
+
+    // 0 = number of hardware threads
+    const int nthread = argc > 4 ? atoi(argv[4]) : 0;
 
     const int64_t t_main_start_us = ggml_time_us();
 
@@ -202,7 +222,7 @@ int main(int argc, char ** argv) {
     {
         const int64_t t_start_us = ggml_time_us();
 
-        if (!whisper_model_quantize(fname_inp, fname_out, ggml_ftype(ftype))) {
+        if (!whisper_model_quantize(fname_inp, fname_out, ggml_ftype(ftype), recipe, nthread)) {
             fprintf(stderr, "%s: failed to quantize model from '%s'\n", __func__, fname_inp.c_str());
             return 1;
         }
@@ -0,0 +1,300 @@
+// replays a whisper_full() call captured with whisper_full_params::capture_path and compares the decisions of each
+// window (seek, temperature fallbacks and their reasons) with the capture
+//
+// usage: whisper-replay -c capture [-m model] [-r N] [-pr N]
+
+#include "whisper.h"
+#include "json.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::ordered_json;
+
+// command-line parameters
+struct whisper_params {
+    int32_t n_threads = -1; // -1 = the captured value
+    int32_t n_repeat  = 1;
+    int32_t n_profile = 0;
+
+    std::string capture = "";
+    std::string model   = ""; // empty = the captured path
+};
+
+static void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
+
+static bool whisper_params_parse(int argc, char ** argv, whisper_params & params) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            whisper_print_usage(argc, argv, params);
+            exit(0);
+        }
+        else if (arg == "-c"  || arg == "--capture") { params.capture   = argv[++i]; }
+        else if (arg == "-m"  || arg == "--model")   { params.model     = argv[++i]; }
+        else if (arg == "-t"  || arg == "--threads") { params.n_threads = std::stoi(argv[++i]); }
+        else if (arg == "-r"  || arg == "--repeat")  { params.n_repeat  = std::stoi(argv[++i]); }
+        else if (arg == "-pr" || arg == "--profile") { params.n_profile = std::stoi(argv[++i]); }
+        else {
+            fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+            whisper_print_usage(argc, argv, params);
+            exit(0);
+        }
+    }
+
+    return !params.capture.empty();
+}
+
+static void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & params) {
+    fprintf(stderr, "\n");
+    fprintf(stderr, "usage: %s -c CAPTURE [options]\n", argv[0]);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "  -h,       --help          [default] show this help message and exit\n");
+    fprintf(stderr, "  -c PATH,  --capture PATH  [%-7s] capture to replay, reads PATH.json and PATH.pcm\n", params.capture.c_str());
+    fprintf(stderr, "  -m FNAME, --model FNAME   [%-7s] model path (default: the captured one)\n", params.model.c_str());
+    fprintf(stderr, "  -t N,     --threads N     [%-7d] number of threads (default: the captured value)\n", params.n_threads);
+    fprintf(stderr, "  -r N,     --repeat N      [%-7d] number of replays\n", params.n_repeat);
+    fprintf(stderr, "  -pr N,    --profile N     [%-7d] print the N most expensive ops of the last replay\n", params.n_profile);
+    fprintf(stderr, "\n");
+}
+
+// must match whisper_capture_write() in src/whisper.cpp
+static uint64_t fnv1a(const std::vector<float> & pcm) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    const uint8_t * bytes = (const uint8_t *) pcm.data();
+    for (size_t i = 0; i < pcm.size()*sizeof(float); ++i) {
+        hash = (hash ^ bytes[i])*0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static const char * json_cstr(const json & j, std::string & storage) {
+    if (j.is_null()) {
+        return nullptr;
+    }
+    storage = j.get<std::string>();
+    return storage.c_str();
+}
+
+// compares the windows of a replay with the ones of the capture, returns the number of differences
+static int compare_windows(const json & expected, const json & actual) {
+    int n_diff = 0;
+
+    const size_t n = std::max(expected.size(), actual.size());
+    for (size_t i = 0; i < n; ++i) {
+        if (i >= expected.size() || i >= actual.size()) {
+            printf("  window %3zu: %s\n", i, i >= expected.size() ? "not in the capture" : "not in the replay");
+            n_diff++;
+            continue;
+        }
+
+        const auto & e = expected[i];
+        const auto & a = actual[i];
+
+        std::string reasons_e;
+        std::string reasons_a;
+        for (const auto & t : e["tries"]) reasons_e += t["result"].get<std::string>() + " ";
+        for (const auto & t : a["tries"]) reasons_a += t["result"].get<std::string>() + " ";
+
+        if (e["seek"] != a["seek"] || e["seek_delta"] != a["seek_delta"] || e["skipped"] != a["skipped"] || reasons_e != reasons_a) {
+            printf("  window %3zu: seek %d -> %d, seek_delta %d -> %d, tries [ %s] -> [ %s]\n", i,
+                    e["seek"].get<int>(), a["seek"].get<int>(), e["seek_delta"].get<int>(), a["seek_delta"].get<int>(),
+                    reasons_e.c_str(), reasons_a.c_str());
+            n_diff++;
+        }
+    }
+
+    return n_diff;
+}
+
+int main(int argc, char ** argv) {
+    whisper_params params;
+
+    if (whisper_params_parse(argc, argv, params) == false) {
+        whisper_print_usage(argc, argv, params);
+        return 1;
+    }
+
+    json capture;
+    {
+        std::ifstream fin(params.capture + ".json");
+        if (!fin) {
+            fprintf(stderr, "error: failed to open '%s.json'\n", params.capture.c_str());
+            return 1;
+        }
+        try {
+            fin >> capture;
+        } catch (const std::exception & e) {
+            fprintf(stderr, "error: failed to parse '%s.json': %s\n", params.capture.c_str(), e.what());
+            return 1;
+        }
+    }
+
+    std::vector<float> pcm(capture["audio"]["n_samples"].get<int64_t>());
+    {
+        FILE * fin = fopen((params.capture + ".pcm").c_str(), "rb");
+        if (fin == nullptr) {
+            fprintf(stderr, "error: failed to open '%s.pcm'\n", params.capture.c_str());
+            return 1;
+        }
+        const size_t n_read = fread(pcm.data(), sizeof(float), pcm.size(), fin);
+        fclose(fin);
+
+        char hash[17];
+        snprintf(hash, sizeof(hash), "%016llx", (unsigned long long) fnv1a(pcm));
+
+        if (n_read != pcm.size() || capture["audio"]["fnv1a"].get<std::string>() != hash) {
+            fprintf(stderr, "error: '%s.pcm' does not match the capture\n", params.capture.c_str());
+            return 1;
+        }
+    }
+
+    const json & cp = capture["params"];
+
+    if (cp["has_logits_filter_callback"].get<bool>() || cp["has_grammar"].get<bool>() || cp["has_draft_model"].get<bool>()) {
+        fprintf(stderr, "warning: the capture used a logits filter, a grammar or a draft model, which are not replayed\n");
+    }
+
+    if (params.model.empty()) {
+        params.model = capture["model"]["path"].get<std::string>();
+    }
+
+    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), whisper_context_default_params());
+    if (ctx == nullptr) {
+        fprintf(stderr, "error: failed to initialize whisper context from '%s'\n", params.model.c_str());
+        return 2;
+    }
+
+    if (whisper_model_type_readable(ctx) != capture["model"]["type"].get<std::string>() || whisper_n_vocab(ctx) != capture["model"]["n_vocab"].get<int>()) {
+        fprintf(stderr, "warning: the model differs from the captured one (%s)\n", capture["model"]["type"].get<std::string>().c_str());
+    }
+
+    std::string suppress_regex;
+    std::string initial_prompt;
+    std::string language;
+    std::string vad_model_path;
+
+    std::vector<whisper_token> prompt_tokens = cp["prompt_tokens"].get<std::vector<whisper_token>>();
+
+    whisper_full_params wparams = whisper_full_default_params((whisper_sampling_strategy) cp["strategy"].get<int>());
+
+    wparams.n_threads        = params.n_threads > 0 ? params.n_threads : cp["n_threads"].get<int>();
+    wparams.n_max_text_ctx   = cp["n_max_text_ctx"];
+    wparams.offset_ms        = cp["offset_ms"];
+    wparams.duration_ms      = cp["duration_ms"];
+    wparams.translate        = cp["translate"];
+    wparams.no_context       = cp["no_context"];
+    wparams.no_timestamps    = cp["no_timestamps"];
+    wparams.single_segment   = cp["single_segment"];
+    wparams.print_special    = cp["print_special"];
+    wparams.print_progress   = false;
+    wparams.print_realtime   = false;
+    wparams.token_timestamps = cp["token_timestamps"];
+    wparams.thold_pt         = cp["thold_pt"];
+    wparams.thold_ptsum      = cp["thold_ptsum"];
+    wparams.max_len          = cp["max_len"];
+    wparams.split_on_word    = cp["split_on_word"];
+    wparams.max_tokens       = cp["max_tokens"];
+    wparams.debug_mode       = cp["debug_mode"];
+    wparams.audio_ctx        = cp["audio_ctx"];
+    wparams.audio_ctx_auto   = cp["audio_ctx_auto"];
+    wparams.sample_on_device = cp["sample_on_device"];
+    wparams.tdrz_enable      = cp["tdrz_enable"];
+    wparams.suppress_regex   = json_cstr(cp["suppress_regex"], suppress_regex);
+    wparams.initial_prompt   = json_cstr(cp["initial_prompt"], initial_prompt);
+    wparams.prompt_tokens    = prompt_tokens.empty() ? nullptr : prompt_tokens.data();
+    wparams.prompt_n_tokens  = prompt_tokens.size();
+    wparams.language         = json_cstr(cp["language"], language);
+    wparams.detect_language  = cp["detect_language"];
+    wparams.suppress_blank   = cp["suppress_blank"];
+    wparams.suppress_nst     = cp["suppress_nst"];
+    wparams.temperature      = cp["temperature"];
+    wparams.max_initial_ts   = cp["max_initial_ts"];
+    wparams.length_penalty   = cp["length_penalty"];
+    wparams.temperature_inc  = cp["temperature_inc"];
+    wparams.entropy_thold    = cp["entropy_thold"];
+    wparams.logprob_thold    = cp["logprob_thold"];
+    wparams.no_speech_thold  = cp["no_speech_thold"];
+
+    wparams.greedy.best_of        = cp["greedy_best_of"];
+    wparams.beam_search.beam_size = cp["beam_size"];
+    wparams.beam_search.patience  = cp["beam_patience"];
+    wparams.fallback_parallel     = cp["fallback_parallel"];
+
+    wparams.split_search_ms      = cp["split_search_ms"];
+    wparams.split_overlap_ms     = cp["split_overlap_ms"];
+    wparams.split_chunk_ms       = cp["split_chunk_ms"];
+    wparams.vad_chunk_ms         = cp["vad_chunk_ms"];
+    wparams.silence_thold        = cp["silence_thold"];
+    wparams.no_speech_skip_thold = cp["no_speech_skip_thold"];
+
+    wparams.vad            = cp["vad"];
+    wparams.vad_model_path = json_cstr(cp["vad_model_path"], vad_model_path);
+
+    wparams.vad_params.threshold               = cp["vad_threshold"];
+    wparams.vad_params.min_speech_duration_ms  = cp["vad_min_speech_duration_ms"];
+    wparams.vad_params.min_silence_duration_ms = cp["vad_min_silence_duration_ms"];
+    wparams.vad_params.max_speech_duration_s   = cp["vad_max_speech_duration_s"];
+    wparams.vad_params.speech_pad_ms           = cp["vad_speech_pad_ms"];
+    wparams.vad_params.samples_overlap         = cp["vad_samples_overlap"];
+
+    const std::string replay_path = params.capture + ".replay";
+    wparams.capture_path = replay_path.c_str();
+
+    if (params.n_profile > 0) {
+        whisper_profile_enable_from_state(whisper_get_state(ctx), true);
+    }
+
+    fprintf(stderr, "%s: replaying '%s' (%.2f sec, %s, %d threads) %d times\n", __func__, params.capture.c_str(),
+            float(pcm.size())/WHISPER_SAMPLE_RATE, params.model.c_str(), wparams.n_threads, params.n_repeat);
+
+    int n_failed = 0;
+
+    for (int i = 0; i < params.n_repeat; ++i) {
+        whisper_reset_timings(ctx);
+        if (params.n_profile > 0) {
+            whisper_profile_reset_from_state(whisper_get_state(ctx));
+        }
+
+        const int ret = whisper_full(ctx, wparams, pcm.data(), pcm.size());
+
+        json replay;
+        {
+            std::ifstream fin(replay_path + ".json");
+            fin >> replay;
+        }
+
+        int n_diff = ret != capture["result"].get<int>() ? 1 : 0;
+        if (n_diff) {
+            printf("replay %d: result %d, captured %d\n", i, ret, capture["result"].get<int>());
+        }
+
+        n_diff += compare_windows(capture["windows"], replay["windows"]);
+
+        printf("replay %d: %zu windows, %d differences\n", i, replay["windows"].size(), n_diff);
+        n_failed += n_diff > 0;
+    }
+
+    whisper_print_timings(ctx);
+
+    if (params.n_profile > 0) {
+        whisper_profile_print_from_state(whisper_get_state(ctx), params.n_profile);
+    }
+
+    whisper_free(ctx);
+
+    if (n_failed > 0) {
+        fprintf(stderr, "%s: %d of %d replays diverged from the capture\n", __func__, n_failed, params.n_repeat);
+        return 3;
+    }
+
+    return 0;
+}
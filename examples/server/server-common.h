@@ -0,0 +1,349 @@
+#pragma once
+
+// the parts of whisper-server that do not depend on HTTP, shared with tests/test-server-common.cpp
+
+#include "whisper.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// bounds the number of requests that run inference at the same time and the number of requests waiting for a slot
+struct admission_queue {
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    int n_slots;
+    int n_queue;
+
+    int n_active  = 0;
+    int n_waiting = 0;
+
+    admission_queue(int n_slots, int n_queue) : n_slots(n_slots), n_queue(n_queue) {}
+
+    // wait for a free slot, returns false if the queue is full
+    bool acquire() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (n_active >= n_slots && n_waiting >= n_queue) {
+            return false;
+        }
+
+        ++n_waiting;
+        cv.wait(lock, [&]() { return n_active < n_slots; });
+        --n_waiting;
+        ++n_active;
+
+        return true;
+    }
+
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --n_active;
+        }
+        cv.notify_one();
+    }
+};
+
+// a slot of the admission queue, released when the request is done
+struct admission_ticket {
+    admission_queue & queue;
+    const bool        ok;
+
+    admission_ticket(admission_queue & queue) : queue(queue), ok(queue.acquire()) {}
+
+    ~admission_ticket() {
+        if (ok) {
+            queue.release();
+        }
+    }
+
+    admission_ticket(const admission_ticket &) = delete;
+    admission_ticket & operator=(const admission_ticket &) = delete;
+};
+
+// a state checked out of the context pool, recycled when the request is done
+struct whisper_state_lease {
+    // the states checked out by all requests
+    static std::atomic<int> & n_active() {
+        static std::atomic<int> n{0};
+        return n;
+    }
+
+    whisper_context * ctx;
+    whisper_state   * state;
+
+    whisper_state_lease(whisper_context * ctx) : ctx(ctx), state(whisper_init_state(ctx)) {
+        n_active() += state != nullptr;
+    }
+
+    ~whisper_state_lease() {
+        n_active() -= state != nullptr;
+        whisper_recycle_state(ctx, state);
+    }
+
+    whisper_state_lease(const whisper_state_lease &) = delete;
+    whisper_state_lease & operator=(const whisper_state_lease &) = delete;
+};
+
+// the served model - a request keeps a reference to the context it started with, so /load can swap in a new
+// model while requests are running, and the old context is freed when the last request that uses it is done
+struct model_holder {
+    std::mutex                       mutex;
+    std::shared_ptr<whisper_context> ctx;
+
+    std::shared_ptr<whisper_context> get() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ctx;
+    }
+
+    // the previous model is released outside of the lock
+    void swap(std::shared_ptr<whisper_context> & other) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ctx.swap(other);
+    }
+};
+
+// a reference-counted context for model_holder and model_registry, on_free is called with it before it is freed
+inline std::shared_ptr<whisper_context> make_model(whisper_context * ctx, std::function<void(whisper_context *)> on_free) {
+    return std::shared_ptr<whisper_context>(ctx, [on_free](whisper_context * ctx) {
+        fprintf(stderr, "model_holder: freeing the model, no request uses it anymore\n");
+        if (on_free) {
+            on_free(ctx);
+        }
+        whisper_free(ctx);
+    });
+}
+
+// the models that requests can select by name - they are loaded on first use, and the least recently used ones are
+// evicted when the loaded models exceed the memory budget. Each context has its own pool of states
+struct model_registry {
+    struct entry {
+        std::string path;
+        size_t      n_bytes   = 0; // size of the model file, used as the estimate of its memory
+        uint64_t    last_used = 0;
+
+        std::shared_ptr<whisper_context> ctx;
+    };
+
+    std::mutex mutex;
+    std::mutex load_mutex; // serializes the loads, the requests on loaded models are not blocked by them
+
+    std::map<std::string, entry> models;
+
+    whisper_context_params cparams;
+    size_t   budget = 0; // 0 - no limit
+
+    std::function<void(whisper_context *)> on_load; // called with each model after it is loaded
+    std::function<void(whisper_context *)> on_free; // called with each model before it is freed
+    uint64_t n_uses = 0;
+
+    bool add(const std::string & name, const std::string & path) {
+        std::ifstream fin(path, std::ios::binary | std::ios::ate);
+        if (!fin) {
+            return false;
+        }
+
+        entry & e = models[name];
+        e.path    = path;
+        e.n_bytes = (size_t) fin.tellg();
+
+        return true;
+    }
+
+    bool has(const std::string & name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return models.count(name) > 0;
+    }
+
+    // returns nullptr if the model fails to load
+    std::shared_ptr<whisper_context> get(const std::string & name) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            entry & e = models.at(name);
+            e.last_used = ++n_uses;
+            if (e.ctx) {
+                return e.ctx;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock_load(load_mutex);
+
+        // the evicted models are freed outside of the lock
+        std::vector<std::shared_ptr<whisper_context>> evicted;
+
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            entry & e = models.at(name);
+            if (e.ctx) {
+                // loaded by another request in the meantime
+                return e.ctx;
+            }
+
+            evict(e.n_bytes, evicted);
+            path = e.path;
+        }
+        evicted.clear();
+
+        fprintf(stderr, "%s: loading model '%s' from '%s'\n", __func__, name.c_str(), path.c_str());
+
+        whisper_context * ctx = whisper_init_from_file_with_params(path.c_str(), cparams);
+        if (ctx == nullptr) {
+            fprintf(stderr, "%s: failed to load model '%s'\n", __func__, name.c_str());
+            return nullptr;
+        }
+
+        if (on_load) {
+            on_load(ctx);
+        }
+
+        std::shared_ptr<whisper_context> loaded = make_model(ctx, on_free);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        models.at(name).ctx = loaded;
+
+        return loaded;
+    }
+
+private:
+    // drop the least recently used models until n_bytes more fit in the budget
+    // requests that still use an evicted model keep it alive until they are done
+    void evict(size_t n_bytes, std::vector<std::shared_ptr<whisper_context>> & evicted) {
+        if (budget == 0) {
+            return;
+        }
+
+        while (true) {
+            size_t n_loaded = 0;
+            auto   lru      = models.end();
+            for (auto it = models.begin(); it != models.end(); ++it) {
+                if (!it->second.ctx) {
+                    continue;
+                }
+                n_loaded += it->second.n_bytes;
+                if (lru == models.end() || it->second.last_used < lru->second.last_used) {
+                    lru = it;
+                }
+            }
+
+            // a model larger than the budget is still loaded, as the only one
+            if (lru == models.end() || n_loaded + n_bytes <= budget) {
+                break;
+            }
+
+            fprintf(stderr, "%s: evicting model '%s' to stay within the memory budget\n", __func__, lru->first.c_str());
+            evicted.push_back(std::move(lru->second.ctx));
+            lru->second.ctx.reset();
+        }
+    }
+};
+
+// FNV-1a
+inline uint64_t hash_bytes(const void * data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL) {
+    const uint8_t * p = (const uint8_t *) data;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ p[i])*0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// least recently used cache of the values computed with a model - an entry is only returned for the model it was
+// computed with. The capacity is in the units of the cost of the entries
+template <typename T>
+struct model_lru_cache {
+    struct entry {
+        std::string                    key;
+        std::weak_ptr<whisper_context> model;
+        std::shared_ptr<const T>       value;
+        size_t                         cost;
+    };
+
+    std::mutex mutex;
+
+    std::list<entry> entries; // the most recently used first
+    std::map<std::string, typename std::list<entry>::iterator> index;
+
+    size_t capacity = 0; // 0 - disabled
+    size_t used     = 0;
+
+    uint64_t n_hits   = 0;
+    uint64_t n_misses = 0;
+
+    bool enabled() const {
+        return capacity > 0;
+    }
+
+    std::shared_ptr<const T> get(const std::string & key, const std::shared_ptr<whisper_context> & model) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = index.find(key);
+        if (it == index.end()) {
+            n_misses++;
+            return nullptr;
+        }
+
+        const std::shared_ptr<whisper_context> owner = it->second->model.lock();
+
+        // the entries of a freed model cannot be used again, their memory is returned right away
+        if (!owner) {
+            used -= it->second->cost;
+            entries.erase(it->second);
+            index.erase(it);
+        }
+
+        if (!owner || owner != model) {
+            n_misses++;
+            return nullptr;
+        }
+
+        entries.splice(entries.begin(), entries, it->second);
+        n_hits++;
+
+        return it->second->value;
+    }
+
+    void put(const std::string & key, const std::shared_ptr<whisper_context> & model, std::shared_ptr<const T> value, size_t cost) {
+        if (cost > capacity) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = index.find(key);
+        if (it != index.end()) {
+            used -= it->second->cost;
+            entries.erase(it->second);
+            index.erase(it);
+        }
+
+        while (used + cost > capacity) {
+            used -= entries.back().cost;
+            index.erase(entries.back().key);
+            entries.pop_back();
+        }
+
+        entries.push_front({ key, model, std::move(value), cost });
+        index[key] = entries.begin();
+        used += cost;
+    }
+
+    void print(std::ostringstream & ss, const std::string & name) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        ss << "# TYPE whisper_" << name << "_cache_hits_total counter\n";
+        ss << "whisper_" << name << "_cache_hits_total " << n_hits << "\n";
+        ss << "# TYPE whisper_" << name << "_cache_misses_total counter\n";
+        ss << "whisper_" << name << "_cache_misses_total " << n_misses << "\n";
+    }
+};
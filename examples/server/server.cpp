@@ -3,12 +3,24 @@
 
 #include "whisper.h"
 #include "httplib.h"
+#include "server-common.h"
 #include "json.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -37,7 +49,36 @@ struct server_params
     int32_t read_timeout  = 600;
     int32_t write_timeout = 600;
 
+    int32_t n_parallel    = 2;  // requests that run inference at the same time, each one with its own whisper_state
+    int32_t n_queue       = 16; // requests that wait for a free slot before the server answers 503
+    int32_t batch_size    = 1;  // short requests that are processed together, 1 - no batching
+    int32_t batch_wait_ms = 10; // how long a request waits for others to fill its batch
+    bool    decode_batch  = false; // the decoding steps of the requests that run at the same time are evaluated together
+
+    std::vector<std::pair<std::string, std::string>> models; // name and path of the models that requests can select
+    int32_t models_budget_mb = 0; // memory for the selectable models, 0 - no limit
+
+    std::vector<std::pair<std::string, std::string>> loras; // name and path of the LoRA adapters that requests can select
+
+    int32_t cache_responses  = 0; // responses kept for repeated requests, 0 - no cache
+    int32_t cache_encoder_mb = 0; // memory for the encoder outputs of repeated audio, 0 - no cache
+
+    int32_t jobs_max            = 64;   // background jobs that are queued or running
+    int32_t jobs_audio_budget_s = 3600; // total audio duration of the running background jobs
+    int32_t jobs_keep_s         = 3600; // how long the results of a finished job are kept
+    int32_t jobs_preempt_ms     = 0;    // how long a background job pauses at a time for the interactive requests, 0 - never
+
+    int32_t live_workers   = 0;  // workers that transcribe the live streams, 0 - no live streams
+    int32_t live_max       = 64; // live streams that are open at the same time
+    int32_t live_timeout_s = 60; // live streams without new audio for this long are closed
+
+    std::string vad_model; // VAD model that gates the jobs of the live streams, and splits the audio of a coordinator
+
+    std::vector<std::string> workers; // whisper-server instances that transcribe the shards of the requests
+    int32_t shard_s = 120;            // duration of the shards that a coordinator sends to its workers
+
     bool ffmpeg_converter = false;
+    bool warmup           = false; // run silence through the models when they are loaded
 };
 
 struct whisper_params {
@@ -62,6 +103,7 @@ struct whisper_params {
 
     bool debug_mode      = false;
     bool translate       = false;
+    bool translate_also  = false; // also return the English translation, see whisper_full_params::translate_also
     bool detect_language = false;
     bool diarize         = false;
     bool tinydiarize     = false;
@@ -90,6 +132,13 @@ struct whisper_params {
     std::string openvino_encode_device = "CPU";
 
     std::string dtw = "";
+
+    // a routed model that transcribes the low confidence segments again, see whisper_full_cascade_with_state()
+    std::string cascade_model = "";
+
+    // a LoRA adapter of the decoder, selected by its --lora name, and its scale
+    std::string lora       = "";
+    float       lora_scale = 1.0f;
 };
 
 void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & params, const server_params& sparams) {
@@ -134,7 +183,28 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  --public PATH,                 [%-7s] Path to the public folder\n", sparams.public_path.c_str());
     fprintf(stderr, "  --request-path PATH,           [%-7s] Request path for all requests\n", sparams.request_path.c_str());
     fprintf(stderr, "  --inference-path PATH,         [%-7s] Inference path for all requests\n", sparams.inference_path.c_str());
-    fprintf(stderr, "  --convert,                     [%-7s] Convert audio to WAV, requires ffmpeg on the server\n", sparams.ffmpeg_converter ? "true" : "false");
+    fprintf(stderr, "  --convert,                     [%-7s] Use ffmpeg for audio that cannot be decoded in-process\n", sparams.ffmpeg_converter ? "true" : "false");
+    fprintf(stderr, "  --warmup,                      [%-7s] Warm up the models when they are loaded, before the first request\n", sparams.warmup ? "true" : "false");
+    fprintf(stderr, "  --parallel N,                  [%-7d] Number of requests that run inference at the same time\n", sparams.n_parallel);
+    fprintf(stderr, "  --queue N,                     [%-7d] Number of requests waiting for inference before the server is busy\n", sparams.n_queue);
+    fprintf(stderr, "  --batch-size N,                [%-7d] Number of short requests that share the encoder passes (max 8)\n", sparams.batch_size);
+    fprintf(stderr, "  --batch-wait-ms N,             [%-7d] Time a request waits for others to fill its batch\n", sparams.batch_wait_ms);
+    fprintf(stderr, "  --decode-batch,                [%-7s] Decode the steps of the requests that run at the same time together\n", sparams.decode_batch ? "true" : "false");
+    fprintf(stderr, "  --model-route NAME=PATH,       [%-7s] Model that requests select with the 'model' field, loaded on first use\n", "");
+    fprintf(stderr, "  --models-budget-mb N,          [%-7d] Memory for the routed models, the least recently used are evicted (0 = no limit)\n", sparams.models_budget_mb);
+    fprintf(stderr, "  --lora NAME=PATH,              [%-7s] LoRA adapter that requests select with the 'lora' field, loaded onto a model on first use\n", "");
+    fprintf(stderr, "  --cache-responses N,           [%-7d] Number of responses kept for requests with the same audio and parameters\n", sparams.cache_responses);
+    fprintf(stderr, "  --cache-encoder-mb N,          [%-7d] Memory for the encoder outputs of repeated audio of up to 30 s\n", sparams.cache_encoder_mb);
+    fprintf(stderr, "  --jobs-max N,                  [%-7d] Number of background jobs that are queued or running\n", sparams.jobs_max);
+    fprintf(stderr, "  --jobs-audio-budget-s N,       [%-7d] Total audio duration of the background jobs that run at the same time\n", sparams.jobs_audio_budget_s);
+    fprintf(stderr, "  --jobs-keep-s N,               [%-7d] Time the result of a finished background job is kept\n", sparams.jobs_keep_s);
+    fprintf(stderr, "  --jobs-preempt-ms N,           [%-7d] Longest pause of a background job while interactive requests run (0 = no pauses)\n", sparams.jobs_preempt_ms);
+    fprintf(stderr, "  --live-workers N,              [%-7d] Number of workers that transcribe the live streams (0 = no live streams)\n", sparams.live_workers);
+    fprintf(stderr, "  --live-max N,                  [%-7d] Number of live streams that are open at the same time\n", sparams.live_max);
+    fprintf(stderr, "  --live-timeout-s N,            [%-7d] Time without new audio after which a live stream is closed (0 = never)\n", sparams.live_timeout_s);
+    fprintf(stderr, "  --vad-model FNAME,             [%-7s] VAD model, the live streams are transcribed at the end of each speech\n", sparams.vad_model.c_str());
+    fprintf(stderr, "  --worker URL,                  [%-7s] whisper-server that transcribes shards of the requests, http://host:port[/path], repeatable\n", "");
+    fprintf(stderr, "  --shard-s N,                   [%-7d] Duration of the shards that are sent to the workers\n", sparams.shard_s);
     fprintf(stderr, "  -sns,      --suppress-nst      [%-7s] suppress non-speech tokens\n", params.suppress_nst ? "true" : "false");
     fprintf(stderr, "  -nth N,    --no-speech-thold N [%-7.2f] no speech threshold\n",   params.no_speech_thold);
     fprintf(stderr, "  -nc,       --no-context        [%-7s] do not use previous audio context\n", params.no_context ? "true" : "false");
@@ -194,6 +264,47 @@ bool whisper_params_parse(int argc, char ** argv, whisper_params & params, serve
         else if (                  arg == "--request-path")    { sparams.request_path = argv[++i]; }
         else if (                  arg == "--inference-path")  { sparams.inference_path = argv[++i]; }
         else if (                  arg == "--convert")         { sparams.ffmpeg_converter     = true; }
+        else if (                  arg == "--warmup")          { sparams.warmup               = true; }
+        else if (                  arg == "--parallel")        { sparams.n_parallel  = std::max(1, std::stoi(argv[++i])); }
+        else if (                  arg == "--queue")           { sparams.n_queue     = std::max(0, std::stoi(argv[++i])); }
+        else if (                  arg == "--batch-size")      { sparams.batch_size  = std::min(8, std::max(1, std::stoi(argv[++i]))); }
+        else if (                  arg == "--batch-wait-ms")   { sparams.batch_wait_ms = std::max(0, std::stoi(argv[++i])); }
+        else if (                  arg == "--decode-batch")    { sparams.decode_batch  = true; }
+        else if (                  arg == "--model-route")
+        {
+            const std::string route = argv[++i];
+            const size_t pos = route.find('=');
+            if (pos == std::string::npos || pos == 0) {
+                fprintf(stderr, "error: expected NAME=PATH for --model-route, got '%s'\n", route.c_str());
+                whisper_print_usage(argc, argv, params, sparams);
+                exit(0);
+            }
+            sparams.models.emplace_back(route.substr(0, pos), route.substr(pos + 1));
+        }
+        else if (                  arg == "--lora")
+        {
+            const std::string lora = argv[++i];
+            const size_t pos = lora.find('=');
+            if (pos == std::string::npos || pos == 0) {
+                fprintf(stderr, "error: expected NAME=PATH for --lora, got '%s'\n", lora.c_str());
+                whisper_print_usage(argc, argv, params, sparams);
+                exit(0);
+            }
+            sparams.loras.emplace_back(lora.substr(0, pos), lora.substr(pos + 1));
+        }
+        else if (                  arg == "--models-budget-mb") { sparams.models_budget_mb = std::max(0, std::stoi(argv[++i])); }
+        else if (                  arg == "--cache-responses") { sparams.cache_responses  = std::max(0, std::stoi(argv[++i])); }
+        else if (                  arg == "--cache-encoder-mb") { sparams.cache_encoder_mb = std::max(0, std::stoi(argv[++i])); }
+        else if (                  arg == "--jobs-max")        { sparams.jobs_max    = std::max(1, std::stoi(argv[++i])); }
+        else if (                  arg == "--jobs-audio-budget-s") { sparams.jobs_audio_budget_s = std::max(1, std::stoi(argv[++i])); }
+        else if (                  arg == "--jobs-keep-s")     { sparams.jobs_keep_s = std::max(0, std::stoi(argv[++i])); }
+        else if (                  arg == "--jobs-preempt-ms") { sparams.jobs_preempt_ms = std::max(0, std::stoi(argv[++i])); }
+        else if (                  arg == "--live-workers")    { sparams.live_workers = std::max(0, std::stoi(argv[++i])); }
+        else if (                  arg == "--live-max")        { sparams.live_max     = std::max(1, std::stoi(argv[++i])); }
+        else if (                  arg == "--live-timeout-s")  { sparams.live_timeout_s = std::max(0, std::stoi(argv[++i])); }
+        else if (                  arg == "--vad-model")       { sparams.vad_model    = argv[++i]; }
+        else if (                  arg == "--worker")          { sparams.workers.push_back(argv[++i]); }
+        else if (                  arg == "--shard-s")         { sparams.shard_s      = std::max(1, std::stoi(argv[++i])); }
         else {
             fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
             whisper_print_usage(argc, argv, params, sparams);
@@ -207,7 +318,7 @@ bool whisper_params_parse(int argc, char ** argv, whisper_params & params, serve
 struct whisper_print_user_data {
     const whisper_params * params;
 
-    const std::vector<std::vector<float>> * pcmf32s;
+    const stereo_energy * energy;
     int progress_prev;
 };
 
@@ -268,37 +379,50 @@ bool convert_to_wav(const std::string & temp_filename, std::string & error_resp)
     return true;
 }
 
-std::string estimate_diarization_speaker(std::vector<std::vector<float>> pcmf32s, int64_t t0, int64_t t1, bool id_only = false) {
-    std::string speaker = "";
-    const int64_t n_samples = pcmf32s[0].size();
+// decodes an uploaded audio file to 16 kHz F32 PCM, on failure error_resp is the JSON error response
+bool decode_upload(
+        const std::string & content,
+                     bool   diarize,
+                     bool   ffmpeg_converter,
+       std::vector<float> & pcmf32,
+       std::vector<std::vector<float>> & pcmf32s,
+              std::string & error_resp) {
+    // decode in memory first - WAV, MP3, FLAC and OGG (and any container with WHISPER_FFMPEG) are
+    // decoded and resampled to 16 kHz without touching the disk
+    if (::read_audio_data(content, pcmf32, pcmf32s, diarize)) {
+        return true;
+    }
 
-    const int64_t is0 = timestamp_to_sample(t0, n_samples, WHISPER_SAMPLE_RATE);
-    const int64_t is1 = timestamp_to_sample(t1, n_samples, WHISPER_SAMPLE_RATE);
+    if (!ffmpeg_converter) {
+        fprintf(stderr, "error: failed to read audio data\n");
+        error_resp = "{\"error\":\"failed to read audio data\"}";
+        return false;
+    }
 
-    double energy0 = 0.0f;
-    double energy1 = 0.0f;
+    // fall back to the ffmpeg executable for the remaining formats
+    // write to temporary file
+    const std::string temp_filename = generate_temp_filename("whisper-server", ".wav");
+    std::ofstream temp_file{temp_filename, std::ios::binary};
+    temp_file << content;
+    temp_file.close();
 
-    for (int64_t j = is0; j < is1; j++) {
-        energy0 += fabs(pcmf32s[0][j]);
-        energy1 += fabs(pcmf32s[1][j]);
+    error_resp = "{\"error\":\"Failed to execute ffmpeg command.\"}";
+    if (!convert_to_wav(temp_filename, error_resp)) {
+        return false;
     }
 
-    if (energy0 > 1.1*energy1) {
-        speaker = "0";
-    } else if (energy1 > 1.1*energy0) {
-        speaker = "1";
-    } else {
-        speaker = "?";
+    // read audio content into pcmf32
+    if (!::read_audio_data(temp_filename, pcmf32, pcmf32s, diarize)) {
+        fprintf(stderr, "error: failed to read WAV file '%s'\n", temp_filename.c_str());
+        error_resp = "{\"error\":\"failed to read WAV file\"}";
+        std::remove(temp_filename.c_str());
+        return false;
     }
 
-    //printf("is0 = %lld, is1 = %lld, energy0 = %f, energy1 = %f, speaker = %s\n", is0, is1, energy0, energy1, speaker.c_str());
+    // remove temp file
+    std::remove(temp_filename.c_str());
 
-    if (!id_only) {
-        speaker.insert(0, "(speaker ");
-        speaker.append(")");
-    }
-
-    return speaker;
+    return true;
 }
 
 void whisper_print_progress_callback(struct whisper_context * /*ctx*/, struct whisper_state * /*state*/, int progress, void * user_data) {
@@ -310,11 +434,11 @@ void whisper_print_progress_callback(struct whisper_context * /*ctx*/, struct wh
     }
 }
 
-void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * /*state*/, int n_new, void * user_data) {
+void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * state, int n_new, void * user_data) {
     const auto & params  = *((whisper_print_user_data *) user_data)->params;
-    const auto & pcmf32s = *((whisper_print_user_data *) user_data)->pcmf32s;
+    const auto & energy  = *((whisper_print_user_data *) user_data)->energy;
 
-    const int n_segments = whisper_full_n_segments(ctx);
+    const int n_segments = whisper_full_n_segments_from_state(state);
 
     std::string speaker = "";
 
@@ -330,42 +454,42 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
 
     for (int i = s0; i < n_segments; i++) {
         if (!params.no_timestamps || params.diarize) {
-            t0 = whisper_full_get_segment_t0(ctx, i);
-            t1 = whisper_full_get_segment_t1(ctx, i);
+            t0 = whisper_full_get_segment_t0_from_state(state, i);
+            t1 = whisper_full_get_segment_t1_from_state(state, i);
         }
 
         if (!params.no_timestamps) {
             printf("[%s --> %s]  ", to_timestamp(t0).c_str(), to_timestamp(t1).c_str());
         }
 
-        if (params.diarize && pcmf32s.size() == 2) {
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+        if (params.diarize && !energy.empty()) {
+            speaker = estimate_diarization_speaker(energy, t0, t1);
         }
 
         if (params.print_colors) {
-            for (int j = 0; j < whisper_full_n_tokens(ctx, i); ++j) {
+            for (int j = 0; j < whisper_full_n_tokens_from_state(state, i); ++j) {
                 if (params.print_special == false) {
-                    const whisper_token id = whisper_full_get_token_id(ctx, i, j);
+                    const whisper_token id = whisper_full_get_token_id_from_state(state, i, j);
                     if (id >= whisper_token_eot(ctx)) {
                         continue;
                     }
                 }
 
-                const char * text = whisper_full_get_token_text(ctx, i, j);
-                const float  p    = whisper_full_get_token_p   (ctx, i, j);
+                const char * text = whisper_full_get_token_text_from_state(ctx, state, i, j);
+                const float  p    = whisper_full_get_token_p_from_state   (state, i, j);
 
                 const int col = std::max(0, std::min((int) k_colors.size() - 1, (int) (std::pow(p, 3)*float(k_colors.size()))));
 
                 printf("%s%s%s%s", speaker.c_str(), k_colors[col].c_str(), text, "\033[0m");
             }
         } else {
-            const char * text = whisper_full_get_segment_text(ctx, i);
+            const char * text = whisper_full_get_segment_text_from_state(state, i);
 
             printf("%s%s", speaker.c_str(), text);
         }
 
         if (params.tinydiarize) {
-            if (whisper_full_get_segment_speaker_turn_next(ctx, i)) {
+            if (whisper_full_get_segment_speaker_turn_next_from_state(state, i)) {
                 printf("%s", params.tdrz_speaker_turn.c_str());
             }
         }
@@ -378,18 +502,18 @@ void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper
     }
 }
 
-std::string output_str(struct whisper_context * ctx, const whisper_params & params, std::vector<std::vector<float>> pcmf32s) {
+std::string output_str(struct whisper_state * state, const whisper_params & params, const stereo_energy & energy) {
     std::stringstream result;
-    const int n_segments = whisper_full_n_segments(ctx);
+    const int n_segments = whisper_full_n_segments_from_state(state);
     for (int i = 0; i < n_segments; ++i) {
-        const char * text = whisper_full_get_segment_text(ctx, i);
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
         std::string speaker = "";
 
-        if (params.diarize && pcmf32s.size() == 2)
+        if (params.diarize && !energy.empty())
         {
-            const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-            const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
-            speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+            const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+            const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
+            speaker = estimate_diarization_speaker(energy, t0, t1);
         }
 
         result << speaker << text << "\n";
@@ -397,6 +521,688 @@ std::string output_str(struct whisper_context * ctx, const whisper_params & para
     return result.str();
 }
 
+// the English translation of a request with translate_also
+std::string output_translation(struct whisper_state * state) {
+    std::stringstream result;
+    const int n_segments = whisper_full_n_translated_segments_from_state(state);
+    for (int i = 0; i < n_segments; ++i) {
+        result << whisper_full_get_translated_segment_text_from_state(state, i) << "\n";
+    }
+    return result.str();
+}
+
+// cumulative histogram in the Prometheus text format
+struct metrics_histogram {
+    std::vector<double>   bounds;
+    std::vector<uint64_t> counts; // observations <= bounds[i], the last one is +Inf
+
+    double   sum   = 0.0;
+    uint64_t count = 0;
+
+    metrics_histogram(std::vector<double> bounds) : bounds(std::move(bounds)), counts(this->bounds.size() + 1, 0) {}
+
+    void observe(double value) {
+        for (size_t i = 0; i < bounds.size(); ++i) {
+            counts[i] += value <= bounds[i];
+        }
+        counts.back()++;
+
+        sum += value;
+        count++;
+    }
+
+    void print(std::ostringstream & ss, const std::string & name, const std::string & labels) const {
+        const std::string sep = labels.empty() ? "" : ",";
+        for (size_t i = 0; i < bounds.size(); ++i) {
+            ss << name << "_bucket{" << labels << sep << "le=\"" << bounds[i] << "\"} " << counts[i] << "\n";
+        }
+        ss << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << counts.back() << "\n";
+        ss << name << "_sum" << (labels.empty() ? "" : "{" + labels + "}") << " " << sum << "\n";
+        ss << name << "_count" << (labels.empty() ? "" : "{" + labels + "}") << " " << count << "\n";
+    }
+};
+
+// the statistics of the processed requests for /metrics - recorded from the counters of their states
+struct server_metrics {
+    std::mutex mutex;
+
+    uint64_t n_requests = 0;
+    uint64_t n_failed   = 0;
+    uint64_t n_fail_p   = 0;
+    uint64_t n_fail_h   = 0;
+
+    // time per request in each stage, in seconds
+    std::map<std::string, metrics_histogram> stages;
+
+    metrics_histogram rtf    { { 0.01, 0.02, 0.05, 0.1, 0.2, 0.5, 1.0, 2.0, 5.0 } };
+    metrics_histogram kv_use { { 0.1, 0.25, 0.5, 0.75, 0.9, 1.0 } }; // the most of the KV cache used, as a fraction
+
+    // the requests with asynchronous callbacks: the deepest their event queue got and the longest delay of an event
+    metrics_histogram cb_queue { { 1, 2, 4, 8, 16, 32, 64 } };
+    metrics_histogram cb_delay { { 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0 } };
+
+    server_metrics() {
+        const std::vector<double> bounds = { 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0 };
+        for (const char * stage : { "mel", "encode", "decode", "batchd", "prompt", "sample" }) {
+            stages.emplace(stage, metrics_histogram(bounds));
+        }
+    }
+
+    // t_wall_s is the processing time of the request, t_audio_s the duration of its audio
+    void record(whisper_state * state, bool ok, double t_wall_s, double t_audio_s) {
+        const whisper_state_stats st = whisper_get_state_stats(state);
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        n_requests++;
+        n_failed += !ok;
+        n_fail_p += st.n_fail_p;
+        n_fail_h += st.n_fail_h;
+
+        stages.at("mel")   .observe(1e-3*st.mel_ms);
+        stages.at("encode").observe(1e-3*st.encode_ms);
+        stages.at("decode").observe(1e-3*st.decode_ms);
+        stages.at("batchd").observe(1e-3*st.batchd_ms);
+        stages.at("prompt").observe(1e-3*st.prompt_ms);
+        stages.at("sample").observe(1e-3*st.sample_ms);
+
+        if (t_audio_s > 0.0) {
+            rtf.observe(t_wall_s/t_audio_s);
+        }
+        if (st.kv_self_size > 0) {
+            kv_use.observe(double(st.kv_self_n_max)/st.kv_self_size);
+        }
+        if (st.n_cb_events > 0) {
+            cb_queue.observe(st.cb_queue_max);
+            cb_delay.observe(1e-3*st.cb_delay_max_ms);
+        }
+    }
+
+    std::string print(int n_active, int n_waiting) {
+        std::ostringstream ss;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        ss << "# HELP whisper_requests_total Requests that ran inference\n";
+        ss << "# TYPE whisper_requests_total counter\n";
+        ss << "whisper_requests_total " << n_requests << "\n";
+        ss << "# HELP whisper_requests_failed_total Requests that failed or were aborted during inference\n";
+        ss << "# TYPE whisper_requests_failed_total counter\n";
+        ss << "whisper_requests_failed_total " << n_failed << "\n";
+        ss << "# HELP whisper_fallbacks_total Temperature fallbacks by the threshold that triggered them\n";
+        ss << "# TYPE whisper_fallbacks_total counter\n";
+        ss << "whisper_fallbacks_total{reason=\"logprob\"} " << n_fail_p << "\n";
+        ss << "whisper_fallbacks_total{reason=\"entropy\"} " << n_fail_h << "\n";
+
+        ss << "# HELP whisper_stage_seconds Time per request in each stage of the inference\n";
+        ss << "# TYPE whisper_stage_seconds histogram\n";
+        for (const auto & kv : stages) {
+            kv.second.print(ss, "whisper_stage_seconds", "stage=\"" + kv.first + "\"");
+        }
+
+        ss << "# HELP whisper_real_time_factor Processing time per request divided by the duration of its audio\n";
+        ss << "# TYPE whisper_real_time_factor histogram\n";
+        rtf.print(ss, "whisper_real_time_factor", "");
+
+        ss << "# HELP whisper_kv_cache_usage_ratio The most of the decoder KV cache used per request\n";
+        ss << "# TYPE whisper_kv_cache_usage_ratio histogram\n";
+        kv_use.print(ss, "whisper_kv_cache_usage_ratio", "");
+
+        ss << "# HELP whisper_callback_queue_depth The most segment and progress events waiting for delivery per request\n";
+        ss << "# TYPE whisper_callback_queue_depth histogram\n";
+        cb_queue.print(ss, "whisper_callback_queue_depth", "");
+
+        ss << "# HELP whisper_callback_delay_seconds The longest delay of a segment or progress event per request\n";
+        ss << "# TYPE whisper_callback_delay_seconds histogram\n";
+        cb_delay.print(ss, "whisper_callback_delay_seconds", "");
+
+        ss << "# HELP whisper_requests_active Requests that hold an inference slot\n";
+        ss << "# TYPE whisper_requests_active gauge\n";
+        ss << "whisper_requests_active " << n_active << "\n";
+        ss << "# HELP whisper_queue_depth Requests waiting for an inference slot\n";
+        ss << "# TYPE whisper_queue_depth gauge\n";
+        ss << "whisper_queue_depth " << n_waiting << "\n";
+        ss << "# HELP whisper_states_active States checked out of the state pools\n";
+        ss << "# TYPE whisper_states_active gauge\n";
+        ss << "whisper_states_active " << whisper_state_lease::n_active().load() << "\n";
+
+        return ss.str();
+    }
+};
+
+struct cached_response {
+    std::string body;
+    std::string content_type;
+};
+
+// lets the background jobs give way to the interactive requests and the live streams on the same device. While any
+// of them runs, the jobs pause at their next window or decoder step through whisper_full_params::yield_callback and
+// resume with their state intact. A job pauses for at most max_wait_ms at a time, so it still makes progress under
+// constant interactive load
+struct priority_gate {
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    int n_high      = 0;
+    int max_wait_ms = 0; // 0 - the jobs never pause
+
+    uint64_t n_pauses   = 0;
+    double   t_paused_s = 0.0;
+
+    // held by an interactive request for the duration of its inference
+    struct high {
+        priority_gate * gate;
+
+        high(priority_gate * gate) : gate(gate && gate->max_wait_ms > 0 ? gate : nullptr) {
+            if (this->gate) {
+                std::lock_guard<std::mutex> lock(this->gate->mutex);
+                this->gate->n_high++;
+            }
+        }
+
+        ~high() {
+            if (gate) {
+                {
+                    std::lock_guard<std::mutex> lock(gate->mutex);
+                    gate->n_high--;
+                }
+                gate->cv.notify_all();
+            }
+        }
+    };
+
+    // called by a background job between its computations
+    void yield(const std::atomic<bool> & cancel) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (n_high == 0 || max_wait_ms == 0) {
+            return;
+        }
+
+        n_pauses++;
+
+        const auto t_start  = std::chrono::steady_clock::now();
+        const auto deadline = t_start + std::chrono::milliseconds(max_wait_ms);
+        while (n_high > 0 && !cancel && std::chrono::steady_clock::now() < deadline) {
+            // the cancellation of the job is not signalled through the condition variable
+            cv.wait_until(lock, std::min(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(50)));
+        }
+
+        t_paused_s += std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    }
+
+    void print(std::ostringstream & ss) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        ss << "# HELP whisper_jobs_pauses_total Pauses of the background jobs for the interactive requests\n";
+        ss << "# TYPE whisper_jobs_pauses_total counter\n";
+        ss << "whisper_jobs_pauses_total " << n_pauses << "\n";
+        ss << "# TYPE whisper_jobs_paused_seconds_total counter\n";
+        ss << "whisper_jobs_paused_seconds_total " << t_paused_s << "\n";
+    }
+};
+
+// a transcription that runs in the background, submitted with POST /jobs and polled with GET /jobs/{id}
+struct async_job {
+    std::string id;
+    double      audio_s = 0.0; // duration of the audio
+
+    bool          diarize       = false;
+    bool          no_timestamps = false;
+    stereo_energy energy;
+
+    std::mutex  mutex;
+    std::string status   = "queued"; // queued, running, done, failed or cancelled
+    int         progress = 0;
+    json        segments = json::array();
+    std::string error;
+
+    std::chrono::steady_clock::time_point t_finished;
+
+    std::atomic<bool> cancel{false};
+    std::thread       worker;
+
+    bool finished() { // call with the mutex locked
+        return status == "done" || status == "failed" || status == "cancelled";
+    }
+
+    void finish(const std::string & result, const std::string & message = "") {
+        std::lock_guard<std::mutex> lock(mutex);
+        status     = result;
+        error      = message;
+        t_finished = std::chrono::steady_clock::now();
+    }
+};
+
+// the background jobs - the running jobs are admitted in order and limited by the total duration of their audio,
+// so a few long files cannot take all the states and the compute from the interactive requests. A job longer than
+// the budget runs alone
+struct job_manager {
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    std::map<std::string, std::shared_ptr<async_job>> jobs;
+    std::list<async_job *> waiting;
+
+    double audio_budget_s = 0.0;
+    double running_s      = 0.0;
+    int    n_running      = 0;
+
+    size_t max_jobs = 0; // queued and running
+    int    keep_s   = 0; // how long a finished job is kept for polling
+
+    priority_gate preempt;
+
+    ~job_manager() {
+        std::vector<std::shared_ptr<async_job>> all;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto & kv : jobs) {
+                kv.second->cancel = true;
+                all.push_back(kv.second);
+            }
+        }
+        cv.notify_all();
+
+        for (auto & job : all) {
+            if (job->worker.joinable()) {
+                job->worker.join();
+            }
+        }
+    }
+
+    std::string new_id() {
+        static std::mt19937_64 rng(std::random_device{}());
+
+        char buf[17];
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) rng());
+        return buf;
+    }
+
+    // returns false if too many jobs are pending
+    bool add(const std::shared_ptr<async_job> & job) {
+        collect();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (waiting.size() + n_running >= max_jobs) {
+            return false;
+        }
+
+        do {
+            job->id = new_id();
+        } while (jobs.count(job->id) > 0);
+
+        jobs[job->id] = job;
+        waiting.push_back(job.get());
+
+        return true;
+    }
+
+    std::shared_ptr<async_job> get(const std::string & id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = jobs.find(id);
+        return it == jobs.end() ? nullptr : it->second;
+    }
+
+    // wait until the job is the oldest waiting one and its audio fits in the budget, returns false if it was cancelled
+    bool acquire(async_job & job) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() {
+            return job.cancel || (waiting.front() == &job && (n_running == 0 || running_s + job.audio_s <= audio_budget_s));
+        });
+
+        waiting.remove(&job);
+        if (job.cancel) {
+            cv.notify_all();
+            return false;
+        }
+
+        running_s += job.audio_s;
+        n_running++;
+
+        // the next job may fit in the budget too
+        cv.notify_all();
+
+        return true;
+    }
+
+    void release(async_job & job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running_s -= job.audio_s;
+            n_running--;
+        }
+        cv.notify_all();
+    }
+
+    // cancels a queued or running job
+    void cancel(async_job & job) {
+        job.cancel = true;
+        cv.notify_all();
+    }
+
+private:
+    // drop the jobs that finished more than keep_s ago
+    void collect() {
+        const auto t_now = std::chrono::steady_clock::now();
+
+        std::vector<std::shared_ptr<async_job>> expired;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto it = jobs.begin(); it != jobs.end(); ) {
+                async_job & job = *it->second;
+
+                std::lock_guard<std::mutex> lock_job(job.mutex);
+                if (job.finished() && t_now - job.t_finished > std::chrono::seconds(keep_s)) {
+                    expired.push_back(it->second);
+                    it = jobs.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        for (auto & job : expired) {
+            if (job->worker.joinable()) {
+                job->worker.join();
+            }
+        }
+    }
+};
+
+// the LoRA adapters that requests select with the 'lora' field - an adapter is loaded onto a model the first time a
+// request uses it with that model, and it is freed with the model
+struct lora_registry {
+    std::mutex mutex;
+
+    std::map<std::string, std::string> paths;
+
+    std::map<const whisper_context *, std::map<std::string, whisper_adapter_lora *>> loaded;
+
+    bool has(const std::string & name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return paths.count(name) > 0;
+    }
+
+    // returns nullptr if the adapter fails to load
+    whisper_adapter_lora * get(whisper_context * ctx, const std::string & name) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        whisper_adapter_lora *& adapter = loaded[ctx][name];
+        if (adapter == nullptr) {
+            fprintf(stderr, "%s: loading LoRA adapter '%s' from '%s'\n", __func__, name.c_str(), paths.at(name).c_str());
+            adapter = whisper_adapter_lora_init(ctx, paths.at(name).c_str());
+        }
+
+        return adapter;
+    }
+
+    // called before the model is freed, whisper_free() frees its adapters
+    void forget(const whisper_context * ctx) {
+        std::lock_guard<std::mutex> lock(mutex);
+        loaded.erase(ctx);
+    }
+};
+
+static lora_registry g_loras;
+
+// sets the LoRA adapter of the request on the state, the state drops it when it is recycled
+static bool set_request_lora(whisper_context * ctx, whisper_state * state, const whisper_params & params) {
+    if (params.lora.empty()) {
+        return true;
+    }
+
+    whisper_adapter_lora * adapter = g_loras.get(ctx, params.lora);
+
+    return adapter != nullptr && whisper_set_adapter_lora(state, adapter, params.lora_scale) == 0;
+}
+
+// frees the LoRA adapters of a model, before whisper_free() frees the model
+static void forget_loras(whisper_context * ctx) {
+    g_loras.forget(ctx);
+}
+
+// the request parameters that go into whisper_full_params - only requests with the same key can be batched
+std::string get_batch_key(const whisper_params & params) {
+    std::ostringstream ss;
+    ss << params.language << '|' << params.translate << '|' << params.prompt << '|'
+       << params.n_threads << '|' << params.max_context << '|' << params.max_len << '|' << params.split_on_word << '|'
+       << params.word_thold << '|' << params.audio_ctx << '|' << params.tinydiarize << '|'
+       << params.best_of << '|' << params.beam_size << '|'
+       << params.temperature << '|' << params.temperature_inc << '|' << params.entropy_thold << '|'
+       << params.logprob_thold << '|' << params.no_speech_thold << '|'
+       << params.no_timestamps << '|' << (params.response_format == vjson_format) << '|'
+       << params.no_context << '|' << params.suppress_nst << '|' << params.print_special << '|' << params.debug_mode;
+    return ss.str();
+}
+
+// the request parameters that affect the response
+std::string get_response_key(const whisper_params & params) {
+    std::ostringstream ss;
+    ss << get_batch_key(params) << '|' << params.response_format << '|' << params.detect_language << '|'
+       << params.diarize << '|' << params.offset_t_ms << '|' << params.offset_n << '|' << params.duration_ms << '|'
+       << params.cascade_model << '|' << params.translate_also << '|' << params.lora << '|' << params.lora_scale;
+    return ss.str();
+}
+
+// coalesces the short requests that arrive within wait_ms of each other into one whisper_full_batch_with_states()
+// call, so their first windows share the encoder passes
+struct inference_batcher {
+    struct job {
+        std::string         key;
+        whisper_context   * ctx;
+        whisper_full_params wparams;
+        whisper_state     * state;
+        const float       * samples;
+        int                 n_samples;
+
+        bool taken  = false;
+        bool done   = false;
+        int  result = -1;
+    };
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    std::vector<job *> pending;
+
+    int n_batch;
+    int wait_ms;
+
+    inference_batcher(int n_batch, int wait_ms) : n_batch(n_batch), wait_ms(wait_ms) {}
+
+    // blocks until the job has been processed, returns the result of whisper_full_with_state() for it
+    // the oldest pending job of a key leads the batch: it waits up to wait_ms for more jobs with the same key
+    int run(job & j) {
+        std::unique_lock<std::mutex> lock(mutex);
+        pending.push_back(&j);
+        cv.notify_all();
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(wait_ms);
+
+        while (!j.done) {
+            if (j.taken || !is_leader(j)) {
+                cv.wait(lock);
+                continue;
+            }
+
+            cv.wait_until(lock, deadline, [&]() { return count(j) >= n_batch; });
+
+            std::vector<job *> batch;
+            for (auto it = pending.begin(); it != pending.end() && (int) batch.size() < n_batch; ) {
+                if (same_batch(**it, j)) {
+                    (*it)->taken = true;
+                    batch.push_back(*it);
+                    it = pending.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+
+            // the remaining jobs of this key get a new leader
+            cv.notify_all();
+            lock.unlock();
+
+            process(batch);
+
+            lock.lock();
+            for (auto * b : batch) {
+                b->done = true;
+            }
+            cv.notify_all();
+        }
+
+        return j.result;
+    }
+
+private:
+    // the requests that started before a model swap keep using the previous context
+    static bool same_batch(const job & a, const job & b) {
+        return a.ctx == b.ctx && a.key == b.key;
+    }
+
+    bool is_leader(const job & j) const {
+        for (const auto * p : pending) {
+            if (same_batch(*p, j)) {
+                return p == &j;
+            }
+        }
+        return false;
+    }
+
+    int count(const job & j) const {
+        int n = 0;
+        for (const auto * p : pending) {
+            n += same_batch(*p, j);
+        }
+        return n;
+    }
+
+    static void process(std::vector<job *> & batch) {
+        whisper_context * ctx = batch[0]->ctx;
+
+        std::vector<whisper_state *> states;
+        std::vector<const float *>   samples;
+        std::vector<int>             n_samples;
+
+        for (const auto * b : batch) {
+            states.push_back(b->state);
+            samples.push_back(b->samples);
+            n_samples.push_back(b->n_samples);
+        }
+
+        fprintf(stderr, "%s: processing %d requests in one batch\n", __func__, (int) batch.size());
+
+        // all jobs have the same key, so the parameters of the first one are valid for the batch
+        whisper_full_batch_with_states(ctx, states.data(), batch[0]->wparams, samples.data(), n_samples.data(), (int) batch.size(),
+            [](struct whisper_context *, struct whisper_state *, int i_input, int result, void * user_data) {
+                (*static_cast<std::vector<job *> *>(user_data))[i_input]->result = result;
+            }, &batch);
+    }
+};
+
+// converts a streamed upload to F32 PCM: a 16 kHz mono 16-bit WAV file, or raw 16 kHz mono s16le samples
+struct pcm16_stream {
+    bool        header_done = false;
+    std::string pending; // the WAV header while it is incomplete, then the odd trailing byte
+    std::string error;
+
+    bool push(const char * data, size_t n, std::vector<float> & pcmf32) {
+        pending.append(data, n);
+
+        if (!header_done) {
+            if (pending.size() < 4) {
+                return true;
+            }
+            if (pending.compare(0, 4, "RIFF") != 0) {
+                header_done = true;
+            } else if (!parse_header()) {
+                return error.empty();
+            }
+        }
+
+        const size_t n_samples = pending.size()/2;
+        const size_t n0 = pcmf32.size();
+        pcmf32.resize(n0 + n_samples);
+        for (size_t i = 0; i < n_samples; ++i) {
+            const int16_t v = (int16_t) ((uint8_t) pending[2*i] | ((uint8_t) pending[2*i + 1] << 8));
+            pcmf32[n0 + i] = float(v)/32768.0f;
+        }
+        pending.erase(0, 2*n_samples);
+
+        return true;
+    }
+
+private:
+    static uint32_t u32(const std::string & s, size_t i) { return (uint8_t) s[i] | ((uint8_t) s[i + 1] << 8) | ((uint8_t) s[i + 2] << 16) | ((uint32_t) (uint8_t) s[i + 3] << 24); }
+    static uint16_t u16(const std::string & s, size_t i) { return (uint8_t) s[i] | ((uint8_t) s[i + 1] << 8); }
+
+    // returns true once the "data" chunk is reached, the samples are left in pending
+    bool parse_header() {
+        size_t off = 12;
+        while (off + 8 <= pending.size()) {
+            const uint32_t size = u32(pending, off + 4);
+            if (pending.compare(off, 4, "data") == 0) {
+                pending.erase(0, off + 8);
+                header_done = true;
+                return true;
+            }
+            if (pending.compare(off, 4, "fmt ") == 0) {
+                if (off + 8 + 16 > pending.size()) {
+                    return false;
+                }
+                if (u16(pending, off + 8) != 1 || u16(pending, off + 10) != 1 || u32(pending, off + 12) != WHISPER_SAMPLE_RATE || u16(pending, off + 22) != 16) {
+                    error = "the WAV stream must be 16 kHz mono 16-bit PCM";
+                    return false;
+                }
+            }
+            off += 8 + size + (size & 1);
+        }
+        if (pending.size() > (1 << 20)) {
+            error = "no data chunk in the WAV header";
+        }
+        return false;
+    }
+};
+
+// a streaming request, shared by the upload, the inference thread and the server-sent events response
+struct stream_session {
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    std::vector<float> pcmf32; // received samples that are not transcribed yet
+    std::string        events; // events not sent yet
+
+    bool eof  = false; // the upload is complete
+    bool done = false; // the inference thread has finished
+
+    std::atomic<bool> abort{false}; // the upload failed or the client went away
+
+    std::thread worker;
+
+    void push(const std::string & event) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            events += event;
+        }
+        cv.notify_all();
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            abort = true;
+        }
+        cv.notify_all();
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+};
+
+std::string sse_event(const char * name, const json & data) {
+    return std::string("event: ") + name + "\ndata: " + data.dump(-1, ' ', false, json::error_handler_t::replace) + "\n\n";
+}
+
 bool parse_str_to_bool(const std::string & s) {
     if (s == "true" || s == "1" || s == "yes" || s == "y") {
         return true;
@@ -406,119 +1212,1042 @@ bool parse_str_to_bool(const std::string & s) {
 
 void get_req_parameters(const Request & req, whisper_params & params)
 {
-    if (req.has_file("offset_t"))
+    // the parameters are multipart fields, or query parameters when the body is the audio itself
+    const auto has = [&](const char * name) { return req.has_file(name) || req.has_param(name); };
+    const auto get = [&](const char * name) { return req.has_file(name) ? req.get_file_value(name).content : req.get_param_value(name); };
+
+    if (has("offset_t"))
     {
-        params.offset_t_ms = std::stoi(req.get_file_value("offset_t").content);
+        params.offset_t_ms = std::stoi(get("offset_t"));
     }
-    if (req.has_file("offset_n"))
+    if (has("offset_n"))
     {
-        params.offset_n = std::stoi(req.get_file_value("offset_n").content);
+        params.offset_n = std::stoi(get("offset_n"));
     }
-    if (req.has_file("duration"))
+    if (has("duration"))
     {
-        params.duration_ms = std::stoi(req.get_file_value("duration").content);
+        params.duration_ms = std::stoi(get("duration"));
     }
-    if (req.has_file("max_context"))
+    if (has("max_context"))
     {
-        params.max_context = std::stoi(req.get_file_value("max_context").content);
+        params.max_context = std::stoi(get("max_context"));
     }
-    if (req.has_file("max_len"))
+    if (has("max_len"))
     {
-        params.max_len = std::stoi(req.get_file_value("max_len").content);
+        params.max_len = std::stoi(get("max_len"));
     }
-    if (req.has_file("best_of"))
+    if (has("best_of"))
     {
-        params.best_of = std::stoi(req.get_file_value("best_of").content);
+        params.best_of = std::stoi(get("best_of"));
     }
-    if (req.has_file("beam_size"))
+    if (has("beam_size"))
     {
-        params.beam_size = std::stoi(req.get_file_value("beam_size").content);
+        params.beam_size = std::stoi(get("beam_size"));
     }
-    if (req.has_file("audio_ctx"))
+    if (has("audio_ctx"))
     {
-        params.audio_ctx = std::stof(req.get_file_value("audio_ctx").content);
+        params.audio_ctx = std::stof(get("audio_ctx"));
     }
-    if (req.has_file("word_thold"))
+    if (has("word_thold"))
     {
-        params.word_thold = std::stof(req.get_file_value("word_thold").content);
+        params.word_thold = std::stof(get("word_thold"));
     }
-    if (req.has_file("entropy_thold"))
+    if (has("entropy_thold"))
     {
-        params.entropy_thold = std::stof(req.get_file_value("entropy_thold").content);
+        params.entropy_thold = std::stof(get("entropy_thold"));
     }
-    if (req.has_file("logprob_thold"))
+    if (has("logprob_thold"))
     {
-        params.logprob_thold = std::stof(req.get_file_value("logprob_thold").content);
+        params.logprob_thold = std::stof(get("logprob_thold"));
     }
-    if (req.has_file("debug_mode"))
+    if (has("debug_mode"))
     {
-        params.debug_mode = parse_str_to_bool(req.get_file_value("debug_mode").content);
+        params.debug_mode = parse_str_to_bool(get("debug_mode"));
     }
-    if (req.has_file("translate"))
+    if (has("translate"))
     {
-        params.translate = parse_str_to_bool(req.get_file_value("translate").content);
+        params.translate = parse_str_to_bool(get("translate"));
     }
-    if (req.has_file("diarize"))
+    if (has("translate_also"))
     {
-        params.diarize = parse_str_to_bool(req.get_file_value("diarize").content);
+        params.translate_also = parse_str_to_bool(get("translate_also"));
     }
-    if (req.has_file("tinydiarize"))
+    if (has("diarize"))
     {
-        params.tinydiarize = parse_str_to_bool(req.get_file_value("tinydiarize").content);
+        params.diarize = parse_str_to_bool(get("diarize"));
     }
-    if (req.has_file("split_on_word"))
+    if (has("tinydiarize"))
     {
-        params.split_on_word = parse_str_to_bool(req.get_file_value("split_on_word").content);
+        params.tinydiarize = parse_str_to_bool(get("tinydiarize"));
     }
-    if (req.has_file("no_timestamps"))
+    if (has("split_on_word"))
     {
-        params.no_timestamps = parse_str_to_bool(req.get_file_value("no_timestamps").content);
+        params.split_on_word = parse_str_to_bool(get("split_on_word"));
     }
-    if (req.has_file("language"))
+    if (has("no_timestamps"))
     {
-        params.language = req.get_file_value("language").content;
+        params.no_timestamps = parse_str_to_bool(get("no_timestamps"));
     }
-    if (req.has_file("detect_language"))
+    if (has("language"))
     {
-        params.detect_language = parse_str_to_bool(req.get_file_value("detect_language").content);
+        params.language = get("language");
     }
-    if (req.has_file("prompt"))
+    if (has("detect_language"))
     {
-        params.prompt = req.get_file_value("prompt").content;
+        params.detect_language = parse_str_to_bool(get("detect_language"));
     }
-    if (req.has_file("response_format"))
+    if (has("prompt"))
     {
-        params.response_format = req.get_file_value("response_format").content;
+        params.prompt = get("prompt");
     }
-    if (req.has_file("temperature"))
+    if (has("response_format"))
     {
-        params.temperature = std::stof(req.get_file_value("temperature").content);
+        params.response_format = get("response_format");
     }
-    if (req.has_file("temperature_inc"))
+    if (has("temperature"))
     {
-        params.temperature_inc = std::stof(req.get_file_value("temperature_inc").content);
+        params.temperature = std::stof(get("temperature"));
     }
-    if (req.has_file("suppress_non_speech"))
+    if (has("temperature_inc"))
     {
-        params.suppress_nst = parse_str_to_bool(req.get_file_value("suppress_non_speech").content);
+        params.temperature_inc = std::stof(get("temperature_inc"));
     }
-    if (req.has_file("suppress_nst"))
+    if (has("suppress_non_speech"))
     {
-        params.suppress_nst = parse_str_to_bool(req.get_file_value("suppress_nst").content);
+        params.suppress_nst = parse_str_to_bool(get("suppress_non_speech"));
     }
-    if (req.has_file("no_context"))
+    if (has("suppress_nst"))
     {
-        params.no_context = parse_str_to_bool(req.get_file_value("no_context").content);
+        params.suppress_nst = parse_str_to_bool(get("suppress_nst"));
     }
-}
-
-}  // namespace
-
-int main(int argc, char ** argv) {
-    whisper_params params;
-    server_params sparams;
+    if (has("no_context"))
+    {
+        params.no_context = parse_str_to_bool(get("no_context"));
+    }
+    if (has("cascade_model"))
+    {
+        params.cascade_model = get("cascade_model");
+    }
+    if (has("lora"))
+    {
+        params.lora = get("lora");
+    }
+    if (has("lora_scale"))
+    {
+        params.lora_scale = std::stof(get("lora_scale"));
+    }
+}
+
+// the inference parameters of a request
+whisper_full_params get_full_params(const whisper_params & params) {
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.strategy = params.beam_size > 1 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY;
+
+    wparams.print_realtime   = false;
+    wparams.print_progress   = params.print_progress;
+    wparams.print_timestamps = !params.no_timestamps;
+    wparams.print_special    = params.print_special;
+    wparams.translate        = params.translate;
+    wparams.translate_also   = params.translate_also;
+    wparams.language         = params.language.c_str();
+    wparams.detect_language  = params.detect_language;
+    wparams.n_threads        = params.n_threads;
+    wparams.n_max_text_ctx   = params.max_context >= 0 ? params.max_context : wparams.n_max_text_ctx;
+    wparams.offset_ms        = params.offset_t_ms;
+    wparams.duration_ms      = params.duration_ms;
+
+    wparams.thold_pt         = params.word_thold;
+    wparams.max_len          = params.max_len == 0 ? 60 : params.max_len;
+    wparams.split_on_word    = params.split_on_word;
+    wparams.audio_ctx        = params.audio_ctx;
+
+    wparams.debug_mode       = params.debug_mode;
+
+    wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
+
+    wparams.initial_prompt   = params.prompt.c_str();
+
+    wparams.greedy.best_of        = params.best_of;
+    wparams.beam_search.beam_size = params.beam_size;
+
+    wparams.temperature      = params.temperature;
+    wparams.no_speech_thold = params.no_speech_thold;
+    wparams.temperature_inc  = params.temperature_inc;
+    wparams.entropy_thold    = params.entropy_thold;
+    wparams.logprob_thold    = params.logprob_thold;
+
+    wparams.no_timestamps    = params.no_timestamps;
+    wparams.token_timestamps = !params.no_timestamps && params.response_format == vjson_format;
+    wparams.no_context       = params.no_context;
+
+    wparams.suppress_nst     = params.suppress_nst;
+
+    return wparams;
+}
+
+// runs one second of silence through a model, so that the first request does not pay for the allocations and, on the
+// GPU backends, for the compilation of the kernels and pipelines of the encoder and decoder graphs
+static bool warmup_model(whisper_context * ctx, const whisper_params & params) {
+    whisper_state_lease lease(ctx);
+    if (lease.state == nullptr) {
+        return false;
+    }
+
+    whisper_full_params wparams = get_full_params(params);
+    wparams.print_progress = false;
+    wparams.language       = whisper_is_multilingual(ctx) ? params.language.c_str() : "en";
+
+    const std::vector<float> silence(WHISPER_SAMPLE_RATE, 0.0f);
+
+    const int64_t t_start_us = ggml_time_us();
+
+    if (whisper_full_with_state(ctx, lease.state, wparams, silence.data(), silence.size()) != 0) {
+        return false;
+    }
+
+    fprintf(stderr, "%s: warm-up done in %.1f ms\n", __func__, 1e-3*(ggml_time_us() - t_start_us));
+
+    return true;
+}
+
+// a live stream of /streams: the audio is posted in pieces as it is captured and the segments are sent back with
+// server-sent events. all live streams share the resident models and the workers of the live_scheduler
+struct live_stream {
+    std::string id;
+
+    std::shared_ptr<whisper_context> model;
+    whisper_params                   params;
+
+    std::chrono::milliseconds latency{0}; // budget from a job being ready to its segments
+    int64_t                   n_step = 0; // samples of ongoing audio that make a job without waiting for the speech end
+
+    // the audio side, protected by mutex
+    std::mutex              mutex;
+    std::condition_variable cv; // new segments or done
+
+    pcm16_stream       decoder;
+    std::vector<float> pcm; // the audio that is not transcribed yet, pcm[0] is sample t_pcm of the stream
+    int64_t            t_pcm = 0;
+
+    whisper_vad_context * vctx = nullptr;
+    bool                  in_speech = false;
+    int64_t               t_speech  = 0; // start of the current or the last speech
+
+    std::vector<whisper_token> prompt; // the last transcribed tokens
+
+    std::deque<json> segments; // the last segments, segments[0] has the index n_dropped
+    size_t           n_dropped = 0;
+
+    bool closed = false; // no more audio is accepted
+    bool done   = false; // all audio is transcribed
+
+    std::atomic<int64_t> t_last_ms{0}; // when the last audio was received
+
+    // the job side, protected by the mutex of the scheduler
+    int64_t t_done  = 0;     // the audio before this sample is transcribed or skipped
+    int64_t t_ready = 0;     // the audio before this sample can be transcribed
+    bool    final   = false; // t_ready is the end of a speech or of the stream - the last segment is not carried over
+    bool    busy    = false;
+
+    std::chrono::steady_clock::time_point deadline;
+
+    ~live_stream() {
+        whisper_vad_free(vctx);
+    }
+};
+
+// runs the jobs of the live streams on a fixed number of workers, earliest deadline first
+// a job is ready when a speech ends (with a VAD model) or when n_step samples are waiting, and its deadline is the
+// time it became ready plus the latency budget of its stream
+struct live_scheduler {
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    std::map<std::string, std::shared_ptr<live_stream>> streams;
+
+    size_t max_streams = 0;
+    int    timeout_s   = 0; // streams without new audio for this long are closed
+
+    whisper_vad_params vad_params = whisper_vad_default_params();
+
+    uint64_t n_jobs   = 0;
+    uint64_t n_missed = 0; // jobs that finished after their deadline
 
-    std::mutex whisper_mutex;
+    server_metrics & metrics;
+
+    priority_gate * preempt = nullptr; // the background jobs pause while the streams are transcribed
+
+    bool stop = false;
+
+    std::vector<std::thread> workers;
+
+    live_scheduler(server_metrics & metrics) : metrics(metrics) {}
+
+    ~live_scheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+
+        for (auto & worker : workers) {
+            worker.join();
+        }
+    }
+
+    void start(int n_workers) {
+        for (int i = 0; i < n_workers; ++i) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    static int64_t now_ms() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // returns false if too many streams are open
+    bool add(const std::shared_ptr<live_stream> & stream) {
+        static std::mt19937_64 rng(std::random_device{}());
+
+        stream->t_last_ms = now_ms();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (streams.size() >= max_streams) {
+            return false;
+        }
+
+        char buf[17];
+        do {
+            snprintf(buf, sizeof(buf), "%016llx", (unsigned long long) rng());
+        } while (streams.count(buf) > 0);
+
+        stream->id = buf;
+        streams[stream->id] = stream;
+
+        return true;
+    }
+
+    std::shared_ptr<live_stream> get(const std::string & id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = streams.find(id);
+        return it == streams.end() ? nullptr : it->second;
+    }
+
+    // append a piece of audio, returns false with the error if it cannot be used
+    bool push(live_stream & s, const std::string & data, std::string & error) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.closed) {
+            error = "the stream is closed";
+            return false;
+        }
+
+        const size_t n0 = s.pcm.size();
+        if (!s.decoder.push(data.data(), data.size(), s.pcm)) {
+            error = s.decoder.error.empty() ? "failed to read the audio" : s.decoder.error;
+            return false;
+        }
+
+        s.t_last_ms = now_ms();
+
+        const int64_t t_end = s.t_pcm + s.pcm.size();
+
+        // the end of the last speech in this piece
+        int64_t t_final = -1;
+
+        if (s.vctx && s.pcm.size() > n0) {
+            const int n_events = whisper_vad_feed(s.vctx, vad_params, s.pcm.data() + n0, s.pcm.size() - n0);
+            if (n_events < 0) {
+                error = "failed to process the audio with VAD";
+                return false;
+            }
+
+            for (int i = 0; i < n_events; ++i) {
+                const whisper_vad_event event = whisper_vad_get_event(s.vctx, i);
+                const int64_t t_event = std::min(t_end, (int64_t) (event.t*WHISPER_SAMPLE_RATE));
+
+                if (event.speech) {
+                    s.in_speech = true;
+                    s.t_speech  = t_event;
+                } else {
+                    s.in_speech = false;
+                    t_final     = t_event;
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock_sched(mutex);
+
+        if (!s.vctx) {
+            update(s, t_end, false);
+            return true;
+        }
+
+        if (t_final >= 0) {
+            update(s, t_final, true);
+        }
+
+        if (!s.busy && s.t_ready <= s.t_done) {
+            // nothing to transcribe - skip the silence before the speech, and keep only the recent audio while there
+            // is no speech, since the start of the next speech is reported with a delay
+            const int64_t t_skip = s.in_speech ? s.t_speech : t_end - 2*WHISPER_SAMPLE_RATE;
+            if (t_skip > s.t_done) {
+                s.t_done = s.t_ready = t_skip;
+
+                s.pcm.erase(s.pcm.begin(), s.pcm.begin() + (t_skip - s.t_pcm));
+                s.t_pcm = t_skip;
+            }
+        }
+
+        if (s.in_speech) {
+            update(s, t_end, false);
+        }
+
+        return true;
+    }
+
+    // no more audio - the rest is transcribed and the stream is done
+    // returns false if the stream was already closed
+    bool close(live_stream & s) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.closed) {
+            return false;
+        }
+        s.closed = true;
+
+        std::lock_guard<std::mutex> lock_sched(mutex);
+        update(s, s.t_pcm + s.pcm.size(), true);
+        finish_if_done(s);
+
+        return true;
+    }
+
+    void print(std::ostringstream & ss) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        int n_ready = 0;
+        for (const auto & kv : streams) {
+            n_ready += ready(*kv.second);
+        }
+
+        ss << "# TYPE whisper_live_streams gauge\n";
+        ss << "whisper_live_streams " << streams.size() << "\n";
+        ss << "# TYPE whisper_live_streams_ready gauge\n";
+        ss << "whisper_live_streams_ready " << n_ready << "\n";
+        ss << "# TYPE whisper_live_jobs_total counter\n";
+        ss << "whisper_live_jobs_total " << n_jobs << "\n";
+        ss << "# TYPE whisper_live_deadline_missed_total counter\n";
+        ss << "whisper_live_deadline_missed_total " << n_missed << "\n";
+    }
+
+private:
+    // the members below are called with the mutex of the scheduler held
+
+    static bool ready(const live_stream & s) {
+        return !s.busy && s.t_ready > s.t_done && (s.final || s.t_ready - s.t_done >= s.n_step);
+    }
+
+    void update(live_stream & s, int64_t t_ready, bool final) {
+        const bool was_ready = ready(s);
+
+        s.t_ready = std::max(s.t_ready, t_ready);
+        s.final   = final;
+
+        if (!was_ready && ready(s)) {
+            s.deadline = std::chrono::steady_clock::now() + s.latency;
+            cv.notify_one();
+        }
+    }
+
+    // also needs the mutex of the stream
+    void finish_if_done(live_stream & s) {
+        if (s.closed && !s.busy && s.t_done >= s.t_ready && !s.done) {
+            s.done = true;
+            s.cv.notify_all();
+            streams.erase(s.id);
+        }
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stop) {
+            std::shared_ptr<live_stream> next;
+            for (const auto & kv : streams) {
+                if (ready(*kv.second) && (!next || kv.second->deadline < next->deadline)) {
+                    next = kv.second;
+                }
+            }
+
+            if (!next) {
+                cv.wait_for(lock, std::chrono::seconds(1));
+                close_idle(lock);
+                continue;
+            }
+
+            live_stream & s = *next;
+
+            s.busy = true;
+
+            const int64_t t0    = s.t_done;
+            const int64_t t1    = s.t_ready;
+            const bool    final = s.final;
+
+            lock.unlock();
+            process(s, t0, t1, final);
+            lock.lock();
+        }
+    }
+
+    void close_idle(std::unique_lock<std::mutex> & lock) {
+        if (timeout_s <= 0) {
+            return;
+        }
+
+        const int64_t t_now = now_ms();
+
+        std::vector<std::shared_ptr<live_stream>> idle;
+        for (const auto & kv : streams) {
+            if (t_now - kv.second->t_last_ms > 1000*timeout_s) {
+                idle.push_back(kv.second);
+            }
+        }
+
+        lock.unlock();
+        for (auto & s : idle) {
+            // a closed stream stays in the map until its last audio is transcribed
+            if (close(*s)) {
+                printf("Live stream %s: no audio for %d s, closed\n", s->id.c_str(), timeout_s);
+            }
+        }
+        lock.lock();
+    }
+
+    void process(live_stream & s, int64_t t0, int64_t t1, bool final) {
+        std::vector<float>         pcm;
+        std::vector<whisper_token> prompt;
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            pcm.assign(s.pcm.begin() + (t0 - s.t_pcm), s.pcm.begin() + (t1 - s.t_pcm));
+            prompt = s.prompt;
+        }
+
+        whisper_context * ctx = s.model.get();
+
+        std::vector<json>          segments;
+        std::vector<whisper_token> tokens;
+
+        int64_t t_consumed = t1;
+        {
+            whisper_state_lease lease(ctx);
+
+            int ret = -1;
+            if (lease.state != nullptr && set_request_lora(ctx, lease.state, s.params)) {
+                whisper_full_params wparams = get_full_params(s.params);
+
+                wparams.print_progress = false;
+
+                if (!prompt.empty() && !s.params.no_context) {
+                    wparams.initial_prompt  = nullptr;
+                    wparams.prompt_tokens   = prompt.data();
+                    wparams.prompt_n_tokens = prompt.size();
+                }
+
+                const auto t_start = std::chrono::steady_clock::now();
+
+                priority_gate::high high(preempt);
+
+                ret = whisper_full_with_state(ctx, lease.state, wparams, pcm.data(), pcm.size());
+
+                metrics.record(lease.state, ret == 0, std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count(), double(pcm.size())/WHISPER_SAMPLE_RATE);
+            }
+
+            if (ret != 0) {
+                segments.push_back(json{{"error", "failed to process audio"}});
+            } else {
+                // the last segment can be cut in the middle of a word - it is transcribed again with the next job
+                const int n_segments = whisper_full_n_segments_from_state(lease.state);
+                const int n_keep     = final || n_segments < 2 ? n_segments : n_segments - 1;
+
+                if (n_keep < n_segments) {
+                    t_consumed = t0 + std::max<int64_t>(0, whisper_full_get_segment_t0_from_state(lease.state, n_keep))*WHISPER_SAMPLE_RATE/100;
+                    if (t_consumed == t0) {
+                        t_consumed = t1;
+                    }
+                }
+
+                const whisper_token token_eot = whisper_token_eot(ctx);
+                const int64_t       t_job     = t0*100/WHISPER_SAMPLE_RATE;
+
+                for (int i = 0; i < n_keep; ++i) {
+                    json segment = json{
+                        {"text", whisper_full_get_segment_text_from_state(lease.state, i)},
+                    };
+                    if (!s.params.no_timestamps) {
+                        segment["start"] = (t_job + whisper_full_get_segment_t0_from_state(lease.state, i)) * 0.01;
+                        segment["end"]   = (t_job + whisper_full_get_segment_t1_from_state(lease.state, i)) * 0.01;
+                    }
+                    segments.push_back(std::move(segment));
+
+                    const int n_tokens = whisper_full_n_tokens_from_state(lease.state, i);
+                    for (int j = 0; j < n_tokens; ++j) {
+                        const whisper_token id = whisper_full_get_token_id_from_state(lease.state, i, j);
+                        if (id < token_eot) {
+                            tokens.push_back(id);
+                        }
+                    }
+                }
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(s.mutex);
+
+        s.pcm.erase(s.pcm.begin(), s.pcm.begin() + (t_consumed - s.t_pcm));
+        s.t_pcm = t_consumed;
+
+        s.prompt.insert(s.prompt.end(), tokens.begin(), tokens.end());
+        const size_t n_prompt_max = whisper_n_text_ctx(ctx)/2;
+        if (s.prompt.size() > n_prompt_max) {
+            s.prompt.erase(s.prompt.begin(), s.prompt.end() - n_prompt_max);
+        }
+
+        for (auto & segment : segments) {
+            segment["id"] = s.n_dropped + s.segments.size();
+            s.segments.push_back(std::move(segment));
+        }
+        while (s.segments.size() > 1000) {
+            s.segments.pop_front();
+            s.n_dropped++;
+        }
+        s.cv.notify_all();
+
+        std::lock_guard<std::mutex> lock_sched(mutex);
+
+        n_jobs++;
+        n_missed += std::chrono::steady_clock::now() > s.deadline;
+
+        s.busy   = false;
+        s.t_done = std::max(s.t_done, t_consumed);
+        if (final && s.t_ready == t1) {
+            s.final = false;
+        }
+
+        if (ready(s)) {
+            s.deadline = std::chrono::steady_clock::now() + s.latency;
+            cv.notify_one();
+        }
+
+        finish_if_done(s);
+    }
+};
+
+// 16-bit mono WAV file of the samples, for the requests that a coordinator sends to its workers
+static std::string pcm_to_wav(const float * samples, int n_samples) {
+    std::string wav(44 + 2*(size_t) n_samples, '\0');
+    char * p = &wav[0];
+
+    auto put = [&p](uint32_t value, int n_bytes) {
+        for (int i = 0; i < n_bytes; ++i) {
+            *p++ = (char) ((value >> (8*i)) & 0xff);
+        }
+    };
+
+    memcpy(p, "RIFF", 4); p += 4;
+    put(36 + 2*n_samples, 4);
+    memcpy(p, "WAVEfmt ", 8); p += 8;
+    put(16, 4);
+    put(1, 2); // PCM
+    put(1, 2); // channels
+    put(WHISPER_SAMPLE_RATE, 4);
+    put(WHISPER_SAMPLE_RATE*2, 4);
+    put(2, 2);
+    put(16, 2);
+    memcpy(p, "data", 4); p += 4;
+    put(2*n_samples, 4);
+
+    for (int i = 0; i < n_samples; ++i) {
+        const float v = std::max(-1.0f, std::min(1.0f, samples[i]));
+        put((uint16_t) (int16_t) std::lrint(v*32767.0f), 2);
+    }
+
+    return wav;
+}
+
+struct fleet_worker {
+    std::string host; // scheme://host:port
+    std::string path; // request path of the worker, /inference and /metrics are appended to it
+
+    int  load    = 0;     // whisper_requests_active + whisper_queue_depth at the last poll of /metrics
+    int  n_sent  = 0;     // shards sent to the worker that it has not answered yet
+    bool healthy = false; // the last poll succeeded
+};
+
+struct fleet_shard {
+    int i0 = 0; // samples of the audio
+    int i1 = 0;
+
+    int  n_tries   = 0; // requests sent for the shard, including the speculative ones
+    int  n_running = 0;
+    bool done      = false;
+
+    std::vector<int> tried; // workers that the shard was sent to
+
+    std::chrono::steady_clock::time_point t_sent; // of the first request
+    double t_done_ms = 0.0;
+
+    json result; // verbose_json response of the worker
+};
+
+// one request of the coordinator, shared with the threads that send its shards, which can outlive it
+struct fleet_request {
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    std::vector<float>       pcmf32;
+    MultipartFormDataItems   fields; // the fields of the request, sent with each shard
+    std::vector<fleet_shard> shards;
+};
+
+// the /inference requests of a coordinator are split in shards at the pauses between speech, which are transcribed
+// by the least loaded workers (other whisper-server instances); a shard that runs much longer than the others is sent
+// to another worker as well and the first response wins. The segments of the shards are stitched in one response
+struct fleet_coordinator {
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    std::vector<fleet_worker> workers;
+
+    int   timeout_s = 600;
+    int   max_tries = 3;    // requests for a shard, including the speculative ones
+    float straggler = 2.0f; // a shard is sent again once it runs this many times the median time of the done shards
+
+    std::atomic<uint64_t> n_shards{0};
+    std::atomic<uint64_t> n_retries{0};     // after an error of a worker
+    std::atomic<uint64_t> n_speculative{0}; // for a straggler
+    std::atomic<uint64_t> n_speculative_won{0};
+
+    int  n_threads = 0; // requests in flight
+    bool stop      = false;
+
+    std::thread poller;
+
+    ~fleet_coordinator() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stop = true;
+            cv.notify_all();
+            cv.wait(lock, [this]() { return n_threads == 0; });
+        }
+
+        if (poller.joinable()) {
+            poller.join();
+        }
+    }
+
+    bool enabled() const {
+        return !workers.empty();
+    }
+
+    // url is http://host:port with an optional request path
+    bool add(const std::string & url) {
+        const size_t i_host = url.find("://");
+        if (i_host == std::string::npos) {
+            return false;
+        }
+
+        const size_t i_path = url.find('/', i_host + 3);
+
+        fleet_worker worker;
+        worker.host = url.substr(0, i_path);
+        worker.path = i_path == std::string::npos ? "" : url.substr(i_path);
+        while (!worker.path.empty() && worker.path.back() == '/') {
+            worker.path.pop_back();
+        }
+
+        workers.push_back(worker);
+
+        return true;
+    }
+
+    void start(int poll_ms) {
+        poll();
+
+        poller = std::thread([this, poll_ms]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!cv.wait_for(lock, std::chrono::milliseconds(poll_ms), [this]() { return stop; })) {
+                lock.unlock();
+                poll();
+                lock.lock();
+            }
+        });
+    }
+
+    // reads the load of the workers from their /metrics
+    void poll() {
+        for (size_t i = 0; i < workers.size(); ++i) {
+            Client cli(workers[i].host);
+            cli.set_connection_timeout(2);
+            cli.set_read_timeout(2);
+
+            const auto res = cli.Get(workers[i].path + "/metrics");
+            const bool ok  = res && res->status == 200;
+
+            int load = 0;
+            if (ok) {
+                std::istringstream ss(res->body);
+                std::string line;
+                while (std::getline(ss, line)) {
+                    if (line.rfind("whisper_requests_active ", 0) == 0 || line.rfind("whisper_queue_depth ", 0) == 0) {
+                        load += std::atoi(line.c_str() + line.find(' ') + 1);
+                    }
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            workers[i].healthy = ok;
+            workers[i].load    = load;
+        }
+    }
+
+    // the healthy worker with the least load that the shard was not sent to, then any healthy worker unless only
+    // new ones are wanted, -1 if there is none
+    int pick(const std::vector<int> & tried, bool only_new) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        int best = -1;
+        for (int pass = 0; pass < 2 && best < 0; ++pass) {
+            for (int i = 0; i < (int) workers.size(); ++i) {
+                const bool is_new = std::find(tried.begin(), tried.end(), i) == tried.end();
+                if (!workers[i].healthy || (pass == 0 && !is_new)) {
+                    continue;
+                }
+                if (best < 0 || workers[i].load + workers[i].n_sent < workers[best].load + workers[best].n_sent) {
+                    best = i;
+                }
+            }
+            if (only_new) {
+                break;
+            }
+        }
+
+        return best;
+    }
+
+    // sends the shard to the worker on a thread of its own, called with the mutex of the request held
+    void send(const std::shared_ptr<fleet_request> & freq, int i_shard, int i_worker) {
+        fleet_shard & shard = freq->shards[i_shard];
+
+        if (shard.n_tries == 0) {
+            shard.t_sent = std::chrono::steady_clock::now();
+        }
+        shard.n_tries++;
+        shard.n_running++;
+        shard.tried.push_back(i_worker);
+
+        const bool speculative = shard.n_running > 1;
+
+        std::string host;
+        std::string path;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            workers[i_worker].n_sent++;
+            n_threads++;
+
+            host = workers[i_worker].host;
+            path = workers[i_worker].path;
+        }
+
+        n_shards++;
+
+        std::thread([this, freq, i_shard, i_worker, host, path, speculative]() {
+            const fleet_shard & shard = freq->shards[i_shard];
+
+            // the samples and the fields do not change while the request runs
+            MultipartFormDataItems items = freq->fields;
+            items.push_back({ "file", pcm_to_wav(freq->pcmf32.data() + shard.i0, shard.i1 - shard.i0), "shard.wav", "audio/wav" });
+
+            Client cli(host);
+            cli.set_connection_timeout(5);
+            cli.set_read_timeout(timeout_s);
+
+            const auto res = cli.Post(path + "/inference", items);
+
+            json result;
+            if (res && res->status == 200) {
+                result = json::parse(res->body, nullptr, false);
+            }
+            const bool ok = result.is_object() && result.contains("segments");
+
+            if (!ok) {
+                fprintf(stderr, "%s: shard %d failed on %s%s: %s\n", __func__, i_shard, host.c_str(), path.c_str(),
+                        res ? std::to_string(res->status).c_str() : httplib::to_string(res.error()).c_str());
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(freq->mutex);
+                fleet_shard & s = freq->shards[i_shard];
+                s.n_running--;
+                if (ok && !s.done) {
+                    s.done      = true;
+                    s.result    = std::move(result);
+                    s.t_done_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - s.t_sent).count();
+
+                    if (speculative) {
+                        n_speculative_won++;
+                    }
+                }
+                freq->cv.notify_all();
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            workers[i_worker].n_sent--;
+            if (!res) {
+                workers[i_worker].healthy = false;
+            }
+            n_threads--;
+            cv.notify_all();
+        }).detach();
+    }
+
+    // transcribes the shards on the workers, returns 200 or the HTTP status of the error
+    int run(const Request & req, const std::shared_ptr<fleet_request> & freq, std::string & error) {
+        const int n_tries = std::max(max_tries, (int) workers.size());
+
+        std::unique_lock<std::mutex> lock(freq->mutex);
+        while (true) {
+            std::vector<double> t_done;
+            for (const auto & s : freq->shards) {
+                if (s.done) {
+                    t_done.push_back(s.t_done_ms);
+                }
+            }
+            if (t_done.size() == freq->shards.size()) {
+                return 200;
+            }
+
+            if (req.is_connection_closed()) {
+                error = "the client closed the connection";
+                return 499;
+            }
+
+            // stragglers are sent again once half of the shards are done
+            double t_median_ms = -1.0;
+            if (2*t_done.size() >= freq->shards.size()) {
+                std::nth_element(t_done.begin(), t_done.begin() + t_done.size()/2, t_done.end());
+                t_median_ms = t_done[t_done.size()/2];
+            }
+
+            const auto t_now = std::chrono::steady_clock::now();
+
+            for (int i = 0; i < (int) freq->shards.size(); ++i) {
+                fleet_shard & s = freq->shards[i];
+                if (s.done) {
+                    continue;
+                }
+
+                if (s.n_running == 0) {
+                    if (s.n_tries >= n_tries) {
+                        error = "failed to transcribe shard " + std::to_string(i) + " on the workers";
+                        return 502; // Bad Gateway
+                    }
+
+                    const int w = pick(s.tried, false);
+                    if (w < 0) {
+                        error = "no worker is available";
+                        return 503; // Service Unavailable
+                    }
+
+                    if (s.n_tries > 0) {
+                        n_retries++;
+                    }
+                    send(freq, i, w);
+                } else if (s.n_running == 1 && s.n_tries < n_tries && t_median_ms >= 0.0) {
+                    const double t_ms = std::chrono::duration<double, std::milli>(t_now - s.t_sent).count();
+                    if (t_ms > std::max(1000.0, straggler*t_median_ms)) {
+                        const int w = pick(s.tried, true);
+                        if (w >= 0) {
+                            n_speculative++;
+                            send(freq, i, w);
+                        }
+                    }
+                }
+            }
+
+            freq->cv.wait_for(lock, std::chrono::milliseconds(100));
+        }
+    }
+
+    // the verbose_json responses of the shards in one, with the times moved to the whole audio
+    static json stitch(const fleet_request & freq) {
+        json out = freq.shards[0].result;
+
+        out["duration"] = float(freq.pcmf32.size())/WHISPER_SAMPLE_RATE;
+        out["text"]     = "";
+        out["segments"] = json::array();
+
+        const bool has_translation = out.contains("translation");
+        if (has_translation) {
+            out["translation"] = "";
+        }
+
+        for (const auto & s : freq.shards) {
+            const double t_offset = double(s.i0)/WHISPER_SAMPLE_RATE;
+
+            out["text"] = out["text"].get<std::string>() + s.result.value("text", "");
+            if (has_translation) {
+                out["translation"] = out["translation"].get<std::string>() + s.result.value("translation", "");
+            }
+
+            for (json segment : s.result["segments"]) {
+                segment["id"] = out["segments"].size();
+                if (segment.contains("start")) {
+                    segment["start"] = segment["start"].get<double>() + t_offset;
+                    segment["end"]   = segment["end"].get<double>()   + t_offset;
+                }
+                if (segment.contains("words")) {
+                    for (auto & word : segment["words"]) {
+                        if (word.contains("start")) {
+                            word["start"] = word["start"].get<double>() + t_offset;
+                            word["end"]   = word["end"].get<double>()   + t_offset;
+                        }
+                        if (word.contains("t_dtw") && word["t_dtw"].get<int64_t>() >= 0) {
+                            word["t_dtw"] = word["t_dtw"].get<int64_t>() + std::llround(t_offset*100);
+                        }
+                    }
+                }
+                out["segments"].push_back(segment);
+            }
+        }
+
+        return out;
+    }
+
+    void print(std::ostringstream & ss) {
+        int n_healthy = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (const auto & worker : workers) {
+                n_healthy += worker.healthy;
+            }
+        }
+
+        ss << "# TYPE whisper_fleet_workers_healthy gauge\n";
+        ss << "whisper_fleet_workers_healthy " << n_healthy << "\n";
+        ss << "# TYPE whisper_fleet_shards_total counter\n";
+        ss << "whisper_fleet_shards_total " << n_shards << "\n";
+        ss << "# TYPE whisper_fleet_retries_total counter\n";
+        ss << "whisper_fleet_retries_total " << n_retries << "\n";
+        ss << "# TYPE whisper_fleet_speculative_total counter\n";
+        ss << "whisper_fleet_speculative_total " << n_speculative << "\n";
+        ss << "# TYPE whisper_fleet_speculative_won_total counter\n";
+        ss << "whisper_fleet_speculative_won_total " << n_speculative_won << "\n";
+    }
+};
+
+}  // namespace
+
+int main(int argc, char ** argv) {
+    whisper_params params;
+    server_params sparams;
 
     if (whisper_params_parse(argc, argv, params, sparams) == false) {
         whisper_print_usage(argc, argv, params, sparams);
@@ -543,8 +2272,9 @@ int main(int argc, char ** argv) {
     // whisper init
     struct whisper_context_params cparams = whisper_context_default_params();
 
-    cparams.use_gpu    = params.use_gpu;
-    cparams.flash_attn = params.flash_attn;
+    cparams.use_gpu      = params.use_gpu;
+    cparams.flash_attn   = params.flash_attn;
+    cparams.decode_batch = sparams.decode_batch;
 
     if (!params.dtw.empty()) {
         cparams.dtw_token_timestamps = true;
@@ -590,17 +2320,94 @@ int main(int argc, char ** argv) {
         }
     }
 
-    struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+    model_holder model;
+
+    {
+        struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
+
+        if (ctx == nullptr) {
+            fprintf(stderr, "error: failed to initialize whisper context\n");
+            return 3;
+        }
+
+        // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
+        whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
+
+        if (sparams.warmup && !warmup_model(ctx, params)) {
+            fprintf(stderr, "warning: warm-up of the model failed\n");
+        }
+
+        auto loaded = make_model(ctx, forget_loras);
+        model.swap(loaded);
+    }
+
+    model_registry registry;
+
+    // the routed models do not use the DTW preset of the default model
+    registry.cparams = cparams;
+    registry.cparams.dtw_token_timestamps = false;
+    registry.budget  = (size_t) sparams.models_budget_mb*1024*1024;
+    registry.on_free = forget_loras;
+
+    if (sparams.warmup) {
+        registry.on_load = [&params](whisper_context * ctx) {
+            if (!warmup_model(ctx, params)) {
+                fprintf(stderr, "warning: warm-up of the model failed\n");
+            }
+        };
+    }
+
+    for (const auto & route : sparams.models) {
+        if (!registry.add(route.first, route.second)) {
+            fprintf(stderr, "error: model '%s' not found: %s\n", route.first.c_str(), route.second.c_str());
+            return 3;
+        }
+    }
 
-    if (ctx == nullptr) {
-        fprintf(stderr, "error: failed to initialize whisper context\n");
-        return 3;
+    for (const auto & lora : sparams.loras) {
+        if (!std::ifstream(lora.second)) {
+            fprintf(stderr, "error: LoRA adapter '%s' not found: %s\n", lora.first.c_str(), lora.second.c_str());
+            return 3;
+        }
+        g_loras.paths[lora.first] = lora.second;
     }
 
-    // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
-    whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
+    // the model selected by the 'model' field of a request, the default model if there is none
+    const auto route_model = [&](const Request & req, Response & res) -> std::shared_ptr<whisper_context> {
+        const std::string lora = req.has_file("lora") ? req.get_file_value("lora").content : req.get_param_value("lora");
+        if (!lora.empty() && !g_loras.has(lora)) {
+            res.status = 400; // Bad Request
+            res.set_content(json{{"error", "unknown LoRA adapter '" + lora + "'"}}.dump(), "application/json");
+            return nullptr;
+        }
+
+        const std::string name = req.has_file("model") ? req.get_file_value("model").content : req.get_param_value("model");
+        if (name.empty()) {
+            return model.get();
+        }
+
+        if (!registry.has(name)) {
+            res.status = 400; // Bad Request
+            res.set_content(json{{"error", "unknown model '" + name + "'"}}.dump(), "application/json");
+            return nullptr;
+        }
+
+        std::shared_ptr<whisper_context> ctx = registry.get(name);
+        if (!ctx) {
+            res.status = 500; // Internal Server Error
+            res.set_content(json{{"error", "failed to load model '" + name + "'"}}.dump(), "application/json");
+        }
+
+        return ctx;
+    };
 
     Server svr;
+
+    // the waiting requests hold a worker thread, keep some threads for the uploads and the other endpoints
+    svr.new_task_queue = [&sparams] {
+        return new ThreadPool(std::max<size_t>(CPPHTTPLIB_THREAD_POOL_COUNT, sparams.n_parallel + sparams.n_queue + 2));
+    };
+
     svr.set_default_headers({{"Server", "whisper.cpp"},
                              {"Access-Control-Allow-Origin", "*"},
                              {"Access-Control-Allow-Headers", "content-type, authorization"}});
@@ -676,7 +2483,7 @@ int main(int argc, char ** argv) {
     </html>
     )";
 
-    // store default params so we can reset after each inference request
+    // store default params, each inference request starts from a copy of them
     whisper_params default_params = params;
 
     // this is only called if no index.html is found in the public --path
@@ -688,10 +2495,51 @@ int main(int argc, char ** argv) {
     svr.Options(sparams.request_path + sparams.inference_path, [&](const Request &, Response &){
     });
 
-    svr.Post(sparams.request_path + sparams.inference_path, [&](const Request &req, Response &res){
-        // acquire whisper model mutex lock
-        std::lock_guard<std::mutex> lock(whisper_mutex);
+    // a batch only fills up if its requests hold a slot at the same time
+    if (sparams.n_parallel < sparams.batch_size) {
+        fprintf(stderr, "%s: increasing --parallel to the batch size %d\n", __func__, sparams.batch_size);
+        sparams.n_parallel = sparams.batch_size;
+    }
+
+    admission_queue admission(sparams.n_parallel, sparams.n_queue);
+    inference_batcher batcher(sparams.batch_size, sparams.batch_wait_ms);
+    server_metrics    metrics;
+
+    model_lru_cache<cached_response>      response_cache;
+    model_lru_cache<std::vector<uint8_t>> encoder_cache;
+
+    response_cache.capacity = sparams.cache_responses;
+    encoder_cache.capacity  = (size_t) sparams.cache_encoder_mb*1024*1024;
+
+    job_manager jobs;
 
+    jobs.max_jobs       = sparams.jobs_max;
+    jobs.audio_budget_s = sparams.jobs_audio_budget_s;
+    jobs.keep_s         = sparams.jobs_keep_s;
+
+    jobs.preempt.max_wait_ms = sparams.jobs_preempt_ms;
+
+    live_scheduler live(metrics);
+
+    live.preempt     = &jobs.preempt;
+    live.max_streams = sparams.live_max;
+    live.timeout_s   = sparams.live_timeout_s;
+    live.start(sparams.live_workers);
+
+    fleet_coordinator fleet;
+
+    fleet.timeout_s = sparams.read_timeout;
+    for (const auto & url : sparams.workers) {
+        if (!fleet.add(url)) {
+            fprintf(stderr, "error: invalid worker URL '%s', expected http://host:port[/path]\n", url.c_str());
+            return 1;
+        }
+    }
+    if (fleet.enabled()) {
+        fleet.start(1000);
+    }
+
+    svr.Post(sparams.request_path + sparams.inference_path, [&](const Request &req, Response &res){
         // first check user requested fields of the request
         if (!req.has_file("file"))
         {
@@ -703,52 +2551,180 @@ int main(int argc, char ** argv) {
         auto audio_file = req.get_file_value("file");
 
         // check non-required fields
+        whisper_params params = default_params;
         get_req_parameters(req, params);
 
         std::string filename{audio_file.filename};
         printf("Received request: %s\n", filename.c_str());
 
+        // the model stays alive until the request is done, even if /load swaps it out or it is evicted in the meantime
+        const std::shared_ptr<whisper_context> model_ref = route_model(req, res);
+        if (!model_ref) {
+            return;
+        }
+        whisper_context * ctx = model_ref.get();
+
+        // the flagged segments of the first pass are transcribed again with this routed model
+        std::shared_ptr<whisper_context> cascade_ref;
+        if (!params.cascade_model.empty()) {
+            if (!registry.has(params.cascade_model)) {
+                res.status = 400; // Bad Request
+                res.set_content(json{{"error", "unknown cascade model '" + params.cascade_model + "'"}}.dump(), "application/json");
+                return;
+            }
+
+            cascade_ref = registry.get(params.cascade_model);
+            if (!cascade_ref) {
+                res.status = 500; // Internal Server Error
+                res.set_content(json{{"error", "failed to load model '" + params.cascade_model + "'"}}.dump(), "application/json");
+                return;
+            }
+
+            if (whisper_is_multilingual(ctx) != whisper_is_multilingual(cascade_ref.get())) {
+                res.status = 400; // Bad Request
+                res.set_content(json{{"error", "the cascade model and the model must both be multilingual or English-only"}}.dump(), "application/json");
+                return;
+            }
+        }
+
+        // identical requests get the same response, without decoding the audio or taking a slot
+        std::string response_key;
+        if (response_cache.enabled()) {
+            response_key = std::to_string(hash_bytes(audio_file.content.data(), audio_file.content.size())) + '|' + get_response_key(params);
+
+            if (auto cached = response_cache.get(response_key, model_ref)) {
+                printf("Returning the cached response for %s\n", filename.c_str());
+                res.set_content(cached->body, cached->content_type);
+                return;
+            }
+        }
+
         // audio arrays
         std::vector<float> pcmf32;               // mono-channel F32 PCM
         std::vector<std::vector<float>> pcmf32s; // stereo-channel F32 PCM
 
-        if (sparams.ffmpeg_converter) {
-            // if file is not wav, convert to wav
-            // write to temporary file
-            const std::string temp_filename = generate_temp_filename("whisper-server", ".wav");
-            std::ofstream temp_file{temp_filename, std::ios::binary};
-            temp_file << audio_file.content;
-            temp_file.close();
-
-            std::string error_resp = "{\"error\":\"Failed to execute ffmpeg command.\"}";
-            const bool is_converted = convert_to_wav(temp_filename, error_resp);
-            if (!is_converted) {
-                res.set_content(error_resp, "application/json");
-                return;
+        std::string error_resp;
+        if (!decode_upload(audio_file.content, params.diarize, sparams.ffmpeg_converter, pcmf32, pcmf32s, error_resp)) {
+            res.set_content(error_resp, "application/json");
+            return;
+        }
+
+        printf("Successfully loaded %s\n", filename.c_str());
+
+        // the speaker of each segment is estimated from the channel energies
+        const stereo_energy energy(pcmf32s);
+
+        // a coordinator sends the shards of the audio to its workers and stitches their segments
+        if (fleet.enabled() && !params.diarize && !params.detect_language && params.offset_t_ms == 0 && params.duration_ms == 0) {
+            auto freq = std::make_shared<fleet_request>();
+
+            const int n_shards = std::max(1, (int) std::lround(double(pcmf32.size())/WHISPER_SAMPLE_RATE/sparams.shard_s));
+
+            std::vector<int> bounds = { 0, (int) pcmf32.size() };
+            if (n_shards > 1) {
+                whisper_full_params wparams = get_full_params(params);
+                if (!sparams.vad_model.empty()) {
+                    wparams.vad            = true;
+                    wparams.vad_model_path = sparams.vad_model.c_str();
+                }
+
+                whisper_state_lease lease(ctx);
+                bounds.resize(n_shards + 1);
+                if (lease.state == nullptr ||
+                    whisper_split_audio_with_state(lease.state, wparams, pcmf32.data(), pcmf32.size(), n_shards, bounds.data()) != 0) {
+                    res.status = 500; // Internal Server Error
+                    res.set_content("{\"error\":\"failed to split the audio\"}", "application/json");
+                    return;
+                }
             }
 
-            // read audio content into pcmf32
-            if (!::read_audio_data(temp_filename, pcmf32, pcmf32s, params.diarize))
-            {
-                fprintf(stderr, "error: failed to read WAV file '%s'\n", temp_filename.c_str());
-                const std::string error_resp = "{\"error\":\"failed to read WAV file\"}";
-                res.set_content(error_resp, "application/json");
-                std::remove(temp_filename.c_str());
-                return;
+            for (int i = 0; i + 1 < (int) bounds.size(); ++i) {
+                if (bounds[i + 1] > bounds[i]) {
+                    fleet_shard shard;
+                    shard.i0 = bounds[i];
+                    shard.i1 = bounds[i + 1];
+                    freq->shards.push_back(shard);
+                }
             }
-            // remove temp file
-            std::remove(temp_filename.c_str());
-        } else {
-            if (!::read_audio_data(audio_file.content, pcmf32, pcmf32s, params.diarize))
-            {
-                fprintf(stderr, "error: failed to read audio data\n");
-                const std::string error_resp = "{\"error\":\"failed to read audio data\"}";
-                res.set_content(error_resp, "application/json");
+
+            // the workers get the fields of the request, the audio of the shard and always answer with verbose_json
+            for (const auto & kv : req.files) {
+                if (kv.first != "file" && kv.first != "response_format") {
+                    freq->fields.push_back({ kv.first, kv.second.content, kv.second.filename, kv.second.content_type });
+                }
+            }
+            for (const auto & kv : req.params) {
+                if (kv.first != "response_format" && !req.has_file(kv.first)) {
+                    freq->fields.push_back({ kv.first, kv.second, "", "" });
+                }
+            }
+            freq->fields.push_back({ "response_format", vjson_format, "", "" });
+
+            freq->pcmf32 = std::move(pcmf32);
+
+            printf("Sending %d shards of %s to %d workers\n", (int) freq->shards.size(), filename.c_str(), (int) fleet.workers.size());
+
+            std::string error;
+            const int status = fleet.run(req, freq, error);
+            if (status != 200) {
+                fprintf(stderr, "error: %s\n", error.c_str());
+                res.status = status;
+                res.set_content(json{{"error", error}}.dump(), "application/json");
                 return;
             }
+
+            // speculative requests that are still running do not change the shards that are done
+            std::lock_guard<std::mutex> lock(freq->mutex);
+            const json jres = fleet_coordinator::stitch(*freq);
+
+            if (params.response_format == text_format) {
+                res.set_content(jres["text"].get<std::string>(), "text/html; charset=utf-8");
+            } else if (params.response_format == srt_format || params.response_format == vtt_format) {
+                const bool srt = params.response_format == srt_format;
+
+                std::stringstream ss;
+                if (!srt) {
+                    ss << "WEBVTT\n\n";
+                }
+                for (const auto & segment : jres["segments"]) {
+                    const int64_t t0 = std::llround(segment.value("start", 0.0)*100);
+                    const int64_t t1 = std::llround(segment.value("end",   0.0)*100);
+
+                    if (srt) {
+                        ss << segment["id"].get<int>() + 1 + params.offset_n << "\n";
+                    }
+                    ss << to_timestamp(t0, srt) << " --> " << to_timestamp(t1, srt) << "\n";
+                    ss << segment["text"].get<std::string>() << "\n\n";
+                }
+                res.set_content(ss.str(), srt ? "application/x-subrip" : "text/vtt");
+            } else if (params.response_format == vjson_format) {
+                res.set_content(jres.dump(-1, ' ', false, json::error_handler_t::replace), "application/json");
+            } else {
+                json jtext = json{
+                    {"text", jres["text"]}
+                };
+                if (jres.contains("translation")) {
+                    jtext["translation"] = jres["translation"];
+                }
+                res.set_content(jtext.dump(-1, ' ', false, json::error_handler_t::replace), "application/json");
+            }
+
+            if (!response_key.empty()) {
+                response_cache.put(response_key, model_ref,
+                        std::make_shared<cached_response>(cached_response{ res.body, res.get_header_value("Content-Type") }), 1);
+            }
+            return;
+        }
+
+        // the upload and the audio decoding above do not use a slot
+        admission_ticket ticket(admission);
+        if (!ticket.ok) {
+            fprintf(stderr, "error: too many pending requests\n");
+            res.status = 503; // Service Unavailable
+            res.set_content("{\"error\":\"server is busy, too many pending requests\"}", "application/json");
+            return;
         }
 
-        printf("Successfully loaded %s\n", filename.c_str());
 
         // print system information
         {
@@ -781,52 +2757,28 @@ int main(int argc, char ** argv) {
             fprintf(stderr, "\n");
         }
 
+        // check a state out of the context pool for this request, it is returned on all exit paths
+        whisper_state_lease lease(ctx);
+        whisper_state * state = lease.state;
+        if (state == nullptr) {
+            fprintf(stderr, "error: failed to initialize whisper state\n");
+            res.status = 500; // Internal Server Error
+            res.set_content("{\"error\":\"failed to initialize whisper state\"}", "application/json");
+            return;
+        }
+
+        if (!set_request_lora(ctx, state, params)) {
+            res.status = 500; // Internal Server Error
+            res.set_content(json{{"error", "failed to load LoRA adapter '" + params.lora + "'"}}.dump(), "application/json");
+            return;
+        }
+
         // run the inference
         {
             printf("Running whisper.cpp inference on %s\n", filename.c_str());
-            whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-
-            wparams.strategy = params.beam_size > 1 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY;
-
-            wparams.print_realtime   = false;
-            wparams.print_progress   = params.print_progress;
-            wparams.print_timestamps = !params.no_timestamps;
-            wparams.print_special    = params.print_special;
-            wparams.translate        = params.translate;
-            wparams.language         = params.language.c_str();
-            wparams.detect_language  = params.detect_language;
-            wparams.n_threads        = params.n_threads;
-            wparams.n_max_text_ctx   = params.max_context >= 0 ? params.max_context : wparams.n_max_text_ctx;
-            wparams.offset_ms        = params.offset_t_ms;
-            wparams.duration_ms      = params.duration_ms;
-
-            wparams.thold_pt         = params.word_thold;
-            wparams.max_len          = params.max_len == 0 ? 60 : params.max_len;
-            wparams.split_on_word    = params.split_on_word;
-            wparams.audio_ctx        = params.audio_ctx;
+            whisper_full_params wparams = get_full_params(params);
 
-            wparams.debug_mode       = params.debug_mode;
-
-            wparams.tdrz_enable      = params.tinydiarize; // [TDRZ]
-
-            wparams.initial_prompt   = params.prompt.c_str();
-
-            wparams.greedy.best_of        = params.best_of;
-            wparams.beam_search.beam_size = params.beam_size;
-
-            wparams.temperature      = params.temperature;
-            wparams.no_speech_thold = params.no_speech_thold;
-            wparams.temperature_inc  = params.temperature_inc;
-            wparams.entropy_thold    = params.entropy_thold;
-            wparams.logprob_thold    = params.logprob_thold;
-
-            wparams.no_timestamps    = params.no_timestamps;
-            wparams.token_timestamps = !params.no_timestamps && params.response_format == vjson_format;
-            wparams.no_context       = params.no_context;
-
-            wparams.suppress_nst     = params.suppress_nst;
-
-            whisper_print_user_data user_data = { &params, &pcmf32s, 0 };
+            whisper_print_user_data user_data = { &params, &energy, 0 };
 
             // this callback is called on each new segment
             if (params.print_realtime) {
@@ -847,7 +2799,65 @@ int main(int argc, char ** argv) {
             };
             wparams.abort_callback_user_data = (void*)&req;
 
-            if (whisper_full_parallel(ctx, wparams, pcmf32.data(), pcmf32.size(), params.n_processors) != 0) {
+            // a single window without callbacks can share the encoder passes with other requests
+            const bool batched = batcher.n_batch > 1 && params.n_processors == 1 && !params.print_realtime && !wparams.print_progress && !params.translate_also &&
+                                 params.language != "auto" && params.offset_t_ms == 0 && params.duration_ms == 0 &&
+                                 pcmf32.size() <= (size_t) 30*WHISPER_SAMPLE_RATE;
+
+            const auto t_start = std::chrono::steady_clock::now();
+
+            priority_gate::high high(&jobs.preempt);
+
+            int ret = 0;
+            if (batched) {
+                inference_batcher::job job;
+                job.key       = get_batch_key(params);
+                job.ctx       = ctx;
+                job.wparams   = wparams;
+                job.state     = state;
+                job.samples   = pcmf32.data();
+                job.n_samples = (int) pcmf32.size();
+
+                // the batch is processed in one call, so it cannot be aborted for a single request
+                job.wparams.abort_callback           = nullptr;
+                job.wparams.abort_callback_user_data = nullptr;
+
+                ret = batcher.run(job);
+            } else {
+                // the encoder output of a single window only depends on the samples, so it is shared by the requests
+                // with the same audio and other decoding parameters
+                const bool encoder_cacheable = encoder_cache.enabled() && params.n_processors == 1 && params.audio_ctx == 0 &&
+                                               params.offset_t_ms == 0 && params.duration_ms == 0 &&
+                                               pcmf32.size() <= (size_t) 30*WHISPER_SAMPLE_RATE;
+
+                std::string encoder_key;
+                if (encoder_cacheable) {
+                    encoder_key = std::to_string(hash_bytes(pcmf32.data(), pcmf32.size()*sizeof(float)));
+
+                    auto cached = encoder_cache.get(encoder_key, model_ref);
+                    if (cached &&
+                        whisper_pcm_to_mel_with_state(ctx, state, pcmf32.data(), pcmf32.size(), params.n_threads) == 0 &&
+                        whisper_set_encoder_output(ctx, state, cached->data(), cached->size()) == 0) {
+                        printf("Reusing the cached encoder output for %s\n", filename.c_str());
+                        encoder_key.clear();
+                    }
+                }
+
+                ret = whisper_full_parallel_with_state(ctx, state, wparams, pcmf32.data(), pcmf32.size(), params.n_processors);
+
+                // with a single encoder pass, the state holds the encoder output of the first window
+                if (ret == 0 && !encoder_key.empty() && whisper_get_state_stats(state).n_encode == 1) {
+                    auto output = std::make_shared<std::vector<uint8_t>>(whisper_get_encoder_output_size(ctx, state));
+                    if (whisper_get_encoder_output(ctx, state, output->data(), output->size()) == 0) {
+                        encoder_cache.put(encoder_key, model_ref, output, output->size());
+                    }
+                }
+            }
+
+            metrics.record(state, ret == 0, std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count(),
+                    double(pcmf32.size())/WHISPER_SAMPLE_RATE);
+
+            if (ret != 0) {
                 // handle failure or early abort
                 if (req.is_connection_closed()) {
                     // log client disconnect
@@ -862,27 +2872,44 @@ int main(int argc, char ** argv) {
                 res.set_content(error_resp, "application/json");
                 return;
             }
+
+            if (cascade_ref) {
+                whisper_state_lease lease_large(cascade_ref.get());
+
+                const int n_flagged = lease_large.state == nullptr ? -1 :
+                    whisper_full_cascade_with_state(ctx, state, cascade_ref.get(), lease_large.state, wparams,
+                            whisper_cascade_default_params(), pcmf32.data(), pcmf32.size());
+
+                if (n_flagged < 0) {
+                    fprintf(stderr, "%s: failed to process audio with the cascade model\n", argv[0]);
+                    res.status = 500; // Internal Server Error
+                    res.set_content("{\"error\":\"failed to process audio with the cascade model\"}", "application/json");
+                    return;
+                }
+
+                printf("Transcribed %d segments again with %s\n", n_flagged, params.cascade_model.c_str());
+            }
         }
 
         // return results to user
         if (params.response_format == text_format)
         {
-            std::string results = output_str(ctx, params, pcmf32s);
+            std::string results = output_str(state, params, energy);
             res.set_content(results.c_str(), "text/html; charset=utf-8");
         }
         else if (params.response_format == srt_format)
         {
             std::stringstream ss;
-            const int n_segments = whisper_full_n_segments(ctx);
+            const int n_segments = whisper_full_n_segments_from_state(state);
             for (int i = 0; i < n_segments; ++i) {
-                const char * text = whisper_full_get_segment_text(ctx, i);
-                const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-                const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+                const char * text = whisper_full_get_segment_text_from_state(state, i);
+                const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+                const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
                 std::string speaker = "";
 
-                if (params.diarize && pcmf32s.size() == 2)
+                if (params.diarize && !energy.empty())
                 {
-                    speaker = estimate_diarization_speaker(pcmf32s, t0, t1);
+                    speaker = estimate_diarization_speaker(energy, t0, t1);
                 }
 
                 ss << i + 1 + params.offset_n << "\n";
@@ -895,16 +2922,16 @@ int main(int argc, char ** argv) {
 
             ss << "WEBVTT\n\n";
 
-            const int n_segments = whisper_full_n_segments(ctx);
+            const int n_segments = whisper_full_n_segments_from_state(state);
             for (int i = 0; i < n_segments; ++i) {
-                const char * text = whisper_full_get_segment_text(ctx, i);
-                const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-                const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+                const char * text = whisper_full_get_segment_text_from_state(state, i);
+                const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+                const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
                 std::string speaker = "";
 
-                if (params.diarize && pcmf32s.size() == 2)
+                if (params.diarize && !energy.empty())
                 {
-                    speaker = estimate_diarization_speaker(pcmf32s, t0, t1, true);
+                    speaker = estimate_diarization_speaker(energy, t0, t1, true);
                     speaker.insert(0, "<v Speaker");
                     speaker.append(">");
                 }
@@ -915,13 +2942,13 @@ int main(int argc, char ** argv) {
             res.set_content(ss.str(), "text/vtt");
         } else if (params.response_format == vjson_format) {
             /* try to match openai/whisper's Python format */
-            std::string results = output_str(ctx, params, pcmf32s); 
+            std::string results = output_str(state, params, energy); 
             // Get language probabilities
             std::vector<float> lang_probs(whisper_lang_max_id() + 1, 0.0f);
-            const auto detected_lang_id = whisper_lang_auto_detect(ctx, 0, params.n_threads, lang_probs.data());
+            const auto detected_lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, params.n_threads, lang_probs.data());
             json jres = json{
                 {"task", params.translate ? "translate" : "transcribe"},
-                {"language", whisper_lang_str_full(whisper_full_lang_id(ctx))},
+                {"language", whisper_lang_str_full(whisper_full_lang_id_from_state(state))},
                 {"duration", float(pcmf32.size())/WHISPER_SAMPLE_RATE},
                 {"text", results},
                 {"segments", json::array()},
@@ -929,35 +2956,38 @@ int main(int argc, char ** argv) {
                 {"detected_language_probability", lang_probs[detected_lang_id]},
                 {"language_probabilities", json::object()}
             };
+            if (params.translate_also) {
+                jres["translation"] = output_translation(state);
+            }
             // Add all language probabilities
             for (int i = 0; i <= whisper_lang_max_id(); ++i) {
                 if (lang_probs[i] > 0.001f) { // Only include non-negligible probabilities
                     jres["language_probabilities"][whisper_lang_str(i)] = lang_probs[i];
                 }
             }
-            const int n_segments = whisper_full_n_segments(ctx);
+            const int n_segments = whisper_full_n_segments_from_state(state);
             for (int i = 0; i < n_segments; ++i)
             {
                 json segment = json{
                     {"id", i},
-                    {"text", whisper_full_get_segment_text(ctx, i)},
+                    {"text", whisper_full_get_segment_text_from_state(state, i)},
                 };
 
                 if (!params.no_timestamps) {
-                    segment["start"] = whisper_full_get_segment_t0(ctx, i) * 0.01;
-                    segment["end"] = whisper_full_get_segment_t1(ctx, i) * 0.01;
+                    segment["start"] = whisper_full_get_segment_t0_from_state(state, i) * 0.01;
+                    segment["end"] = whisper_full_get_segment_t1_from_state(state, i) * 0.01;
                 }
 
                 float total_logprob = 0;
-                const int n_tokens = whisper_full_n_tokens(ctx, i);
+                const int n_tokens = whisper_full_n_tokens_from_state(state, i);
                 for (int j = 0; j < n_tokens; ++j) {
-                    whisper_token_data token = whisper_full_get_token_data(ctx, i, j);
+                    whisper_token_data token = whisper_full_get_token_data_from_state(state, i, j);
                     if (token.id >= whisper_token_eot(ctx)) {
                         continue;
                     }
 
                     segment["tokens"].push_back(token.id);
-                    json word = json{{"word", whisper_full_get_token_text(ctx, i, j)}};
+                    json word = json{{"word", whisper_full_get_token_text_from_state(ctx, state, i, j)}};
                     if (!params.no_timestamps) {
                         word["start"] = token.t0 * 0.01;
                         word["end"] = token.t1 * 0.01;
@@ -973,7 +3003,7 @@ int main(int argc, char ** argv) {
 
                 // TODO compression_ratio and no_speech_prob are not implemented yet
                 // segment["compression_ratio"] = 0;
-                segment["no_speech_prob"] = whisper_full_get_segment_no_speech_prob(ctx, i);
+                segment["no_speech_prob"] = whisper_full_get_segment_no_speech_prob_from_state(state, i);
 
                 jres["segments"].push_back(segment);
             }
@@ -983,19 +3013,605 @@ int main(int argc, char ** argv) {
         // TODO add more output formats
         else
         {
-            std::string results = output_str(ctx, params, pcmf32s);
+            std::string results = output_str(state, params, energy);
             json jres = json{
                 {"text", results}
             };
+            if (params.translate_also) {
+                jres["translation"] = output_translation(state);
+            }
             res.set_content(jres.dump(-1, ' ', false, json::error_handler_t::replace),
                             "application/json");
         }
 
-        // reset params to their defaults
-        params = default_params;
+        if (!response_key.empty()) {
+            response_cache.put(response_key, model_ref,
+                    std::make_shared<cached_response>(cached_response{ res.body, res.get_header_value("Content-Type") }), 1);
+        }
+    });
+    svr.Options(sparams.request_path + sparams.inference_path + "/stream", [&](const Request &, Response &){
+    });
+
+    // the body is the audio itself, sent with chunked transfer encoding: 16 kHz mono 16-bit WAV or raw s16le samples
+    // the inference runs on each 30 s window as soon as it is received and the segments are sent as server-sent events
+    svr.Post(sparams.request_path + sparams.inference_path + "/stream", [&](const Request &req, Response &res, const ContentReader &content_reader){
+        if (req.is_multipart_form_data()) {
+            res.status = 400; // Bad Request
+            res.set_content("{\"error\":\"send the audio as the request body\"}", "application/json");
+            return;
+        }
+
+        // the parameters are passed as query parameters
+        whisper_params params = default_params;
+        get_req_parameters(req, params);
+
+        // the model stays alive until the stream is done, even if /load swaps it out or it is evicted in the meantime
+        std::shared_ptr<whisper_context> model_ref = route_model(req, res);
+        if (!model_ref) {
+            return;
+        }
+        whisper_context * ctx = model_ref.get();
+
+        if (!whisper_is_multilingual(ctx)) {
+            params.language  = "en";
+            params.translate = false;
+        }
+        if (params.detect_language) {
+            params.language = "auto";
+        }
+
+        auto ticket = std::make_shared<admission_ticket>(admission);
+        if (!ticket->ok) {
+            fprintf(stderr, "error: too many pending requests\n");
+            res.status = 503; // Service Unavailable
+            res.set_content("{\"error\":\"server is busy, too many pending requests\"}", "application/json");
+            return;
+        }
+
+        auto session = std::make_shared<stream_session>();
+
+        session->worker = std::thread([&, session, ticket, params, model_ref]() {
+            stream_session & s = *session;
+
+            whisper_context * ctx = model_ref.get();
+
+            whisper_state_lease lease(ctx);
+            if (lease.state == nullptr) {
+                s.push(sse_event("error", json{{"error", "failed to initialize whisper state"}}));
+            } else if (!set_request_lora(ctx, lease.state, params)) {
+                s.push(sse_event("error", json{{"error", "failed to load LoRA adapter '" + params.lora + "'"}}));
+            } else {
+                whisper_full_params wparams = get_full_params(params);
+
+                wparams.abort_callback = [](void * user_data) {
+                    return ((stream_session *) user_data)->abort.load();
+                };
+                wparams.abort_callback_user_data = &s;
+
+                const size_t n_window = 30*WHISPER_SAMPLE_RATE;
+
+                std::vector<float> chunk;
+
+                int64_t t_offset = 0; // start of the window, in samples from the start of the stream
+                int     n_sent   = 0;
+                bool    ok       = true;
+
+                // only the time spent in the inference, not the time waiting for the upload
+                std::chrono::steady_clock::duration t_busy{0};
+
+                while (true) {
+                    bool last = false;
+                    {
+                        std::unique_lock<std::mutex> lock(s.mutex);
+                        s.cv.wait(lock, [&]() { return s.abort || s.eof || s.pcmf32.size() >= n_window; });
+                        if (s.abort) {
+                            ok = false;
+                            break;
+                        }
+
+                        last = s.eof && s.pcmf32.size() <= n_window;
+                        chunk.assign(s.pcmf32.begin(), s.pcmf32.begin() + std::min(s.pcmf32.size(), n_window));
+                    }
+
+                    if (chunk.empty()) {
+                        break;
+                    }
+
+                    const auto t_start = std::chrono::steady_clock::now();
+
+                    priority_gate::high high(&jobs.preempt);
+
+                    const int  ret     = whisper_full_with_state(ctx, lease.state, wparams, chunk.data(), chunk.size());
+                    t_busy += std::chrono::steady_clock::now() - t_start;
+
+                    if (ret != 0) {
+                        if (!s.abort) {
+                            s.push(sse_event("error", json{{"error", "failed to process audio"}}));
+                        }
+                        ok = false;
+                        break;
+                    }
+
+                    // the initial prompt only applies to the first window, the context carries over in the state
+                    wparams.initial_prompt = nullptr;
+
+                    // the last segment of a window can be cut in the middle of a word, transcribe it again with the next window
+                    const int n_segments = whisper_full_n_segments_from_state(lease.state);
+                    const int n_keep     = last || n_segments < 2 ? n_segments : n_segments - 1;
+
+                    const int64_t t_window = t_offset*100/WHISPER_SAMPLE_RATE;
+
+                    std::string events;
+                    for (int i = 0; i < n_keep; ++i) {
+                        json segment = json{
+                            {"id",   n_sent++},
+                            {"text", whisper_full_get_segment_text_from_state(lease.state, i)},
+                        };
+                        if (!params.no_timestamps) {
+                            segment["start"] = (t_window + whisper_full_get_segment_t0_from_state(lease.state, i)) * 0.01;
+                            segment["end"]   = (t_window + whisper_full_get_segment_t1_from_state(lease.state, i)) * 0.01;
+                        }
+                        events += sse_event("segment", segment);
+                    }
+
+                    size_t n_consumed = chunk.size();
+                    if (n_keep < n_segments) {
+                        const int64_t t0 = whisper_full_get_segment_t0_from_state(lease.state, n_keep);
+                        n_consumed = std::min(n_consumed, size_t(std::max<int64_t>(0, t0)*WHISPER_SAMPLE_RATE/100));
+                        if (n_consumed == 0) {
+                            n_consumed = chunk.size();
+                        }
+                    }
+
+                    {
+                        std::lock_guard<std::mutex> lock(s.mutex);
+                        s.pcmf32.erase(s.pcmf32.begin(), s.pcmf32.begin() + n_consumed);
+                        s.events += events;
+                    }
+                    s.cv.notify_all();
+
+                    t_offset += n_consumed;
+
+                    if (last) {
+                        break;
+                    }
+                }
+
+                metrics.record(lease.state, ok, std::chrono::duration<double>(t_busy).count(), double(t_offset)/WHISPER_SAMPLE_RATE);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                s.events += sse_event("done", json::object());
+                s.done = true;
+            }
+            s.cv.notify_all();
+        });
+
+        // the inference thread works on the received windows while the rest of the upload is read
+        pcm16_stream stream;
+
+        const bool ok = content_reader([&](const char * data, size_t n) {
+            {
+                std::lock_guard<std::mutex> lock(session->mutex);
+                if (!stream.push(data, n, session->pcmf32)) {
+                    return false;
+                }
+            }
+            session->cv.notify_all();
+
+            return !session->abort;
+        });
+
+        if (!ok || !stream.error.empty()) {
+            session->stop();
+
+            const std::string error = stream.error.empty() ? "failed to read the audio stream" : stream.error;
+            fprintf(stderr, "error: %s\n", error.c_str());
+            res.status = 400; // Bad Request
+            res.set_content(json{{"error", error}}.dump(), "application/json");
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            session->eof = true;
+        }
+        session->cv.notify_all();
+
+        res.set_chunked_content_provider("text/event-stream",
+            [session](size_t /*offset*/, DataSink & sink) {
+                std::string events;
+                bool done = false;
+                {
+                    std::unique_lock<std::mutex> lock(session->mutex);
+                    session->cv.wait(lock, [&]() { return !session->events.empty() || session->done; });
+                    events.swap(session->events);
+                    done = session->done;
+                }
+
+                if (!events.empty() && !sink.write(events.data(), events.size())) {
+                    return false;
+                }
+                if (done) {
+                    sink.done();
+                }
+
+                return true;
+            },
+            [session](bool /*success*/) {
+                // stops the inference if the client went away
+                session->stop();
+            });
+    });
+    // long files are transcribed in the background: POST /jobs returns the id of the job right away, and the progress
+    // and the segments transcribed so far are polled with GET /jobs/{id}
+    svr.Post(sparams.request_path + "/jobs", [&](const Request &req, Response &res){
+        if (!req.has_file("file"))
+        {
+            res.status = 400; // Bad Request
+            res.set_content("{\"error\":\"no 'file' field in the request\"}", "application/json");
+            return;
+        }
+        auto audio_file = req.get_file_value("file");
+
+        whisper_params params = default_params;
+        get_req_parameters(req, params);
+
+        std::shared_ptr<whisper_context> model_ref = route_model(req, res);
+        if (!model_ref) {
+            return;
+        }
+
+        if (!whisper_is_multilingual(model_ref.get())) {
+            params.language  = "en";
+            params.translate = false;
+        }
+        if (params.detect_language) {
+            params.language = "auto";
+        }
+
+        std::vector<float> pcmf32;
+        std::vector<std::vector<float>> pcmf32s;
+
+        std::string error_resp;
+        if (!decode_upload(audio_file.content, params.diarize, sparams.ffmpeg_converter, pcmf32, pcmf32s, error_resp)) {
+            res.status = 400; // Bad Request
+            res.set_content(error_resp, "application/json");
+            return;
+        }
+
+        auto job = std::make_shared<async_job>();
+        job->audio_s       = double(pcmf32.size())/WHISPER_SAMPLE_RATE;
+        job->diarize       = params.diarize;
+        job->no_timestamps = params.no_timestamps;
+        job->energy        = stereo_energy(pcmf32s);
+
+        if (!jobs.add(job)) {
+            fprintf(stderr, "error: too many background jobs\n");
+            res.status = 503; // Service Unavailable
+            res.set_content("{\"error\":\"server is busy, too many background jobs\"}", "application/json");
+            return;
+        }
+
+        printf("Queued job %s for %s (%.1f sec)\n", job->id.c_str(), audio_file.filename.c_str(), job->audio_s);
+
+        // the job cannot finish, and be collected, before its worker is assigned
+        std::lock_guard<std::mutex> lock(job->mutex);
+        job->worker = std::thread([&, job, model_ref, params, pcm = std::move(pcmf32)]() {
+            whisper_context * ctx = model_ref.get();
+
+            if (!jobs.acquire(*job)) {
+                job->finish("cancelled");
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                job->status = "running";
+            }
+
+            std::string result  = "done";
+            std::string message = "";
+            {
+                whisper_state_lease lease(ctx);
+                if (lease.state == nullptr) {
+                    result  = "failed";
+                    message = "failed to initialize whisper state";
+                } else if (!set_request_lora(ctx, lease.state, params)) {
+                    result  = "failed";
+                    message = "failed to load LoRA adapter '" + params.lora + "'";
+                } else {
+                    whisper_full_params wparams = get_full_params(params);
+
+                    wparams.print_progress = false;
+
+                    // the JSON of the segments is built off the decoding thread
+                    wparams.callback_async = true;
+
+                    wparams.new_segment_callback = [](struct whisper_context *, struct whisper_state * state, int n_new, void * user_data) {
+                        async_job & job = *(async_job *) user_data;
+
+                        const int n_segments = whisper_full_n_segments_from_state(state);
+
+                        json segments = json::array();
+                        for (int i = n_segments - n_new; i < n_segments; ++i) {
+                            const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i);
+                            const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i);
+
+                            json segment = json{
+                                {"id",   i},
+                                {"text", whisper_full_get_segment_text_from_state(state, i)},
+                            };
+                            if (!job.no_timestamps) {
+                                segment["start"] = t0 * 0.01;
+                                segment["end"]   = t1 * 0.01;
+                            }
+                            if (job.diarize && !job.energy.empty()) {
+                                segment["speaker"] = estimate_diarization_speaker(job.energy, t0, t1, true);
+                            }
+                            segments.push_back(std::move(segment));
+                        }
+
+                        std::lock_guard<std::mutex> lock(job.mutex);
+                        for (auto & segment : segments) {
+                            job.segments.push_back(std::move(segment));
+                        }
+                    };
+                    wparams.new_segment_callback_user_data = job.get();
+
+                    wparams.progress_callback = [](struct whisper_context *, struct whisper_state *, int progress, void * user_data) {
+                        async_job & job = *(async_job *) user_data;
+
+                        std::lock_guard<std::mutex> lock(job.mutex);
+                        job.progress = progress;
+                    };
+                    wparams.progress_callback_user_data = job.get();
+
+                    wparams.abort_callback = [](void * user_data) {
+                        return ((async_job *) user_data)->cancel.load();
+                    };
+                    wparams.abort_callback_user_data = job.get();
+
+                    // pause while the interactive requests run, the job keeps its state
+                    std::pair<priority_gate *, async_job *> yield_data = { &jobs.preempt, job.get() };
+                    if (jobs.preempt.max_wait_ms > 0) {
+                        wparams.yield_callback = [](struct whisper_context *, struct whisper_state *, void * user_data) {
+                            auto & data = *(std::pair<priority_gate *, async_job *> *) user_data;
+                            data.first->yield(data.second->cancel);
+                        };
+                        wparams.yield_callback_user_data = &yield_data;
+                    }
+
+                    const auto t_start = std::chrono::steady_clock::now();
+
+                    const int ret = whisper_full_with_state(ctx, lease.state, wparams, pcm.data(), pcm.size());
+
+                    metrics.record(lease.state, ret == 0, std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count(), job->audio_s);
+
+                    if (job->cancel) {
+                        result = "cancelled";
+                    } else if (ret != 0) {
+                        result  = "failed";
+                        message = "failed to process audio";
+                    }
+                }
+            }
+
+            jobs.release(*job);
+
+            if (result == "done") {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                job->progress = 100;
+            }
+            job->finish(result, message);
+
+            printf("Job %s: %s\n", job->id.c_str(), result.c_str());
+        });
+
+        res.status = 202; // Accepted
+        res.set_content(json{{"id", job->id}, {"status", job->status}, {"duration", job->audio_s}}.dump(), "application/json");
+    });
+
+    // ?since=N only returns the segments from index N, so the clients can poll for the new ones
+    svr.Get(sparams.request_path + R"(/jobs/([0-9a-f]+))", [&](const Request &req, Response &res){
+        auto job = jobs.get(req.matches[1]);
+        if (!job) {
+            res.status = 404; // Not Found
+            res.set_content("{\"error\":\"no such job\"}", "application/json");
+            return;
+        }
+
+        const size_t since = req.has_param("since") ? std::stoul(req.get_param_value("since")) : 0;
+
+        std::lock_guard<std::mutex> lock(job->mutex);
+
+        json jres = json{
+            {"id",         job->id},
+            {"status",     job->status},
+            {"progress",   job->progress},
+            {"duration",   job->audio_s},
+            {"n_segments", job->segments.size()},
+            {"segments",   json::array()},
+        };
+        for (size_t i = since; i < job->segments.size(); ++i) {
+            jres["segments"].push_back(job->segments[i]);
+        }
+        if (job->status == "done") {
+            std::string text;
+            for (const auto & segment : job->segments) {
+                text += segment["text"].get<std::string>();
+            }
+            jres["text"] = text;
+        }
+        if (!job->error.empty()) {
+            jres["error"] = job->error;
+        }
+
+        res.set_content(jres.dump(-1, ' ', false, json::error_handler_t::replace), "application/json");
+    });
+
+    svr.Delete(sparams.request_path + R"(/jobs/([0-9a-f]+))", [&](const Request &req, Response &res){
+        auto job = jobs.get(req.matches[1]);
+        if (!job) {
+            res.status = 404; // Not Found
+            res.set_content("{\"error\":\"no such job\"}", "application/json");
+            return;
+        }
+
+        jobs.cancel(*job);
+
+        res.set_content(json{{"id", job->id}, {"status", "cancelled"}}.dump(), "application/json");
+    });
+
+    // live streams: POST /streams opens a stream, the audio is posted in pieces to /streams/{id}/audio as it is
+    // captured and the segments are received with server-sent events from /streams/{id}/events
+    svr.Post(sparams.request_path + "/streams", [&](const Request &req, Response &res){
+        if (sparams.live_workers == 0) {
+            res.status = 503; // Service Unavailable
+            res.set_content("{\"error\":\"live streams are disabled, start the server with --live-workers N\"}", "application/json");
+            return;
+        }
+
+        whisper_params params = default_params;
+        get_req_parameters(req, params);
+
+        std::shared_ptr<whisper_context> model_ref = route_model(req, res);
+        if (!model_ref) {
+            return;
+        }
+
+        if (!whisper_is_multilingual(model_ref.get())) {
+            params.language  = "en";
+            params.translate = false;
+        }
+        if (params.detect_language) {
+            params.language = "auto";
+        }
+
+        const auto get_int = [&](const char * name, int value) {
+            if (req.has_file(name)) {
+                return std::stoi(req.get_file_value(name).content);
+            }
+            return req.has_param(name) ? std::stoi(req.get_param_value(name)) : value;
+        };
+
+        auto stream = std::make_shared<live_stream>();
+
+        stream->model   = model_ref;
+        stream->params  = params;
+        stream->latency = std::chrono::milliseconds(std::max(0, get_int("latency_ms", 2000)));
+        stream->n_step  = int64_t(std::min(30000, std::max(1000, get_int("step_ms", 5000))))*WHISPER_SAMPLE_RATE/1000;
+
+        if (!sparams.vad_model.empty()) {
+            whisper_vad_context_params vcparams = whisper_vad_default_context_params();
+            vcparams.n_threads = params.n_threads;
+
+            stream->vctx = whisper_vad_init_from_file_with_params(sparams.vad_model.c_str(), vcparams);
+            if (stream->vctx == nullptr) {
+                res.status = 500; // Internal Server Error
+                res.set_content("{\"error\":\"failed to load the VAD model\"}", "application/json");
+                return;
+            }
+        }
+
+        if (!live.add(stream)) {
+            fprintf(stderr, "error: too many live streams\n");
+            res.status = 503; // Service Unavailable
+            res.set_content("{\"error\":\"server is busy, too many live streams\"}", "application/json");
+            return;
+        }
+
+        printf("Opened live stream %s (latency %d ms, step %d ms)\n", stream->id.c_str(),
+                (int) stream->latency.count(), (int) (stream->n_step*1000/WHISPER_SAMPLE_RATE));
+
+        res.status = 201; // Created
+        res.set_content(json{{"id", stream->id}}.dump(), "application/json");
+    });
+
+    // the body is 16-bit mono PCM at 16 kHz, the first piece can start with a WAV header
+    svr.Post(sparams.request_path + R"(/streams/([0-9a-f]+)/audio)", [&](const Request &req, Response &res){
+        auto stream = live.get(req.matches[1]);
+        if (!stream) {
+            res.status = 404; // Not Found
+            res.set_content("{\"error\":\"no such stream\"}", "application/json");
+            return;
+        }
+
+        std::string error;
+        if (!live.push(*stream, req.body, error)) {
+            res.status = stream->closed ? 409 : 400; // Conflict or Bad Request
+            res.set_content(json{{"error", error}}.dump(), "application/json");
+            return;
+        }
+
+        res.set_content(json{{"id", stream->id}}.dump(), "application/json");
+    });
+
+    // ?since=N starts from the segment with index N, so a client can reconnect without losing segments
+    svr.Get(sparams.request_path + R"(/streams/([0-9a-f]+)/events)", [&](const Request &req, Response &res){
+        auto stream = live.get(req.matches[1]);
+        if (!stream) {
+            res.status = 404; // Not Found
+            res.set_content("{\"error\":\"no such stream\"}", "application/json");
+            return;
+        }
+
+        auto next = std::make_shared<size_t>(req.has_param("since") ? std::stoul(req.get_param_value("since")) : 0);
+
+        res.set_chunked_content_provider("text/event-stream",
+            [stream, next](size_t /*offset*/, DataSink & sink) {
+                std::string events;
+                bool done = false;
+                {
+                    std::unique_lock<std::mutex> lock(stream->mutex);
+                    stream->cv.wait_for(lock, std::chrono::seconds(1), [&]() {
+                        return stream->n_dropped + stream->segments.size() > *next || stream->done;
+                    });
+
+                    // the segments that were already dropped are skipped
+                    *next = std::max(*next, stream->n_dropped);
+                    for (; *next < stream->n_dropped + stream->segments.size(); ++*next) {
+                        const json & segment = stream->segments[*next - stream->n_dropped];
+                        events += sse_event(segment.contains("error") ? "error" : "segment", segment);
+                    }
+                    done = stream->done;
+                }
+
+                if (done) {
+                    events += sse_event("done", json::object());
+                }
+                if (!events.empty() && !sink.write(events.data(), events.size())) {
+                    return false;
+                }
+                if (done) {
+                    sink.done();
+                }
+
+                return true;
+            });
+    });
+
+    // the rest of the audio is transcribed, the events end with "done"
+    svr.Delete(sparams.request_path + R"(/streams/([0-9a-f]+))", [&](const Request &req, Response &res){
+        auto stream = live.get(req.matches[1]);
+        if (!stream) {
+            res.status = 404; // Not Found
+            res.set_content("{\"error\":\"no such stream\"}", "application/json");
+            return;
+        }
+
+        live.close(*stream);
+
+        printf("Closed live stream %s\n", stream->id.c_str());
+
+        res.set_content(json{{"id", stream->id}, {"status", "closed"}}.dump(), "application/json");
     });
+
+    // serializes the model loads, the requests keep running on the current model while a new one is loaded
+    std::mutex load_mutex;
+
     svr.Post(sparams.request_path + "/load", [&](const Request &req, Response &res){
-        std::lock_guard<std::mutex> lock(whisper_mutex);
         if (!req.has_file("model"))
         {
             fprintf(stderr, "error: no 'model' field in the request\n");
@@ -1003,34 +3619,81 @@ int main(int argc, char ** argv) {
             res.set_content(error_resp, "application/json");
             return;
         }
-        std::string model = req.get_file_value("model").content;
-        if (!is_file_exist(model.c_str()))
+        std::string model_path = req.get_file_value("model").content;
+        if (!is_file_exist(model_path.c_str()))
         {
-            fprintf(stderr, "error: 'model': %s not found!\n", model.c_str());
+            fprintf(stderr, "error: 'model': %s not found!\n", model_path.c_str());
             const std::string error_resp = "{\"error\":\"model not found!\"}";
             res.set_content(error_resp, "application/json");
             return;
         }
 
-        // clean up
-        whisper_free(ctx);
+        const bool warmup = req.has_file("warmup") && req.get_file_value("warmup").content != "false";
+
+        std::lock_guard<std::mutex> lock(load_mutex);
 
         // whisper init
-        ctx = whisper_init_from_file_with_params(model.c_str(), cparams);
+        whisper_context * ctx = whisper_init_from_file_with_params(model_path.c_str(), cparams);
 
-        // TODO perhaps load prior model here instead of exit
         if (ctx == nullptr) {
-            fprintf(stderr, "error: model init  failed, no model loaded must exit\n");
-            exit(1);
+            fprintf(stderr, "error: failed to load '%s', keeping the current model\n", model_path.c_str());
+            res.status = 500; // Internal Server Error
+            res.set_content("{\"error\":\"failed to load the model, the current model is kept\"}", "application/json");
+            return;
         }
 
         // initialize openvino encoder. this has no effect on whisper.cpp builds that don't have OpenVINO configured
         whisper_ctx_init_openvino_encoder(ctx, nullptr, params.openvino_encode_device.c_str(), nullptr);
 
+        std::shared_ptr<whisper_context> loaded = make_model(ctx, forget_loras);
+
+        if (warmup) {
+            if (!warmup_model(ctx, default_params)) {
+                fprintf(stderr, "error: warm-up of '%s' failed, keeping the current model\n", model_path.c_str());
+                res.status = 500; // Internal Server Error
+                res.set_content("{\"error\":\"warm-up of the model failed, the current model is kept\"}", "application/json");
+                return;
+            }
+        }
+
+        // the requests in flight finish on the previous model, it is freed when the last of them is done
+        model.swap(loaded);
+        loaded.reset();
+
+        fprintf(stderr, "%s: now serving '%s'\n", __func__, model_path.c_str());
+
         const std::string success = "Load was successful!";
         res.set_content(success, "application/text");
+    });
+
+    svr.Get(sparams.request_path + "/metrics", [&](const Request &, Response &res){
+        int n_active  = 0;
+        int n_waiting = 0;
+        {
+            std::lock_guard<std::mutex> lock(admission.mutex);
+            n_active  = admission.n_active;
+            n_waiting = admission.n_waiting;
+        }
+
+        std::ostringstream ss;
+        ss << metrics.print(n_active, n_waiting);
+        if (response_cache.enabled()) {
+            response_cache.print(ss, "response");
+        }
+        if (encoder_cache.enabled()) {
+            encoder_cache.print(ss, "encoder");
+        }
+        if (sparams.live_workers > 0) {
+            live.print(ss);
+        }
+        if (sparams.jobs_preempt_ms > 0) {
+            jobs.preempt.print(ss);
+        }
+        if (fleet.enabled()) {
+            fleet.print(ss);
+        }
 
-        // check if the model is in the file system
+        res.set_content(ss.str(), "text/plain; version=0.0.4");
     });
 
     svr.Get(sparams.request_path + "/health", [&](const Request &, Response &res){
@@ -1054,8 +3717,13 @@ int main(int argc, char ** argv) {
 
     svr.set_error_handler([](const Request &req, Response &res) {
         if (res.status == 400) {
-            res.set_content("Invalid request", "text/plain");
-        } else if (res.status != 500) {
+            // keep the error set by the handler
+            if (res.body.empty()) {
+                res.set_content("Invalid request", "text/plain");
+            }
+        } else if (res.status == 404 && !res.body.empty()) {
+            // keep the error set by the handler
+        } else if (res.status != 500 && res.status != 503) {
             res.set_content("File Not Found (" + req.path + ")", "text/plain");
             res.status = 404;
         }
@@ -1083,8 +3751,7 @@ int main(int argc, char ** argv) {
         return 1;
     }
 
-    whisper_print_timings(ctx);
-    whisper_free(ctx);
+    whisper_print_timings(model.get().get());
 
     return 0;
 }
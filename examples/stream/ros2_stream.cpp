@@ -262,6 +262,12 @@ int main(int argc, char ** argv) {
                 if (!is_running) {
                     break;
                 }
+
+                // sleep until a full step has been captured - the timeout keeps the SDL events polled
+                if (!audio.wait(params.step_ms, 100)) {
+                    continue;
+                }
+
                 audio.get(params.step_ms, pcmf32_new);
 
                 if ((int) pcmf32_new.size() > 2*n_samples_step) {
@@ -278,8 +284,6 @@ int main(int argc, char ** argv) {
                     audio.clear();
                     break;
                 }
-
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
             }
 
             const int n_samples_new = pcmf32_new.size();
@@ -418,15 +422,7 @@ int main(int argc, char ** argv) {
 
                 // Add tokens of the last full length segment as the prompt
                 if (!params.no_context) {
-                    prompt_tokens.clear();
-
-                    const int n_segments = whisper_full_n_segments(ctx);
-                    for (int i = 0; i < n_segments; ++i) {
-                        const int token_count = whisper_full_n_tokens(ctx, i);
-                        for (int j = 0; j < token_count; ++j) {
-                            prompt_tokens.push_back(whisper_full_get_token_id(ctx, i, j));
-                        }
-                    }
+                    whisper_get_result_tokens(ctx, prompt_tokens);
                 }
             }
             fflush(stdout);
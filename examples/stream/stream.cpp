@@ -24,9 +24,13 @@ struct whisper_params {
     int32_t max_tokens = 32;
     int32_t audio_ctx  = 0;
     int32_t beam_size  = -1;
+    int32_t n_agree    = 0;
+    int32_t metrics_interval_s = 0;
+    int32_t n_threads_min = 1;
 
     float vad_thold    = 0.6f;
     float freq_thold   = 100.0f;
+    float target_rtf   = 0.0f;
 
     bool translate     = false;
     bool no_fallback   = false;
@@ -37,10 +41,14 @@ struct whisper_params {
     bool save_audio    = false; // save audio to wav file
     bool use_gpu       = true;
     bool flash_attn    = false;
+    bool vad_gate      = false; // run the VAD model only when the energy gate detects the end of speech
+    bool fit_audio_ctx = false;
 
     std::string language  = "en";
     std::string model     = "models/ggml-base.en.bin";
+    std::string vad_model;
     std::string fname_out;
+    std::string metrics_json;
 };
 
 void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
@@ -54,6 +62,9 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
             exit(0);
         }
         else if (arg == "-t"    || arg == "--threads")       { params.n_threads     = std::stoi(argv[++i]); }
+        else if (arg == "-tmin" || arg == "--threads-min")   { params.n_threads_min = std::stoi(argv[++i]); }
+        else if (arg == "-rtf"  || arg == "--target-rtf")    { params.target_rtf    = std::stof(argv[++i]); }
+        else if (arg == "-fac"  || arg == "--fit-audio-ctx") { params.fit_audio_ctx = true; }
         else if (                  arg == "--step")          { params.step_ms       = std::stoi(argv[++i]); }
         else if (                  arg == "--length")        { params.length_ms     = std::stoi(argv[++i]); }
         else if (                  arg == "--keep")          { params.keep_ms       = std::stoi(argv[++i]); }
@@ -61,6 +72,7 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-mt"   || arg == "--max-tokens")    { params.max_tokens    = std::stoi(argv[++i]); }
         else if (arg == "-ac"   || arg == "--audio-ctx")     { params.audio_ctx     = std::stoi(argv[++i]); }
         else if (arg == "-bs"   || arg == "--beam-size")     { params.beam_size     = std::stoi(argv[++i]); }
+        else if (arg == "-la"   || arg == "--local-agreement") { params.n_agree     = std::stoi(argv[++i]); }
         else if (arg == "-vth"  || arg == "--vad-thold")     { params.vad_thold     = std::stof(argv[++i]); }
         else if (arg == "-fth"  || arg == "--freq-thold")    { params.freq_thold    = std::stof(argv[++i]); }
         else if (arg == "-tr"   || arg == "--translate")     { params.translate     = true; }
@@ -69,6 +81,10 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-kc"   || arg == "--keep-context")  { params.no_context    = false; }
         else if (arg == "-l"    || arg == "--language")      { params.language      = argv[++i]; }
         else if (arg == "-m"    || arg == "--model")         { params.model         = argv[++i]; }
+        else if (arg == "-vm"   || arg == "--vad-model")     { params.vad_model     = argv[++i]; }
+        else if (arg == "-vg"   || arg == "--vad-gate")      { params.vad_gate      = true; }
+        else if (arg == "-mi"   || arg == "--metrics-interval") { params.metrics_interval_s = std::stoi(argv[++i]); }
+        else if (arg == "-mj"   || arg == "--metrics-json")  { params.metrics_json  = argv[++i]; }
         else if (arg == "-f"    || arg == "--file")          { params.fname_out     = argv[++i]; }
         else if (arg == "-tdrz" || arg == "--tinydiarize")   { params.tinydiarize   = true; }
         else if (arg == "-sa"   || arg == "--save-audio")    { params.save_audio    = true; }
@@ -92,6 +108,9 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "options:\n");
     fprintf(stderr, "  -h,       --help          [default] show this help message and exit\n");
     fprintf(stderr, "  -t N,     --threads N     [%-7d] number of threads to use during computation\n",    params.n_threads);
+    fprintf(stderr, "  -tmin N,  --threads-min N [%-7d] fewest threads the governor goes down to (see -rtf)\n", params.n_threads_min);
+    fprintf(stderr, "  -rtf N,   --target-rtf N  [%-7.2f] adapt the threads to hold the inference time at N x step (0 - off)\n", params.target_rtf);
+    fprintf(stderr, "  -fac,     --fit-audio-ctx [%-7s] with -rtf, encode only the decoded audio when all the threads are too slow\n", params.fit_audio_ctx ? "true" : "false");
     fprintf(stderr, "            --step N        [%-7d] audio step size in milliseconds\n",                params.step_ms);
     fprintf(stderr, "            --length N      [%-7d] audio length in milliseconds\n",                   params.length_ms);
     fprintf(stderr, "            --keep N        [%-7d] audio to keep from previous step in ms\n",         params.keep_ms);
@@ -99,6 +118,7 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  -mt N,    --max-tokens N  [%-7d] maximum number of tokens per audio chunk\n",       params.max_tokens);
     fprintf(stderr, "  -ac N,    --audio-ctx N   [%-7d] audio context size (0 - all)\n",                   params.audio_ctx);
     fprintf(stderr, "  -bs N,    --beam-size N   [%-7d] beam size for beam search\n",                      params.beam_size);
+    fprintf(stderr, "  -la N,    --local-agreement N [%-7d] commit the text that N consecutive steps agree on (0 - off)\n", params.n_agree);
     fprintf(stderr, "  -vth N,   --vad-thold N   [%-7.2f] voice activity detection threshold\n",           params.vad_thold);
     fprintf(stderr, "  -fth N,   --freq-thold N  [%-7.2f] high-pass frequency cutoff\n",                   params.freq_thold);
     fprintf(stderr, "  -tr,      --translate     [%-7s] translate from source language to english\n",      params.translate ? "true" : "false");
@@ -107,6 +127,10 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  -kc,      --keep-context  [%-7s] keep context between audio chunks\n",              params.no_context ? "false" : "true");
     fprintf(stderr, "  -l LANG,  --language LANG [%-7s] spoken language\n",                                params.language.c_str());
     fprintf(stderr, "  -m FNAME, --model FNAME   [%-7s] model path\n",                                     params.model.c_str());
+    fprintf(stderr, "  -vm FNAME,--vad-model FNAME [%-7s] Silero VAD model path, transcribe each utterance\n", params.vad_model.c_str());
+    fprintf(stderr, "  -vg,      --vad-gate      [%-7s] run the VAD model only when the energy drops at the end of speech\n", params.vad_gate ? "true" : "false");
+    fprintf(stderr, "  -mi N,    --metrics-interval N [%-7d] print the latency of the steps every N seconds (0 - at exit)\n", params.metrics_interval_s);
+    fprintf(stderr, "  -mj FNAME,--metrics-json FNAME [%-7s] write the latency of the steps as JSON\n", params.metrics_json.c_str());
     fprintf(stderr, "  -f FNAME, --file FNAME    [%-7s] text output file name\n",                          params.fname_out.c_str());
     fprintf(stderr, "  -tdrz,    --tinydiarize   [%-7s] enable tinydiarize (requires a tdrz model)\n",     params.tinydiarize ? "true" : "false");
     fprintf(stderr, "  -sa,      --save-audio    [%-7s] save the recorded audio to a file\n",              params.save_audio ? "true" : "false");
@@ -115,6 +139,107 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "\n");
 }
 
+// transcribe with a whisper_stream session - the text that the last n_agree steps agree on is committed and printed
+// once, the rest of the hypothesis is shown in gray until the next step
+static int process_local_agreement(
+        struct whisper_context * ctx,
+        struct whisper_vad_context * vctx,
+        struct whisper_vad_params vad_params,
+        audio_async & audio,
+        const whisper_params & params,
+        std::ofstream & fout,
+        wav_writer & wavWriter) {
+    whisper_stream_params sparams = whisper_stream_default_params(params.beam_size > 1 ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
+
+    sparams.full_params.print_special    = params.print_special;
+    sparams.full_params.translate        = params.translate;
+    sparams.full_params.language         = params.language.c_str();
+    sparams.full_params.n_threads        = params.n_threads;
+    sparams.full_params.audio_ctx        = params.audio_ctx;
+    sparams.full_params.temperature_inc  = params.no_fallback ? 0.0f : sparams.full_params.temperature_inc;
+    sparams.full_params.beam_search.beam_size = params.beam_size;
+
+    sparams.step_ms    = params.step_ms;
+    sparams.length_ms  = std::min(params.length_ms, 30000);
+    sparams.n_agree    = params.n_agree;
+    sparams.vctx       = vctx;
+    sparams.vad_params = vad_params;
+
+    sparams.target_rtf    = params.target_rtf;
+    sparams.n_threads_min = params.n_threads_min;
+    sparams.fit_audio_ctx = params.fit_audio_ctx;
+
+    struct whisper_stream * stream = whisper_stream_init(ctx, sparams);
+    if (stream == nullptr) {
+        fprintf(stderr, "%s: failed to initialize the stream\n", __func__);
+        return 1;
+    }
+
+    std::vector<float> pcmf32;
+
+    // the committed text of the current line
+    std::string line;
+
+    auto print = [&](const char * unstable) {
+        const std::string committed = whisper_stream_get_committed(stream);
+
+        line += committed;
+        if (fout.is_open()) {
+            fout << committed;
+        }
+
+        if (line.size() >= 80) {
+            printf("\33[2K\r%s\n", line.c_str());
+            line.clear();
+        }
+
+        printf("\33[2K\r%s\33[90m%s\33[0m", line.c_str(), unstable);
+        fflush(stdout);
+    };
+
+    bool is_running = true;
+
+    while (is_running) {
+        // handle Ctrl + C
+        is_running = sdl_poll_events();
+        if (!is_running) {
+            break;
+        }
+
+        // the audio is fed as it arrives, the stream decides when to run the inference
+        if (!audio.wait(100, 200)) {
+            continue;
+        }
+
+        audio.get(params.length_ms, pcmf32);
+        audio.clear();
+
+        if (params.save_audio) {
+            wavWriter.write(pcmf32.data(), pcmf32.size());
+        }
+
+        const int ret = whisper_stream_feed(stream, pcmf32.data(), pcmf32.size());
+        if (ret < 0) {
+            fprintf(stderr, "%s: failed to process audio\n", __func__);
+            whisper_stream_free(stream);
+            return 6;
+        }
+
+        if (ret > 0) {
+            print(whisper_stream_get_unstable(stream));
+        }
+    }
+
+    if (whisper_stream_flush(stream) == 0) {
+        print("");
+    }
+    printf("\n");
+
+    whisper_stream_free(stream);
+
+    return 0;
+}
+
 int main(int argc, char ** argv) {
     whisper_params params;
 
@@ -125,12 +250,17 @@ int main(int argc, char ** argv) {
     params.keep_ms   = std::min(params.keep_ms,   params.step_ms);
     params.length_ms = std::max(params.length_ms, params.step_ms);
 
+    if (params.n_agree > 0 && params.step_ms <= 0) {
+        fprintf(stderr, "error: --local-agreement needs --step > 0\n");
+        return 1;
+    }
+
     const int n_samples_step = (1e-3*params.step_ms  )*WHISPER_SAMPLE_RATE;
     const int n_samples_len  = (1e-3*params.length_ms)*WHISPER_SAMPLE_RATE;
     const int n_samples_keep = (1e-3*params.keep_ms  )*WHISPER_SAMPLE_RATE;
     const int n_samples_30s  = (1e-3*30000.0         )*WHISPER_SAMPLE_RATE;
 
-    const bool use_vad = n_samples_step <= 0; // sliding window mode uses VAD
+    const bool use_vad = n_samples_step <= 0 || !params.vad_model.empty(); // sliding window mode uses VAD
 
     const int n_new_line = !use_vad ? std::max(1, params.length_ms / params.step_ms - 1) : 1; // number of steps to print new line
 
@@ -162,6 +292,31 @@ int main(int argc, char ** argv) {
 
     struct whisper_context * ctx = whisper_init_from_file_with_params(params.model.c_str(), cparams);
 
+    // with a VAD model the speech start and end events decide what to transcribe
+    struct whisper_vad_context * vctx = nullptr;
+    struct whisper_vad_params    vad_params = whisper_vad_default_params();
+
+    if (!params.vad_model.empty()) {
+        struct whisper_vad_context_params vcparams = whisper_vad_default_context_params();
+        vcparams.n_threads = params.n_threads;
+
+        vctx = whisper_vad_init_from_file_with_params(params.vad_model.c_str(), vcparams);
+        if (vctx == nullptr) {
+            fprintf(stderr, "error: failed to load the VAD model '%s'\n", params.vad_model.c_str());
+            return 1;
+        }
+
+        // transcribe long speech in pieces of at most length_ms
+        vad_params.max_speech_duration_s = 1e-3f*params.length_ms;
+    }
+
+    // the audio since the end of the last utterance, starting at sample n_vad_past of the stream
+    std::vector<float> pcmf32_vad;
+    int64_t n_vad_past  = 0;
+    int64_t n_vad_start = 0;
+
+    std::vector<std::vector<float>> utterances;
+
     std::vector<float> pcmf32    (n_samples_30s, 0.0f);
     std::vector<float> pcmf32_old;
     std::vector<float> pcmf32_new(n_samples_30s, 0.0f);
@@ -191,6 +346,10 @@ int main(int argc, char ** argv) {
 
         if (!use_vad) {
             fprintf(stderr, "%s: n_new_line = %d, no_context = %d\n", __func__, n_new_line, params.no_context);
+        } else if (vctx && !params.vad_gate) {
+            fprintf(stderr, "%s: using the VAD model, will transcribe each utterance\n", __func__);
+        } else if (vctx) {
+            fprintf(stderr, "%s: using VAD, will transcribe on speech activity confirmed by the VAD model\n", __func__);
         } else {
             fprintf(stderr, "%s: using VAD, will transcribe on speech activity\n", __func__);
         }
@@ -225,9 +384,37 @@ int main(int argc, char ** argv) {
     printf("[Start speaking]\n");
     fflush(stdout);
 
+    if (params.n_agree > 0) {
+        const int ret = process_local_agreement(ctx, vctx, vad_params, audio, params, fout, wavWriter);
+
+        audio.pause();
+
+        whisper_vad_free(vctx);
+        whisper_free(ctx);
+
+        return ret;
+    }
+
     auto t_last  = std::chrono::high_resolution_clock::now();
     const auto t_start = t_last;
 
+    // the energy gate of the VAD mode without a VAD model or with --vad-gate, fed with the audio once
+    vad_energy gate(WHISPER_SAMPLE_RATE, 2000, 1000, params.vad_thold, params.freq_thold);
+    uint64_t   n_gate_pos = 0; // the end of the audio fed to the gate
+
+    stream_metrics metrics;
+    auto t_metrics = std::chrono::steady_clock::now();
+
+    // the end of the audio of the last step - the audio captured after it that is older than the next step is lost
+    int64_t n_step_end = -1;
+
+    const auto report_metrics = [&]() {
+        metrics.print(stderr);
+        if (!params.metrics_json.empty() && !metrics.write_json(params.metrics_json)) {
+            fprintf(stderr, "%s: failed to write the metrics to '%s'\n", __func__, params.metrics_json.c_str());
+        }
+    };
+
     // main audio loop
     while (is_running) {
         if (params.save_audio) {
@@ -249,22 +436,36 @@ int main(int argc, char ** argv) {
                 if (!is_running) {
                     break;
                 }
-                audio.get(params.step_ms, pcmf32_new);
+
+                // sleep until a full step has been captured - the timeout keeps the SDL events polled
+                if (!audio.wait(params.step_ms, 100)) {
+                    continue;
+                }
+
+                uint64_t n_step_pos = 0;
+                audio.get(params.step_ms, pcmf32_new, &n_step_pos);
 
                 if ((int) pcmf32_new.size() > 2*n_samples_step) {
                     fprintf(stderr, "\n\n%s: WARNING: cannot process audio fast enough, dropping audio ...\n\n", __func__);
+                    metrics.drop(pcmf32_new.size());
                     audio.clear();
                     continue;
                 }
 
                 if ((int) pcmf32_new.size() >= n_samples_step) {
                     audio.clear();
+
+                    // the processing of the previous step took longer than the step
+                    if (n_step_end >= 0 && (int64_t) n_step_pos > n_step_end) {
+                        metrics.drop(n_step_pos - n_step_end);
+                    }
+                    n_step_end = n_step_pos + pcmf32_new.size();
                     break;
                 }
-
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
             }
 
+            metrics.audio_ready(ctx);
+
             const int n_samples_new = pcmf32_new.size();
 
             // take up to params.length_ms audio from previous iteration
@@ -281,27 +482,127 @@ int main(int argc, char ** argv) {
             memcpy(pcmf32.data() + n_samples_take, pcmf32_new.data(), n_samples_new*sizeof(float));
 
             pcmf32_old = pcmf32;
-        } else {
-            const auto t_now  = std::chrono::high_resolution_clock::now();
-            const auto t_diff = std::chrono::duration_cast<std::chrono::milliseconds>(t_now - t_last).count();
 
-            if (t_diff < 2000) {
+            // only the frames of the new audio are computed - the rest of the window is reused from the previous steps
+            if (whisper_pcm_to_mel_stream(ctx, pcmf32_new.data(), n_samples_new, params.keep_ms + params.length_ms, params.n_threads) != 0) {
+                fprintf(stderr, "%s: failed to compute log mel spectrogram\n", argv[0]);
+                return 6;
+            }
+        } else if (vctx && !params.vad_gate) {
+            if (utterances.empty()) {
                 std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
+                audio.get(2000, pcmf32_new);
+                audio.clear();
+
+                pcmf32_vad.insert(pcmf32_vad.end(), pcmf32_new.begin(), pcmf32_new.end());
+
+                const int n_events = whisper_vad_feed(vctx, vad_params, pcmf32_new.data(), pcmf32_new.size());
+                if (n_events < 0) {
+                    fprintf(stderr, "%s: failed to process audio with VAD\n", argv[0]);
+                    return 6;
+                }
+
+                for (int i = 0; i < n_events; ++i) {
+                    const whisper_vad_event event = whisper_vad_get_event(vctx, i);
+                    const int64_t n_event = std::max(n_vad_past, (int64_t) (event.t*WHISPER_SAMPLE_RATE));
+
+                    if (event.speech) {
+                        n_vad_start = n_event;
+                        continue;
+                    }
+
+                    const int64_t i0 = n_vad_start - n_vad_past;
+                    const int64_t i1 = std::min((int64_t) pcmf32_vad.size(), n_event - n_vad_past);
+
+                    if (i1 > i0) {
+                        utterances.emplace_back(pcmf32_vad.begin() + i0, pcmf32_vad.begin() + i1);
+                    }
+
+                    pcmf32_vad.erase(pcmf32_vad.begin(), pcmf32_vad.begin() + i1);
+                    n_vad_past += i1;
+                }
+
+                // outside of speech only the audio that can still be part of the next utterance is kept
+                if (!whisper_vad_in_speech(vctx) && (int) pcmf32_vad.size() > n_samples_30s) {
+                    const int n_drop = pcmf32_vad.size() - n_samples_30s;
+
+                    pcmf32_vad.erase(pcmf32_vad.begin(), pcmf32_vad.begin() + n_drop);
+                    n_vad_past += n_drop;
+                }
+
+                if (utterances.empty()) {
+                    continue;
+                }
+            }
+
+            metrics.audio_ready(ctx);
+
+            pcmf32 = std::move(utterances.front());
+            utterances.erase(utterances.begin());
+
+            t_last = std::chrono::high_resolution_clock::now();
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            // only the audio captured since the last iteration is fed to the gate
+            audio_span span;
+            if (!audio.peek(params.length_ms, span)) {
                 continue;
             }
 
-            audio.get(2000, pcmf32_new);
+            const size_t n_skip = std::min<uint64_t>(span.size(), n_gate_pos > span.pos ? n_gate_pos - span.pos : 0);
 
-            if (::vad_simple(pcmf32_new, WHISPER_SAMPLE_RATE, 1000, params.vad_thold, params.freq_thold, false)) {
-                audio.get(params.length_ms, pcmf32);
+            pcmf32_new.resize(span.size() - n_skip);
+            if (n_skip < span.n0) {
+                memcpy(pcmf32_new.data(), span.p0 + n_skip, (span.n0 - n_skip)*sizeof(float));
+                memcpy(pcmf32_new.data() + span.n0 - n_skip, span.p1, span.n1*sizeof(float));
             } else {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                memcpy(pcmf32_new.data(), span.p1 + (n_skip - span.n0), pcmf32_new.size()*sizeof(float));
+            }
+            n_gate_pos = span.pos + span.size();
 
+            bool speech_end = false;
+
+            const int n_events = gate.feed(pcmf32_new.data(), pcmf32_new.size());
+            for (int i = 0; i < n_events; ++i) {
+                speech_end |= !gate.events[i].speech;
+            }
+
+            if (!speech_end) {
                 continue;
             }
 
-            t_last = t_now;
+            metrics.audio_ready(ctx);
+
+            audio.get(params.length_ms, pcmf32);
+
+            if (vctx) {
+                // the gate only detects a drop of the energy - the VAD model checks that there is speech and trims
+                // the audio to it
+                if (!whisper_vad_detect_speech(vctx, pcmf32.data(), pcmf32.size())) {
+                    fprintf(stderr, "%s: failed to process audio with VAD\n", argv[0]);
+                    return 6;
+                }
+
+                struct whisper_vad_segments * segments = whisper_vad_segments_from_probs(vctx, vad_params);
+
+                const int n_segments = segments ? whisper_vad_segments_n_segments(segments) : 0;
+                if (n_segments > 0) {
+                    const size_t i0 = std::min(pcmf32.size(), (size_t) (whisper_vad_segments_get_segment_t0(segments, 0             )*WHISPER_SAMPLE_RATE));
+                    const size_t i1 = std::min(pcmf32.size(), (size_t) (whisper_vad_segments_get_segment_t1(segments, n_segments - 1)*WHISPER_SAMPLE_RATE));
+
+                    pcmf32.erase(pcmf32.begin() + std::max(i0, i1), pcmf32.end());
+                    pcmf32.erase(pcmf32.begin(), pcmf32.begin() + i0);
+                }
+                whisper_vad_free_segments(segments);
+
+                if (n_segments == 0 || pcmf32.empty()) {
+                    continue;
+                }
+            }
+
+            t_last = std::chrono::high_resolution_clock::now();
         }
 
         // run the inference
@@ -335,11 +636,17 @@ int main(int argc, char ** argv) {
             wparams.prompt_tokens    = params.no_context ? nullptr : prompt_tokens.data();
             wparams.prompt_n_tokens  = params.no_context ? 0       : prompt_tokens.size();
 
-            if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
+            // in sliding window mode the spectrogram of the window has already been computed incrementally
+            const float * samples   = use_vad ? pcmf32.data() : nullptr;
+            const int     n_samples = use_vad ? (int) pcmf32.size() : 0;
+
+            if (whisper_full(ctx, wparams, samples, n_samples) != 0) {
                 fprintf(stderr, "%s: failed to process audio\n", argv[0]);
                 return 6;
             }
 
+            metrics.inferred(ctx);
+
             // print result;
             {
                 if (!use_vad) {
@@ -400,6 +707,13 @@ int main(int argc, char ** argv) {
                 }
             }
 
+            metrics.emitted(use_vad ? pcmf32.size() : pcmf32_new.size());
+
+            if (params.metrics_interval_s > 0 && std::chrono::steady_clock::now() - t_metrics >= std::chrono::seconds(params.metrics_interval_s)) {
+                report_metrics();
+                t_metrics = std::chrono::steady_clock::now();
+            }
+
             ++n_iter;
 
             if (!use_vad && (n_iter % n_new_line) == 0) {
@@ -408,17 +722,16 @@ int main(int argc, char ** argv) {
                 // keep part of the audio for next iteration to try to mitigate word boundary issues
                 pcmf32_old = std::vector<float>(pcmf32.end() - n_samples_keep, pcmf32.end());
 
+                // restart the spectrogram from the kept audio
+                whisper_mel_stream_reset(ctx);
+                if (whisper_pcm_to_mel_stream(ctx, pcmf32_old.data(), pcmf32_old.size(), params.keep_ms + params.length_ms, params.n_threads) != 0) {
+                    fprintf(stderr, "%s: failed to compute log mel spectrogram\n", argv[0]);
+                    return 6;
+                }
+
                 // Add tokens of the last full length segment as the prompt
                 if (!params.no_context) {
-                    prompt_tokens.clear();
-
-                    const int n_segments = whisper_full_n_segments(ctx);
-                    for (int i = 0; i < n_segments; ++i) {
-                        const int token_count = whisper_full_n_tokens(ctx, i);
-                        for (int j = 0; j < token_count; ++j) {
-                            prompt_tokens.push_back(whisper_full_get_token_id(ctx, i, j));
-                        }
-                    }
+                    whisper_get_result_tokens(ctx, prompt_tokens);
                 }
             }
             fflush(stdout);
@@ -427,7 +740,10 @@ int main(int argc, char ** argv) {
 
     audio.pause();
 
+    report_metrics();
+
     whisper_print_timings(ctx);
+    whisper_vad_free(vctx);
     whisper_free(ctx);
 
     return 0;
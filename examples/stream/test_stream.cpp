@@ -32,6 +32,7 @@ struct whisper_params {
     int32_t max_tokens = 32;
     int32_t audio_ctx  = 0;
     int32_t beam_size  = -1;
+    int32_t metrics_interval_s = 0;
 
     float vad_thold    = 0.6f;
     float freq_thold   = 100.0f;
@@ -49,6 +50,7 @@ struct whisper_params {
     std::string language  = "en";
     std::string model     = "models/ggml-base.en.bin";
     std::string fname_out;
+    std::string metrics_json;
 };
 
 void whisper_print_usage(int argc, char ** argv, const whisper_params & params);
@@ -82,6 +84,8 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-sa"   || arg == "--save-audio")    { params.save_audio    = true; }
         else if (arg == "-ng"   || arg == "--no-gpu")        { params.use_gpu       = false; }
         else if (arg == "-fa"   || arg == "--flash-attn")    { params.flash_attn    = true; }
+        else if (arg == "-mi"   || arg == "--metrics-interval") { params.metrics_interval_s = std::stoi(argv[++i]); }
+        else if (arg == "-mj"   || arg == "--metrics-json")  { params.metrics_json  = argv[++i]; }
 
         else {
             fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
@@ -120,6 +124,8 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  -sa,      --save-audio    [%-7s] save the recorded audio to a file\n",              params.save_audio ? "true" : "false");
     fprintf(stderr, "  -ng,      --no-gpu        [%-7s] disable GPU inference\n",                          params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,      --flash-attn    [%-7s] flash attention during inference\n",               params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -mi N,    --metrics-interval N [%-7d] print the latency of the steps every N seconds (0 - at exit)\n", params.metrics_interval_s);
+    fprintf(stderr, "  -mj FNAME,--metrics-json FNAME [%-7s] write the latency of the steps as JSON\n", params.metrics_json.c_str());
     fprintf(stderr, "\n");
 }
 
@@ -236,6 +242,19 @@ int main(int argc, char ** argv) {
     auto t_last  = std::chrono::high_resolution_clock::now();
     const auto t_start = t_last;
 
+    stream_metrics metrics;
+    auto t_metrics = std::chrono::steady_clock::now();
+
+    const auto report_metrics = [&]() {
+        metrics.print(stderr);
+        if (!params.metrics_json.empty() && !metrics.write_json(params.metrics_json)) {
+            fprintf(stderr, "%s: failed to write the metrics to '%s'\n", __func__, params.metrics_json.c_str());
+        }
+    };
+
+    // the end of the audio of the last step - the audio captured after it that is older than the next step is lost
+    int64_t n_step_end = -1;
+
     // main audio loop
     while (is_running) {
         // handle Ctrl + C
@@ -252,10 +271,18 @@ int main(int argc, char ** argv) {
                 if (!is_running) {
                     break;
                 }
-                audio.get(params.step_ms, pcmf32_new);
+
+                // sleep until a full step has been captured - the timeout keeps the SDL events polled
+                if (!audio.wait(params.step_ms, 100)) {
+                    continue;
+                }
+
+                uint64_t n_step_pos = 0;
+                audio.get(params.step_ms, pcmf32_new, &n_step_pos);
 
                 if ((int) pcmf32_new.size() > 2*n_samples_step) {
                     fprintf(stderr, "\n\n%s: WARNING: cannot process audio fast enough, dropping audio ...\n\n", __func__);
+                    metrics.drop(pcmf32_new.size());
                     audio.clear();
                     continue;
                 }
@@ -266,12 +293,18 @@ int main(int argc, char ** argv) {
                         wavWriter.write(pcmf32_new.data(), pcmf32_new.size());
                     }
                     audio.clear();
+
+                    // the processing of the previous step took longer than the step
+                    if (n_step_end >= 0 && (int64_t) n_step_pos > n_step_end) {
+                        metrics.drop(n_step_pos - n_step_end);
+                    }
+                    n_step_end = n_step_pos + pcmf32_new.size();
                     break;
                 }
-
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
             }
 
+            metrics.audio_ready(ctx);
+
             const int n_samples_new = pcmf32_new.size();
 
             // take up to params.length_ms audio from previous iteration
@@ -301,6 +334,7 @@ int main(int argc, char ** argv) {
             audio.get(2000, pcmf32_new);
 
             if (::vad_simple(pcmf32_new, WHISPER_SAMPLE_RATE, 1000, params.vad_thold, params.freq_thold, false)) {
+                metrics.audio_ready(ctx);
                 audio.get(params.length_ms, pcmf32);
             } else {
                 std::this_thread::sleep_for(std::chrono::milliseconds(100));
@@ -343,6 +377,7 @@ int main(int argc, char ** argv) {
                 return 6;
             }
             auto t_inference_end = std::chrono::high_resolution_clock::now();
+            metrics.inferred(ctx);
             long long inference_duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t_inference_end - t_inference_start).count();
 
             // Collect all segments for this inference pass into a single string
@@ -390,6 +425,13 @@ int main(int argc, char ** argv) {
                 }
             }
 
+            metrics.emitted(use_vad ? pcmf32.size() : pcmf32_new.size());
+
+            if (params.metrics_interval_s > 0 && std::chrono::steady_clock::now() - t_metrics >= std::chrono::seconds(params.metrics_interval_s)) {
+                report_metrics();
+                t_metrics = std::chrono::steady_clock::now();
+            }
+
             ++n_iter;
 
             if (!use_vad && (n_iter % n_new_line) == 0) {
@@ -400,15 +442,7 @@ int main(int argc, char ** argv) {
 
                 // Add tokens of the last full length segment as the prompt
                 if (!params.no_context) {
-                    prompt_tokens.clear();
-
-                    const int n_segments = whisper_full_n_segments(ctx);
-                    for (int i = 0; i < n_segments; ++i) {
-                        const int token_count = whisper_full_n_tokens(ctx, i);
-                        for (int j = 0; j < token_count; ++j) {
-                            prompt_tokens.push_back(whisper_full_get_token_id(ctx, i, j));
-                        }
-                    }
+                    whisper_get_result_tokens(ctx, prompt_tokens);
                 }
             }
             fflush(stdout);
@@ -417,6 +451,8 @@ int main(int argc, char ** argv) {
 
     audio.pause();
 
+    report_metrics();
+
     whisper_print_timings(ctx);
     whisper_free(ctx);
 
@@ -7,10 +7,14 @@
 #include "whisper.h"
 #include "llama.h"
 
+#include <atomic>
+#include <cctype>
 #include <chrono>
+#include <condition_variable>
 #include <cstdio>
+#include <deque>
 #include <fstream>
-#include <regex>
+#include <mutex>
 #include <regex>
 #include <sstream>
 #include <string>
@@ -60,6 +64,7 @@ struct whisper_params {
     int32_t max_tokens = 32;
     int32_t audio_ctx  = 0;
     int32_t n_gpu_layers = 999;
+    int32_t step_ms    = 500; // pipelined mode: the ASR step of the partial transcripts
 
     float vad_thold  = 0.6f;
     float freq_thold = 100.0f;
@@ -71,6 +76,8 @@ struct whisper_params {
     bool verbose_prompt = false;
     bool use_gpu        = true;
     bool flash_attn     = false;
+    bool pipeline       = false;
+    bool barge_in       = false;
 
     std::string person      = "Georgi";
     std::string bot_name    = "LLaMA";
@@ -110,6 +117,9 @@ static bool whisper_params_parse(int argc, char ** argv, whisper_params & params
         else if (arg == "-vp"  || arg == "--verbose-prompt") { params.verbose_prompt = true; }
         else if (arg == "-ng"  || arg == "--no-gpu")         { params.use_gpu        = false; }
         else if (arg == "-fa"  || arg == "--flash-attn")     { params.flash_attn     = true; }
+        else if (arg == "-pl"  || arg == "--pipeline")       { params.pipeline       = true; }
+        else if (arg == "-bi"  || arg == "--barge-in")       { params.barge_in       = true; }
+        else if (                 arg == "--step")           { params.step_ms        = std::stoi(argv[++i]); }
         else if (arg == "-p"   || arg == "--person")         { params.person         = argv[++i]; }
         else if (arg == "-bn"   || arg == "--bot-name")      { params.bot_name       = argv[++i]; }
         else if (arg == "--session")                         { params.path_session   = argv[++i]; }
@@ -158,6 +168,9 @@ void whisper_print_usage(int /*argc*/, char ** argv, const whisper_params & para
     fprintf(stderr, "  -vp,      --verbose-prompt [%-7s] print prompt at start\n",                       params.verbose_prompt ? "true" : "false");
     fprintf(stderr, "  -ng,      --no-gpu         [%-7s] disable GPU\n",                                 params.use_gpu ? "false" : "true");
     fprintf(stderr, "  -fa,      --flash-attn     [%-7s] flash attention\n",                             params.flash_attn ? "true" : "false");
+    fprintf(stderr, "  -pl,      --pipeline       [%-7s] overlap ASR, LLM and TTS (prefill while speaking, speak by sentence)\n", params.pipeline ? "true" : "false");
+    fprintf(stderr, "  -bi,      --barge-in       [%-7s] pipelined mode: speech interrupts the reply (needs echo cancellation)\n", params.barge_in ? "true" : "false");
+    fprintf(stderr, "  --step N                   [%-7d] pipelined mode: ASR step of the partial transcripts in ms\n", params.step_ms);
     fprintf(stderr, "  -p NAME,  --person NAME    [%-7s] person name (for prompt selection)\n",          params.person.c_str());
     fprintf(stderr, "  -bn NAME, --bot-name NAME  [%-7s] bot name (to display)\n",                       params.bot_name.c_str());
     fprintf(stderr, "  -w TEXT,  --wake-command T [%-7s] wake-up command to listen for\n",               params.wake_cmd.c_str());
@@ -252,6 +265,75 @@ static std::vector<std::string> get_words(const std::string &txt) {
     return words;
 }
 
+// the text that is passed to LLaMA - without annotations like [BLANK_AUDIO] or (music), on a single line
+static std::string clean_heard(std::string text) {
+    // remove text between brackets using regex
+    {
+        std::regex re("\\[.*?\\]");
+        text = std::regex_replace(text, re, "");
+    }
+
+    // remove text between brackets using regex
+    {
+        std::regex re("\\(.*?\\)");
+        text = std::regex_replace(text, re, "");
+    }
+
+    // remove all characters, except for letters, numbers, punctuation and ':', '\'', '-', ' '
+    text = std::regex_replace(text, std::regex("[^a-zA-Z0-9\\.,\\?!\\s\\:\\'\\-]"), "");
+
+    // take first line
+    text = text.substr(0, text.find_first_of('\n'));
+
+    // remove leading and trailing whitespace
+    text = std::regex_replace(text, std::regex("^\\s+"), "");
+    text = std::regex_replace(text, std::regex("\\s+$"), "");
+
+    return text;
+}
+
+// makes room for n_new tokens after n_past when the context is full. the older half of the dialog after the initial
+// prompt (the first n_keep tokens) is discarded and the rest of the KV cache is shifted down in place, so nothing is
+// evaluated again. dialog are the tokens in the KV cache. if the KV cache cannot be shifted, the whole dialog after the
+// initial prompt is discarded and its last n_prev tokens are returned in tail, to be evaluated again
+static void llama_make_room(
+        llama_context * ctx,
+        std::vector<llama_token> & dialog,
+        int & n_past,
+        int n_keep,
+        int n_new,
+        int n_prev,
+        std::vector<llama_token> & tail) {
+    tail.clear();
+
+    const int n_ctx  = llama_n_ctx(ctx);
+    const int n_left = n_past - n_keep;
+
+    if (n_past + n_new <= n_ctx || n_left <= 0) {
+        return;
+    }
+
+    const int n_discard = std::min(n_left, std::max(n_left/2, n_past + n_new - n_ctx));
+
+    if (n_discard < n_left && llama_kv_self_can_shift(ctx)) {
+        llama_kv_self_seq_rm (ctx, 0, n_keep, n_keep + n_discard);
+        llama_kv_self_seq_add(ctx, 0, n_keep + n_discard, -1, -n_discard);
+        llama_kv_self_update (ctx);
+
+        dialog.erase(dialog.begin() + n_keep, dialog.begin() + n_keep + n_discard);
+        n_past -= n_discard;
+
+        return;
+    }
+
+    tail.assign(dialog.end() - std::min(n_prev, n_left), dialog.end());
+
+    llama_kv_self_seq_rm(ctx, 0, n_keep, -1);
+
+    dialog.resize(n_keep);
+    n_past = n_keep;
+}
+
 const std::string k_prompt_whisper = R"(A conversation with a person called {1}.)";
 
 const std::string k_prompt_llama = R"(Text transcript of a never ending dialog, where {0} interacts with an AI assistant named {1}.
@@ -272,6 +354,618 @@ The transcript only includes text, it does not include markup like HTML and Mark
 {1}{4} Blue
 {0}{4})";
 
+//
+// pipelined mode
+//
+// ASR, LLaMA and TTS run at the same time instead of one after the other:
+//  - the ASR thread transcribes the speech with a whisper_stream session, started and stopped by an energy VAD. the
+//    text that the stream commits while the person is still speaking is passed to LLaMA right away
+//  - LLaMA prefills the committed text during the speech, so only the last words are left to evaluate at its end
+//  - the reply is cut into sentences, which are spoken by the TTS thread while the next ones are generated
+//  - with barge-in, speech during the reply stops the generation and drops the sentences that were not spoken yet.
+//    without it, the audio is ignored until the reply has been spoken, as in the sequential mode
+//  - the whisper and the LLaMA computations take turns on the device (see compute_arbiter)
+//
+
+struct asr_event {
+    enum kind_t {
+        ONSET, // the person started speaking
+        TEXT,  // newly committed text of the utterance
+        END,   // the person stopped speaking, all the text of the utterance has been sent
+    };
+
+    kind_t      kind;
+    std::string text;
+};
+
+struct asr_events {
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::deque<asr_event>   queue;
+
+    void push(asr_event::kind_t kind, const std::string & text) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back({ kind, text });
+        }
+        cv.notify_one();
+    }
+
+    // returns false if there was no event for timeout_ms
+    bool pop(asr_event & ev, int timeout_ms) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&]() { return !queue.empty(); })) {
+            return false;
+        }
+        ev = std::move(queue.front());
+        queue.pop_front();
+        return true;
+    }
+};
+
+// speaks the queued sentences in order on a worker thread
+class tts_queue {
+public:
+    tts_queue(const whisper_params & params, int voice_id) : params(params), voice_id(voice_id) {
+        worker = std::thread([this]() { run(); });
+    }
+
+    ~tts_queue() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cv.notify_all();
+        worker.join();
+    }
+
+    void push(const std::string & text) {
+        if (text.find_first_not_of(" \t\n") == std::string::npos) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(text);
+        }
+        cv.notify_one();
+    }
+
+    // drops the sentences that are not spoken yet - the TTS command is blocking, the current sentence is finished
+    void cancel() {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.clear();
+    }
+
+    // nothing is queued or being spoken
+    bool idle() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queue.empty() && !speaking;
+    }
+
+private:
+    void run() {
+        while (true) {
+            std::string text;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]() { return stop || !queue.empty(); });
+                if (stop) {
+                    break;
+                }
+                text = std::move(queue.front());
+                queue.pop_front();
+                speaking = true;
+            }
+
+            speak_with_file(params.speak, text, params.speak_file, voice_id);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            speaking = false;
+        }
+    }
+
+    const whisper_params & params;
+    const int voice_id;
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::deque<std::string> queue;
+    bool speaking = false;
+    bool stop     = false;
+
+    std::thread worker;
+};
+
+// serializes the whisper and the LLaMA computations, which share the device (and the CPU threads) in the pipelined
+// mode - an encoder burst in the middle of the decoding slows down both. the favored side waits only for the
+// computation that is already running: whisper while the person speaks, LLaMA while it replies
+class compute_arbiter {
+public:
+    enum user_t {
+        WHISPER = 0,
+        LLAMA   = 1,
+    };
+
+    void set_favored(user_t user) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            favored = user;
+        }
+        cv.notify_all();
+    }
+
+    void acquire(user_t user) {
+        std::unique_lock<std::mutex> lock(mutex);
+        n_waiting[user]++;
+        cv.wait(lock, [&]() { return !busy && (user == favored || n_waiting[favored] == 0); });
+        n_waiting[user]--;
+        busy = true;
+    }
+
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy = false;
+        }
+        cv.notify_all();
+    }
+
+private:
+    std::mutex              mutex;
+    std::condition_variable cv;
+
+    user_t favored      = WHISPER;
+    int    n_waiting[2] = { 0, 0 };
+    bool   busy         = false;
+};
+
+struct compute_lock {
+    compute_lock(compute_arbiter & arbiter, compute_arbiter::user_t user) : arbiter(arbiter) {
+        arbiter.acquire(user);
+    }
+    ~compute_lock() {
+        arbiter.release();
+    }
+
+    compute_arbiter & arbiter;
+};
+
+// the ASR thread: VAD -> streaming transcription -> events
+static void asr_run(
+        whisper_stream * stream,
+        const whisper_params & params,
+        audio_async & audio,
+        asr_events & events,
+        compute_arbiter & arbiter,
+        const std::atomic<bool> & listening,
+        std::atomic<bool> & in_speech,
+        const std::atomic<bool> & running) {
+    auto vad_new = [&]() {
+        return vad_energy(WHISPER_SAMPLE_RATE, 2000, 1250, params.vad_thold, params.freq_thold);
+    };
+
+    vad_energy vad = vad_new();
+
+    // the onset is detected up to last_ms after the start of the speech - keep that much audio before it
+    const size_t n_preroll = WHISPER_SAMPLE_RATE*3/2;
+
+    std::vector<float> pcmf32;
+    std::vector<float> preroll;
+
+    uint64_t n_end = 0; // the end of the audio that has been processed
+
+    auto feed = [&](const float * samples, size_t n_samples) {
+        if (n_samples == 0) {
+            return;
+        }
+        compute_lock lock(arbiter, compute_arbiter::WHISPER);
+
+        const int ret = whisper_stream_feed(stream, samples, n_samples);
+        if (ret < 0) {
+            fprintf(stderr, "%s: failed to transcribe\n", __func__);
+        } else if (ret > 0) {
+            const std::string text = whisper_stream_get_committed(stream);
+            if (!text.empty()) {
+                events.push(asr_event::TEXT, text);
+            }
+        }
+    };
+
+    while (running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        uint64_t pos = 0;
+        audio.get(2000, pcmf32, &pos);
+
+        // only the audio since the last iteration
+        const size_t n_skip = std::min<uint64_t>(pcmf32.size(), n_end > pos ? n_end - pos : 0);
+        pcmf32.erase(pcmf32.begin(), pcmf32.begin() + n_skip);
+        n_end = pos + n_skip + pcmf32.size();
+
+        if (!listening) {
+            // the reply is being spoken and the microphone would hear it
+            if (in_speech) {
+                whisper_stream_reset(stream);
+                in_speech = false;
+            }
+            vad = vad_new();
+            preroll.clear();
+            continue;
+        }
+
+        vad.feed(pcmf32.data(), pcmf32.size());
+
+        if (!in_speech && vad.in_speech) {
+            in_speech = true;
+            events.push(asr_event::ONSET, "");
+
+            feed(preroll.data(), preroll.size());
+            preroll.clear();
+        }
+
+        if (in_speech) {
+            feed(pcmf32.data(), pcmf32.size());
+        } else {
+            preroll.insert(preroll.end(), pcmf32.begin(), pcmf32.end());
+            if (preroll.size() > n_preroll) {
+                preroll.erase(preroll.begin(), preroll.end() - n_preroll);
+            }
+        }
+
+        if (in_speech && !vad.in_speech) {
+            int ret = 0;
+            {
+                compute_lock lock(arbiter, compute_arbiter::WHISPER);
+                ret = whisper_stream_flush(stream);
+            }
+            if (ret != 0) {
+                fprintf(stderr, "%s: failed to transcribe\n", __func__);
+            } else {
+                const std::string text = whisper_stream_get_committed(stream);
+                if (!text.empty()) {
+                    events.push(asr_event::TEXT, text);
+                }
+            }
+            events.push(asr_event::END, "");
+
+            whisper_stream_reset(stream);
+            in_speech = false;
+        }
+    }
+}
+
+// returns 0 when the user quits, 1 on failure
+static int run_pipelined(
+        whisper_context * ctx_wsp,
+        llama_context * ctx_llama,
+        llama_sampler * smpl,
+        llama_batch & batch,
+        audio_async & audio,
+        const whisper_params & params,
+        const std::string & prompt_whisper,
+        const std::string & chat_symb,
+        const std::string & path_session,
+        std::vector<llama_token> & embd_inp,
+        int n_keep) {
+    const llama_vocab * vocab = llama_model_get_vocab(llama_get_model(ctx_llama));
+
+    whisper_stream_params sparams = whisper_stream_default_params(WHISPER_SAMPLING_GREEDY);
+
+    sparams.full_params.print_progress = false;
+    sparams.full_params.print_special  = params.print_special;
+    sparams.full_params.translate      = params.translate;
+    sparams.full_params.max_tokens     = params.max_tokens;
+    sparams.full_params.language       = params.language.c_str();
+    sparams.full_params.n_threads      = params.n_threads;
+    sparams.full_params.audio_ctx      = params.audio_ctx;
+    sparams.full_params.initial_prompt = prompt_whisper.c_str();
+
+    sparams.step_ms   = params.step_ms;
+    sparams.length_ms = std::min(params.voice_ms, 30000);
+
+    whisper_stream * stream = whisper_stream_init(ctx_wsp, sparams);
+    if (!stream) {
+        fprintf(stderr, "%s: failed to initialize the stream\n", __func__);
+        return 1;
+    }
+
+    const int voice_id = 2;
+    const int n_ctx    = llama_n_ctx(ctx_llama);
+    const int n_prev   = 64;
+
+    const std::string wake_cmd = params.wake_cmd;
+    const int wake_cmd_length = get_words(wake_cmd).size();
+    const bool use_wake_cmd = wake_cmd_length > 0;
+
+    const std::vector<std::string> antiprompts = {
+        params.person + chat_symb,
+    };
+
+    int n_past = embd_inp.size();
+
+    compute_arbiter arbiter;
+
+    // the tokens of the current utterance that have been evaluated after n_past
+    std::vector<llama_token> prefilled;
+
+    auto eval = [&](const llama_token * tokens, int n_tokens, int pos, bool logits_last) {
+        batch.n_tokens = n_tokens;
+
+        for (int i = 0; i < n_tokens; i++) {
+            batch.token[i]     = tokens[i];
+            batch.pos[i]       = pos + i;
+            batch.n_seq_id[i]  = 1;
+            batch.seq_id[i][0] = 0;
+            batch.logits[i]    = logits_last && i == n_tokens - 1;
+        }
+
+        if (n_tokens == 0) {
+            return true;
+        }
+
+        compute_lock lock(arbiter, compute_arbiter::LLAMA);
+
+        return llama_decode(ctx_llama, batch) == 0;
+    };
+
+    auto shift = [&](int n_new) {
+        std::vector<llama_token> tail;
+        llama_make_room(ctx_llama, embd_inp, n_past, n_keep, n_new, n_prev, tail);
+        if (tail.empty()) {
+            return true;
+        }
+
+        // the KV cache after the initial prompt has been cleared
+        prefilled.clear();
+
+        if (!eval(tail.data(), tail.size(), n_past, false)) {
+            return false;
+        }
+        embd_inp.insert(embd_inp.end(), tail.begin(), tail.end());
+        n_past += tail.size();
+
+        return true;
+    };
+
+    // evaluates tokens after n_past, reusing the prefilled prefix
+    auto sync = [&](const std::vector<llama_token> & tokens, bool logits_last) {
+        size_t n_common = 0;
+        while (n_common < prefilled.size() && n_common < tokens.size() && prefilled[n_common] == tokens[n_common]) {
+            n_common++;
+        }
+        if (logits_last && n_common == tokens.size() && n_common > 0) {
+            // the logits of the last token are needed
+            n_common--;
+        }
+        if (n_common < prefilled.size()) {
+            llama_kv_self_seq_rm(ctx_llama, 0, n_past + n_common, -1);
+            prefilled.resize(n_common);
+        }
+
+        if (!shift(tokens.size())) {
+            return false;
+        }
+        if (prefilled.empty()) {
+            n_common = 0;
+        }
+
+        if (!eval(tokens.data() + n_common, tokens.size() - n_common, n_past + n_common, logits_last)) {
+            return false;
+        }
+        prefilled = tokens;
+
+        return true;
+    };
+
+    // appends tokens to the dialog
+    auto append = [&](const std::vector<llama_token> & tokens, bool logits_last) {
+        if (!sync(tokens, logits_last)) {
+            return false;
+        }
+        embd_inp.insert(embd_inp.end(), tokens.begin(), tokens.end());
+        n_past += tokens.size();
+        prefilled.clear();
+
+        return true;
+    };
+
+    tts_queue tts(params, voice_id);
+    asr_events events;
+
+    std::atomic<bool> listening(true);
+    std::atomic<bool> in_speech(false);
+    std::atomic<bool> running(true);
+
+    std::thread asr([&]() {
+        asr_run(stream, params, audio, events, arbiter, listening, in_speech, running);
+    });
+
+    int ret = 0;
+
+    std::string heard; // the committed text of the current utterance
+
+    while (true) {
+        // handle Ctrl + C
+        if (!sdl_poll_events()) {
+            break;
+        }
+
+        if (!listening && tts.idle()) {
+            listening = true;
+        }
+
+        asr_event ev;
+        if (!events.pop(ev, 100)) {
+            continue;
+        }
+
+        if (ev.kind == asr_event::ONSET) {
+            if (params.barge_in) {
+                tts.cancel();
+            }
+            continue;
+        }
+
+        if (ev.kind == asr_event::TEXT) {
+            heard += ev.text;
+
+            // prefill all but the last token, which can still merge with the next words
+            if (!use_wake_cmd) {
+                std::string text;
+                for (const auto & word : get_words(heard)) {
+                    text += word + " ";
+                }
+                text = clean_heard(text);
+
+                std::vector<llama_token> tokens = ::llama_tokenize(ctx_llama, " " + text, false);
+                if (!text.empty() && tokens.size() > 1 && n_past + (int) tokens.size() < n_ctx) {
+                    tokens.pop_back();
+                    if (!sync(tokens, false)) {
+                        fprintf(stderr, "%s : failed to decode\n", __func__);
+                        ret = 1;
+                        break;
+                    }
+                }
+            }
+            continue;
+        }
+
+        // END - the person stopped speaking
+
+        std::string text_heard;
+        {
+            const auto words = get_words(::trim(heard));
+            heard.clear();
+
+            std::string wake_cmd_heard;
+            for (int i = 0; i < (int) words.size(); ++i) {
+                if (i < wake_cmd_length) {
+                    wake_cmd_heard += words[i] + " ";
+                } else {
+                    text_heard += words[i] + " ";
+                }
+            }
+
+            if (use_wake_cmd && similarity(wake_cmd_heard, wake_cmd) < 0.7f) {
+                text_heard.clear();
+            }
+        }
+
+        text_heard = clean_heard(text_heard);
+
+        if (text_heard.empty() || ::llama_tokenize(ctx_llama, text_heard, false).empty()) {
+            // drop the prefill of the noise
+            if (!prefilled.empty()) {
+                llama_kv_self_seq_rm(ctx_llama, 0, n_past, -1);
+                prefilled.clear();
+            }
+            continue;
+        }
+
+        // optionally give audio feedback that the current text is being processed
+        if (!params.heard_ok.empty()) {
+            tts.push(params.heard_ok);
+        }
+
+        text_heard.insert(0, 1, ' ');
+        text_heard += "\n" + params.bot_name + chat_symb;
+        fprintf(stdout, "%s%s%s", "\033[1m", text_heard.c_str(), "\033[0m");
+        fflush(stdout);
+
+        if (!append(::llama_tokenize(ctx_llama, text_heard, false), true)) {
+            fprintf(stderr, "%s : failed to decode\n", __func__);
+            ret = 1;
+            break;
+        }
+
+        listening = params.barge_in;
+        arbiter.set_favored(compute_arbiter::LLAMA);
+
+        // text inference - every complete sentence is spoken while the next one is generated
+        std::string reply;
+        std::string sentence;
+
+        bool done = false;
+        while (!done) {
+            if (params.barge_in && in_speech) {
+                break;
+            }
+
+            const llama_token id = llama_sampler_sample(smpl, ctx_llama, -1);
+            if (id == llama_vocab_eos(vocab)) {
+                break;
+            }
+
+            const std::string piece = llama_token_to_piece(ctx_llama, id);
+            printf("%s", piece.c_str());
+            fflush(stdout);
+
+            if (!append({ id }, true)) {
+                fprintf(stderr, "%s : failed to decode\n", __func__);
+                ret = 1;
+                break;
+            }
+
+            reply    += piece;
+            sentence += piece;
+
+            for (const std::string & antiprompt : antiprompts) {
+                if (reply.size() >= antiprompt.size() && reply.compare(reply.size() - antiprompt.size(), antiprompt.size(), antiprompt) == 0) {
+                    sentence.erase(sentence.size() - std::min(sentence.size(), antiprompt.size()));
+                    done = true;
+                    break;
+                }
+            }
+
+            if (!done) {
+                size_t n_cut = 0;
+                for (size_t i = 0; i < sentence.size(); ++i) {
+                    const char c = sentence[i];
+                    if (c == '\n' || ((c == '.' || c == '!' || c == '?') && i + 1 < sentence.size() && isspace((unsigned char) sentence[i + 1]))) {
+                        n_cut = i + 1;
+                    }
+                }
+                if (n_cut > 0) {
+                    tts.push(sentence.substr(0, n_cut));
+                    sentence.erase(0, n_cut);
+                }
+            }
+        }
+
+        arbiter.set_favored(compute_arbiter::WHISPER);
+
+        if (ret != 0) {
+            break;
+        }
+
+        if (done) {
+            tts.push(sentence);
+
+            if (!path_session.empty()) {
+                llama_state_save_file(ctx_llama, path_session.c_str(), embd_inp.data(), embd_inp.size());
+            }
+        } else {
+            // interrupted or end of text - hand the turn back to the person
+            const std::string turn = "\n" + params.person + chat_symb;
+            printf("%s", turn.c_str());
+            fflush(stdout);
+
+            if (!append(::llama_tokenize(ctx_llama, turn, false), false)) {
+                fprintf(stderr, "%s : failed to decode\n", __func__);
+                ret = 1;
+                break;
+            }
+        }
+    }
+
+    running = false;
+    asr.join();
+
+    whisper_stream_free(stream);
+
+    return ret;
+}
+
 int main(int argc, char ** argv) {
     whisper_params params;
 
@@ -429,10 +1123,15 @@ int main(int argc, char ** argv) {
     }
 
     // init session
-    std::string path_session = params.path_session;
-    std::vector<llama_token> session_tokens;
+    const std::string path_session = params.path_session;
     auto embd_inp = ::llama_tokenize(ctx_llama, prompt_llama, true);
 
+    // the initial prompt is kept when the context is full
+    const int n_keep = embd_inp.size();
+
+    // the session holds the KV cache of the dialog and its tokens, saved after each reply
+    bool resumed = false;
+
     if (!path_session.empty()) {
         fprintf(stderr, "%s: attempting to load saved session from %s\n", __func__, path_session.c_str());
 
@@ -441,18 +1140,25 @@ int main(int argc, char ** argv) {
         if (fp != NULL) {
             std::fclose(fp);
 
-            session_tokens.resize(llama_n_ctx(ctx_llama));
+            std::vector<llama_token> session_tokens(llama_n_ctx(ctx_llama));
             size_t n_token_count_out = 0;
             if (!llama_state_load_file(ctx_llama, path_session.c_str(), session_tokens.data(), session_tokens.capacity(), &n_token_count_out)) {
                 fprintf(stderr, "%s: error: failed to load session file '%s'\n", __func__, path_session.c_str());
                 return 1;
             }
             session_tokens.resize(n_token_count_out);
-            for (size_t i = 0; i < session_tokens.size(); i++) {
-                embd_inp[i] = session_tokens[i];
-            }
 
-            fprintf(stderr, "%s: loaded a session with prompt size of %d tokens\n", __func__, (int) session_tokens.size());
+            if (session_tokens.size() >= embd_inp.size() && std::equal(embd_inp.begin(), embd_inp.end(), session_tokens.begin())) {
+                // continue the dialog of the session, it is already in the KV cache
+                embd_inp = session_tokens;
+                resumed = true;
+
+                fprintf(stderr, "%s: resuming a session of %d tokens\n", __func__, (int) session_tokens.size());
+            } else {
+                llama_kv_self_clear(ctx_llama);
+
+                fprintf(stderr, "%s: warning: the session was started with a different prompt, starting a new one\n", __func__);
+            }
         } else {
             fprintf(stderr, "%s: session file does not exist, will create\n", __func__);
         }
@@ -463,22 +1169,24 @@ int main(int argc, char ** argv) {
     printf("\n");
     printf("%s : initializing - please wait ...\n", __func__);
 
-    // prepare batch
-    {
-        batch.n_tokens = embd_inp.size();
-
-        for (int i = 0; i < batch.n_tokens; i++) {
-            batch.token[i]     = embd_inp[i];
-            batch.pos[i]       = i;
-            batch.n_seq_id[i]  = 1;
-            batch.seq_id[i][0] = 0;
-            batch.logits[i]    = i == batch.n_tokens - 1;
+    if (!resumed) {
+        // prepare batch
+        {
+            batch.n_tokens = embd_inp.size();
+
+            for (int i = 0; i < batch.n_tokens; i++) {
+                batch.token[i]     = embd_inp[i];
+                batch.pos[i]       = i;
+                batch.n_seq_id[i]  = 1;
+                batch.seq_id[i][0] = 0;
+                batch.logits[i]    = i == batch.n_tokens - 1;
+            }
         }
-    }
 
-    if (llama_decode(ctx_llama, batch)) {
-        fprintf(stderr, "%s : failed to decode\n", __func__);
-        return 1;
+        if (llama_decode(ctx_llama, batch)) {
+            fprintf(stderr, "%s : failed to decode\n", __func__);
+            return 1;
+        }
     }
 
     if (params.verbose_prompt) {
@@ -487,31 +1195,6 @@ int main(int argc, char ** argv) {
         fflush(stdout);
     }
 
-     // debug message about similarity of saved session, if applicable
-    size_t n_matching_session_tokens = 0;
-    if (session_tokens.size()) {
-        for (llama_token id : session_tokens) {
-            if (n_matching_session_tokens >= embd_inp.size() || id != embd_inp[n_matching_session_tokens]) {
-                break;
-            }
-            n_matching_session_tokens++;
-        }
-        if (n_matching_session_tokens >= embd_inp.size()) {
-            fprintf(stderr, "%s: session file has exact match for prompt!\n", __func__);
-        } else if (n_matching_session_tokens < (embd_inp.size() / 2)) {
-            fprintf(stderr, "%s: warning: session file has low similarity to prompt (%zu / %zu tokens); will mostly be reevaluated\n",
-                __func__, n_matching_session_tokens, embd_inp.size());
-        } else {
-            fprintf(stderr, "%s: session file matches %zu / %zu tokens of prompt\n",
-                __func__, n_matching_session_tokens, embd_inp.size());
-        }
-    }
-
-    // HACK - because session saving incurs a non-negligible delay, for now skip re-saving session
-    // if we loaded a session with at least 75% similarity. It's currently just used to speed up the
-    // initial prompt so it doesn't need to be an exact match.
-    bool need_to_save_session = !path_session.empty() && n_matching_session_tokens < (embd_inp.size() * 3 / 4);
-
     printf("%s : done! start speaking in the microphone\n", __func__);
 
     // show wake command if enabled
@@ -532,12 +1215,10 @@ int main(int argc, char ** argv) {
 
     // text inference variables
     const int voice_id = 2;
-    const int n_keep   = embd_inp.size();
     const int n_ctx    = llama_n_ctx(ctx_llama);
 
-    int n_past = n_keep;
+    int n_past = embd_inp.size();
     int n_prev = 64; // TODO arg
-    int n_session_consumed = !path_session.empty() && session_tokens.size() > 0 ? session_tokens.size() : 0;
 
     std::vector<llama_token> embd;
 
@@ -546,6 +1227,14 @@ int main(int argc, char ** argv) {
         params.person + chat_symb,
     };
 
+    if (params.pipeline) {
+        if (run_pipelined(ctx_wsp, ctx_llama, smpl, batch, audio, params, prompt_whisper, chat_symb, path_session, embd_inp, n_keep) != 0) {
+            return 1;
+        }
+
+        is_running = false;
+    }
+
     // main loop
     while (is_running) {
         // handle Ctrl + C
@@ -602,27 +1291,7 @@ int main(int argc, char ** argv) {
                     speak_with_file(params.speak, params.heard_ok, params.speak_file, voice_id);
                 }
 
-                // remove text between brackets using regex
-                {
-                    std::regex re("\\[.*?\\]");
-                    text_heard = std::regex_replace(text_heard, re, "");
-                }
-
-                // remove text between brackets using regex
-                {
-                    std::regex re("\\(.*?\\)");
-                    text_heard = std::regex_replace(text_heard, re, "");
-                }
-
-                // remove all characters, except for letters, numbers, punctuation and ':', '\'', '-', ' '
-                text_heard = std::regex_replace(text_heard, std::regex("[^a-zA-Z0-9\\.,\\?!\\s\\:\\'\\-]"), "");
-
-                // take first line
-                text_heard = text_heard.substr(0, text_heard.find_first_of('\n'));
-
-                // remove leading and trailing whitespace
-                text_heard = std::regex_replace(text_heard, std::regex("^\\s+"), "");
-                text_heard = std::regex_replace(text_heard, std::regex("\\s+$"), "");
+                text_heard = clean_heard(text_heard);
 
                 const std::vector<llama_token> tokens = llama_tokenize(ctx_llama, text_heard.c_str(), false);
 
@@ -642,11 +1311,6 @@ int main(int argc, char ** argv) {
 
                 embd = ::llama_tokenize(ctx_llama, text_heard, false);
 
-                // Append the new input tokens to the session_tokens vector
-                if (!path_session.empty()) {
-                    session_tokens.insert(session_tokens.end(), tokens.begin(), tokens.end());
-                }
-
                 // text inference
                 bool done = false;
                 std::string text_to_speak;
@@ -654,47 +1318,10 @@ int main(int argc, char ** argv) {
                     // predict
                     if (embd.size() > 0) {
                         if (n_past + (int) embd.size() > n_ctx) {
-                            n_past = n_keep;
-
-                            // insert n_left/2 tokens at the start of embd from last_n_tokens
-                            embd.insert(embd.begin(), embd_inp.begin() + embd_inp.size() - n_prev, embd_inp.end());
-                            // stop saving session if we run out of context
-                            path_session = "";
-                            //printf("\n---\n");
-                            //printf("resetting: '");
-                            //for (int i = 0; i < (int) embd.size(); i++) {
-                            //    printf("%s", llama_token_to_piece(ctx_llama, embd[i]));
-                            //}
-                            //printf("'\n");
-                            //printf("\n---\n");
-                        }
-
-                        // try to reuse a matching prefix from the loaded session instead of re-eval (via n_past)
-                        // REVIEW
-                        if (n_session_consumed < (int) session_tokens.size()) {
-                            size_t i = 0;
-                            for ( ; i < embd.size(); i++) {
-                                if (embd[i] != session_tokens[n_session_consumed]) {
-                                    session_tokens.resize(n_session_consumed);
-                                    break;
-                                }
-
-                                n_past++;
-                                n_session_consumed++;
-
-                                if (n_session_consumed >= (int) session_tokens.size()) {
-                                    i++;
-                                    break;
-                                }
-                            }
-                            if (i > 0) {
-                                embd.erase(embd.begin(), embd.begin() + i);
-                            }
-                        }
-
-                        if (embd.size() > 0 && !path_session.empty()) {
-                            session_tokens.insert(session_tokens.end(), embd.begin(), embd.end());
-                            n_session_consumed = session_tokens.size();
+                            // discard old turns in place, or evaluate the last n_prev tokens again
+                            std::vector<llama_token> tail;
+                            llama_make_room(ctx_llama, embd_inp, n_past, n_keep, embd.size(), n_prev, tail);
+                            embd.insert(embd.begin(), tail.begin(), tail.end());
                         }
 
                         // prepare batch
@@ -722,16 +1349,16 @@ int main(int argc, char ** argv) {
 
                     embd.clear();
 
-                    if (done) break;
+                    if (done) {
+                        // the dialog so far, resumed on the next start without evaluating it again
+                        if (!path_session.empty()) {
+                            llama_state_save_file(ctx_llama, path_session.c_str(), embd_inp.data(), embd_inp.size());
+                        }
+                        break;
+                    }
 
                     {
                         // out of user input, sample next token
-
-                        if (!path_session.empty() && need_to_save_session) {
-                            need_to_save_session = false;
-                            llama_state_save_file(ctx_llama, path_session.c_str(), session_tokens.data(), session_tokens.size());
-                        }
-
                         const llama_token id = llama_sampler_sample(smpl, ctx_llama, -1);
 
                         if (id != llama_vocab_eos(vocab_llama)) {
@@ -757,7 +1384,6 @@ int main(int argc, char ** argv) {
                                 done = true;
                                 text_to_speak = ::replace(text_to_speak, antiprompt, "");
                                 fflush(stdout);
-                                need_to_save_session = true;
                                 break;
                             }
                         }
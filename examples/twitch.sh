@@ -79,6 +79,21 @@ if [ $? -ne 0 ]; then
     exit 1
 fi
 
+# load the model once and keep it resident, each step below only sends the new chunk to it
+rm -f /tmp/whisper-live.sock
+./build/bin/whisper-cli -t $threads -m ./models/ggml-$model.bin --daemon /tmp/whisper-live.sock 2> /tmp/whisper-daemon.err &
+daemon_pid=$!
+trap "kill $daemon_pid 2> /dev/null" EXIT
+
+# the daemon listens once the model is loaded
+while [ ! -S /tmp/whisper-live.sock ]; do
+    if ! kill -0 $daemon_pid 2> /dev/null; then
+        printf "error: whisper-cli failed to load the model, see /tmp/whisper-daemon.err\n"
+        exit 1
+    fi
+    sleep 1
+done
+
 echo "Buffering stream... (this should take $step seconds)"
 sleep $(($step))
 
@@ -100,7 +115,7 @@ do
         err=$(cat /tmp/whisper-live.err | wc -l)
     done
 
-    ./build/bin/whisper-cli -t $threads -m ./models/ggml-$model.bin -f /tmp/whisper-live.wav --no-timestamps -otxt 2> /tmp/whispererr | tail -n 1
+    ./build/bin/whisper-cli --connect /tmp/whisper-live.sock -f /tmp/whisper-live.wav --no-timestamps -otxt 2> /tmp/whispererr | tail -n 1
 
     while [ $SECONDS -lt $((($i+1)*$step)) ]; do
         sleep 1
@@ -178,10 +178,20 @@ Java_com_whispercpp_whisper_WhisperLib_00024Companion_fullTranscribe(
     params.translate = false;
     params.language = "en";
     params.n_threads = num_threads;
+    // the decoder steps are small, more threads mostly wait at the barriers
+    params.n_threads_dec = num_threads < 4 ? num_threads : 4;
     params.offset_ms = 0;
     params.no_context = true;
     params.single_segment = false;
 
+    // keep the threads on the performance cores - a graph waits for its slowest thread
+    struct whisper_threadpool_params tpp = whisper_threadpool_default_params(num_threads);
+    tpp.poll = 0;
+    tpp.perf_cores = true;
+    if (whisper_state_set_threadpool(whisper_get_state(context), &tpp) != 0) {
+        LOGW("Failed to create the threadpool, the threads are not pinned");
+    }
+
     whisper_reset_timings(context);
 
     LOGI("About to run whisper_full");
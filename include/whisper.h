@@ -80,6 +80,7 @@ extern "C" {
     struct whisper_context;
     struct whisper_state;
     struct whisper_full_params;
+    struct whisper_adapter_lora;
 
     typedef int32_t whisper_pos;
     typedef int32_t whisper_token;
@@ -103,6 +104,14 @@ extern "C" {
         WHISPER_AHEADS_LARGE_V3_TURBO,
     };
 
+    // [EXPERIMENTAL] NUMA strategies of the CPU threads, see ggml_numa_init
+    enum whisper_numa_strategy {
+        WHISPER_NUMA_DISABLED,
+        WHISPER_NUMA_DISTRIBUTE, // spread the threads over the nodes
+        WHISPER_NUMA_ISOLATE,    // keep the threads on the node of the thread that starts them
+        WHISPER_NUMA_NUMACTL,    // use the CPU map set with numactl
+    };
+
     typedef struct whisper_ahead {
         int n_text_layer;
         int n_head;
@@ -116,7 +125,27 @@ extern "C" {
     struct whisper_context_params {
         bool  use_gpu;
         bool  flash_attn;
+        bool  fuse_qkv;    // [EXPERIMENTAL] compute the self-attention Q, K and V with a single matrix multiplication
         int   gpu_device;  // CUDA device
+        int   gpu_device_dec; // [EXPERIMENTAL] GPU device for the decoder and its KV caches (-1 = gpu_device)
+
+        // [EXPERIMENTAL] number of encoder / decoder layers to keep on the GPU (-1 = all), the remaining layers
+        // are kept in host memory and computed on the CPU. The non-layer weights of the encoder (decoder) and the KV
+        // caches of the decoder stay on the GPU unless the corresponding count is 0
+        int   n_gpu_layers_enc;
+        int   n_gpu_layers_dec;
+
+        // [EXPERIMENTAL] comma-separated RPC servers (host:port, see ggml/include/ggml-rpc.h) used as GPU devices,
+        // numbered after the local GPUs: gpu_device can place the encoder on a remote GPU while gpu_device_dec or
+        // n_gpu_layers_dec = 0 keep the decoder local. Run the servers with a cache directory (rpc-server -c) so the
+        // weights they have already received are not uploaded again. Requires GGML_RPC (NULL = none)
+        const char * rpc_servers;
+
+        bool  use_mmap;    // map the model file into memory when loading from a path
+
+        // [EXPERIMENTAL] if the weights used in place from the mapped file exceed this many bytes, the encoder
+        // weights are released from memory while decoding and the decoder weights while encoding (0 = no limit)
+        size_t mmap_budget;
 
         // [EXPERIMENTAL] Token-level timestamps with DTW
         bool dtw_token_timestamps;
@@ -126,6 +155,80 @@ extern "C" {
         struct whisper_aheads dtw_aheads;
 
         size_t dtw_mem_size; // TODO: remove
+
+        // [EXPERIMENTAL] Record a timeline of each state (mel, VAD, encoder passes, decoder steps, logits processing,
+        // temperature fallbacks) and write it in the Chrome trace event format to <trace_path>-<id>.json when the state
+        // is freed. The files can be opened with chrome://tracing or Perfetto. The WHISPER_TRACE environment variable
+        // overrides trace_path (NULL = disabled)
+        const char * trace_path;
+
+        // [EXPERIMENTAL] NUMA placement on multi-socket hosts (Linux)
+        // numa is applied once per process, by the first context created with a strategy other than disabled.
+        // numa_node >= 0 moves the weights held in host memory to that node; loading one context per node, each used
+        // by the states pinned to the node (see whisper_threadpool_params::numa_node), replicates the weights on every
+        // node. The weights used in place from the mapped model file are not moved, set use_mmap = false (-1 = off)
+        enum whisper_numa_strategy numa;
+        int                        numa_node;
+
+        // [EXPERIMENTAL] back the host memory of the weights, of the KV caches and of the compute buffers with
+        // transparent huge pages (madvise MADV_HUGEPAGE, Linux), fewer TLB misses in the large matrix multiplications.
+        // the kernel falls back to small pages when no huge page is available. huge pages of the mapped model file
+        // also need a kernel with CONFIG_READ_ONLY_THP_FOR_FS
+        bool huge_pages;
+
+        // [EXPERIMENTAL] types of the K and V tensors of the self-attention (kv_self) and cross-attention (kv_cross)
+        // caches. The quantized types (Q8_0, Q5_0, Q5_1, Q4_0, Q4_1, IQ4_NL) require flash_attn, without it the
+        // caches are F16. BF16 has the range of F32 and uses the native BF16 paths of the CPUs and GPUs that have them
+        enum ggml_type type_k;
+        enum ggml_type type_v;
+
+        // [EXPERIMENTAL] intermediate type of the encoder self-attention: the padded K and V of flash_attn and the
+        // K and V casts without it. F16, BF16 or F32
+        enum ggml_type type_i;
+
+        // [EXPERIMENTAL] the cross-attention caches (kv_cross) of the states are taken from a pool shared by the states
+        // of the context when they encode, and returned to it when whisper_full() returns or the state is recycled, so
+        // idle states hold no cross-attention memory. whisper_get_encoder_output() fails after whisper_full() then
+        bool kv_cross_pool;
+
+        // [EXPERIMENTAL] the encoder and the decoder graphs of a state are allocated in the same compute buffers, sized
+        // for the larger of the two graphs instead of one buffer for each. The graph of one is built again after the
+        // other has run, so a state that alternates between the two (whisper_full) rebuilds them at each window
+        bool share_compute;
+
+        // [EXPERIMENTAL] when the encoder and the decoder run on the same GPU, the decoder graph runs on its own instance
+        // of the GPU backend, with its own stream and graph cache. The CUDA graph of a decoding step is then captured
+        // once and replayed for the next steps and windows, instead of being captured again after each encoder and
+        // cross graph. Not used with share_compute
+        bool gpu_dec_instance;
+
+        // [EXPERIMENTAL] load only this number of the decoder layers (0 - all of them), evenly spaced and including the
+        // first and the last one, like the pruned decoders of large-v3-turbo and distil-whisper. The other layers are not
+        // loaded nor computed, so each decoding step is faster, but the model was not trained for it and the accuracy drops
+        int dec_layers;
+
+        // [EXPERIMENTAL] compute the log mel spectrogram of whisper_full() and whisper_pcm_to_mel() in a graph on the
+        // device of the encoder (a DFT as a matrix product, the filterbank and the log), so the samples are not
+        // transformed by the CPU threads. The frames are read back to the host, where they are normalized. The frames
+        // match the ones of the FFT up to rounding. Not used for mel_lazy_ms and the streaming spectrogram
+        bool mel_gpu;
+
+        // [EXPERIMENTAL] store the matrix weights of the encoder (decoder) layers computed on the CPU in the extra CPU
+        // buffer types (AMX, aarch64 repack) that support them. The encoder multiplies them with the frames of a window
+        // and the decoder with the few tokens of a step, so a layout can pay off for one phase and not the other
+        bool cpu_repack_enc;
+        bool cpu_repack_dec;
+
+        // [EXPERIMENTAL] cache file of the weights converted to the layout of the extra CPU buffer types, written when
+        // the weights are converted and read on the next loads of the same model on the same CPU (NULL = disabled)
+        const char * repack_cache;
+
+        // [EXPERIMENTAL] the decoding steps that the states of the context run at the same time (whisper_full() on
+        // several threads, like the concurrent requests of a server) are evaluated together, as with
+        // whisper_decode_batch_with_state(): a thread that finds no batch running decodes the steps of all the states
+        // waiting for one, up to 8, while the others wait for their logits. Not used for the steps that save the
+        // alignment heads or sample on the device
+        bool decode_batch;
     };
 
     typedef struct whisper_token_data {
@@ -211,6 +314,18 @@ extern "C" {
     WHISPER_API struct whisper_context * whisper_init_from_buffer_with_params_no_state(void * buffer, size_t buffer_size,    struct whisper_context_params params);
     WHISPER_API struct whisper_context * whisper_init_with_params_no_state            (struct whisper_model_loader * loader, struct whisper_context_params params);
 
+    // [EXPERIMENTAL] Share the model weights between processes
+    // whisper_shared_publish copies a model file into the named POSIX shared memory segment (e.g. "/whisper-base").
+    // Other processes attach to it with whisper_init_from_shared_with_params - the weights that the CPU backend uses in
+    // place (see use_mmap) are not copied, so there is a single copy of them in memory for all processes.
+    // The segment stays alive until whisper_shared_unlink is called.
+    // Return 0 on success
+    WHISPER_API int whisper_shared_publish(const char * path_model, const char * name);
+    WHISPER_API int whisper_shared_unlink (const char * name);
+
+    WHISPER_API struct whisper_context * whisper_init_from_shared_with_params         (const char * name, struct whisper_context_params params);
+    WHISPER_API struct whisper_context * whisper_init_from_shared_with_params_no_state(const char * name, struct whisper_context_params params);
+
     WHISPER_DEPRECATED(
         WHISPER_API struct whisper_context * whisper_init_from_file(const char * path_model),
         "use whisper_init_from_file_with_params instead"
@@ -238,6 +353,76 @@ extern "C" {
 
     WHISPER_API struct whisper_state * whisper_init_state(struct whisper_context * ctx);
 
+    // The default state of the context, used by the functions without a state argument
+    // Returns nullptr if the context was created with one of the *_no_state functions
+    WHISPER_API struct whisper_state * whisper_get_state(struct whisper_context * ctx);
+
+    // [EXPERIMENTAL] Reuse states instead of creating new ones
+    // whisper_reset_state clears the per-request data of a state (results, prompt past, KV cache, language, timings,
+    // VAD segments, LoRA adapters) so it can process an unrelated request. whisper_recycle_state resets the state and keeps it in the
+    // context, so that the next whisper_init_state(ctx) returns it without allocating the KV caches and compute
+    // buffers again. Checking states out and back in is thread safe.
+    // The state must have been created with whisper_init_state(ctx). Recycled states are freed by whisper_free(ctx).
+    WHISPER_API void whisper_reset_state  (struct whisper_context * ctx, struct whisper_state * state);
+    WHISPER_API void whisper_recycle_state(struct whisper_context * ctx, struct whisper_state * state);
+
+    // [EXPERIMENTAL] Persistent CPU threadpool of a state
+    // The CPU graphs of the state (encoder, decoder, and the VAD model of whisper_full) run on threads that are created
+    // once and wait between the graphs, instead of threads started for each graph. The n_threads of the calls are capped
+    // to the size of the pool. Pinning the pools of several states to disjoint cores avoids oversubscription.
+    // With an OpenMP build of ggml, the threads are the ones of OpenMP and cpus, prio and strict_cpu have no effect
+    struct whisper_threadpool_params {
+        int          n_threads;
+        const char * cpus;       // cores of the threads, e.g. "0-7,16-23" (NULL = not pinned)
+        int          prio;       // 0 - normal, 1 - medium, 2 - high, 3 - realtime
+        int          poll;       // busy-wait of the idle threads, 0 - none to 100 - aggressive
+        bool         strict_cpu; // pin each thread to the next core of cpus instead of all of them
+
+        // pin the threads to the cores of this NUMA node unless cpus is set, and move the KV caches of the state to
+        // the node. The compute buffers are placed on the node when the pinned threads first write them (-1 = off, Linux)
+        int          numa_node;
+
+        // pin the threads to the performance cores (see whisper_cpu_perf_cores) unless cpus or numa_node is set
+        // On big.LITTLE phones, a graph waits for its slowest thread, so threads on the efficiency cores slow it down
+        bool         perf_cores;
+    };
+
+    WHISPER_API struct whisper_threadpool_params whisper_threadpool_default_params(int n_threads);
+
+    // [EXPERIMENTAL] The performance cores of the CPU: the big cores of big.LITTLE, the P-cores of hybrid x86 CPUs
+    // Linux and Android: the cores above the lowest maximum frequency (or capacity) in sysfs, all of them if they
+    // are the same. Apple platforms: hw.perflevel0, without the list of cores since the threads cannot be pinned
+    // Writes the list of cores (e.g. "4-7") to cpus if it is not NULL and returns their number, 0 if unknown
+    WHISPER_API int whisper_cpu_perf_cores(char * cpus, size_t size);
+
+    // Replaces the threadpool of the state, params == NULL releases it. The threadpool is kept when the params are the
+    // same as the ones it was created with, so it can be set before each transcription without respawning its threads
+    // Returns 0 on success, -1 if the params are invalid or the CPU backend has no threadpool support
+    WHISPER_API int whisper_state_set_threadpool(struct whisper_state * state, const struct whisper_threadpool_params * params);
+
+    // [EXPERIMENTAL] LoRA adapters of the decoder
+    // An adapter is loaded once onto the context and used by the states it is set on, so several fine-tunes can be
+    // served from one base model. The file is a GGUF with a pair of tensors "<weight>.lora_a" [n_in, rank] and
+    // "<weight>.lora_b" [rank, n_out] for each adapted weight, named like the weights of the model (e.g.
+    // "decoder.blocks.0.attn.query.weight"), and an optional float "adapter.lora.alpha"
+    // Only the projections that the decoder computes for each token are adapted: the self-attention, the query and
+    // output of the cross-attention, and the MLP. The other tensors of the file are skipped with a warning
+    // Returns nullptr on error. The adapters that are still loaded are freed by whisper_free(ctx)
+    WHISPER_API struct whisper_adapter_lora * whisper_adapter_lora_init(struct whisper_context * ctx, const char * path_lora);
+
+    // The adapter must not be set on a state anymore
+    WHISPER_API void whisper_adapter_lora_free(struct whisper_adapter_lora * adapter);
+
+    // Use the adapter in the decoder passes of the state, with its output multiplied by scale
+    // Setting an adapter that is already used changes its scale. Returns 0 on success, -1 if the adapter was loaded
+    // onto another context
+    WHISPER_API int whisper_set_adapter_lora(struct whisper_state * state, struct whisper_adapter_lora * adapter, float scale);
+
+    // Returns 0 on success, -1 if the adapter is not used by the state
+    WHISPER_API int whisper_rm_adapter_lora(struct whisper_state * state, struct whisper_adapter_lora * adapter);
+
+    WHISPER_API void whisper_clear_adapter_lora(struct whisper_state * state);
+
     // Given a context, enable use of OpenVINO for encode inference.
     // model_path: Optional path to OpenVINO encoder IR model. If set to nullptr,
     //                      the path will be generated from the ggml model path that was passed
@@ -284,6 +469,33 @@ extern "C" {
                                int   n_samples,
                                int   n_threads);
 
+    // [EXPERIMENTAL] Incremental log mel spectrogram for streaming audio.
+    // Appends n_samples of new PCM to the stream of the state and computes only the mel frames that became available.
+    // At most the last n_window_ms of audio are kept in a rolling window (0 - 30 seconds).
+    // The spectrogram of the window is stored inside the state, so it can be transcribed with
+    //   whisper_full_with_state(ctx, state, params, NULL, 0)
+    // The clamping reference of the normalization is the maximum over the frames currently in the window.
+    // If the window covers the entire input, the result is the same as whisper_pcm_to_mel().
+    // Returns 0 on success
+    WHISPER_API int whisper_pcm_to_mel_stream(
+            struct whisper_context * ctx,
+                       const float * samples,
+                               int   n_samples,
+                               int   n_window_ms,
+                               int   n_threads);
+
+    WHISPER_API int whisper_pcm_to_mel_stream_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                       const float * samples,
+                               int   n_samples,
+                               int   n_window_ms,
+                               int   n_threads);
+
+    // Drop all buffered audio and mel frames of the stream
+    WHISPER_API void whisper_mel_stream_reset           (struct whisper_context * ctx);
+    WHISPER_API void whisper_mel_stream_reset_with_state(struct whisper_context * ctx, struct whisper_state * state);
+
     // This can be used to set a custom log mel spectrogram inside the default state of the provided whisper context.
     // Use this instead of whisper_pcm_to_mel() if you want to provide your own log mel spectrogram.
     // n_mel must be 80
@@ -316,6 +528,29 @@ extern "C" {
                                int   offset,
                                int   n_threads);
 
+    // [EXPERIMENTAL] Run the Whisper encoder on the log mel spectrograms of n_batch (<= 8) different states in a single batch.
+    // The segment of states[i] starts at frame offsets[i]; it can come from a different file, or a later window of the same audio
+    // loaded into a separate state. The result for each segment is stored in its own state and can be decoded with
+    // whisper_decode_with_state() as after whisper_encode_with_state().
+    // All states must use the same audio_ctx. The compute buffers of states[0] are used and grow with the batch size.
+    // Returns 0 on success
+    WHISPER_API int whisper_encode_batch_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state ** states,
+                         const int * offsets,
+                               int   n_batch,
+                               int   n_threads);
+
+    // [EXPERIMENTAL] Save and restore the encoder output (the cross-attention memory) of the last encoder pass of a state
+    // The size depends on the audio_ctx of the state, on flash_attn and on type_k / type_v. After
+    // whisper_set_encoder_output(), the next whisper_full_with_state() call uses the log mel spectrogram already in the
+    // state (see whisper_pcm_to_mel_with_state) and this output for its first window instead of running the encoder.
+    // That call must process the same samples from the start with audio_ctx = 0, and without VAD
+    // Return 0 on success
+    WHISPER_API size_t whisper_get_encoder_output_size(struct whisper_context * ctx, struct whisper_state * state);
+    WHISPER_API int    whisper_get_encoder_output     (struct whisper_context * ctx, struct whisper_state * state,       void * dst, size_t size);
+    WHISPER_API int    whisper_set_encoder_output     (struct whisper_context * ctx, struct whisper_state * state, const void * src, size_t size);
+
     // Run the Whisper decoder to obtain the logits and probabilities for the next token.
     // Make sure to call whisper_encode() first.
     // tokens + n_tokens is the provided context for the decoder.
@@ -337,6 +572,22 @@ extern "C" {
                                int   n_past,
                                int   n_threads);
 
+    // [EXPERIMENTAL] Run the decoder step of n_batch (<= 8) different states in a single batch.
+    // states[i] decodes tokens[i][0..n_tokens[i]) after n_past[i] past tokens, same as whisper_decode_with_state().
+    // The projections and the MLP of all states are evaluated as one matrix multiplication, while the attention of each state
+    // uses its own KV cache and its own encoder output, so the states can be at different positions of different audio.
+    // The logits are stored in each state. The compute buffers of states[0] are used and grow with the batch size.
+    // whisper_context_params::decode_batch batches the steps of the states that decode at the same time this way
+    // Returns 0 on success
+    WHISPER_API int whisper_decode_batch_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state ** states,
+              const whisper_token ** tokens,
+                         const int * n_tokens,
+                         const int * n_past,
+                               int   n_batch,
+                               int   n_threads);
+
     // Convert the provided text into tokens.
     // The tokens pointer must be large enough to hold the resulting tokens.
     // Returns the number of tokens on success, no more than n_max_tokens
@@ -386,6 +637,23 @@ extern "C" {
                                int   n_threads,
                              float * lang_probs);
 
+    // [EXPERIMENTAL] Auto-detect the spoken language from up to n_windows windows of the mel, for audio that may start
+    // with music, silence or another language than the rest
+    // The first window starts at offset_ms and is encoded as whisper_full() encodes its first window. The next ones are
+    // window_ms long, spread over the rest of the mel, and encoded with the smallest audio_ctx that fits them
+    // The distributions of the windows are averaged, weighted by the probability that the window contains speech, and
+    // the detection stops as soon as the most probable language reaches the probability p_thold
+    // Returns the top language id or negative on failure, lang_probs is filled as by whisper_lang_auto_detect()
+    WHISPER_API int whisper_lang_auto_detect_multi_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                               int   offset_ms,
+                               int   n_windows,
+                               int   window_ms,
+                             float   p_thold,
+                               int   n_threads,
+                             float * lang_probs);
+
     WHISPER_API int whisper_n_len           (struct whisper_context * ctx); // mel length
     WHISPER_API int whisper_n_len_from_state(struct whisper_state * state); // mel length
     WHISPER_API int whisper_n_vocab         (struct whisper_context * ctx);
@@ -439,11 +707,148 @@ extern "C" {
         float decode_ms;
         float batchd_ms;
         float prompt_ms;
+
+        // whisper_full_parallel(): the wall time of the last call, the longest single job and the number of workers
+        // the wall time cannot get below the longest job, no matter how many processors are used
+        float parallel_ms;
+        float critical_ms;
+        int   n_workers;
+    };
+
+    // How a worker (processor) of the last whisper_full_parallel() call spent its time
+    struct whisper_worker_timings {
+        float wall_ms; // from the start of the call until the worker found the job queue empty
+        float busy_ms; // processing jobs
+        float idle_ms; // waiting for the other workers to finish
+        int   n_jobs;
     };
+
     WHISPER_API struct whisper_timings * whisper_get_timings(struct whisper_context * ctx);
+    WHISPER_API struct whisper_timings * whisper_get_timings_from_state(struct whisper_state * state);
+
+    // [EXPERIMENTAL] The counters of a state since it was created or reset, for monitoring
+    // Unlike whisper_timings, the times are totals and not averages per run
+    struct whisper_state_stats {
+        float mel_ms;
+        float sample_ms;
+        float encode_ms;
+        float decode_ms;
+        float batchd_ms;
+        float prompt_ms;
+        float vad_ms; // whisper_full() with params.vad, including the loading of the VAD model on first use
+
+        int n_sample;
+        int n_encode;
+        int n_decode;
+        int n_batchd;
+        int n_prompt;
+        int n_fail_p; // temperature fallbacks because of the logprob threshold
+        int n_fail_h; // temperature fallbacks because of the entropy threshold
+
+        int kv_self_n_max; // the most cells of the decoder self-attention KV cache used by a decoder pass
+        int kv_self_size;  // the cells of the decoder self-attention KV cache
+
+        // the encoder and decoder passes split by what they spend their time on. a batched pass is counted in the
+        // state whose compute buffers it uses (the first state of the batch)
+        float graph_build_ms;   // building and allocating the graphs that could not be reused
+        float graph_compute_ms; // computing the graphs on the backends
+        float copy_ms;          // setting the inputs of the graphs and reading the logits back
+        int   n_graph_build;
+        int   n_graph_reuse;
+
+        // whisper_full_params::callback_async
+        int   n_cb_events;     // events delivered to the callbacks
+        int   n_cb_merged;     // events merged into a pending one because the queue was full
+        int   cb_queue_max;    // the most events waiting in the queue
+        float cb_delay_max_ms; // the longest time from an event to its callback
+        float cb_wait_ms;      // whisper_full() waiting for the last callbacks before returning
+
+        // whisper_full_params::yield_callback
+        int   n_yield;  // calls of the callback
+        float yield_ms; // time spent in the callback, i.e. paused
+
+        // whisper_full_cascade_with_state(), counted in the state of the first pass
+        int   n_cascade;        // segments transcribed again with the large model
+        float cascade_audio_ms; // audio transcribed again
+    };
+
+    WHISPER_API struct whisper_state_stats whisper_get_state_stats(struct whisper_state * state);
+
+    // The counters of the default state of the context, zeros if it has no state
+    WHISPER_API struct whisper_state_stats whisper_get_stats(struct whisper_context * ctx);
+
+    // [EXPERIMENTAL] Memory used by a state or a context, in bytes
+    #define WHISPER_MEMORY_MAX_DEVICES 16
+
+    struct whisper_memory_usage {
+        size_t weights;        // the model buffers (context only)
+        size_t aheads_masks;   // the DTW alignment heads masks, shared by the states (context only)
+
+        size_t kv_self;
+        size_t kv_cross;
+        size_t kv_pad;
+        size_t compute_conv;   // the compute buffers of the schedulers of the graphs, with the graph metadata
+        size_t compute_encode;
+        size_t compute_cross;
+        size_t compute_decode;
+        size_t sampling;       // the device buffer of the greedy sampling in the decoder graph
+        size_t host;           // the host vectors: mel spectrogram, logits, decoders, input and work buffers
+
+        size_t total;
+
+        // the same bytes by device, the host vectors are counted in the "CPU" device
+        int n_devices;
+        struct {
+            const char * name; // ggml_backend_dev_name()
+            size_t       size;
+        } devices[WHISPER_MEMORY_MAX_DEVICES];
+    };
+
+    WHISPER_API struct whisper_memory_usage whisper_state_memory_usage(struct whisper_state * state);
+
+    // The weights and the shared buffers of the context (including the free kv_cross_pool buffers), plus the buffers of
+    // its default state if it has one
+    WHISPER_API struct whisper_memory_usage whisper_context_memory_usage(struct whisper_context * ctx);
+
+    // Returns zeros if i_worker is out of range
+    WHISPER_API struct whisper_worker_timings whisper_get_worker_timings           (struct whisper_context * ctx, int i_worker);
+    WHISPER_API struct whisper_worker_timings whisper_get_worker_timings_from_state(struct whisper_state * state, int i_worker);
     WHISPER_API void whisper_print_timings(struct whisper_context * ctx);
     WHISPER_API void whisper_reset_timings(struct whisper_context * ctx);
 
+    // Resets the timings and the counters of a state, e.g. at the start of each request of a server
+    // whisper_reset_state() also resets them
+    WHISPER_API void whisper_reset_timings_from_state(struct whisper_state * state);
+
+    // [EXPERIMENTAL] Write the events recorded so far by a state in the Chrome trace event format
+    // Returns 0 on success, -1 if tracing is not enabled (see whisper_context_params::trace_path) or on I/O error
+    WHISPER_API int whisper_trace_write_from_state(struct whisper_state * state, const char * fname);
+
+    // [EXPERIMENTAL] Per-op profile of the encoder and decoder graphs of a state
+    // While enabled, the nodes of the graphs are computed one at a time through the eval callback of the backend
+    // scheduler, synchronized and timed, so the computation is slower. The times of the nodes with the same graph, op,
+    // backend, type and shape are accumulated until the profile is reset or disabled
+    struct whisper_profile_op {
+        const char * graph;   // "conv", "encoder", "cross" or "decoder"
+        const char * op;      // ggml_op_desc() of the node
+        const char * backend;
+        const char * type;    // type of the first source of the node, e.g. the weights of a matrix multiplication
+        const char * shape;   // shape of the result
+        int          n_calls;
+        float        total_ms;
+    };
+
+    WHISPER_API void whisper_profile_enable_from_state(struct whisper_state * state, bool enable);
+    WHISPER_API void whisper_profile_reset_from_state (struct whisper_state * state);
+
+    // Sorts the entries by decreasing time and returns their number (0 if profiling is not enabled)
+    // The strings of the entries are valid until the profile is reset or disabled
+    WHISPER_API int                       whisper_profile_n_ops_from_state (struct whisper_state * state);
+    WHISPER_API struct whisper_profile_op whisper_profile_get_op_from_state(struct whisper_state * state, int i);
+
+    // Logs the n_top slowest ops (summed over the graphs and shapes) and the n_top slowest entries
+    WHISPER_API void whisper_profile_print_from_state(struct whisper_state * state, int n_top);
+
     // Print system information
     WHISPER_API const char * whisper_print_system_info(void);
 
@@ -479,6 +884,28 @@ extern "C" {
                              float * logits,
                               void * user_data);
 
+    // [EXPERIMENTAL] Token callback
+    // Called as the tokens are sampled, for the new tokens of the best decoder so far (the greedy decoder, or the
+    // beam with the highest average log probability) - the partial hypothesis is available before the segment ends
+    // i_token is the index of the token in the current window. The tokens are provisional: when they are replaced
+    // (temperature fallback, another beam or candidate taking the lead), they are reported again starting from the
+    // first index that changed
+    // t0 is the start of the token estimated from its timestamp probabilities (see thold_pt and thold_ptsum) and t1 is
+    // -1, except for timestamp tokens. The final timestamps are set when the segments are created
+    typedef void (*whisper_new_token_callback)(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                               int   i_token,
+          const whisper_token_data * token,
+                              void * user_data);
+
+    // [EXPERIMENTAL] Yield callback
+    // Called by whisper_full() at the points where the transcription can pause without losing any work: before each
+    // window is encoded and before each decoder step. The seek position, the KV caches and the decoders stay as they are
+    // while the callback runs, so it can block until a computation of higher priority on the same device is done, and
+    // the transcription resumes where it was when the callback returns. Use abort_callback to cancel it instead
+    typedef void (*whisper_yield_callback)(struct whisper_context * ctx, struct whisper_state * state, void * user_data);
+
     // Parameters for the whisper_full() function
     // If you change the order or add new parameters, make sure to update the default values in whisper.cpp:
     // whisper_full_default_params()
@@ -486,11 +913,17 @@ extern "C" {
         enum whisper_sampling_strategy strategy;
 
         int n_threads;
+        int n_threads_dec;      // threads of the decoder graphs (0 = n_threads), the small decoder steps scale worse than the encoder
         int n_max_text_ctx;     // max tokens to use from past text as prompt for the decoder
         int offset_ms;          // start offset in ms
         int duration_ms;        // audio duration to process in ms
 
         bool translate;
+        // [EXPERIMENTAL] also translate each window into English, with a second decoding of the window that reuses its
+        // encoder output and cross-attention KV. the translation is read with whisper_full_n_translated_segments()
+        // multilingual models only, not used with translate, by whisper_full_parallel() with several processors, by
+        // whisper_full_chunked() and with vad_chunk_ms
+        bool translate_also;
         bool no_context;        // do not use past transcription (if any) as initial prompt for the decoder
         bool no_timestamps;     // do not generate timestamps
         bool single_segment;    // force single segment output (useful for streaming)
@@ -511,6 +944,13 @@ extern "C" {
         // note: these can significantly reduce the quality of the output
         bool debug_mode;        // enable debug_mode provides extra info (eg. Dump log_mel)
         int  audio_ctx;         // overwrite the audio context size (0 = use default)
+        bool audio_ctx_auto;    // pick a smaller audio context size for inputs shorter than 30 s (when audio_ctx == 0)
+        bool sample_on_device;  // apply the logit filters and pick the token in the decoder graph instead of reading back the logits
+                                // used for greedy sampling at temperature 0 without grammar and logits_filter_callback
+        bool restrict_vocab;    // with no_timestamps (and without tdrz_enable), the decoding steps after the prompt only compute
+                                // the logits of the text tokens and EOT - the others are suppressed anyway
+        int  enc_reuse_ms;      // whisper_commands_score: reuse the encoder output of the previous call on the state when the
+                                // input is the same audio moved by at most this much - the new audio is not encoded (0 = never)
 
         // [EXPERIMENTAL] [TDRZ] tinydiarize
         bool tdrz_enable;       // enable tinydiarize speaker turn detection
@@ -530,6 +970,11 @@ extern "C" {
         const char * language;
         bool detect_language;
 
+        // [EXPERIMENTAL] auto-detection from up to lang_detect_n_windows windows, see whisper_lang_auto_detect_multi_with_state
+        // (<= 1 = the first window only)
+        int   lang_detect_n_windows;
+        float lang_detect_thold;     // stop once the most probable language reaches this probability
+
         // common decoding parameters:
         bool suppress_blank; // ref: https://github.com/openai/whisper/blob/f82bc59f5ea234d4b97fb2860842ed38519f7e65/whisper/decoding.py#L89
         bool suppress_nst;   // non-speech tokens, ref: https://github.com/openai/whisper/blob/7858aa9c08d98f75575035ecd6481f462d66ca27/whisper/tokenizer.py#L224-L253
@@ -544,6 +989,14 @@ extern "C" {
         float entropy_thold;    // similar to OpenAI's "compression_ratio_threshold"
         float logprob_thold;
         float no_speech_thold;
+        int   repeat_max;       // [EXPERIMENTAL] a decoder fails as soon as its text ends with more than repeat_max copies of
+                                // a block of 1 to 32 tokens, spanning at least 32 tokens (0 = disabled)
+
+        // [EXPERIMENTAL] with greedy sampling, the best_of decoders of the first fallback temperature are decoded in the
+        // same batches as the decoder of the first temperature, sharing its prompt. their result is used when the first
+        // temperature fails the checks above and is discarded as soon as it passes them. trades the spare batch capacity
+        // of the decoder for a lower latency on hard audio. not used with beam search, a draft model or sample_on_device
+        bool fallback_parallel;
 
         struct {
             int best_of;    // ref: https://github.com/openai/whisper/blob/f82bc59f5ea234d4b97fb2860842ed38519f7e65/whisper/transcribe.py#L264
@@ -552,7 +1005,7 @@ extern "C" {
         struct {
             int beam_size;  // ref: https://github.com/openai/whisper/blob/f82bc59f5ea234d4b97fb2860842ed38519f7e65/whisper/transcribe.py#L265
 
-            float patience; // TODO: not implemented, ref: https://arxiv.org/pdf/2204.05424.pdf
+            float patience; // stop once round(beam_size*patience) beams have completed (<= 0 - wait for all), ref: https://arxiv.org/pdf/2204.05424.pdf
         } beam_search;
 
         // called for every newly generated text segment
@@ -563,6 +1016,15 @@ extern "C" {
         whisper_progress_callback progress_callback;
         void * progress_callback_user_data;
 
+        // [EXPERIMENTAL] call new_segment_callback and progress_callback from a separate thread, so that a slow consumer
+        // does not stall the decoding. the new segments are copied into a queue of up to callback_queue_size events
+        // (0 - 64), the events that do not fit are merged and queued later, the decoding never waits for the callbacks.
+        // the callbacks get a view state that holds the segments delivered so far, only the whisper_full_*_from_state()
+        // getters of the segments, the tokens and the language can be used with it. whisper_full() returns after the
+        // last callback. not used by whisper_full_parallel() and whisper_full_chunked()
+        bool callback_async;
+        int  callback_queue_size;
+
         // called each time before the encoder starts
         whisper_encoder_begin_callback encoder_begin_callback;
         void * encoder_begin_callback_user_data;
@@ -580,6 +1042,64 @@ extern "C" {
         size_t                           i_start_rule;
         float                            grammar_penalty;
 
+        // [EXPERIMENTAL] speculative decoding
+        // a smaller model with the same vocabulary proposes up to draft_n_tokens tokens at a time, which are then
+        // verified by a single decoder pass of the model. the output is the same as without a draft model, up to the
+        // floating-point differences of the batched evaluation
+        // used only for greedy sampling at temperature 0 without grammar and logits_filter_callback
+        // the draft reuses the encoder output of the model when the audio dimensions match
+        struct whisper_context * draft_ctx;
+        int                      draft_n_tokens;
+
+        // [EXPERIMENTAL] whisper_full_parallel() moves each split point to the quietest moment within split_search_ms
+        // of the even split (to the nearest pause between speech segments when vad is enabled). each chunk after the
+        // first starts split_overlap_ms earlier, and its segments that repeat the end of the previous chunk are dropped
+        int split_search_ms;
+        int split_overlap_ms;
+
+        // [EXPERIMENTAL] whisper_full_parallel() splits the audio in jobs of about split_chunk_ms, which the processors
+        // take from a shared queue as soon as they are done with the previous one (0 - one job per processor)
+        int split_chunk_ms;
+
+        // [EXPERIMENTAL] when vad is enabled, the detected speech is transcribed in chunks of at least vad_chunk_ms,
+        // while VAD is still running on the rest of the audio on a separate thread (0 - VAD before any encoding)
+        // not used together with offset_ms, duration_ms and detect_language
+        int vad_chunk_ms;
+
+        // [EXPERIMENTAL] the log mel spectrogram is computed in chunks of about mel_lazy_ms (at least 30 s) just ahead of
+        // the encoded windows, instead of for the whole audio before the first window, so the memory of the spectrogram
+        // does not grow with the length of the audio. the frames are the same (0 - off)
+        int mel_lazy_ms;
+
+        // [EXPERIMENTAL] early exit for the audio windows without speech
+        //  - silence_thold:        a window that stays this many dB below the loudest part of the audio is skipped
+        //                          without being encoded (0 - off)
+        //  - no_speech_skip_thold: a window with a no_speech probability above this value after the prompt decode is
+        //                          skipped without generating any tokens or falling back to higher temperatures (1.0 - off)
+        float silence_thold;
+        float no_speech_skip_thold;
+
+        // [EXPERIMENTAL] called for each provisional token while a window is decoded
+        whisper_new_token_callback new_token_callback;
+        void * new_token_callback_user_data;
+
+        // [EXPERIMENTAL] called where the transcription can pause, to give the device to other states
+        whisper_yield_callback yield_callback;
+        void * yield_callback_user_data;
+
+        // [EXPERIMENTAL] write the input audio to <capture_path>.pcm (raw f32), and the parameters, the model and the
+        // decisions of each window (temperature fallbacks and their reasons, seek deltas, KV cache sizes) to
+        // <capture_path>.json at the end of the call, so that it can be replayed with whisper-replay (NULL - off)
+        // the callbacks, the grammar and the draft model are not captured. not used by whisper_full_parallel()
+        const char * capture_path;
+
+        // [EXPERIMENTAL] the encoder output (the cross-attention memory) of each encoded window is appended to the file
+        // encoder_cache_path, and the windows already in it are not encoded again, so the same audio can be decoded
+        // again with another prompt, language, grammar or sampling without running the encoder. the windows are found by
+        // their log mel spectrogram, any audio can be added to the file. a file written for another model, flash_attn or
+        // type_k / type_v is replaced. not used with a draft model, one process at a time (NULL - off)
+        const char * encoder_cache_path;
+
         // Voice Activity Detection (VAD) params
         bool         vad;                         // Enable VAD
         const char * vad_model_path;              // Path to VAD model
@@ -594,6 +1114,10 @@ extern "C" {
     WHISPER_API struct whisper_full_params * whisper_full_default_params_by_ref(enum whisper_sampling_strategy strategy);
     WHISPER_API struct whisper_full_params   whisper_full_default_params       (enum whisper_sampling_strategy strategy);
 
+    // sizes of the params structs, for the bindings that mirror their layout (e.g. JNA)
+    WHISPER_API size_t whisper_context_params_size(void);
+    WHISPER_API size_t whisper_full_params_size   (void);
+
     // Run the entire model: PCM -> log mel spectrogram -> encoder -> decoder -> text
     // Not thread safe for same context
     // Uses the specified decoding strategy to obtain the text.
@@ -610,6 +1134,41 @@ extern "C" {
                            const float * samples,
                                    int   n_samples);
 
+    // [EXPERIMENTAL] Same as whisper_full(), but reads the audio directly from the buffer of the caller:
+    //   - whisper_full_s16: 16-bit signed PCM, scaled by 1/32768
+    //   - whisper_full_strided: float PCM where consecutive samples are `stride` elements apart
+    // stride is in samples (1 for mono, e.g. 2 to transcribe one channel of interleaved stereo)
+    // No converted or padded copy of the input is made
+    WHISPER_API int whisper_full_s16(
+                struct whisper_context * ctx,
+            struct whisper_full_params   params,
+                         const int16_t * samples,
+                                   int   n_samples,
+                                   int   stride);
+
+    WHISPER_API int whisper_full_s16_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+                         const int16_t * samples,
+                                   int   n_samples,
+                                   int   stride);
+
+    WHISPER_API int whisper_full_strided(
+                struct whisper_context * ctx,
+            struct whisper_full_params   params,
+                           const float * samples,
+                                   int   n_samples,
+                                   int   stride);
+
+    WHISPER_API int whisper_full_strided_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+                           const float * samples,
+                                   int   n_samples,
+                                   int   stride);
+
     // Split the input audio in chunks and process each chunk separately using whisper_full_with_state()
     // Result is stored in the default state of the context
     // Not thread safe if executed in parallel on the same context.
@@ -622,6 +1181,169 @@ extern "C" {
                                    int   n_samples,
                                    int   n_processors);
 
+    // Same as whisper_full_parallel(), but the first chunk is processed with the provided state and the results of
+    // all chunks are combined into it. Thread safe as long as each call uses a separate state.
+    WHISPER_API int whisper_full_parallel_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+                           const float * samples,
+                                   int   n_samples,
+                                   int   n_processors);
+
+    // [EXPERIMENTAL] The boundaries of n_chunks chunks of the audio after params.offset_ms, in samples, placed as
+    // whisper_full_parallel() places them (see split_search_ms): in the nearest pause between speech segments when vad
+    // is enabled, otherwise at the quietest moment near the even split points. bounds receives n_chunks + 1 values,
+    // the first one at the offset and the last one n_samples. The state only holds the VAD context
+    // Returns 0 on success
+    WHISPER_API int whisper_split_audio_with_state(
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+                           const float * samples,
+                                   int   n_samples,
+                                   int   n_chunks,
+                                   int * bounds);
+
+    // Called when whisper_full_batch() is done with input i_input, result is the return value of whisper_full_with_state()
+    // The results of the input can be read from the provided state, which is reused for another input after the return
+    // Called from the thread that processed the input
+    typedef void (*whisper_batch_callback)(struct whisper_context * ctx, struct whisper_state * state, int i_input, int result, void * user_data);
+
+    // [EXPERIMENTAL] Process n_inputs separate audio inputs with n_processors states, each taking the next input as soon
+    // as it is done with the previous one. The new segment and progress callbacks of params are not used
+    // Returns 0 if all inputs have been processed successfully
+    WHISPER_API int whisper_full_batch(
+                struct whisper_context * ctx,
+            struct whisper_full_params   params,
+                    const float * const * samples,
+                             const int * n_samples,
+                                   int   n_inputs,
+                                   int   n_processors,
+                whisper_batch_callback   callback,
+                                  void * user_data);
+
+    // [EXPERIMENTAL] Process n_inputs separate audio inputs at the same time, input i with states[i], one thread per input
+    // The first windows of the inputs are encoded together with whisper_encode_batch_with_state(), in batches of up to 8
+    // inputs that use the same audio_ctx, so short clips share the encoder passes. The batched encoding needs a language
+    // other than "auto" and is not used with VAD, offset_ms, duration_ms or a draft model
+    // The results of input i can be read from states[i]. The new segment and progress callbacks of params are not used
+    // Returns 0 if all inputs have been processed successfully
+    WHISPER_API int whisper_full_batch_with_states(
+                struct whisper_context * ctx,
+                 struct whisper_state ** states,
+            struct whisper_full_params   params,
+                    const float * const * samples,
+                             const int * n_samples,
+                                   int   n_inputs,
+                whisper_batch_callback   callback,
+                                  void * user_data);
+
+    // [EXPERIMENTAL] Transcribes long audio as independent 30 s windows, with a stride of 30 s - split_overlap_ms
+    // The windows are transcribed n_batch at a time with whisper_full_batch_with_states(), without the text of the
+    // previous window as prompt. A segment is kept by the window that holds its center and the repeats in the overlaps
+    // are dropped. The results and the callbacks are reported through the provided state, in the order of the audio
+    // Without a language, the first window is transcribed alone and its language is used for the others
+    // Not used with detect_language, VAD or a draft model, whisper_full_with_state() is called instead
+    WHISPER_API int whisper_full_chunked_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+                           const float * samples,
+                                   int   n_samples,
+                                   int   n_batch);
+
+    WHISPER_API int whisper_full_chunked(
+                struct whisper_context * ctx,
+            struct whisper_full_params   params,
+                           const float * samples,
+                                   int   n_samples,
+                                   int   n_batch);
+
+    // [EXPERIMENTAL] Transcribes each channel of multichannel audio on its own, e.g. the two speakers of a stereo call
+    // recording. The channels are processed at the same time with whisper_full_batch_with_states(), channel 0 with the
+    // provided state and the others with new states, so their first windows share the encoder passes
+    // channels[c] holds the n_samples samples of channel c. The results are reported through the provided state, with
+    // the channel of each segment in whisper_full_get_segment_channel(). With interleave, the segments of all channels
+    // are ordered by their start time, otherwise the segments of channel 0 come first, then those of channel 1, ...
+    // The new segment callback is called once all channels are done, the progress callback is not used
+    WHISPER_API int whisper_full_multichannel_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+                    const float * const * channels,
+                                   int   n_channels,
+                                   int   n_samples,
+                                  bool   interleave);
+
+    WHISPER_API int whisper_full_multichannel(
+                struct whisper_context * ctx,
+            struct whisper_full_params   params,
+                    const float * const * channels,
+                                   int   n_channels,
+                                   int   n_samples,
+                                  bool   interleave);
+
+    // [EXPERIMENTAL] Confidence-gated model cascade: the audio is first transcribed with a fast model and only the
+    // segments it is not sure about are transcribed again with a large one
+    typedef struct whisper_cascade_params {
+        float logprob_thold;   // a segment is flagged if the average log probability of its text tokens is lower
+        float token_p_thold;   // ... if one of its text tokens is less probable than this (0 - off)
+        float no_speech_thold; // ... or if the no speech probability of its window is higher
+        int   merge_ms;        // flagged segments closer than this are transcribed together, with the segments between them
+    } whisper_cascade_params;
+
+    WHISPER_API struct whisper_cascade_params whisper_cascade_default_params(void);
+
+    // Transcribes the flagged segments of the last whisper_full*() call on state again with ctx_large and state_large,
+    // and replaces them in the results of state. samples must be the audio of that call. Each run of flagged segments
+    // is transcribed on its own, with the text before it as prompt, in the language of the first pass and without VAD:
+    // the ranges come from the segments, which already skip what VAD found to be silence
+    // The models must share the text tokens: both multilingual or both English-only
+    // The new segment and progress callbacks are not called. Returns the number of flagged segments, or < 0 on error
+    WHISPER_API int whisper_full_cascade_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+                struct whisper_context * ctx_large,
+                  struct whisper_state * state_large,
+            struct whisper_full_params   params,
+        struct whisper_cascade_params    cparams,
+                           const float * samples,
+                                   int   n_samples);
+
+    WHISPER_API int whisper_full_cascade(
+                struct whisper_context * ctx,
+                struct whisper_context * ctx_large,
+            struct whisper_full_params   params,
+        struct whisper_cascade_params    cparams,
+                           const float * samples,
+                                   int   n_samples);
+
+    // Fills dst with up to n_max samples of 16 kHz mono audio
+    // Returns the number of samples read, 0 at the end of the audio or < 0 on error
+    typedef int (*whisper_pcm_reader)(float * dst, int n_max, void * user_data);
+
+    // [EXPERIMENTAL] Process audio pulled through a reader, with a memory use that does not grow with its length
+    // The audio is read and processed in chunks of about chunk_ms (at least 30 s), cut at the quietest moment within
+    // split_search_ms of the end of the chunk. Each chunk is processed with whisper_full_with_state(), so the mel
+    // spectrogram, the VAD and the token timestamps only cover the chunk, and its text is the context of the next one
+    // The segments are passed to new_segment_callback with the timestamps of the whole audio and dropped when the next
+    // chunk is done, the state only holds the segments of the last chunk at the end. The progress callback is not used
+    // Returns 0 on success, -1 if the reader has failed, or the error of whisper_full_with_state()
+    WHISPER_API int whisper_full_reader(
+                struct whisper_context * ctx,
+            struct whisper_full_params   params,
+                                   int   chunk_ms,
+                    whisper_pcm_reader   reader,
+                                  void * user_data);
+
+    WHISPER_API int whisper_full_reader_with_state(
+                struct whisper_context * ctx,
+                  struct whisper_state * state,
+            struct whisper_full_params   params,
+                                   int   chunk_ms,
+                    whisper_pcm_reader   reader,
+                                  void * user_data);
+
     // Number of generated text segments
     // A segment can be a few words, a sentence, or even a paragraph.
     WHISPER_API int whisper_full_n_segments           (struct whisper_context * ctx);
@@ -644,6 +1366,10 @@ extern "C" {
     WHISPER_API bool whisper_full_get_segment_speaker_turn_next(struct whisper_context * ctx, int i_segment);
     WHISPER_API bool whisper_full_get_segment_speaker_turn_next_from_state(struct whisper_state * state, int i_segment);
 
+    // Get the input channel of the specified segment after whisper_full_multichannel(), 0 for the other calls
+    WHISPER_API int whisper_full_get_segment_channel(struct whisper_context * ctx, int i_segment);
+    WHISPER_API int whisper_full_get_segment_channel_from_state(struct whisper_state * state, int i_segment);
+
     // Get the text of the specified segment
     WHISPER_API const char * whisper_full_get_segment_text           (struct whisper_context * ctx, int i_segment);
     WHISPER_API const char * whisper_full_get_segment_text_from_state(struct whisper_state * state, int i_segment);
@@ -668,6 +1394,129 @@ extern "C" {
     WHISPER_API float whisper_full_get_token_p           (struct whisper_context * ctx, int i_segment, int i_token);
     WHISPER_API float whisper_full_get_token_p_from_state(struct whisper_state * state, int i_segment, int i_token);
 
+    // [EXPERIMENTAL] All the segments and tokens of the results in one call, for the bindings where each native call
+    // is costly (JNA, cgo, ...). The tokens of segment i are tokens[segments[i].i_token, + segments[i].n_tokens)
+    // The texts are owned by the context and the state, and valid until the next whisper_full() with the state
+    struct whisper_segment_data {
+        int64_t t0;
+        int64_t t1;
+
+        const char * text;
+
+        int32_t i_token;
+        int32_t n_tokens;
+
+        float no_speech_prob;
+        bool  speaker_turn_next;
+    };
+
+    // Total number of tokens of all the segments
+    WHISPER_API int whisper_full_n_tokens_all           (struct whisper_context * ctx);
+    WHISPER_API int whisper_full_n_tokens_all_from_state(struct whisper_state * state);
+
+    // Fills segments[0, n_segments) and, if tokens is not NULL, tokens[0, n_tokens)
+    // token_texts can be NULL, otherwise it receives the text of each token
+    // Returns 0 on success, -1 if the arrays are smaller than whisper_full_n_segments() / whisper_full_n_tokens_all()
+    WHISPER_API int whisper_full_get_segments(
+            struct whisper_context * ctx,
+       struct whisper_segment_data * segments,
+                               int   n_segments,
+                whisper_token_data * tokens,
+                      const char  ** token_texts,
+                               int   n_tokens);
+
+    WHISPER_API int whisper_full_get_segments_from_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+       struct whisper_segment_data * segments,
+                               int   n_segments,
+                whisper_token_data * tokens,
+                      const char  ** token_texts,
+                               int   n_tokens);
+
+    // [EXPERIMENTAL] All the results copied to one contiguous buffer, as arrays that follow this header in the buffer
+    // The texts of the segments and of the tokens are nul-terminated strings in text_data, at the given offsets
+    // Unlike whisper_full_get_segments(), the buffer stays valid after the next whisper_full() and can be freed at once
+    struct whisper_full_export_data {
+        int32_t n_segments;
+        int32_t n_tokens;
+        int32_t n_text_data; // bytes
+
+        // [n_segments]
+        const int64_t * t0;
+        const int64_t * t1;
+        const int32_t * text;             // offset in text_data
+        const int32_t * i_token;          // the tokens of segment i are tokens[i_token[i], + n_tokens_segment[i])
+        const int32_t * n_tokens_segment;
+        const float   * no_speech_prob;
+        const int8_t  * speaker_turn_next;
+
+        // [n_tokens]
+        const whisper_token_data * tokens;
+        const int32_t            * token_text; // offset in text_data
+
+        const char * text_data;
+    };
+
+    // Returns the size of the export in bytes, and writes it to buffer (aligned to 8 bytes) if size is large enough
+    // Call it with a NULL buffer first to get the size to allocate
+    WHISPER_API size_t whisper_full_export(
+            struct whisper_context * ctx,
+                              void * buffer,
+                            size_t   size);
+
+    WHISPER_API size_t whisper_full_export_from_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+                              void * buffer,
+                            size_t   size);
+
+    // [EXPERIMENTAL] Scoring of a fixed set of commands (keywords, phrases) against the audio
+    // The commands are tokenized once into a token trie. Each scoring encodes the audio, decodes the prompt and then
+    // evaluates the tokens of all commands in a single batched decode, where the commands that share a prefix share its
+    // cells in the KV cache. There is no sampling: the log probability of a command is the sum of the log probabilities
+    // of its tokens, normalized over the text tokens, and p is the softmax of these over the commands
+    struct whisper_commands;
+
+    struct whisper_command_score {
+        int   id;      // index of the command in whisper_commands_init()
+        float p;       // probability among the commands
+        float logprob; // log probability of the tokens of the command
+    };
+
+    // Returns NULL on failure, e.g. a command without any token
+    WHISPER_API struct whisper_commands * whisper_commands_init(
+            struct whisper_context * ctx,
+                       const char ** commands,
+                               int   n_commands);
+
+    WHISPER_API void whisper_commands_free(struct whisper_commands * commands);
+
+    WHISPER_API int whisper_commands_n       (const struct whisper_commands * commands);
+    WHISPER_API int whisper_commands_n_tokens(const struct whisper_commands * commands, int i_command);
+
+    // Scores the commands against the first 30 seconds of samples. The prompt (prompt_tokens / initial_prompt), the
+    // language, translate, no_timestamps, audio_ctx, audio_ctx_auto, enc_reuse_ms, n_threads and abort_callback of params
+    // are used, the rest is ignored
+    // scores must have room for whisper_commands_n() entries and is sorted by decreasing probability
+    // Returns 0 on success
+    WHISPER_API int whisper_commands_score(
+            struct whisper_context * ctx,
+      const struct whisper_commands * commands,
+        struct whisper_full_params   params,
+                       const float * samples,
+                               int   n_samples,
+      struct whisper_command_score * scores);
+
+    WHISPER_API int whisper_commands_score_with_state(
+            struct whisper_context * ctx,
+              struct whisper_state * state,
+      const struct whisper_commands * commands,
+        struct whisper_full_params   params,
+                       const float * samples,
+                               int   n_samples,
+      struct whisper_command_score * scores);
+
     //
     // Voice Activity Detection (VAD)
     //
@@ -707,14 +1556,145 @@ extern "C" {
                            const float * samples,
                                    int   n_samples);
 
+    // Called for each speech segment as soon as it is final, start and end are in seconds
+    typedef void (*whisper_vad_segment_callback)(float t0, float t1, void * user_data);
+
+    // Same as whisper_vad_segments_from_samples(), but the segments are also passed to the callback while the rest
+    // of the audio is still being processed
+    WHISPER_API struct whisper_vad_segments * whisper_vad_segments_from_samples_with_callback(
+            struct whisper_vad_context * vctx,
+            struct whisper_vad_params    params,
+                           const float * samples,
+                                   int   n_samples,
+          whisper_vad_segment_callback   callback,
+                                  void * user_data);
+
     WHISPER_API int whisper_vad_segments_n_segments(struct whisper_vad_segments * segments);
 
     WHISPER_API float whisper_vad_segments_get_segment_t0(struct whisper_vad_segments * segments, int i_segment);
     WHISPER_API float whisper_vad_segments_get_segment_t1(struct whisper_vad_segments * segments, int i_segment);
 
+    // [EXPERIMENTAL] Streaming VAD
+    // The audio passed to whisper_vad_feed() is evaluated as soon as it fills whole windows - the LSTM state and the
+    // remaining samples are kept for the next call. A speech start is reported once the speech has lasted
+    // min_speech_duration_ms and a speech end once the silence has lasted min_silence_duration_ms, which bounds the
+    // latency of the events. whisper_vad_detect_speech() resets the stream
+    typedef struct whisper_vad_event {
+        bool  speech; // true - the speech starts, false - the speech ends
+        float t;      // seconds from the start of the stream, including the speech_pad_ms padding
+    } whisper_vad_event;
+
+    WHISPER_API void whisper_vad_stream_reset(struct whisper_vad_context * vctx);
+
+    // Returns the number of new events or -1 on failure
+    WHISPER_API int whisper_vad_feed(
+            struct whisper_vad_context * vctx,
+            struct whisper_vad_params    params,
+                           const float * samples,
+                                   int   n_samples);
+
+    // The events of the last whisper_vad_feed() call
+    WHISPER_API struct whisper_vad_event whisper_vad_get_event(struct whisper_vad_context * vctx, int i_event);
+
+    // Whether the stream is in speech after the last whisper_vad_feed() call
+    WHISPER_API bool whisper_vad_in_speech(struct whisper_vad_context * vctx);
+
     WHISPER_API void whisper_vad_free_segments(struct whisper_vad_segments * segments);
     WHISPER_API void whisper_vad_free         (struct whisper_vad_context  * ctx);
 
+    // [EXPERIMENTAL] Streaming transcription session
+    // The stream keeps the log mel spectrogram of a rolling window of the input (see whisper_pcm_to_mel_stream) and
+    // runs the inference only on the part of the window that is not committed yet. The tokens of each inference are
+    // compared with the previous n_agree - 1 inferences and the common prefix is committed (local agreement), the rest
+    // is unstable and can still change. The audio of the committed segments is dropped from the decoded range and their
+    // text becomes the prompt of the next inferences.
+    // Without vctx, the inference runs every step_ms of new audio. With vctx, it runs every step_ms during the speech
+    // and once more at the end of each speech, which commits the whole utterance - the silence is not transcribed.
+    struct whisper_stream;
+
+    typedef struct whisper_stream_params {
+        // params of each inference - offset_ms, duration_ms, no_context, prompt_tokens and the output options are
+        // set by the stream. initial_prompt is the prompt of the first inference
+        struct whisper_full_params full_params;
+
+        int step_ms;   // run the inference after this much new audio
+        int length_ms; // length of the window (<= 30000), the oldest segment is committed before it leaves the window
+        int n_agree;   // number of consecutive inferences that must agree on a token to commit it
+
+        struct whisper_vad_context * vctx; // optional, not owned by the stream
+        struct whisper_vad_params    vad_params;
+
+        // [EXPERIMENTAL] governor of the inferences: their number of threads adapts, between n_threads_min and
+        // full_params.n_threads, so that an inference takes about target_rtf*step_ms. Fewer threads during the easy
+        // parts of the input save power. The threads are the ones of a persistent threadpool of the stream, without
+        // busy-waiting. With fit_audio_ctx, an inference that is too slow with all the threads encodes only the audio
+        // it decodes instead of the 30 s window (see full_params.audio_ctx), which is faster and slightly less accurate
+        float target_rtf;    // 0 = off
+        int   n_threads_min;
+        bool  fit_audio_ctx;
+    } whisper_stream_params;
+
+    WHISPER_API struct whisper_stream_params whisper_stream_default_params(enum whisper_sampling_strategy strategy);
+
+    // The stream has its own whisper_state. Returns NULL on failure
+    WHISPER_API struct whisper_stream * whisper_stream_init(struct whisper_context * ctx, struct whisper_stream_params params);
+    WHISPER_API void                    whisper_stream_free(struct whisper_stream * stream);
+
+    // Append new audio
+    // Returns 1 if an inference ran (the committed and the unstable text may have changed), 0 if not, -1 on failure
+    WHISPER_API int whisper_stream_feed(struct whisper_stream * stream, const float * samples, int n_samples);
+
+    // Transcribe and commit all remaining audio, e.g. at the end of the input. Returns 0 on success
+    WHISPER_API int whisper_stream_flush(struct whisper_stream * stream);
+
+    // Drop the audio, the text and the prompt of the stream
+    WHISPER_API void whisper_stream_reset(struct whisper_stream * stream);
+
+    // The text committed by the last whisper_stream_feed() / whisper_stream_flush() call and the current unstable text
+    WHISPER_API const char * whisper_stream_get_committed(struct whisper_stream * stream);
+    WHISPER_API const char * whisper_stream_get_unstable (struct whisper_stream * stream);
+
+    // Seconds from the start of the stream up to which the audio is committed
+    WHISPER_API float whisper_stream_get_t_committed(struct whisper_stream * stream);
+
+    // The number of threads of the next inference and whether it fits audio_ctx to its audio, see target_rtf
+    WHISPER_API int  whisper_stream_get_n_threads(struct whisper_stream * stream);
+    WHISPER_API bool whisper_stream_get_fit_audio_ctx(struct whisper_stream * stream);
+
+    ////////////////////////////////////////////////////////////////////////////
+
+    // [EXPERIMENTAL] Auto-tuning of the runtime parameters
+    // Times short runs of the encoder and of the decoder on silence for each candidate and returns the fastest
+    // configuration. The result is cached in a text file per (model, devices, CPU threads), so that the next startups
+    // with the same setup only read it
+    struct whisper_autotune_params {
+        int n_threads_max;  // largest number of threads tried, the candidates are the powers of 2 below it and itself (0 = hardware concurrency)
+        int n_batch_max;    // largest encoder batch tried (<= 8), see whisper_encode_batch_with_state (1 = no batching)
+        int n_runs;         // timed runs of each candidate, the median is used
+        int n_tokens;       // the decoder steps of a window, used to weigh the decoder time against the encoder time
+
+        bool try_flash_attn; // also time the other flash_attn setting, with a second context loaded from the model file
+
+        const char * cache_path; // NULL = no cache
+    };
+
+    struct whisper_autotune_result {
+        int  n_threads;
+        bool flash_attn;
+        int  n_batch;       // the number of inputs to encode together for the best encoder throughput
+
+        float t_encode_ms;  // one window with the chosen configuration
+        float t_decode_ms;  // one decoder step with the chosen configuration
+
+        bool from_cache;
+    };
+
+    WHISPER_API struct whisper_autotune_params whisper_autotune_default_params(void);
+
+    // The context must have been loaded from a file to try the other flash_attn setting
+    // Returns the configuration of the context with n_threads = 0 on failure
+    WHISPER_API struct whisper_autotune_result whisper_autotune(struct whisper_context * ctx, struct whisper_autotune_params params);
+
     ////////////////////////////////////////////////////////////////////////////
 
     // Temporary helpers needed for exposing ggml interface
@@ -731,6 +1711,20 @@ extern "C" {
     // Get the no_speech probability for the specified segment
     WHISPER_API float whisper_full_get_segment_no_speech_prob           (struct whisper_context * ctx, int i_segment);
     WHISPER_API float whisper_full_get_segment_no_speech_prob_from_state(struct whisper_state * state, int i_segment);
+
+    // [EXPERIMENTAL] The English translation of the last whisper_full() call with translate_also
+    // The segments of the translation are timed like the segments of the transcription, but do not match them one to one
+    WHISPER_API int whisper_full_n_translated_segments           (struct whisper_context * ctx);
+    WHISPER_API int whisper_full_n_translated_segments_from_state(struct whisper_state * state);
+
+    WHISPER_API int64_t whisper_full_get_translated_segment_t0           (struct whisper_context * ctx, int i_segment);
+    WHISPER_API int64_t whisper_full_get_translated_segment_t0_from_state(struct whisper_state * state, int i_segment);
+
+    WHISPER_API int64_t whisper_full_get_translated_segment_t1           (struct whisper_context * ctx, int i_segment);
+    WHISPER_API int64_t whisper_full_get_translated_segment_t1_from_state(struct whisper_state * state, int i_segment);
+
+    WHISPER_API const char * whisper_full_get_translated_segment_text           (struct whisper_context * ctx, int i_segment);
+    WHISPER_API const char * whisper_full_get_translated_segment_text_from_state(struct whisper_state * state, int i_segment);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,141 @@
+# Compress a Whisper model in the legacy ggml .bin format with zstd, for models that are downloaded over slow links
+#
+# Usage: python compress-ggml.py ./models/ggml-base.en-q5_0.bin ./models/ggml-base.en-q5_0.bin.zst [level]
+#
+# The model file is cut in frames at the tensor boundaries - the header (hparams, mel filters and vocab) and each
+# tensor, with the large tensors in pieces of 16 MB - and each frame is compressed on its own:
+#
+#  - u32 magic ("ggzs"), u32 version
+#  - for each frame: u32 compressed size, u32 size, zstd frame
+#  - u32 0, u32 0
+#
+# whisper.cpp built with -DWHISPER_ZSTD=ON loads the compressed file as it is, decompressing the frames on several
+# threads. The frames keep the order of the model file, so the encoder can be loaded before the decoder has arrived.
+#
+# The zstandard module is used if it is installed, otherwise the zstd command line tool.
+#
+
+import struct
+import subprocess
+import sys
+
+GGML_FILE_MAGIC = 0x67676d6c
+ZSTD_MAGIC      = 0x67677a73
+ZSTD_VERSION    = 1
+
+FRAME_SIZE = 16*1024*1024
+
+# ggml type -> (block size, type size)
+GGML_TYPE_SIZE = {
+     0: (  1,   4), # F32
+     1: (  1,   2), # F16
+     2: ( 32,  18), # Q4_0
+     3: ( 32,  20), # Q4_1
+     6: ( 32,  22), # Q5_0
+     7: ( 32,  24), # Q5_1
+     8: ( 32,  34), # Q8_0
+    10: (256,  84), # Q2_K
+    11: (256, 110), # Q3_K
+    12: (256, 144), # Q4_K
+    13: (256, 176), # Q5_K
+    14: (256, 210), # Q6_K
+    30: (  1,   2), # BF16
+}
+
+if len(sys.argv) < 3:
+    print("Usage: compress-ggml.py model.bin model.bin.zst [level]\n")
+    sys.exit(1)
+
+fname_inp = sys.argv[1]
+fname_out = sys.argv[2]
+level     = int(sys.argv[3]) if len(sys.argv) > 3 else 19
+
+try:
+    import zstandard
+
+    compressor = zstandard.ZstdCompressor(level=level)
+
+    def compress(data):
+        return compressor.compress(data)
+except ImportError:
+    def compress(data):
+        return subprocess.run(["zstd", "-q", "-c", "-%d" % level], input=data, stdout=subprocess.PIPE, check=True).stdout
+
+def read_i32(f):
+    return struct.unpack("<i", f.read(4))[0]
+
+fin = open(fname_inp, "rb")
+
+if struct.unpack("<I", fin.read(4))[0] != GGML_FILE_MAGIC:
+    print("Error: '%s' is not a ggml model file" % fname_inp)
+    sys.exit(1)
+
+# hparams, mel filters and vocab
+fin.seek(4*11, 1)
+
+n_mel = read_i32(fin)
+n_fft = read_i32(fin)
+fin.seek(4*n_mel*n_fft, 1)
+
+n_vocab = read_i32(fin)
+for i in range(n_vocab):
+    n = struct.unpack("<I", fin.read(4))[0]
+    fin.seek(n, 1)
+
+# the frame boundaries
+bounds = [0, fin.tell()]
+while True:
+    hdr = fin.read(12)
+    if len(hdr) < 12:
+        break
+
+    n_dims, length, ttype = struct.unpack("<iii", hdr)
+    ne = [read_i32(fin) for _ in range(n_dims)]
+    name = fin.read(length)
+
+    if ttype not in GGML_TYPE_SIZE:
+        print("Error: tensor '%s' has unsupported type %d" % (name.decode("utf-8"), ttype))
+        sys.exit(1)
+
+    blck_size, type_size = GGML_TYPE_SIZE[ttype]
+
+    n_elements = 1
+    for n in ne:
+        n_elements *= n
+
+    nbytes = n_elements // blck_size * type_size
+
+    end = fin.tell() + nbytes
+    while end - bounds[-1] > FRAME_SIZE:
+        bounds.append(bounds[-1] + FRAME_SIZE)
+    bounds.append(end)
+
+    fin.seek(nbytes, 1)
+
+fout = open(fname_out, "wb")
+fout.write(struct.pack("<II", ZSTD_MAGIC, ZSTD_VERSION))
+
+size_inp = 0
+size_out = 8
+for i in range(len(bounds) - 1):
+    fin.seek(bounds[i])
+    data = fin.read(bounds[i + 1] - bounds[i])
+    if len(data) != bounds[i + 1] - bounds[i]:
+        print("Error: unexpected end of file")
+        sys.exit(1)
+
+    frame = compress(data)
+    fout.write(struct.pack("<II", len(frame), len(data)))
+    fout.write(frame)
+
+    size_inp += len(data)
+    size_out += 8 + len(frame)
+
+fout.write(struct.pack("<II", 0, 0))
+
+fout.close()
+fin.close()
+
+print("frames: %d, %.2f MB -> %.2f MB" % (len(bounds) - 1, size_inp/1e6, (size_out + 8)/1e6))
+print("Done. Output file: ", fname_out)
+print("")
@@ -0,0 +1,195 @@
+# Convert a Whisper model from the legacy ggml .bin format to the GGUF container
+#
+# Usage: python convert-ggml-to-gguf.py ./models/ggml-medium.bin ./models/ggml-medium.gguf [alignment]
+#
+# The legacy format interleaves the per-tensor headers with the tensor data, so the data is not aligned
+# and the weights cannot be used directly from a memory mapping of the file. The GGUF container written
+# by this script stores:
+#
+#  - hparams           as whisper.* KV pairs
+#  - mel filters       as whisper.mel_filters.* KV pairs
+#  - tokenizer vocab   as the tokenizer.ggml.tokens string array
+#  - model variables   as GGUF tensors, with the data aligned to `alignment` bytes (default: 32)
+#
+# Any tensor type (including quantized models) is copied as-is. Only the standard library is needed.
+#
+
+import struct
+import sys
+
+GGML_FILE_MAGIC = 0x67676d6c
+
+GGUF_VERSION = 3
+GGUF_DEFAULT_ALIGNMENT = 32
+
+GGUF_TYPE_UINT32  = 4
+GGUF_TYPE_INT32   = 5
+GGUF_TYPE_FLOAT32 = 6
+GGUF_TYPE_STRING  = 8
+GGUF_TYPE_ARRAY   = 9
+
+# ggml type -> (block size, type size)
+GGML_TYPE_SIZE = {
+     0: (  1,   4), # F32
+     1: (  1,   2), # F16
+     2: ( 32,  18), # Q4_0
+     3: ( 32,  20), # Q4_1
+     6: ( 32,  22), # Q5_0
+     7: ( 32,  24), # Q5_1
+     8: ( 32,  34), # Q8_0
+    10: (256,  84), # Q2_K
+    11: (256, 110), # Q3_K
+    12: (256, 144), # Q4_K
+    13: (256, 176), # Q5_K
+    14: (256, 210), # Q6_K
+    30: (  1,   2), # BF16
+}
+
+HPARAMS = [
+    "n_vocab",
+    "n_audio_ctx",
+    "n_audio_state",
+    "n_audio_head",
+    "n_audio_layer",
+    "n_text_ctx",
+    "n_text_state",
+    "n_text_head",
+    "n_text_layer",
+    "n_mels",
+    "ftype",
+]
+
+if len(sys.argv) < 3:
+    print("Usage: convert-ggml-to-gguf.py model.bin model.gguf [alignment]\n")
+    sys.exit(1)
+
+fname_inp = sys.argv[1]
+fname_out = sys.argv[2]
+alignment = int(sys.argv[3]) if len(sys.argv) > 3 else GGUF_DEFAULT_ALIGNMENT
+
+if alignment <= 0 or alignment % 8 != 0:
+    print("Error: the alignment must be a positive multiple of 8")
+    sys.exit(1)
+
+def read_i32(f):
+    return struct.unpack("<i", f.read(4))[0]
+
+def pad(n):
+    return (n + alignment - 1) // alignment * alignment
+
+fin = open(fname_inp, "rb")
+
+if struct.unpack("<I", fin.read(4))[0] != GGML_FILE_MAGIC:
+    print("Error: '%s' is not a ggml model file" % fname_inp)
+    sys.exit(1)
+
+hparams = { name: read_i32(fin) for name in HPARAMS }
+print("hparams:", hparams)
+
+n_mel = read_i32(fin)
+n_fft = read_i32(fin)
+filters = fin.read(4*n_mel*n_fft)
+
+n_vocab = read_i32(fin)
+tokens = []
+for i in range(n_vocab):
+    n = struct.unpack("<I", fin.read(4))[0]
+    tokens.append(fin.read(n))
+
+# scan the tensor headers, the data is copied later
+tensors = []
+while True:
+    hdr = fin.read(12)
+    if len(hdr) < 12:
+        break
+
+    n_dims, length, ttype = struct.unpack("<iii", hdr)
+    ne = [read_i32(fin) for _ in range(n_dims)]
+    name = fin.read(length)
+
+    if ttype not in GGML_TYPE_SIZE:
+        print("Error: tensor '%s' has unsupported type %d" % (name.decode("utf-8"), ttype))
+        sys.exit(1)
+
+    blck_size, type_size = GGML_TYPE_SIZE[ttype]
+
+    n_elements = 1
+    for n in ne:
+        n_elements *= n
+
+    nbytes = n_elements // blck_size * type_size
+
+    tensors.append((name, ne, ttype, fin.tell(), nbytes))
+    fin.seek(nbytes, 1)
+
+print("tensors: %d" % len(tensors))
+
+def w_str(f, s):
+    f.write(struct.pack("<Q", len(s)))
+    f.write(s)
+
+def w_kv_i32(f, key, val):
+    w_str(f, key.encode("utf-8"))
+    f.write(struct.pack("<Ii", GGUF_TYPE_INT32, val))
+
+fout = open(fname_out, "wb")
+
+n_kv = 1 + len(HPARAMS) + 3 + 1 + (1 if alignment != GGUF_DEFAULT_ALIGNMENT else 0)
+
+fout.write(b"GGUF")
+fout.write(struct.pack("<IQQ", GGUF_VERSION, len(tensors), n_kv))
+
+w_str(fout, b"general.architecture")
+fout.write(struct.pack("<I", GGUF_TYPE_STRING))
+w_str(fout, b"whisper")
+
+if alignment != GGUF_DEFAULT_ALIGNMENT:
+    w_str(fout, b"general.alignment")
+    fout.write(struct.pack("<II", GGUF_TYPE_UINT32, alignment))
+
+for name in HPARAMS:
+    w_kv_i32(fout, "whisper." + name, hparams[name])
+
+w_kv_i32(fout, "whisper.mel_filters.n_mel", n_mel)
+w_kv_i32(fout, "whisper.mel_filters.n_fft", n_fft)
+
+w_str(fout, b"whisper.mel_filters")
+fout.write(struct.pack("<IIQ", GGUF_TYPE_ARRAY, GGUF_TYPE_FLOAT32, n_mel*n_fft))
+fout.write(filters)
+
+w_str(fout, b"tokenizer.ggml.tokens")
+fout.write(struct.pack("<IIQ", GGUF_TYPE_ARRAY, GGUF_TYPE_STRING, len(tokens)))
+for token in tokens:
+    w_str(fout, token)
+
+# tensor infos - the offsets are relative to the start of the aligned data section
+offset = 0
+for name, ne, ttype, _, nbytes in tensors:
+    w_str(fout, name)
+    fout.write(struct.pack("<I", len(ne)))
+    for n in ne:
+        fout.write(struct.pack("<Q", n))
+    fout.write(struct.pack("<IQ", ttype, offset))
+    offset += pad(nbytes)
+
+fout.write(b"\0" * (pad(fout.tell()) - fout.tell()))
+
+for name, _, _, data_offset, nbytes in tensors:
+    fin.seek(data_offset)
+
+    remaining = nbytes
+    while remaining > 0:
+        chunk = fin.read(min(remaining, 64*1024*1024))
+        if not chunk:
+            print("Error: unexpected end of file while reading tensor '%s'" % name.decode("utf-8"))
+            sys.exit(1)
+        fout.write(chunk)
+        remaining -= len(chunk)
+
+    fout.write(b"\0" * (pad(nbytes) - nbytes))
+
+fout.close()
+fin.close()
+
+print("Done. Output file: ", fname_out)
+print("")
@@ -0,0 +1,75 @@
+#pragma once
+
+// Entry points to internal helpers of whisper.cpp, for the tests, the micro benchmarks (whisper-microbench) and the
+// quantize tool
+// This is not part of the public API: the functions can change or go away without notice
+
+#include "whisper.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// real FFT of WHISPER_N_FFT samples with the plan used by the mel spectrogram
+// out receives WHISPER_N_FFT/2 + 1 complex values as (re, im) pairs
+WHISPER_API void whisper_internal_fft(const float * in, float * out);
+
+// the (not normalized) log10 mel frames [0, n_len) of the samples, with the filters of the model, on the calling thread
+// frame i is centered on sample i*WHISPER_HOP_LENGTH, mel receives n_mel rows of n_len values
+// returns n_mel
+WHISPER_API int whisper_internal_log_mel_frames(
+        struct whisper_context * ctx,
+                   const float * samples,
+                           int   n_samples,
+                           int   n_len,
+            std::vector<float> & mel);
+
+// the logprobs (log_softmax) and probs (softmax) of the logits of a decoder
+WHISPER_API void whisper_internal_compute_logprobs(
+                   const float * logits,
+                           int   n_logits,
+                         float * logprobs,
+                         float * probs);
+
+// the candidates of a beam search decoder for the next token, drawn from probs with a generator seeded with seed
+// probs and logprobs have n_vocab values, they are moved into the decoder for the call and moved back
+WHISPER_API void whisper_internal_sample_token_topk(
+        struct whisper_context * ctx,
+            std::vector<float> & probs,
+            std::vector<float> & logprobs,
+                           int   k,
+                      uint32_t   seed,
+std::vector<whisper_token_data> & result);
+
+// the DTW path through the cost matrix x, where x[i + j*n_tokens] is the cost of token i at frame j
+// path receives the (token, frame) pairs of the path
+WHISPER_API void whisper_internal_dtw(
+                   const float * x,
+                           int   n_tokens,
+                           int   n_frames,
+          std::vector<int32_t> & path);
+
+// mixed precision recipes of the quantize tool
+// the recipe of a model file is stored in the hundreds of its ftype: qntvr*GGML_QNT_VERSION_FACTOR + recipe*100 + ftype
+#define WHISPER_QUANT_RECIPE_FACTOR 100
+
+enum whisper_quant_recipe {
+    WHISPER_QUANT_RECIPE_NONE      = 0, // all the quantized weights have the type of the ftype
+    WHISPER_QUANT_RECIPE_MIX       = 1, // the token embedding and the first and last layers of encoder and decoder in Q8_0
+    WHISPER_QUANT_RECIPE_MIX_SMALL = 2, // MIX, and the MLPs of the other encoder layers one type below the ftype
+    WHISPER_QUANT_RECIPE_COUNT,
+};
+
+// the recipe with the given name ("mix", "mix-small"), or -1
+WHISPER_API int whisper_internal_quant_recipe_from_str(const char * name);
+
+WHISPER_API const char * whisper_internal_quant_recipe_name(int recipe);
+
+// the regexes of the names of the quantized weights with their own type, the first match wins
+// the weights that match none have wtype
+WHISPER_API std::vector<std::pair<std::string, ggml_type>> whisper_internal_quant_recipe(
+                           int   recipe,
+                     ggml_type   wtype,
+                           int   n_audio_layer,
+                           int   n_text_layer);
@@ -0,0 +1,197 @@
+"""WER and speed regression harness
+
+Runs whisper-cli over a fixed set of LibriSpeech files for every combination of
+models and decoding configurations, and records the WER, the real time factor,
+the stage times and the peak memory of each run into a JSON (and optionally CSV)
+file. When a baseline is given, the runs are compared with it and the script
+exits with 1 if any of them is worse than the tolerances.
+
+    $ python regress.py --models tiny,base.en-q5_1 --configs "greedy=,beam5=-bs 5" \\
+          --limit 200 --output results.json --baseline baseline.json
+"""
+
+import argparse
+import csv
+import glob
+import json
+import os
+import re
+import subprocess
+import sys
+import time
+
+import jiwer
+from normalizers import EnglishTextNormalizer
+
+TIMING_RE = re.compile(r'whisper_print_timings:\s+(\w+) time =\s+([\d.]+) ms')
+PROCESSING_RE = re.compile(r"processing '.*' \(\d+ samples, ([\d.]+) sec\)")
+
+# the metrics compared with the baseline, higher is worse for all of them
+METRICS = ['wer', 'rtf', 'encode_ms', 'decode_ms', 'peak_rss_mb']
+
+
+def get_reference():
+    ref = {}
+    for path in glob.glob('LibriSpeech/*/*/*/*.trans.txt'):
+        with open(path) as fp:
+            for line in fp:
+                code, text = line.strip().split(" ", maxsplit=1)
+                ref[code] = text
+    return ref
+
+
+def get_corpus(limit):
+    paths = sorted(glob.glob('LibriSpeech/*/*/*/*.flac'))
+    return paths[:limit] if limit > 0 else paths
+
+
+def parse_configs(spec):
+    """name=flags pairs separated by commas, e.g. "greedy=,beam5=-bs 5" """
+    configs = []
+    for item in spec.split(','):
+        name, _, flags = item.partition('=')
+        configs.append((name.strip(), flags.split()))
+    return configs
+
+
+def run(args, model, config_name, config_flags, corpus, ref, normalizer):
+    """transcribes the corpus with one whisper-cli process and returns the metrics of the run"""
+    outdir = os.path.join(args.workdir, model, config_name)
+    os.makedirs(outdir, exist_ok=True)
+
+    cmd = [args.whisper_cli, '--model', os.path.join(args.prefix, 'models', f'ggml-{model}.bin'),
+           '--language', 'en', '--output-txt'] + args.flags.split() + config_flags
+    for path in corpus:
+        code = os.path.basename(path).replace('.flac', '')
+        cmd += ['--file', path, '--output-file', os.path.join(outdir, code)]
+
+    t_start = time.monotonic()
+    proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+    stderr = proc.stderr.read()
+    _, status, rusage = os.wait4(proc.pid, 0)
+    wall_s = time.monotonic() - t_start
+
+    if os.waitstatus_to_exitcode(status) != 0:
+        sys.stderr.write(stderr)
+        raise RuntimeError(f'whisper-cli failed for {model} / {config_name}')
+
+    timings = {name: float(ms) for name, ms in TIMING_RE.findall(stderr)}
+    audio_s = sum(float(sec) for sec in PROCESSING_RE.findall(stderr))
+
+    refs = []
+    hyps = []
+    for path in corpus:
+        code = os.path.basename(path).replace('.flac', '')
+        with open(os.path.join(outdir, code + '.txt')) as fp:
+            hyps.append(normalizer(fp.read().strip()))
+        refs.append(normalizer(ref[code]))
+
+    # ru_maxrss is in KB on Linux and in bytes on macOS
+    rss_scale = 1.0 / 1024 / 1024 if sys.platform == 'darwin' else 1.0 / 1024
+
+    # the model loading is not part of the real time factor
+    process_s = wall_s - timings.get('load', 0.0) / 1000
+
+    return {
+        'model': model,
+        'config': config_name,
+        'flags': ' '.join(config_flags),
+        'n_files': len(corpus),
+        'audio_s': round(audio_s, 2),
+        'wer': round(100 * jiwer.wer(refs, hyps), 3),
+        'rtf': round(process_s / audio_s, 5) if audio_s > 0 else 0.0,
+        'load_ms': timings.get('load', 0.0),
+        'mel_ms': timings.get('mel', 0.0),
+        'encode_ms': timings.get('encode', 0.0),
+        'decode_ms': timings.get('decode', 0.0) + timings.get('batchd', 0.0) + timings.get('prompt', 0.0),
+        'sample_ms': timings.get('sample', 0.0),
+        'peak_rss_mb': round(rusage.ru_maxrss * rss_scale, 1),
+    }
+
+
+def compare(results, baseline, args):
+    """returns the regressions of results against baseline, as printable strings"""
+    base = {(r['model'], r['config']): r for r in baseline['runs']}
+
+    tolerances = {
+        'wer': lambda b: b + args.tol_wer,
+        'rtf': lambda b: b * (1 + args.tol_speed),
+        'encode_ms': lambda b: b * (1 + args.tol_speed),
+        'decode_ms': lambda b: b * (1 + args.tol_speed),
+        'peak_rss_mb': lambda b: b * (1 + args.tol_mem),
+    }
+
+    regressions = []
+    for r in results:
+        b = base.get((r['model'], r['config']))
+        if b is None:
+            continue
+        if b['n_files'] != r['n_files']:
+            regressions.append(f"{r['model']} / {r['config']}: {r['n_files']} files vs {b['n_files']} in the baseline")
+            continue
+        for m in METRICS:
+            if r[m] > tolerances[m](b[m]):
+                regressions.append(f"{r['model']} / {r['config']}: {m} = {r[m]} (baseline {b[m]})")
+
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--prefix', default='../../', help='root of the whisper.cpp tree')
+    parser.add_argument('--whisper-cli', default=None, help='whisper-cli binary (default: <prefix>/build/bin/whisper-cli)')
+    parser.add_argument('--models', default='tiny', help='comma-separated models, models/ggml-<model>.bin')
+    parser.add_argument('--configs', default='greedy=', help='comma-separated name=flags decoding configurations')
+    parser.add_argument('--flags', default='--threads 4', help='whisper-cli flags common to all the runs')
+    parser.add_argument('--limit', type=int, default=0, help='use the first N files of the corpus (0 = all)')
+    parser.add_argument('--workdir', default='regress', help='directory of the transcriptions')
+    parser.add_argument('--output', default='regress.json', help='JSON file of the results')
+    parser.add_argument('--csv', default=None, help='also write the results to this CSV file')
+    parser.add_argument('--baseline', default=None, help='JSON file of a previous run to compare with')
+    parser.add_argument('--tol-wer', type=float, default=0.3, help='allowed WER increase, in percentage points')
+    parser.add_argument('--tol-speed', type=float, default=0.10, help='allowed relative increase of the RTF and the stage times')
+    parser.add_argument('--tol-mem', type=float, default=0.05, help='allowed relative increase of the peak memory')
+    args = parser.parse_args()
+
+    if args.whisper_cli is None:
+        args.whisper_cli = os.path.join(args.prefix, 'build', 'bin', 'whisper-cli')
+
+    corpus = get_corpus(args.limit)
+    if not corpus:
+        sys.exit('no audio files, run "make get-audio" first')
+
+    ref = get_reference()
+    normalizer = EnglishTextNormalizer()
+
+    results = []
+    for model in args.models.split(','):
+        for config_name, config_flags in parse_configs(args.configs):
+            r = run(args, model, config_name, config_flags, corpus, ref, normalizer)
+            print(f"{model:>16} {config_name:>12}: WER {r['wer']:6.2f}%  RTF {r['rtf']:.4f}  "
+                  f"encode {r['encode_ms']:9.1f} ms  decode {r['decode_ms']:9.1f} ms  RSS {r['peak_rss_mb']:8.1f} MB")
+            results.append(r)
+
+    with open(args.output, 'w') as fp:
+        json.dump({'flags': args.flags, 'n_files': len(corpus), 'runs': results}, fp, indent=2)
+
+    if args.csv:
+        with open(args.csv, 'w', newline='') as fp:
+            writer = csv.DictWriter(fp, fieldnames=list(results[0].keys()))
+            writer.writeheader()
+            writer.writerows(results)
+
+    if args.baseline:
+        with open(args.baseline) as fp:
+            baseline = json.load(fp)
+
+        regressions = compare(results, baseline, args)
+        for line in regressions:
+            print(f'REGRESSION {line}')
+        if regressions:
+            sys.exit(1)
+
+        print(f'no regression against {args.baseline}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,150 @@
+// whisper_attn_tiled and whisper_attn_exp are static
+#include "whisper.cpp"
+
+#include "ggml-cpu.h"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+static const int D = 64;
+
+// the polynomial exp of the online softmax against exp in double precision, over the range of the shifted scores
+static void test_attn_exp() {
+    double max_rel = 0.0;
+
+    for (int i = 0; i <= 870000; ++i) {
+        const float x = -i*1e-4f;
+
+        const double ref = exp((double) x);
+        const double res = whisper_attn_exp(x);
+
+        max_rel = std::max(max_rel, std::fabs(res - ref)/ref);
+    }
+
+    if (max_rel > 1e-6) {
+        fprintf(stderr, "%s: max relative error = %g\n", __func__, max_rel);
+    }
+    assert(max_rel <= 1e-6);
+
+    // the scores far below the max do not contribute
+    assert(whisper_attn_exp(-100.0f) == 0.0f);
+    assert(whisper_attn_exp(-1e30f)  == 0.0f);
+}
+
+// softmax(Q*K^T/sqrt(D))*V of each head, in double precision
+static std::vector<double> attn_ref(const std::vector<float> & q, const std::vector<float> & k, const std::vector<float> & v, int n_head, int n_ctx, int n_batch) {
+    const int n_state = n_head*D;
+
+    std::vector<double> out(n_state*n_ctx*n_batch);
+    std::vector<double> s(n_ctx);
+
+    for (int b = 0; b < n_batch; ++b) {
+        for (int h = 0; h < n_head; ++h) {
+            for (int i = 0; i < n_ctx; ++i) {
+                const float * pq = q.data() + (b*n_ctx + i)*n_state + h*D;
+
+                double mx = -INFINITY;
+                for (int j = 0; j < n_ctx; ++j) {
+                    const float * pk = k.data() + (b*n_ctx + j)*n_state + h*D;
+
+                    double dot = 0.0;
+                    for (int c = 0; c < D; ++c) {
+                        dot += (double) pq[c]*pk[c];
+                    }
+                    s[j] = dot/sqrt((double) D);
+                    mx = std::max(mx, s[j]);
+                }
+
+                double sum = 0.0;
+                for (int j = 0; j < n_ctx; ++j) {
+                    s[j] = exp(s[j] - mx);
+                    sum += s[j];
+                }
+
+                double * po = out.data() + (b*n_ctx + i)*n_state + h*D;
+                for (int j = 0; j < n_ctx; ++j) {
+                    const float * pv = v.data() + (b*n_ctx + j)*n_state + h*D;
+                    for (int c = 0; c < D; ++c) {
+                        po[c] += s[j]/sum*pv[c];
+                    }
+                }
+            }
+        }
+    }
+
+    return out;
+}
+
+// the scores span several tens, as in the trained models, so that the softmax is far from uniform
+static void test_attn_tiled(int n_head, int n_ctx, int n_batch, int n_threads, std::mt19937 & rng) {
+    const int n_state = n_head*D;
+    const int n       = n_state*n_ctx*n_batch;
+
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+
+    std::vector<float> q(n), k(n), v(n);
+    for (int i = 0; i < n; ++i) {
+        q[i] = 1.5f*dist(rng);
+        k[i] = 1.5f*dist(rng);
+        v[i] = dist(rng);
+    }
+
+    ggml_init_params params = {
+        /*.mem_size   =*/ 4*n*sizeof(float) + 16*ggml_tensor_overhead() + ggml_graph_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ false,
+    };
+
+    ggml_context * ctx = ggml_init(params);
+
+    ggml_tensor * tq = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_state, n_ctx, n_batch);
+    ggml_tensor * tk = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_state, n_ctx, n_batch);
+    ggml_tensor * tv = ggml_new_tensor_3d(ctx, GGML_TYPE_F32, n_state, n_ctx, n_batch);
+
+    memcpy(tq->data, q.data(), n*sizeof(float));
+    memcpy(tk->data, k.data(), n*sizeof(float));
+    memcpy(tv->data, v.data(), n*sizeof(float));
+
+    ggml_tensor * out = whisper_attn_tiled(ctx, tq, tk, tv);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx);
+    ggml_build_forward_expand(gf, out);
+
+    assert(ggml_graph_compute_with_ctx(ctx, gf, n_threads) == GGML_STATUS_SUCCESS);
+
+    const std::vector<double> ref = attn_ref(q, k, v, n_head, n_ctx, n_batch);
+
+    double max_diff = 0.0;
+    for (int i = 0; i < n; ++i) {
+        max_diff = std::max(max_diff, std::fabs(((const float *) out->data)[i] - ref[i]));
+    }
+
+    // the outputs are weighted means of V, of the order of 1
+    if (max_diff > 1e-5) {
+        fprintf(stderr, "%s: n_head = %d, n_ctx = %d, n_batch = %d, max diff = %g\n", __func__, n_head, n_ctx, n_batch, max_diff);
+    }
+    assert(max_diff <= 1e-5);
+
+    ggml_free(ctx);
+}
+
+int main() {
+    std::mt19937 rng(42);
+
+    test_attn_exp();
+
+    // the contexts that are not a multiple of the tiles, a single tile, and the full context of the encoder
+    test_attn_tiled(2, 37,   2, 1, rng);
+    test_attn_tiled(3, 64,   1, 2, rng);
+    test_attn_tiled(1, 200,  2, 3, rng);
+    test_attn_tiled(6, 1500, 1, 4, rng);
+
+    return 0;
+}
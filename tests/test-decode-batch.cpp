@@ -0,0 +1,220 @@
+// the static functions and the internals of the context are used to fill the weights of the test model
+#include "whisper.cpp"
+
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+static const int n_states = 3;
+static const int n_steps  = 6;
+
+static const int n_audio_ctx = 64;
+
+struct sequence {
+    std::vector<whisper_token> prompt;
+    std::vector<whisper_token> steps;
+};
+
+// the test models hold no weights - they are filled with small random values, so the logits depend on the input
+static void fill_weights(whisper_context * ctx, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-0.05f, 0.05f);
+
+    for (auto & it : ctx->model.tensors) {
+        ggml_tensor * t = it.second;
+
+        const int64_t n = ggml_nelements(t);
+
+        std::vector<float> data(n);
+        for (auto & v : data) {
+            v = dist(rng);
+        }
+
+        if (t->type == GGML_TYPE_F32) {
+            ggml_backend_tensor_set(t, data.data(), 0, ggml_nbytes(t));
+        } else {
+            assert(t->type == GGML_TYPE_F16);
+
+            std::vector<ggml_fp16_t> data_f16(n);
+            ggml_fp32_to_fp16_row(data.data(), data_f16.data(), n);
+            ggml_backend_tensor_set(t, data_f16.data(), 0, ggml_nbytes(t));
+        }
+    }
+}
+
+static void encode_random(whisper_context * ctx, whisper_state * state, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    const int n_mels = ctx->model.hparams.n_mels;
+    const int n_len  = 2*n_audio_ctx;
+
+    std::vector<float> mel(n_mels*n_len);
+    for (auto & v : mel) {
+        v = dist(rng);
+    }
+
+    state->exp_n_audio_ctx = n_audio_ctx;
+
+    assert(whisper_set_mel_with_state(ctx, state, mel.data(), n_len, n_mels) == 0);
+    assert(whisper_encode_with_state(ctx, state, 0, 1) == 0);
+}
+
+// the logits of the last token of the prompt, then of each step
+static std::vector<std::vector<float>> decode_alone(whisper_context * ctx, whisper_state * state, const sequence & seq) {
+    const int n_vocab = whisper_n_vocab(ctx);
+
+    std::vector<std::vector<float>> result;
+
+    const int n_prompt = seq.prompt.size();
+
+    assert(whisper_decode_with_state(ctx, state, seq.prompt.data(), n_prompt, 0, 1) == 0);
+
+    const float * logits = whisper_get_logits_from_state(state) + (n_prompt - 1)*n_vocab;
+    result.emplace_back(logits, logits + n_vocab);
+
+    for (int i = 0; i < (int) seq.steps.size(); ++i) {
+        assert(whisper_decode_with_state(ctx, state, &seq.steps[i], 1, n_prompt + i, 1) == 0);
+
+        logits = whisper_get_logits_from_state(state);
+        result.emplace_back(logits, logits + n_vocab);
+    }
+
+    return result;
+}
+
+static void assert_logits_eq(const std::vector<float> & ref, const float * logits) {
+    float max_ref  = 1.0f;
+    float max_diff = 0.0f;
+
+    for (size_t i = 0; i < ref.size(); ++i) {
+        max_ref  = std::max(max_ref,  std::fabs(ref[i]));
+        max_diff = std::max(max_diff, std::fabs(ref[i] - logits[i]));
+    }
+
+    assert(max_diff <= 1e-3f*max_ref);
+}
+
+// all the states decode their step with one call, at different positions
+static void test_decode_batch_with_state(
+        whisper_context * ctx,
+        whisper_state ** states,
+        const std::vector<sequence> & seqs,
+        const std::vector<std::vector<std::vector<float>>> & ref) {
+    const int n_vocab = whisper_n_vocab(ctx);
+
+    const whisper_token * tokens  [n_states];
+    int                   n_tokens[n_states];
+    int                   n_past  [n_states];
+
+    for (int step = 0; step <= n_steps; ++step) {
+        for (int i = 0; i < n_states; ++i) {
+            const int n_prompt = seqs[i].prompt.size();
+
+            tokens  [i] = step == 0 ? seqs[i].prompt.data() : &seqs[i].steps[step - 1];
+            n_tokens[i] = step == 0 ? n_prompt : 1;
+            n_past  [i] = step == 0 ? 0 : n_prompt + step - 1;
+        }
+
+        assert(whisper_decode_batch_with_state(ctx, states, tokens, n_tokens, n_past, n_states, 1) == 0);
+
+        for (int i = 0; i < n_states; ++i) {
+            assert_logits_eq(ref[i][step], whisper_get_logits_from_state(states[i]) + (n_tokens[i] - 1)*n_vocab);
+        }
+    }
+}
+
+// each state decodes on its own thread, the steps that wait at the same time are batched
+static void test_decode_batch_param(
+        whisper_context * ctx,
+        whisper_state ** states,
+        const std::vector<sequence> & seqs,
+        const std::vector<std::vector<std::vector<float>>> & ref) {
+    ctx->params.decode_batch = true;
+
+    std::vector<std::vector<std::vector<float>>> result(n_states);
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < n_states; ++i) {
+        workers.emplace_back([&, i]() {
+            result[i] = decode_alone(ctx, states[i], seqs[i]);
+        });
+    }
+    for (auto & w : workers) {
+        w.join();
+    }
+
+    ctx->params.decode_batch = false;
+
+    for (int i = 0; i < n_states; ++i) {
+        for (int step = 0; step <= n_steps; ++step) {
+            assert_logits_eq(ref[i][step], result[i][step].data());
+        }
+    }
+}
+
+int main(int argc, char ** argv) {
+    const std::string model_path = argc > 1 ? argv[1] : "../../models/for-tests-ggml-tiny.en.bin";
+
+    whisper_log_set([](enum ggml_log_level, const char *, void *) {}, nullptr);
+
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu        = false;
+    cparams.cpu_repack_enc = false;
+    cparams.cpu_repack_dec = false;
+
+    whisper_context * ctx = whisper_init_from_file_with_params_no_state(model_path.c_str(), cparams);
+    assert(ctx != nullptr);
+
+    std::mt19937 rng(42);
+
+    fill_weights(ctx, rng);
+
+    std::uniform_int_distribution<whisper_token> dist_token(0, whisper_token_eot(ctx) - 1);
+
+    whisper_state * states[n_states];
+
+    std::vector<sequence> seqs(n_states);
+    std::vector<std::vector<std::vector<float>>> ref(n_states);
+
+    for (int i = 0; i < n_states; ++i) {
+        states[i] = whisper_init_state(ctx);
+        assert(states[i] != nullptr);
+
+        encode_random(ctx, states[i], rng);
+
+        seqs[i].prompt.push_back(whisper_token_sot(ctx));
+        for (int j = 0; j < 2*i + 2; ++j) {
+            seqs[i].prompt.push_back(dist_token(rng));
+        }
+        for (int j = 0; j < n_steps; ++j) {
+            seqs[i].steps.push_back(dist_token(rng));
+        }
+
+        ref[i] = decode_alone(ctx, states[i], seqs[i]);
+    }
+
+    // the comparisons are meaningless if the logits do not depend on the audio and the tokens
+    {
+        float max_diff = 0.0f;
+        for (size_t i = 0; i < ref[0][0].size(); ++i) {
+            max_diff = std::max(max_diff, std::fabs(ref[0][0][i] - ref[1][0][i]));
+        }
+        assert(max_diff > 1e-2f);
+    }
+
+    test_decode_batch_with_state(ctx, states, seqs, ref);
+    test_decode_batch_param     (ctx, states, seqs, ref);
+
+    for (int i = 0; i < n_states; ++i) {
+        whisper_free_state(states[i]);
+    }
+    whisper_free(ctx);
+
+    return 0;
+}
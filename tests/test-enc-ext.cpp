@@ -0,0 +1,165 @@
+// the static functions and the internals of the state are used to fill the weights and to take the path of an external
+// encoder (Core ML, OpenVINO) without one: the output of the encoder is written into enc_ext by the test
+#include "whisper.cpp"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+// the test models hold no weights - they are filled with small random values, so the output depends on the input
+static void fill_weights(whisper_context * ctx, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-0.05f, 0.05f);
+
+    for (auto & it : ctx->model.tensors) {
+        ggml_tensor * t = it.second;
+
+        const int64_t n = ggml_nelements(t);
+
+        std::vector<float> data(n);
+        for (auto & v : data) {
+            v = dist(rng);
+        }
+
+        if (t->type == GGML_TYPE_F32) {
+            ggml_backend_tensor_set(t, data.data(), 0, ggml_nbytes(t));
+        } else {
+            assert(t->type == GGML_TYPE_F16);
+
+            std::vector<ggml_fp16_t> data_f16(n);
+            ggml_fp32_to_fp16_row(data.data(), data_f16.data(), n);
+            ggml_backend_tensor_set(t, data_f16.data(), 0, ggml_nbytes(t));
+        }
+    }
+}
+
+// the cross-attention memory of the state, see whisper_get_encoder_output
+static std::vector<float> encoder_output(whisper_context * ctx, whisper_state * state) {
+    assert(state->kv_cross.k->type == GGML_TYPE_F16);
+    assert(state->kv_cross.v->type == GGML_TYPE_F16);
+
+    const size_t size = whisper_get_encoder_output_size(ctx, state);
+
+    std::vector<ggml_fp16_t> data(size/sizeof(ggml_fp16_t));
+    assert(whisper_get_encoder_output(ctx, state, data.data(), size) == 0);
+
+    std::vector<float> result(data.size());
+    ggml_fp16_to_fp32_row(data.data(), result.data(), data.size());
+
+    return result;
+}
+
+// the cross-attention memory computed from an encoder output written into enc_ext is the one of the internal encoder
+// a smaller audio_ctx uses a view of enc_ext
+static void test_enc_ext(whisper_context * ctx, const std::vector<float> & mel, int n_audio_ctx) {
+    const int n_mels  = ctx->model.hparams.n_mels;
+    const int n_state = ctx->model.hparams.n_audio_state;
+    const int n_len   = mel.size()/n_mels;
+    const int n_ctx   = n_audio_ctx > 0 ? n_audio_ctx : ctx->model.hparams.n_audio_ctx;
+
+    whisper_state * state_int = whisper_init_state(ctx);
+    assert(state_int != nullptr);
+    assert(state_int->enc_ext == nullptr);
+
+    state_int->exp_n_audio_ctx = n_audio_ctx;
+
+    assert(whisper_set_mel_with_state(ctx, state_int, mel.data(), n_len, n_mels) == 0);
+    assert(whisper_encode_with_state(ctx, state_int, 0, 1) == 0);
+
+    // the output of the encoder is kept by the fused graph
+    assert(ggml_nelements(state_int->embd_enc) == (int64_t) n_state*n_ctx);
+
+    std::vector<float> embd_enc(n_state*n_ctx);
+    ggml_backend_tensor_get(state_int->embd_enc, embd_enc.data(), 0, embd_enc.size()*sizeof(float));
+
+    const std::vector<float> out_int = encoder_output(ctx, state_int);
+
+    whisper_state * state_ext = whisper_init_state(ctx);
+    assert(state_ext != nullptr);
+
+    state_ext->enc_ext_test = true;
+    assert(whisper_sched_init_conv(*ctx, *state_ext));
+
+    // the buffer is allocated with the conv graph, at the full audio_ctx
+    assert(state_ext->enc_ext != nullptr);
+    assert(state_ext->enc_ext->ne[1] == ctx->model.hparams.n_audio_ctx);
+    assert(ggml_backend_buffer_is_host(state_ext->buffer_enc_ext));
+
+    state_ext->exp_n_audio_ctx = n_audio_ctx;
+
+    assert(whisper_set_mel_with_state(ctx, state_ext, mel.data(), n_len, n_mels) == 0);
+
+    // the external encoder writes where the cross-attention graph reads
+    ggml_backend_tensor_set(state_ext->enc_ext, embd_enc.data(), 0, embd_enc.size()*sizeof(float));
+
+    assert(whisper_encode_with_state(ctx, state_ext, 0, 1) == 0);
+
+    if (n_ctx == ctx->model.hparams.n_audio_ctx) {
+        assert(state_ext->embd_enc == state_ext->enc_ext);
+    } else {
+        assert(state_ext->embd_enc->view_src == state_ext->enc_ext);
+        assert(state_ext->embd_enc->ne[1] == n_ctx);
+    }
+
+    const std::vector<float> out_ext = encoder_output(ctx, state_ext);
+
+    assert(out_ext.size() == out_int.size());
+
+    // the same graph of the cross-attention memory, in its own scheduler instead of the fused one
+    double max_diff = 0.0;
+    for (size_t i = 0; i < out_int.size(); ++i) {
+        max_diff = std::max(max_diff, (double) std::fabs(out_int[i] - out_ext[i]));
+    }
+
+    printf("%s: n_audio_ctx = %4d, max diff = %g\n", __func__, n_ctx, max_diff);
+
+    assert(max_diff < 1e-3);
+
+    // a second pass reuses the graphs and reads enc_ext again
+    assert(whisper_encode_with_state(ctx, state_ext, 0, 1) == 0);
+    assert(encoder_output(ctx, state_ext) == out_ext);
+
+    whisper_free_state(state_ext);
+    whisper_free_state(state_int);
+}
+
+int main(int argc, char ** argv) {
+    const std::string model_path = argc > 1 ? argv[1] : "../../models/for-tests-ggml-tiny.en.bin";
+
+    whisper_log_set([](enum ggml_log_level, const char *, void *) {}, nullptr);
+
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu        = false;
+    cparams.cpu_repack_enc = false;
+    cparams.cpu_repack_dec = false;
+
+    whisper_context * ctx = whisper_init_from_file_with_params_no_state(model_path.c_str(), cparams);
+    assert(ctx != nullptr);
+
+    std::mt19937 rng(42);
+
+    fill_weights(ctx, rng);
+
+    const int n_mels = ctx->model.hparams.n_mels;
+    const int n_len  = 2*ctx->model.hparams.n_audio_ctx;
+
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    std::vector<float> mel(n_mels*n_len);
+    for (auto & v : mel) {
+        v = dist(rng);
+    }
+
+    test_enc_ext(ctx, mel, 64);
+    test_enc_ext(ctx, mel, 0);
+
+    whisper_free(ctx);
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+// whisper_fft_plan and whisper_fft_real are static
+#include "whisper.cpp"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+// the n/2 + 1 bins of the DFT of n real samples, in double precision
+static std::vector<double> dft_naive(const std::vector<float> & in) {
+    const int n = in.size();
+
+    std::vector<double> out(2*(n/2 + 1));
+
+    for (int k = 0; k <= n/2; ++k) {
+        double re = 0.0;
+        double im = 0.0;
+        for (int i = 0; i < n; ++i) {
+            const double theta = -2.0*M_PI*(((int64_t) k*i) % n)/n;
+            re += in[i]*cos(theta);
+            im += in[i]*sin(theta);
+        }
+        out[2*k + 0] = re;
+        out[2*k + 1] = im;
+    }
+
+    return out;
+}
+
+static void test_fft_real(int n, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    whisper_fft_plan plan;
+    plan.init(n);
+
+    int n_prod = 1;
+    for (const auto & st : plan.stages) {
+        n_prod *= st.radix;
+    }
+    assert(n_prod == n/2);
+
+    std::vector<float> in(n);
+    for (auto & v : in) {
+        v = dist(rng);
+    }
+
+    std::vector<float> work(4*(n/2));
+    std::vector<float> out(2*(n/2 + 1));
+
+    whisper_fft_real(plan, in.data(), work.data(), out.data());
+
+    const std::vector<double> ref = dft_naive(in);
+
+    // the bins grow with n and so do the rounding errors of the float passes
+    const double tol = 1e-6 + 1e-7*n;
+
+    double max_diff = 0.0;
+    for (size_t i = 0; i < out.size(); ++i) {
+        max_diff = std::max(max_diff, std::fabs(out[i] - ref[i]));
+    }
+
+    if (max_diff > tol) {
+        fprintf(stderr, "%s: n = %d, max diff = %g > %g\n", __func__, n, max_diff, tol);
+    }
+    assert(max_diff <= tol);
+}
+
+int main() {
+    std::mt19937 rng(42);
+
+    // the STFT size of the log mel spectrogram, n/2 = 200 = 4*2*5*5
+    test_fft_real(WHISPER_N_FFT, rng);
+
+    // the sizes that factor into the radix-4/2/5/3 butterflies, each radix alone and mixed
+    for (int n : { 2, 4, 6, 8, 10, 16, 18, 30, 50, 54, 64, 120, 250, 256, 360, 480, 512, 600, 960, 1024, 1350 }) {
+        test_fft_real(n, rng);
+    }
+
+    // the generic butterfly of the other prime factors
+    for (int n : { 14, 22, 42, 154, 338 }) {
+        test_fft_real(n, rng);
+    }
+
+    return 0;
+}
@@ -0,0 +1,176 @@
+// the static functions and the internals of the state are used to fill the weights and to disable the graph reuse
+#include "whisper.cpp"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+static const int n_audio_ctx = 64;
+static const int n_steps     = 80;
+
+// the test models hold no weights - they are filled with small random values, so the logits depend on the input
+static void fill_weights(whisper_context * ctx, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-0.05f, 0.05f);
+
+    for (auto & it : ctx->model.tensors) {
+        ggml_tensor * t = it.second;
+
+        const int64_t n = ggml_nelements(t);
+
+        std::vector<float> data(n);
+        for (auto & v : data) {
+            v = dist(rng);
+        }
+
+        if (t->type == GGML_TYPE_F32) {
+            ggml_backend_tensor_set(t, data.data(), 0, ggml_nbytes(t));
+        } else {
+            assert(t->type == GGML_TYPE_F16);
+
+            std::vector<ggml_fp16_t> data_f16(n);
+            ggml_fp32_to_fp16_row(data.data(), data_f16.data(), n);
+            ggml_backend_tensor_set(t, data_f16.data(), 0, ggml_nbytes(t));
+        }
+    }
+}
+
+// large values in all the cells of the self-attention cache, also in the cells that have not been written
+static void fill_kv_cache(whisper_kv_cache & cache, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+
+    for (ggml_tensor * t : { cache.k, cache.v }) {
+        assert(t->type == GGML_TYPE_F16);
+
+        const int64_t n = ggml_nelements(t);
+
+        std::vector<float> data(n);
+        for (auto & v : data) {
+            v = dist(rng);
+        }
+
+        std::vector<ggml_fp16_t> data_f16(n);
+        ggml_fp32_to_fp16_row(data.data(), data_f16.data(), n);
+        ggml_backend_tensor_set(t, data_f16.data(), 0, ggml_nbytes(t));
+    }
+}
+
+// the logits of the last token of the prompt, then of each step
+// the steps after n_steps/2 skip 10 past positions, so their tokens are written to the freed cells behind the others
+static std::vector<float> decode(whisper_context * ctx, whisper_state * state, const std::vector<whisper_token> & tokens, bool reuse) {
+    const int n_vocab  = whisper_n_vocab(ctx);
+    const int n_prompt = tokens.size() - n_steps;
+
+    std::vector<float> result;
+
+    for (int i = 0; i <= n_steps; ++i) {
+        if (!reuse) {
+            state->sched_decode.gf = nullptr;
+        }
+
+        if (i == n_steps/2) {
+            whisper_kv_cache_seq_rm(state->kv_self, 0, 10, 20);
+        }
+
+        const int n_tokens = i == 0 ? n_prompt : 1;
+        const int n_past   = i == 0 ? 0 : n_prompt + i - 1;
+
+        assert(whisper_decode_with_state(ctx, state, tokens.data() + (i == 0 ? 0 : n_prompt + i - 1), n_tokens, n_past, 1) == 0);
+
+        // the attended cells are padded, so the graph is the same for 32 positions
+        assert(state->kv_self.n % WHISPER_KV_GRAPH_PAD == 0);
+
+        const float * logits = whisper_get_logits_from_state(state) + (n_tokens - 1)*n_vocab;
+        result.insert(result.end(), logits, logits + n_vocab);
+    }
+
+    return result;
+}
+
+// the decoder graphs that are reused give the same logits as the graphs built for each step
+static void test_graph_reuse(const std::string & model_path, bool flash_attn) {
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu        = false;
+    cparams.flash_attn     = flash_attn;
+    cparams.cpu_repack_enc = false;
+    cparams.cpu_repack_dec = false;
+
+    whisper_context * ctx = whisper_init_from_file_with_params_no_state(model_path.c_str(), cparams);
+    assert(ctx != nullptr);
+
+    std::mt19937 rng(42);
+
+    fill_weights(ctx, rng);
+
+    whisper_state * state = whisper_init_state(ctx);
+    assert(state != nullptr);
+
+    {
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+        const int n_mels = ctx->model.hparams.n_mels;
+        const int n_len  = 2*n_audio_ctx;
+
+        std::vector<float> mel(n_mels*n_len);
+        for (auto & v : mel) {
+            v = dist(rng);
+        }
+
+        state->exp_n_audio_ctx = n_audio_ctx;
+
+        assert(whisper_set_mel_with_state(ctx, state, mel.data(), n_len, n_mels) == 0);
+        assert(whisper_encode_with_state(ctx, state, 0, 1) == 0);
+    }
+
+    std::uniform_int_distribution<whisper_token> dist_token(0, whisper_token_eot(ctx) - 1);
+
+    std::vector<whisper_token> tokens = { whisper_token_sot(ctx) };
+    for (int i = 0; i < 3 + n_steps; ++i) {
+        tokens.push_back(dist_token(rng));
+    }
+
+    state->n_graph_build = 0;
+    state->n_graph_reuse = 0;
+
+    const std::vector<float> logits_reuse = decode(ctx, state, tokens, true);
+
+    // a graph for the prompt, then one for each 32 attended cells
+    assert(state->n_graph_build <= 5);
+    assert(state->n_graph_reuse >= n_steps - 4);
+
+    // the padded cells past the used ones and the freed cells are masked out: large values in all the cells of the cache
+    // do not change the logits of the second pass
+    fill_kv_cache(state->kv_self, rng);
+
+    state->n_graph_build = 0;
+    state->n_graph_reuse = 0;
+
+    const std::vector<float> logits_build = decode(ctx, state, tokens, false);
+
+    assert(state->n_graph_build == n_steps + 1);
+    assert(state->n_graph_reuse == 0);
+
+    // the same graph is computed with the same inputs, only the offsets of the KV writes are moved in place
+    assert(logits_reuse.size() == logits_build.size());
+    assert(memcmp(logits_reuse.data(), logits_build.data(), logits_reuse.size()*sizeof(float)) == 0);
+
+    whisper_free_state(state);
+    whisper_free(ctx);
+}
+
+int main(int argc, char ** argv) {
+    const std::string model_path = argc > 1 ? argv[1] : "../../models/for-tests-ggml-tiny.en.bin";
+
+    whisper_log_set([](enum ggml_log_level, const char *, void *) {}, nullptr);
+
+    test_graph_reuse(model_path, false);
+    test_graph_reuse(model_path, true);
+
+    return 0;
+}
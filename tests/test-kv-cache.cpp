@@ -0,0 +1,390 @@
+// the KV cache functions are static
+#include "whisper.cpp"
+
+#include <cstdio>
+#include <random>
+#include <set>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+// the cells of a cache without tensors - the slot search and the sequence functions do not touch them
+static void kv_cache_init_cells(whisper_kv_cache & cache, uint32_t n_ctx) {
+    cache.head = 0;
+    cache.size = n_ctx;
+
+    cache.cells_pos.assign(n_ctx, -1);
+    cache.cells_seq.assign(n_ctx, 0);
+    cache.cells_use.assign((n_ctx + 63)/64, 0);
+}
+
+// the KV cells tracked one by one, with a set of sequences for each cell - the cache must match it after each call
+struct kv_cache_ref {
+    uint32_t head = 0;
+
+    std::vector<whisper_pos>              pos;
+    std::vector<std::set<whisper_seq_id>> seq;
+
+    std::vector<uint32_t> slots;
+    bool                  slots_contiguous = true;
+
+    explicit kv_cache_ref(uint32_t n_ctx) : pos(n_ctx, -1), seq(n_ctx) {}
+
+    uint32_t size() const {
+        return pos.size();
+    }
+
+    bool is_free(uint32_t i, uint32_t n) const {
+        for (uint32_t j = i; j < i + n; ++j) {
+            if (pos[j] >= 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool find_slot(const whisper_batch & batch) {
+        const uint32_t n = batch.n_tokens;
+
+        if (n > size()) {
+            return false;
+        }
+
+        slots.clear();
+
+        // the first free range at or after head, then from the start
+        for (uint32_t i = std::min(head, size()); i + n <= size() && slots.empty(); ++i) {
+            if (is_free(i, n)) {
+                for (uint32_t j = 0; j < n; ++j) slots.push_back(i + j);
+            }
+        }
+        for (uint32_t i = 0; i + n <= size() && slots.empty(); ++i) {
+            if (is_free(i, n)) {
+                for (uint32_t j = 0; j < n; ++j) slots.push_back(i + j);
+            }
+        }
+
+        slots_contiguous = !slots.empty();
+
+        // else the first free cells, for up to WHISPER_MAX_SEQ tokens
+        if (slots.empty()) {
+            if (n > WHISPER_MAX_SEQ) {
+                return false;
+            }
+            for (uint32_t i = 0; i < size() && slots.size() < n; ++i) {
+                if (pos[i] < 0) {
+                    slots.push_back(i);
+                }
+            }
+            if (slots.size() < n) {
+                return false;
+            }
+        }
+
+        head = slots[0];
+
+        for (uint32_t i = 0; i < n; ++i) {
+            pos[slots[i]] = batch.pos[i];
+            for (int j = 0; j < batch.n_seq_id[i]; ++j) {
+                seq[slots[i]].insert(batch.seq_id[i][j]);
+            }
+        }
+
+        return true;
+    }
+
+    void free_cell(uint32_t i) {
+        pos[i] = -1;
+        seq[i].clear();
+    }
+
+    void seq_rm(whisper_seq_id seq_id, whisper_pos p0, whisper_pos p1) {
+        if (p0 < 0) p0 = 0;
+        if (p1 < 0) p1 = std::numeric_limits<whisper_pos>::max();
+
+        uint32_t new_head = size();
+
+        for (uint32_t i = 0; i < size(); ++i) {
+            if (pos[i] < p0 || pos[i] >= p1) {
+                continue;
+            }
+            const size_t n_seq = seq[i].size();
+            if (seq_id < 0) {
+                seq[i].clear();
+            } else {
+                seq[i].erase(seq_id);
+            }
+            if (seq[i].size() < n_seq && seq[i].empty()) {
+                free_cell(i);
+                if (new_head == size()) new_head = i;
+            }
+        }
+
+        if (new_head != size()) head = new_head;
+    }
+
+    void seq_keep(whisper_seq_id seq_id) {
+        uint32_t new_head = size();
+
+        for (uint32_t i = 0; i < size(); ++i) {
+            if (seq[i].count(seq_id)) {
+                seq[i] = { seq_id };
+            } else {
+                if (pos[i] >= 0 && new_head == size()) new_head = i;
+                free_cell(i);
+            }
+        }
+
+        if (new_head != size()) head = new_head;
+    }
+
+    void seq_cp(whisper_seq_id src, whisper_seq_id dst, whisper_pos p0, whisper_pos p1) {
+        if (p0 < 0) p0 = 0;
+        if (p1 < 0) p1 = std::numeric_limits<whisper_pos>::max();
+
+        head = 0;
+
+        for (uint32_t i = 0; i < size(); ++i) {
+            if (seq[i].count(src) && pos[i] >= p0 && pos[i] < p1) {
+                seq[i].insert(dst);
+            }
+        }
+    }
+
+    // the beams are copied to temporary sequences, then moved back to [0, n_seq)
+    void seq_reorder(const whisper_seq_id * src, int n_seq) {
+        const whisper_seq_id tmp = 1000;
+
+        for (int j = 0; j < n_seq; ++j) {
+            seq_cp(src[j], tmp + j, -1, -1);
+        }
+        for (int j = 0; j < n_seq; ++j) {
+            seq_rm(j, -1, -1);
+        }
+        for (int j = 0; j < n_seq; ++j) {
+            seq_cp(tmp + j, j, -1, -1);
+            seq_rm(tmp + j, -1, -1);
+        }
+
+        head = 0;
+    }
+
+    int32_t cell_max() const {
+        for (uint32_t i = size(); i > 0; --i) {
+            if (pos[i - 1] >= 0) {
+                return i;
+            }
+        }
+        return 1;
+    }
+};
+
+static void assert_cache_eq(const whisper_kv_cache & cache, const kv_cache_ref & ref) {
+    assert(cache.head == ref.head);
+
+    for (uint32_t i = 0; i < cache.size; ++i) {
+        whisper_seq_mask mask = 0;
+        for (whisper_seq_id s : ref.seq[i]) {
+            mask |= whisper_seq_bit(s);
+        }
+
+        const bool used = (cache.cells_use[i/64] >> (i%64)) & 1;
+
+        assert(cache.cells_pos[i] == ref.pos[i]);
+        assert(cache.cells_seq[i] == mask);
+        assert(used == (ref.pos[i] >= 0));
+        assert((mask == 0) == (ref.pos[i] < 0));
+    }
+
+    // no bit is set past the last cell
+    if (cache.size % 64 != 0) {
+        assert((cache.cells_use.back() >> (cache.size % 64)) == 0);
+    }
+
+    assert(whisper_kv_cache_cell_max(cache) == ref.cell_max());
+}
+
+static void batch_set(whisper_batch & batch, const std::vector<whisper_pos> & pos, const std::vector<whisper_seq_id> & seq) {
+    batch.n_tokens = pos.size();
+    for (int i = 0; i < batch.n_tokens; ++i) {
+        batch.token   [i]    = 0;
+        batch.pos     [i]    = pos[i];
+        batch.n_seq_id[i]    = 1;
+        batch.seq_id  [i][0] = seq[i];
+        batch.logits  [i]    = 0;
+    }
+}
+
+// a free range is found at or after head, the freed cells are reused and a batch is scattered over the holes when no
+// range is large enough
+static void test_find_slot() {
+    whisper_kv_cache cache;
+    kv_cache_init_cells(cache, 200);
+
+    whisper_batch batch = whisper_batch_init(64, 1);
+
+    // 128 tokens of sequence 0 at positions 0..127
+    for (int i = 0; i < 2; ++i) {
+        std::vector<whisper_pos> pos(64);
+        for (int j = 0; j < 64; ++j) {
+            pos[j] = 64*i + j;
+        }
+        batch_set(batch, pos, std::vector<whisper_seq_id>(64, 0));
+
+        assert(whisper_kv_cache_find_slot(cache, batch));
+        assert(cache.slots_contiguous);
+        assert(cache.slots[0] == (uint32_t) 64*i && cache.slots[63] == (uint32_t) 64*i + 63);
+    }
+    assert(whisper_kv_cache_cell_max(cache) == 128);
+
+    // free the positions 60..67 across the first word boundary: the next batch of 8 reuses them
+    whisper_kv_cache_seq_rm(cache, 0, 60, 68);
+    assert(cache.head == 60);
+    assert(whisper_kv_cache_cell_max(cache) == 128);
+
+    batch_set(batch, { 200, 201, 202, 203, 204, 205, 206, 207 }, std::vector<whisper_seq_id>(8, 0));
+    assert(whisper_kv_cache_find_slot(cache, batch));
+    assert(cache.slots_contiguous);
+    for (int i = 0; i < 8; ++i) {
+        assert(cache.slots[i] == (uint32_t) 60 + i);
+        assert(cache.cells_pos[60 + i] == 200 + i);
+    }
+
+    // fill the tail, then free every other cell of 0..39: only single cells are free
+    {
+        std::vector<whisper_pos> pos(200 - 128);
+        for (size_t j = 0; j < pos.size(); ++j) {
+            pos[j] = 300 + j;
+        }
+        batch_set(batch, std::vector<whisper_pos>(pos.begin(), pos.begin() + 64), std::vector<whisper_seq_id>(64, 0));
+        assert(whisper_kv_cache_find_slot(cache, batch));
+        batch_set(batch, std::vector<whisper_pos>(pos.begin() + 64, pos.end()), std::vector<whisper_seq_id>(pos.size() - 64, 0));
+        assert(whisper_kv_cache_find_slot(cache, batch));
+    }
+    for (int i = 1; i < 40; i += 2) {
+        whisper_kv_cache_seq_rm(cache, 0, i, i + 1);
+    }
+
+    // 4 tokens are scattered over the first free cells
+    batch_set(batch, { 400, 401, 402, 403 }, { 0, 1, 2, 3 });
+    assert(whisper_kv_cache_find_slot(cache, batch));
+    assert(!cache.slots_contiguous);
+    for (int i = 0; i < 4; ++i) {
+        assert(cache.slots[i] == (uint32_t) 2*i + 1);
+        assert(cache.cells_pos[2*i + 1] == 400 + i);
+        assert(cache.cells_seq[2*i + 1] == whisper_seq_bit(i));
+    }
+    assert(cache.head == 1);
+
+    // 16 holes are left: a batch of 17 does not fit and changes nothing
+    batch_set(batch, std::vector<whisper_pos>(17, 500), std::vector<whisper_seq_id>(17, 0));
+    assert(!whisper_kv_cache_find_slot(cache, batch));
+    assert(cache.cells_pos[39] == -1);
+
+    // with 56 holes, a batch larger than WHISPER_MAX_SEQ is still not scattered
+    for (int i = 41; i < 128; i += 2) {
+        whisper_kv_cache_seq_rm(cache, 0, i, i + 1);
+    }
+    batch_set(batch, std::vector<whisper_pos>(WHISPER_MAX_SEQ + 1, 500), std::vector<whisper_seq_id>(WHISPER_MAX_SEQ + 1, 0));
+    assert(!whisper_kv_cache_find_slot(cache, batch));
+
+    batch_set(batch, std::vector<whisper_pos>(WHISPER_MAX_SEQ, 500), std::vector<whisper_seq_id>(WHISPER_MAX_SEQ, 0));
+    assert(whisper_kv_cache_find_slot(cache, batch));
+    assert(!cache.slots_contiguous);
+    // the holes 9..39 and 41..59, then 69.. after the reused cells 60..67
+    assert(cache.slots[0] == 9 && cache.slots[25] == 59 && cache.slots[26] == 69 && cache.slots[31] == 79);
+
+    whisper_batch_free(batch);
+}
+
+// random batches and sequence operations of a beam search, compared with the cells tracked one by one
+static void test_random_ops(uint32_t n_ctx, std::mt19937 & rng) {
+    whisper_kv_cache cache;
+    kv_cache_init_cells(cache, n_ctx);
+
+    kv_cache_ref ref(n_ctx);
+
+    const int n_seq = 5;
+
+    whisper_batch batch = whisper_batch_init(48, 1);
+
+    auto rand_int = [&rng](int a, int b) {
+        return std::uniform_int_distribution<int>(a, b)(rng);
+    };
+
+    for (int it = 0; it < 4000; ++it) {
+        const int op = rand_int(0, 99);
+
+        if (op < 45) {
+            // mostly one token of each beam, sometimes a prompt
+            const int n_tokens = rand_int(0, 9) == 0 ? rand_int(1, 48) : rand_int(1, n_seq);
+
+            std::vector<whisper_pos>    pos(n_tokens);
+            std::vector<whisper_seq_id> seq(n_tokens);
+            for (int i = 0; i < n_tokens; ++i) {
+                pos[i] = rand_int(0, 447);
+                seq[i] = rand_int(0, n_seq - 1);
+            }
+            batch_set(batch, pos, seq);
+
+            const bool ok = whisper_kv_cache_find_slot(cache, batch);
+            assert(ok == ref.find_slot(batch));
+
+            if (ok) {
+                assert(cache.slots_contiguous == ref.slots_contiguous);
+                assert(cache.slots == ref.slots);
+            }
+        } else if (op < 70) {
+            const whisper_seq_id s  = rand_int(-1, n_seq - 1);
+            const whisper_pos    p0 = rand_int(-1, 447);
+            const whisper_pos    p1 = rand_int(0, 3) == 0 ? -1 : p0 + rand_int(1, 64);
+
+            whisper_kv_cache_seq_rm(cache, s, p0, p1);
+            ref.seq_rm(s, p0, p1);
+        } else if (op < 80) {
+            const whisper_seq_id src = rand_int(0, n_seq - 1);
+            const whisper_seq_id dst = rand_int(0, n_seq - 1);
+            const whisper_pos    p0  = rand_int(-1, 447);
+            const whisper_pos    p1  = rand_int(0, 1) == 0 ? -1 : p0 + rand_int(1, 64);
+
+            whisper_kv_cache_seq_cp(cache, src, dst, p0, p1);
+            ref.seq_cp(src, dst, p0, p1);
+        } else if (op < 83) {
+            const whisper_seq_id s = rand_int(0, n_seq - 1);
+
+            whisper_kv_cache_seq_keep(cache, s);
+            ref.seq_keep(s);
+        } else {
+            // the beams of the next step, a beam can continue several times or not at all
+            const int n = rand_int(1, n_seq);
+
+            std::vector<whisper_seq_id> src(n);
+            for (auto & s : src) {
+                s = rand_int(0, n_seq - 1);
+            }
+
+            whisper_kv_cache_seq_reorder(cache, src.data(), n);
+            ref.seq_reorder(src.data(), n);
+        }
+
+        assert_cache_eq(cache, ref);
+    }
+
+    whisper_batch_free(batch);
+}
+
+int main() {
+    std::mt19937 rng(42);
+
+    test_find_slot();
+
+    // the cells fill whole words of the bitmap or not
+    for (uint32_t n_ctx : { 64u, 200u, 448u }) {
+        test_random_ops(n_ctx, rng);
+    }
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+// the static functions and the internals of the state are used to fill the weights and to check the sampling on the device
+#include "whisper.cpp"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+// the test models hold no weights - they are filled with small random values, so the tokens depend on the input
+static void fill_weights(whisper_context * ctx, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-0.05f, 0.05f);
+
+    for (auto & it : ctx->model.tensors) {
+        ggml_tensor * t = it.second;
+
+        const int64_t n = ggml_nelements(t);
+
+        std::vector<float> data(n);
+        for (auto & v : data) {
+            v = dist(rng);
+        }
+
+        if (t->type == GGML_TYPE_F32) {
+            ggml_backend_tensor_set(t, data.data(), 0, ggml_nbytes(t));
+        } else {
+            assert(t->type == GGML_TYPE_F16);
+
+            std::vector<ggml_fp16_t> data_f16(n);
+            ggml_fp32_to_fp16_row(data.data(), data_f16.data(), n);
+            ggml_backend_tensor_set(t, data_f16.data(), 0, ggml_nbytes(t));
+        }
+    }
+}
+
+// the tokens of all the segments of a greedy transcription
+static std::vector<whisper_token_data> transcribe(whisper_context * ctx, whisper_state * state, const std::vector<float> & pcm, bool no_timestamps, bool sample_on_device) {
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.n_threads        = 1;
+    wparams.print_progress   = false;
+    wparams.print_realtime   = false;
+    wparams.print_timestamps = false;
+    wparams.print_special    = false;
+    wparams.no_context       = true;
+    wparams.audio_ctx        = 64;
+    wparams.no_timestamps    = no_timestamps;
+    wparams.temperature_inc  = 0.0f; // no fallback, the other temperatures are sampled on the host
+    wparams.sample_on_device = sample_on_device;
+
+    assert(whisper_full_with_state(ctx, state, wparams, pcm.data(), pcm.size()) == 0);
+
+    std::vector<whisper_token_data> result;
+
+    const int n_segments = whisper_full_n_segments_from_state(state);
+    for (int i = 0; i < n_segments; ++i) {
+        const int n_tokens = whisper_full_n_tokens_from_state(state, i);
+        for (int j = 0; j < n_tokens; ++j) {
+            result.push_back(whisper_full_get_token_data_from_state(state, i, j));
+        }
+    }
+
+    return result;
+}
+
+// the greedy tokens picked in the decoder graph are the ones picked on the host
+static void test_sample_dev(whisper_context * ctx, const std::vector<float> & pcm, bool no_timestamps) {
+    whisper_state * state_host = whisper_init_state(ctx);
+    whisper_state * state_dev  = whisper_init_state(ctx);
+    assert(state_host != nullptr && state_dev != nullptr);
+
+    const std::vector<whisper_token_data> tokens_host = transcribe(ctx, state_host, pcm, no_timestamps, false);
+    const std::vector<whisper_token_data> tokens_dev  = transcribe(ctx, state_dev,  pcm, no_timestamps, true);
+
+    // the decoder graph has picked the tokens
+    assert(state_host->sampling_dev.mask == nullptr);
+    assert(state_dev->sampling_dev.mask != nullptr);
+    assert(!state_dev->sampling_dev.id_text.empty());
+
+    printf("%s: no_timestamps = %d, %d tokens\n", __func__, no_timestamps, (int) tokens_host.size());
+
+    // the same logit filters and the same greedy pick as whisper_process_logits() and whisper_sample_token()
+    assert(tokens_host.size() > 1);
+    assert(tokens_host.size() == tokens_dev.size());
+
+    for (size_t i = 0; i < tokens_host.size(); ++i) {
+        assert(tokens_host[i].id  == tokens_dev[i].id);
+        assert(tokens_host[i].tid == tokens_dev[i].tid);
+        assert(std::fabs(tokens_host[i].p  - tokens_dev[i].p)  < 1e-4f);
+        assert(std::fabs(tokens_host[i].pt - tokens_dev[i].pt) < 1e-4f);
+    }
+
+    whisper_free_state(state_dev);
+    whisper_free_state(state_host);
+}
+
+int main(int argc, char ** argv) {
+    const std::string model_path = argc > 1 ? argv[1] : "../../models/for-tests-ggml-tiny.en.bin";
+
+    whisper_log_set([](enum ggml_log_level, const char *, void *) {}, nullptr);
+
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu        = false;
+    cparams.cpu_repack_enc = false;
+    cparams.cpu_repack_dec = false;
+
+    whisper_context * ctx = whisper_init_from_file_with_params_no_state(model_path.c_str(), cparams);
+    assert(ctx != nullptr);
+
+    std::mt19937 rng(42);
+
+    fill_weights(ctx, rng);
+
+    // the weights are set, so whisper_full decodes the whole window instead of a single token
+    ctx->model.n_loaded = ctx->model.tensors.size();
+
+    std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+
+    std::vector<float> pcm(WHISPER_SAMPLE_RATE);
+    for (auto & v : pcm) {
+        v = dist(rng);
+    }
+
+    test_sample_dev(ctx, pcm, false);
+    test_sample_dev(ctx, pcm, true);
+
+    whisper_free(ctx);
+
+    return 0;
+}
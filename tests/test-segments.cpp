@@ -0,0 +1,149 @@
+// the internals of the model are used to fill the weights, the results are read with the public API
+#include "whisper.cpp"
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+// the test models hold no weights - they are filled with small random values, so the tokens depend on the input
+static void fill_weights(whisper_context * ctx, std::mt19937 & rng) {
+    std::uniform_real_distribution<float> dist(-0.05f, 0.05f);
+
+    for (auto & it : ctx->model.tensors) {
+        ggml_tensor * t = it.second;
+
+        const int64_t n = ggml_nelements(t);
+
+        std::vector<float> data(n);
+        for (auto & v : data) {
+            v = dist(rng);
+        }
+
+        if (t->type == GGML_TYPE_F32) {
+            ggml_backend_tensor_set(t, data.data(), 0, ggml_nbytes(t));
+        } else {
+            assert(t->type == GGML_TYPE_F16);
+
+            std::vector<ggml_fp16_t> data_f16(n);
+            ggml_fp32_to_fp16_row(data.data(), data_f16.data(), n);
+            ggml_backend_tensor_set(t, data_f16.data(), 0, ggml_nbytes(t));
+        }
+    }
+}
+
+// the segments and the tokens read in one call are the ones read one by one
+static void test_get_segments(whisper_context * ctx, whisper_state * state) {
+    const int n_segments = whisper_full_n_segments_from_state(state);
+    const int n_tokens   = whisper_full_n_tokens_all_from_state(state);
+
+    printf("%s: %d segments, %d tokens\n", __func__, n_segments, n_tokens);
+
+    // max_len splits the text into segments of several tokens
+    assert(n_segments > 1);
+    assert(n_tokens > n_segments);
+
+    std::vector<whisper_segment_data> segments(n_segments);
+    std::vector<whisper_token_data>   tokens(n_tokens);
+    std::vector<const char *>         token_texts(n_tokens);
+
+    // the arrays must hold all the results
+    assert(whisper_full_get_segments_from_state(ctx, state, segments.data(), n_segments - 1, nullptr, nullptr, 0) == -1);
+    assert(whisper_full_get_segments_from_state(ctx, state, segments.data(), n_segments, tokens.data(), nullptr, n_tokens - 1) == -1);
+
+    assert(whisper_full_get_segments_from_state(ctx, state, segments.data(), n_segments, tokens.data(), token_texts.data(), n_tokens) == 0);
+
+    int i_token = 0;
+    for (int i = 0; i < n_segments; ++i) {
+        const whisper_segment_data & segment = segments[i];
+
+        assert(segment.t0 == whisper_full_get_segment_t0_from_state(state, i));
+        assert(segment.t1 == whisper_full_get_segment_t1_from_state(state, i));
+        assert(strcmp(segment.text, whisper_full_get_segment_text_from_state(state, i)) == 0);
+        assert(segment.no_speech_prob    == whisper_full_get_segment_no_speech_prob_from_state(state, i));
+        assert(segment.speaker_turn_next == whisper_full_get_segment_speaker_turn_next_from_state(state, i));
+
+        // the tokens of the segments follow each other
+        assert(segment.i_token  == i_token);
+        assert(segment.n_tokens == whisper_full_n_tokens_from_state(state, i));
+
+        for (int j = 0; j < segment.n_tokens; ++j) {
+            const whisper_token_data data = whisper_full_get_token_data_from_state(state, i, j);
+
+            assert(memcmp(&tokens[i_token + j], &data, sizeof(data)) == 0);
+            assert(strcmp(token_texts[i_token + j], whisper_full_get_token_text_from_state(ctx, state, i, j)) == 0);
+        }
+
+        i_token += segment.n_tokens;
+    }
+    assert(i_token == n_tokens);
+
+    // the segments alone
+    std::vector<whisper_segment_data> segments_only(n_segments);
+    assert(whisper_full_get_segments_from_state(ctx, state, segments_only.data(), n_segments, nullptr, nullptr, 0) == 0);
+
+    for (int i = 0; i < n_segments; ++i) {
+        assert(segments_only[i].i_token  == segments[i].i_token);
+        assert(segments_only[i].n_tokens == segments[i].n_tokens);
+    }
+}
+
+int main(int argc, char ** argv) {
+    const std::string model_path = argc > 1 ? argv[1] : "../../models/for-tests-ggml-tiny.en.bin";
+
+    whisper_log_set([](enum ggml_log_level, const char *, void *) {}, nullptr);
+
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = false;
+
+    whisper_context * ctx = whisper_init_from_file_with_params(model_path.c_str(), cparams);
+    assert(ctx != nullptr);
+
+    std::mt19937 rng(42);
+
+    fill_weights(ctx, rng);
+
+    // the weights are set, so whisper_full decodes the whole window instead of a single token
+    ctx->model.n_loaded = ctx->model.tensors.size();
+
+    std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+
+    std::vector<float> pcm(WHISPER_SAMPLE_RATE);
+    for (auto & v : pcm) {
+        v = dist(rng);
+    }
+
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+
+    wparams.n_threads        = 1;
+    wparams.print_progress   = false;
+    wparams.print_realtime   = false;
+    wparams.print_timestamps = false;
+    wparams.audio_ctx        = 64;
+    wparams.temperature_inc  = 0.0f;
+    wparams.no_timestamps    = true; // the random weights only give a long text without timestamps
+    wparams.token_timestamps = true;
+    wparams.max_len          = 40; // in characters, with token_timestamps
+
+    // the default state of the context
+    assert(whisper_full(ctx, wparams, pcm.data(), pcm.size()) == 0);
+    test_get_segments(ctx, ctx->state);
+
+    // a state of its own
+    whisper_state * state = whisper_init_state(ctx);
+    assert(state != nullptr);
+
+    assert(whisper_full_with_state(ctx, state, wparams, pcm.data(), pcm.size()) == 0);
+    test_get_segments(ctx, state);
+
+    whisper_free_state(state);
+    whisper_free(ctx);
+
+    return 0;
+}
@@ -0,0 +1,287 @@
+// the parts of whisper-server that do not depend on HTTP, see examples/server/server-common.h
+#include "server-common.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+// waits until pred() holds for the counters of the queue
+template <typename F>
+static void wait_for(admission_queue & queue, F pred) {
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (pred()) {
+                return;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+// the requests past the free slots wait, and the ones past the queue are turned away
+static void test_admission_queue() {
+    admission_queue queue(2, 1);
+
+    assert(queue.acquire());
+    assert(queue.acquire());
+    assert(queue.n_active == 2);
+
+    // the third request waits for a slot
+    bool admitted = false;
+    std::thread waiter([&]() {
+        admission_ticket ticket(queue);
+        admitted = ticket.ok;
+    });
+
+    wait_for(queue, [&]() { return queue.n_waiting == 1; });
+
+    // the fourth one finds the queue full
+    {
+        admission_ticket ticket(queue);
+        assert(!ticket.ok);
+    }
+    assert(queue.n_active == 2);
+    assert(queue.n_waiting == 1);
+
+    // a finished request lets the waiting one in, which releases its slot when it is done
+    queue.release();
+    waiter.join();
+
+    assert(admitted);
+    assert(queue.n_active == 1);
+    assert(queue.n_waiting == 0);
+
+    queue.release();
+    assert(queue.n_active == 0);
+
+    // without a queue, a request is only admitted to a free slot
+    admission_queue no_queue(1, 0);
+    {
+        admission_ticket first(no_queue);
+        admission_ticket second(no_queue);
+        assert(first.ok);
+        assert(!second.ok);
+    }
+    assert(no_queue.n_active == 0);
+}
+
+// a context that records when it is freed
+static std::shared_ptr<whisper_context> load_model(const std::string & model_path, bool & freed) {
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = false;
+
+    whisper_context * ctx = whisper_init_from_file_with_params_no_state(model_path.c_str(), cparams);
+    assert(ctx != nullptr);
+
+    freed = false;
+
+    return make_model(ctx, [&freed](whisper_context *) { freed = true; });
+}
+
+// /load swaps the model while a request runs: the request keeps its context and its state until it is done, and the
+// state goes back to the pool of that context
+static void test_model_swap(const std::string & model_path) {
+    model_holder model;
+
+    bool freed_old = false;
+    bool freed_new = false;
+
+    {
+        auto loaded = load_model(model_path, freed_old);
+        model.swap(loaded);
+        assert(loaded == nullptr);
+    }
+
+    std::shared_ptr<whisper_context> ref = model.get();
+
+    whisper_state * state = nullptr;
+    {
+        whisper_state_lease lease(ref.get());
+        assert(lease.state != nullptr);
+        assert(whisper_state_lease::n_active() == 1);
+
+        state = lease.state;
+
+        auto loaded = load_model(model_path, freed_new);
+        model.swap(loaded);
+        loaded.reset();
+
+        assert(model.get() != ref);
+        assert(!freed_old);
+    }
+    assert(whisper_state_lease::n_active() == 0);
+
+    // the state has been recycled into the pool of the old context
+    {
+        whisper_state_lease lease(ref.get());
+        assert(lease.state == state);
+    }
+
+    // the last request that uses the old context frees it
+    ref.reset();
+    assert(freed_old);
+    assert(!freed_new);
+
+    {
+        std::shared_ptr<whisper_context> none;
+        model.swap(none);
+    }
+    assert(freed_new);
+}
+
+// the entries past the capacity are evicted in the order of their last use, and an entry is only returned for the
+// model that it was computed with
+static void test_model_lru_cache() {
+    // the cache only compares the models, they are never used
+    static int models[2];
+
+    std::shared_ptr<whisper_context> model_a((whisper_context *) &models[0], [](whisper_context *) {});
+    std::shared_ptr<whisper_context> model_b((whisper_context *) &models[1], [](whisper_context *) {});
+
+    auto value = [](int v) { return std::make_shared<const int>(v); };
+
+    model_lru_cache<int> cache;
+    assert(!cache.enabled());
+
+    cache.put("x", model_a, value(0), 1);
+    assert(cache.entries.empty());
+
+    cache.capacity = 3;
+    assert(cache.enabled());
+
+    cache.put("a", model_a, value(1), 1);
+    cache.put("b", model_a, value(2), 1);
+    cache.put("c", model_a, value(3), 1);
+    assert(cache.used == 3);
+
+    // "a" is used, so "b" is the least recently used entry when "d" needs room
+    assert(*cache.get("a", model_a) == 1);
+
+    cache.put("d", model_a, value(4), 1);
+    assert(cache.used == 3);
+    assert(cache.get("b", model_a) == nullptr);
+    assert(*cache.get("c", model_a) == 3);
+    assert(*cache.get("d", model_a) == 4);
+    assert(*cache.get("a", model_a) == 1);
+
+    // an entry of cost 2 evicts the two least recently used ones, "c" and "d"
+    cache.put("e", model_a, value(5), 2);
+    assert(cache.used == 3);
+    assert(cache.entries.size() == 2);
+    assert(cache.get("c", model_a) == nullptr);
+    assert(cache.get("d", model_a) == nullptr);
+
+    // an entry put again replaces the previous one
+    cache.put("a", model_a, value(6), 1);
+    assert(cache.used == 3);
+    assert(*cache.get("a", model_a) == 6);
+
+    // an entry larger than the cache is not stored and does not evict the others
+    cache.put("f", model_a, value(7), 4);
+    assert(cache.used == 3);
+    assert(cache.get("f", model_a) == nullptr);
+    assert(*cache.get("e", model_a) == 5);
+
+    // the entries of another model, or of a model that has been freed, are not returned
+    cache.put("g", model_b, value(8), 1);
+    assert(cache.get("g", model_a) == nullptr);
+    assert(*cache.get("g", model_b) == 8);
+
+    model_b.reset();
+    assert(cache.used == 3);
+    assert(cache.get("g", std::shared_ptr<whisper_context>()) == nullptr);
+    assert(cache.used == 2);
+    assert(cache.index.count("g") == 0);
+
+    assert(cache.n_hits   == 7);
+    assert(cache.n_misses == 6);
+
+    // FNV-1a of "a"
+    assert(hash_bytes("a", 1) == 0xaf63dc4c8601ec8cULL);
+    assert(hash_bytes("ab", 2) == hash_bytes("b", 1, hash_bytes("a", 1)));
+}
+
+// the routed models are loaded on first use, and the least recently used ones are evicted past the memory budget
+static void test_model_registry(const std::string & model_path) {
+    int n_loaded = 0;
+    int n_freed  = 0;
+
+    {
+        model_registry registry;
+
+        registry.cparams = whisper_context_default_params();
+        registry.cparams.use_gpu = false;
+
+        registry.on_load = [&](whisper_context *) { n_loaded++; };
+        registry.on_free = [&](whisper_context *) { n_freed++;  };
+
+        assert(!registry.add("missing", model_path + ".missing"));
+        assert(!registry.has("missing"));
+
+        for (const char * name : { "a", "b", "c" }) {
+            assert(registry.add(name, model_path));
+            assert(registry.has(name));
+        }
+
+        const size_t n_bytes = registry.models.at("a").n_bytes;
+        assert(n_bytes > 0);
+
+        // room for two models
+        registry.budget = 2*n_bytes;
+
+        std::shared_ptr<whisper_context> a = registry.get("a");
+        std::shared_ptr<whisper_context> b = registry.get("b");
+        assert(a != nullptr && b != nullptr && a != b);
+        assert(n_loaded == 2);
+
+        // a loaded model is not loaded again, and it becomes the most recently used one
+        assert(registry.get("a") == a);
+        assert(n_loaded == 2);
+
+        // "c" evicts "b", which lives until the request that uses it is done
+        std::shared_ptr<whisper_context> c = registry.get("c");
+        assert(n_loaded == 3);
+        assert(registry.models.at("a").ctx == a);
+        assert(registry.models.at("b").ctx == nullptr);
+        assert(n_freed == 0);
+
+        b.reset();
+        assert(n_freed == 1);
+
+        // a model larger than the budget is loaded as the only one
+        registry.budget = n_bytes/2;
+
+        b = registry.get("b");
+        assert(n_loaded == 4);
+        assert(registry.models.at("a").ctx == nullptr);
+        assert(registry.models.at("c").ctx == nullptr);
+
+        a.reset();
+        c.reset();
+        b.reset();
+        assert(n_freed == 3);
+    }
+
+    // the registry frees the models that it still holds
+    assert(n_freed == 4);
+}
+
+int main(int argc, char ** argv) {
+    const std::string model_path = argc > 1 ? argv[1] : "../../models/for-tests-ggml-tiny.en.bin";
+
+    whisper_log_set([](enum ggml_log_level, const char *, void *) {}, nullptr);
+
+    test_admission_queue();
+    test_model_swap(model_path);
+    test_model_lru_cache();
+    test_model_registry(model_path);
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+// the threadpool of the state is internal
+#include "whisper.cpp"
+
+#include <string>
+
+#ifdef NDEBUG
+#undef NDEBUG
+#endif
+#include <cassert>
+
+int main(int argc, char ** argv) {
+    const std::string model_path = argc > 1 ? argv[1] : "../../models/for-tests-ggml-tiny.en.bin";
+
+    whisper_log_set([](enum ggml_log_level, const char *, void *) {}, nullptr);
+
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = false;
+
+    whisper_context * ctx = whisper_init_from_file_with_params_no_state(model_path.c_str(), cparams);
+    assert(ctx != nullptr);
+
+    whisper_state * state = whisper_init_state(ctx);
+    assert(state != nullptr);
+
+    whisper_threadpool_params tpp = whisper_threadpool_default_params(2);
+    tpp.poll = 0;
+
+    assert(whisper_state_set_threadpool(state, &tpp) == 0);
+
+    ggml_threadpool_t threadpool = state->threadpool;
+    assert(threadpool != nullptr);
+
+    // the same params keep the threads, also when the cpus are in another buffer
+    {
+        std::string cpus = "0";
+
+        tpp.cpus = cpus.c_str();
+        assert(whisper_state_set_threadpool(state, &tpp) == 0);
+        threadpool = state->threadpool;
+
+        std::string cpus_copy = cpus;
+
+        whisper_threadpool_params same = tpp;
+        same.cpus = cpus_copy.c_str();
+        assert(whisper_state_set_threadpool(state, &same) == 0);
+        assert(state->threadpool == threadpool);
+
+        // the params are copied, the buffers of the caller can go away
+        cpus.clear();
+        cpus_copy.clear();
+        assert(state->threadpool_cpus == "0");
+    }
+
+    {
+        whisper_threadpool_params same = whisper_threadpool_default_params(2);
+        same.poll = 0;
+        same.cpus = "0";
+        assert(whisper_state_set_threadpool(state, &same) == 0);
+        assert(state->threadpool == threadpool);
+    }
+
+    // other params replace the threadpool
+    {
+        whisper_threadpool_params other = whisper_threadpool_default_params(1);
+        other.poll = 0;
+        assert(whisper_state_set_threadpool(state, &other) == 0);
+        assert(state->threadpool != nullptr);
+        assert(state->threadpool_params.n_threads == 1);
+        assert(state->threadpool_params.cpus == nullptr);
+    }
+
+    assert(whisper_state_set_threadpool(state, nullptr) == 0);
+    assert(state->threadpool == nullptr);
+
+    whisper_free_state(state);
+    whisper_free(ctx);
+
+    return 0;
+}